@@ -116,6 +116,7 @@ static SPARTAN_SHARE *get_share(const char *table_name, TABLE *table)
 {
   SPARTAN_SHARE *share;
   uint length;
+  uint i;
 
   if (!spartan_init)
      spartan_init_func();
@@ -158,10 +159,27 @@ static SPARTAN_SHARE *get_share(const char *table_name, TABLE *table)
     */
     share->data_class = new Spartan_data();
     /*
-      Create an instance of index class
+      Create an instance of index class for each key the table may have
+      (the share can be made before the table is known). Only the
+      indexes of the keys the table has are opened.
     */
-    share->index_class = new Spartan_index();
+    for (i = 0; i < SPARTAN_MAX_KEYS; i++)
+      share->index_class[i] = new Spartan_index();
+    /*
+      Create an instance of log class
+    */
+    share->log_class = new Spartan_log();
+    /*
+      Create an instance of data class for the overflow file
+    */
+    share->blob_class = new Spartan_data();
+    /*
+      Create an instance of zone map class
+    */
+    share->zone_class = new Spartan_zones();
     pthread_mutex_init(&share->mutex,MY_MUTEX_INIT_FAST);
+    pthread_mutex_init(&share->data_mutex,MY_MUTEX_INIT_FAST);
+    pthread_cond_init(&share->swap_cond, NULL);
   }
   share->use_count++;
   pthread_mutex_unlock(&spartan_mutex);
@@ -182,6 +200,8 @@ error:
 */
 static int free_share(SPARTAN_SHARE *share)
 {
+  uint i;
+
   DBUG_ENTER("ha_spartan::free_share");
   pthread_mutex_lock(&spartan_mutex);
   if (!--share->use_count)
@@ -189,11 +209,28 @@ static int free_share(SPARTAN_SHARE *share)
     if (share->data_class != NULL)
       delete share->data_class;
     share->data_class = NULL;
-    if (share->index_class != NULL)
-      delete share->index_class;
-    share->index_class = NULL;
+    for (i = 0; i < SPARTAN_MAX_KEYS; i++)
+    {
+      if (share->index_class[i] != NULL)
+        delete share->index_class[i];
+      share->index_class[i] = NULL;
+    }
+    if (share->log_class != NULL)
+      delete share->log_class;
+    share->log_class = NULL;
+    if (share->blob_class != NULL)
+      delete share->blob_class;
+    share->blob_class = NULL;
+    if (share->zone_class != NULL)
+      delete share->zone_class;
+    share->zone_class = NULL;
+    if (share->freed_blobs != NULL)
+      my_free((gptr)share->freed_blobs, MYF(0));
+    share->freed_blobs = NULL;
     hash_delete(&spartan_open_tables, (byte*) share);
     thr_lock_delete(&share->lock);
+    pthread_cond_destroy(&share->swap_cond);
+    pthread_mutex_destroy(&share->data_mutex);
     pthread_mutex_destroy(&share->mutex);
     my_free((gptr)share->table_name, MYF(0));
   }
@@ -212,10 +249,71 @@ static handler* spartan_create_handler(TABLE_SHARE *table)
 ha_spartan::ha_spartan(TABLE_SHARE *table_arg)
   :handler(&spartan_hton, table_arg)
 {
+  read_columns = NULL;
+  project = false;
+  scan_data = NULL;
+  scan_pos = NULL;
+  scan_end = NULL;
+  scan_parts = 0;
+  direct_io = false;
+  mapped = false;
+  read_lock = false;
+  cursor = NULL;
+  blob_cursor = NULL;
+  scan_limit = -1;
+  packed = false;
+  rec_buf = NULL;
+  key_rec = NULL;
+  scan_buf = NULL;
+  scan_blobs = NULL;
+  blob_pos = NULL;
+  zone_col = NULL;
+  zone_cols = 0;
+  zone_val = NULL;
+  zone_null = NULL;
+  zone_preds = 0;
+  pushed_conds = 0;
+  memset(bulk_keys, 0, sizeof(bulk_keys));
+  bulk_count = 0;
+  bulk_alloc = 0;
 }
 
 #define SDE_EXT ".sde"
 #define SDI_EXT ".sdi"
+#define SDT_EXT ".sdt"
+#define SDL_EXT ".sdl"
+#define SDO_EXT ".sdo"
+#define SDZ_EXT ".sdz"
+
+/* keys allocated at the start of a bulk insert of unknown size */
+#define SPARTAN_BULK_KEYS 1024
+
+/* threads check() tests the checksums of the rows with */
+#define SPARTAN_CHECK_THREADS 4
+
+/* rows and index pages check() and repair() take data_mutex for */
+#define SPARTAN_CHECK_ROWS 1024
+#define SPARTAN_CHECK_PAGES 64
+
+/* table comment that selects the PAX (column per minipage) layout */
+#define SPARTAN_PAX_COMMENT "PAX"
+
+/* extension of the index file of each key (the first key has SDI_EXT) */
+static const char *spartan_index_exts[SPARTAN_MAX_KEYS] = {
+  SDI_EXT, ".sdi1", ".sdi2", ".sdi3", ".sdi4", ".sdi5", ".sdi6", ".sdi7"
+};
+
+/*
+  The zone map keeps the integer fields: the signed ones and the
+  unsigned ones that fit in a long long.
+*/
+static bool zone_field(Field *field)
+{
+  return ((field->result_type() == INT_RESULT) &&
+          (field->type() != MYSQL_TYPE_BIT) &&
+          !((field->flags & UNSIGNED_FLAG) &&
+            (field->pack_length() >= sizeof(long long))));
+}
 
 /*
   If frm_error() is called then we will use this to to find out what file extentions
@@ -225,6 +323,16 @@ ha_spartan::ha_spartan(TABLE_SHARE *table_arg)
 static const char *ha_spartan_exts[] = {
   SDE_EXT,
   SDI_EXT,
+  ".sdi1",
+  ".sdi2",
+  ".sdi3",
+  ".sdi4",
+  ".sdi5",
+  ".sdi6",
+  ".sdi7",
+  SDL_EXT,
+  SDO_EXT,
+  SDZ_EXT,
   NullS
 };
 
@@ -247,25 +355,119 @@ int ha_spartan::open(const char *name, int mode, uint test_if_locked)
 {
   DBUG_ENTER("ha_spartan::open");
   char name_buff[FN_REFLEN];
+  File blob_file = -1;
+  bool recovered;
+  uint i;
 
   if (!(share = get_share(name, table)))
     DBUG_RETURN(1);
+  pthread_mutex_lock(&share->data_mutex);
   /*
-    Call the data class open table method.
+    Open the redo log first; the data class replays it when it opens
+    the data file. The index file is opened before that so the index
+    pages in the log are replayed too.
+  */
+  share->log_class->open_log(fn_format(name_buff, name, "", SDL_EXT,
+                             MY_REPLACE_EXT|MY_UNPACK_FILENAME));
+  share->data_class->set_log(share->log_class);
+  /*
+    Call the data class open index method for the index of each key;
+    each is index file i of the redo log.
     Note: the fn_format() method correctly creates a file name from the
     name passed into the method.
   */
-  share->data_class->open_table(fn_format(name_buff, name, "", SDE_EXT,
-                                MY_REPLACE_EXT|MY_UNPACK_FILENAME));
+  for (i = 0; i < index_files(); i++)
+  {
+    share->index_class[i]->open_index(fn_format(name_buff, name, "",
+                                      spartan_index_exts[i],
+                                      MY_REPLACE_EXT|MY_UNPACK_FILENAME));
+    share->index_class[i]->set_log(share->log_class, i);
+  }
+  /*
+    The overflow file of a table with blob fields is file
+    SDL_OVERFLOW_FILE of the redo log. It is attached while the log is
+    replayed and opened afterwards, when its header is up to date.
+  */
+  if (table->s->blob_fields > 0)
+    blob_file = my_open(fn_format(name_buff, name, "", SDO_EXT,
+                        MY_REPLACE_EXT|MY_UNPACK_FILENAME),
+                        O_RDWR | O_BINARY | O_SHARE, MYF(0));
+  share->log_class->set_index(SDL_OVERFLOW_FILE, blob_file);
+  recovered = (share->log_class->log_size() > 0);
   /*
-    Call the data class open index method.
+    Call the data class open table method.
     Note: the fn_format() method correctly creates a file name from the
     name passed into the method.
   */
-  share->index_class->open_index(fn_format(name_buff, name, "", SDI_EXT,
+  share->data_class->open_table(fn_format(name_buff, name, "", SDE_EXT,
                                 MY_REPLACE_EXT|MY_UNPACK_FILENAME));
-  share->index_class->load_index();
+  share->log_class->set_index(SDL_OVERFLOW_FILE, -1);
+  if (blob_file != -1)
+    my_close(blob_file, MYF(0));
+  for (i = 0; i < index_files(); i++)
+    share->index_class[i]->load_index();
+  /*
+    The reads of an index by this handler go through its own cursor, so
+    other handlers on the table (or this table twice in a self-join) do
+    not move them.
+  */
+  for (i = 0; i < table->s->keys; i++)
+    share->index_class[i]->add_cursor(&key_cursor[i]);
+  if (table->s->blob_fields > 0)
+  {
+    share->blob_class->set_log(share->log_class, SDL_OVERFLOW_FILE);
+    share->blob_class->open_table(fn_format(name_buff, name, "", SDO_EXT,
+                                  MY_REPLACE_EXT|MY_UNPACK_FILENAME));
+  }
+  packed = share->data_class->packed_rows();
+  read_columns = (bool *)my_malloc((table->s->fields + 1) * sizeof(bool),
+                                   MYF(MY_WME));
+  key_rec = (byte *)my_malloc(table->s->rec_buff_length, MYF(MY_WME));
+  if (packed)
+  {
+    rec_buf = (byte *)my_malloc(2 * max_row_length() +
+                                table->s->rec_buff_length, MYF(MY_WME));
+    blob_pos = (long long *)my_malloc((2 * table->s->blob_fields + 1) *
+                                      sizeof(long long), MYF(MY_WME));
+  }
+  /*
+    Pick up the auto-increment counter saved in the data file.
+  */
+  pthread_mutex_lock(&share->mutex);
+  if (share->auto_increment < share->data_class->auto_increment())
+    share->auto_increment = share->data_class->auto_increment();
+  pthread_mutex_unlock(&share->mutex);
+  if (recovered)
+    recover_auto_increment();
+  pthread_mutex_unlock(&share->data_mutex);
   current_position = 0;
+  current_row = -1;
+  ref_length = sizeof(long long);
+  /*
+    Open the zone map and build it again from the data file if it
+    cannot be trusted.
+  */
+  zone_val = (long long *)my_malloc((table->s->fields + 1) *
+                                    (sizeof(long long) + sizeof(int) +
+                                     sizeof(bool)), MYF(MY_WME));
+  if (zone_val != NULL)
+  {
+    zone_col = (int *)(zone_val + table->s->fields + 1);
+    zone_null = (bool *)(zone_col + table->s->fields + 1);
+    zone_cols = 0;
+    for (Field **field=table->field ; *field ; field++)
+      zone_col[field - table->field] = zone_field(*field) ? zone_cols++ : -1;
+    pthread_mutex_lock(&share->data_mutex);
+    share->zone_class->open_zones(fn_format(name_buff, name, "", SDZ_EXT,
+                                  MY_REPLACE_EXT|MY_UNPACK_FILENAME),
+                                  zone_cols);
+    if (share->zone_class->needs_rebuild())
+      rebuild_zones();
+    pthread_mutex_unlock(&share->data_mutex);
+  }
+  zone_preds = 0;
+  pushed_conds = 0;
+  project = false;
   thr_lock_data_init(&share->lock,&lock,NULL);
   DBUG_RETURN(0);
 }
@@ -283,17 +485,55 @@ int ha_spartan::open(const char *name, int mode, uint test_if_locked)
 */
 int ha_spartan::close(void)
 {
+  uint i;
+
   DBUG_ENTER("ha_spartan::close");
+  parallel_scan_end();
+  close_cursor();
+  end_bulk_insert();
+  pthread_mutex_lock(&share->data_mutex);
+  /*
+    The index pages and the blob values are saved before the data class
+    checkpoints the redo log. Every statement has committed, so the
+    blob values freed can be reused.
+  */
+  for (i = 0; i < index_files(); i++)
+    share->index_class[i]->save_index();
+  release_blobs(share->log_class->end_lsn());
+  share->blob_class->flush_data();
   share->data_class->close_table();
-  share->index_class->save_index();
-  share->index_class->close_index();
+  share->blob_class->close_table();
+  share->zone_class->close_zones();
+  for (i = 0; i < table->s->keys; i++)
+    share->index_class[i]->remove_cursor(&key_cursor[i]);
+  for (i = 0; i < index_files(); i++)
+    share->index_class[i]->close_index();
+  pthread_mutex_unlock(&share->data_mutex);
+  if (zone_val != NULL)
+    my_free((gptr)zone_val, MYF(0));
+  zone_col = NULL;
+  zone_val = NULL;
+  zone_null = NULL;
+  if (read_columns != NULL)
+    my_free((gptr)read_columns, MYF(0));
+  read_columns = NULL;
+  if (rec_buf != NULL)
+    my_free((gptr)rec_buf, MYF(0));
+  rec_buf = NULL;
+  if (key_rec != NULL)
+    my_free((gptr)key_rec, MYF(0));
+  key_rec = NULL;
+  if (blob_pos != NULL)
+    my_free((gptr)blob_pos, MYF(0));
+  blob_pos = NULL;
+  blob_buf.free();
   DBUG_RETURN(free_share(share));
 }
 
 
 /*
-  write_row() inserts a row. No extra() hint is given currently if a bulk load
-  is happeneding. buf() is a byte array of data. You can use the field
+  write_row() inserts a row. A bulk load is announced by start_bulk_insert().
+  buf() is a byte array of data. You can use the field
   information to extract the data from the native byte array type.
   Example of this would be:
   for (Field **field=table->field ; *field ; field++)
@@ -314,349 +554,1928 @@ int ha_spartan::close(void)
 int ha_spartan::write_row(byte * buf)
 {
   long long pos;
-  SDE_INDEX ndx;
+  int length;
+  int rc = 0;
 
   DBUG_ENTER("ha_spartan::write_row");
   ha_statistic_increment(&SSV::ha_write_count);
-  ndx.length = get_key_len();
-  memcpy(ndx.key, get_key(), get_key_len());
-  pthread_mutex_lock(&spartan_mutex);
-  pos = share->data_class->write_row(buf, table->s->rec_buff_length);
-  ndx.pos = pos;
-  if (ndx.key != 0)
-    share->index_class->insert_key(&ndx, false);
-  pthread_mutex_unlock(&spartan_mutex);
-  DBUG_RETURN(0);
-}
-
-byte *ha_spartan::get_key()
-{
-  byte *key = 0;
-
-  DBUG_ENTER("ha_spartan::get_key");
   /*
-    For each field in the table, check to see if it is the key
-    by checking the key_start variable. (1 = is a key).
+    Give the row its auto-increment value before the keys are taken
+    from it (see get_auto_increment()).
   */
-  for (Field **field=table->field ; *field ; field++)
+  if (table->next_number_field && buf == table->record[0])
+    update_auto_increment();
+  pthread_mutex_lock(&share->data_mutex);
+  if (table->next_number_field && buf == table->record[0])
+    save_auto_increment(table->next_number_field);
+  /*
+    A row with the value of a unique key already in the table is not
+    written at all. The blob values go to the overflow file before the
+    row that points at them is written.
+  */
+  rc = find_dupp_key(buf, -1);
+  if ((rc == 0) && packed && write_blobs(buf, blob_pos))
+  {
+    free_blobs(blob_pos);
+    rc = HA_ERR_INTERNAL_ERROR;
+  }
+  else if (rc == 0)
   {
-    if ((*field)->key_start.to_ulonglong() == 1)
+    if (packed)
+    {
+      length = pack_row(rec_buf, buf, blob_pos);
+      pos = share->data_class->write_row(rec_buf, length);
+    }
+    else
+    {
+      length = table->s->rec_buff_length;
+      pos = share->data_class->write_row(buf, length);
+    }
+    if (pos == -1)
+      rc = HA_ERR_INTERNAL_ERROR;
+    else if ((rc = insert_keys(buf, pos)) != 0)
     {
       /*
-        Copy field value to key value (save key)
+        A key that could not go in takes the row back out, so the data
+        file holds no row the indexes do not.
       */
-      key = (byte *)my_malloc((*field)->field_length, 
-                                  MYF(MY_ZEROFILL | MY_WME));
-      memcpy(key, (*field)->ptr, (*field)->key_length());
+      share->data_class->delete_row(packed ? rec_buf : buf, length, pos);
+    }
+    else if (zone_col != NULL)
+    {
+      zone_values(buf);
+      share->zone_class->add_row(pos, zone_val, zone_null);
     }
+    if (packed && (rc != 0))
+      free_blobs(blob_pos);
   }
-  DBUG_RETURN(key);
+  pthread_mutex_unlock(&share->data_mutex);
+  DBUG_RETURN(rc);
 }
 
-int ha_spartan::get_key_len()
-{
-  int length = 0;
-
-  DBUG_ENTER("ha_spartan::get_key");
-  /*
-    For each field in the table, check to see if it is the key
-    by checking the key_start variable. (1 = is a key).
-  */
-  for (Field **field=table->field ; *field ; field++)
-  {
-    if ((*field)->key_start.to_ulonglong() == 1)
-      /*
-        Copy field length to key length
-      */
-      length = (*field)->key_length();
-  }
-  DBUG_RETURN(length);
-}
 
 /*
-  Yes, update_row() does what you expect, it updates a row. old_data will have
-  the previous row record in it, while new_data will have the newest data in
-  it.
-  Keep in mind that the server can do updates based on ordering if an ORDER BY
-  clause was used. Consecutive ordering is not guarenteed.
-  Currently new_data will not have an updated auto_increament record, or
-  and updated timestamp field. You can do these for spartan by doing these:
-  if (table->timestamp_field_type & TIMESTAMP_AUTO_SET_ON_UPDATE)
-    table->timestamp_field->set_time();
-  if (table->next_number_field && record == table->record[0])
-    update_auto_increment();
-
-  Called from sql_select.cc, sql_acl.cc, sql_update.cc, and sql_insert.cc.
+  A bulk insert of rows rows (0 if not known) is about to start. Rows
+  go to the data file through a larger write buffer and the keys of
+  each key that is not unique are collected unsorted in bulk_keys (a
+  list for each key) instead of being inserted one at a time into the
+  index, which walks the list for every key. Unique keys go in with
+  each row so a duplicate is reported by write_row().
+
+  The collected keys are merged by end_bulk_insert(), or before this
+  handler next reads or changes an index (see flush_bulk_keys()), as
+  REPLACE and INSERT ... ON DUPLICATE KEY UPDATE do in the middle of a
+  bulk insert. Other threads cannot see the table in between:
+  store_lock() gives the statements that bulk insert a TL_WRITE lock.
+
+  Called from sql_insert.cc, sql_load.cc and sql_table.cc.
 */
-int ha_spartan::update_row(const byte * old_data, byte * new_data)
+void ha_spartan::start_bulk_insert(ha_rows rows)
 {
-  DBUG_ENTER("ha_spartan::update_row");
-  pthread_mutex_lock(&spartan_mutex);
-  share->data_class->update_row((byte *)old_data, new_data, 
-                 table->s->rec_buff_length, current_position -
-                 share->data_class->row_size(table->s->rec_buff_length)); 
-  if (get_key() != 0)
+  uint i;
+
+  DBUG_ENTER("ha_spartan::start_bulk_insert");
+  if (bulk_alloc > 0)
+    DBUG_VOID_RETURN;
+  bulk_alloc = ((rows > 0) && (rows < SPARTAN_BULK_KEYS)) ?
+               (int)rows : SPARTAN_BULK_KEYS;
+  bulk_count = 0;
+  for (i = 0; i < table->s->keys; i++)
   {
-    share->index_class->update_key(get_key(), current_position -
-                   share->data_class->row_size(table->s->rec_buff_length),
-                   get_key_len());
-    share->index_class->save_index();
-    share->index_class->load_index();
+    if (!allow_dupes(i))
+      continue;
+    bulk_keys[i] = (SDE_INDEX *)my_malloc(bulk_alloc * sizeof(SDE_INDEX),
+                                          MYF(MY_WME));
+    if (bulk_keys[i] == NULL)
+    {
+      free_keys(bulk_keys);
+      bulk_alloc = 0;
+      DBUG_VOID_RETURN;
+    }
   }
-  pthread_mutex_unlock(&spartan_mutex);
-  DBUG_RETURN(0);
+  pthread_mutex_lock(&share->data_mutex);
+  if (share->bulk_inserts++ == 0)
+    share->data_class->bulk_write(true);
+  pthread_mutex_unlock(&share->data_mutex);
+  DBUG_VOID_RETURN;
 }
 
 
 /*
-  This will delete a row. buf will contain a copy of the row to be deleted.
-  The server will call this right after the current row has been called (from
-  either a previous rnd_nexT() or index call).
-  If you keep a pointer to the last row or can access a primary key it will
-  make doing the deletion quite a bit easier.
-  Keep in mind that the server does no guarentee consecutive deletions. ORDER BY
-  clauses can be used.
+  Finish a bulk insert: sort the keys collected by write_row() and
+  merge them into the index of each key in one pass, then go back to
+  the normal write buffer.
 
-  Called in sql_acl.cc and sql_udf.cc to manage internal table information.
-  Called in sql_delete.cc, sql_insert.cc, and sql_select.cc. In sql_select it is
-  used for removing duplicates while in insert it is used for REPLACE calls.
+  Called from sql_insert.cc, sql_load.cc and sql_table.cc.
 */
-int ha_spartan::delete_row(const byte * buf)
+int ha_spartan::end_bulk_insert()
 {
-  long long pos;
+  int rc;
 
-  DBUG_ENTER("ha_spartan::delete_row");
-  if (current_position > 0)
-    pos = current_position -
-      share->data_class->row_size(table->s->rec_buff_length);
-  else
-    pos = 0;
-  pthread_mutex_lock(&spartan_mutex);
-  share->data_class->delete_row((byte *)buf, 
-                                table->s->rec_buff_length, pos);
-  if (get_key() != 0)
-    share->index_class->delete_key(get_key(), pos, get_key_len());
-  pthread_mutex_unlock(&spartan_mutex);
-  DBUG_RETURN(0);
+  DBUG_ENTER("ha_spartan::end_bulk_insert");
+  if (bulk_alloc == 0)
+    DBUG_RETURN(0);
+  pthread_mutex_lock(&share->data_mutex);
+  rc = flush_bulk_keys();
+  if (--share->bulk_inserts == 0)
+    share->data_class->bulk_write(false);
+  pthread_mutex_unlock(&share->data_mutex);
+  free_keys(bulk_keys);
+  bulk_count = 0;
+  bulk_alloc = 0;
+  DBUG_RETURN(rc);
 }
 
 
 /*
-  Positions an index cursor to the index specified in the handle. Fetches the
-  row if available. If the key value is null, begin at the first key of the
-  index.
+  Make room for more keys in bulk_keys. If the memory cannot be had the
+  keys collected so far are merged into the indexes and bulk_keys is
+  reused. The caller holds data_mutex. Returns 0 or the error of
+  flush_bulk_keys().
 */
-int ha_spartan::index_read(byte * buf, const byte * key,
-                           uint key_len __attribute__((unused)),
-                           enum ha_rkey_function find_flag
-                           __attribute__((unused)))
+int ha_spartan::grow_bulk_keys()
 {
-  long long pos;
+  SDE_INDEX *keys;
+  uint i;
 
-  DBUG_ENTER("ha_spartan::index_read");
-  if (key == NULL)
-    pos = share->index_class->get_first_pos();
-  else
-    pos = share->index_class->get_index_pos((byte *)key, key_len);
-  if (pos == -1)
-    DBUG_RETURN(HA_ERR_KEY_NOT_FOUND);
-  share->data_class->read_row(buf, table->s->rec_buff_length, pos);
-  current_position = pos + share->data_class->row_size(table->s->rec_buff_length);
-  share->index_class->get_next_key();
+  DBUG_ENTER("ha_spartan::grow_bulk_keys");
+  for (i = 0; i < table->s->keys; i++)
+  {
+    if (bulk_keys[i] == NULL)
+      continue;
+    keys = (SDE_INDEX *)my_realloc((gptr)bulk_keys[i],
+                                   2 * bulk_alloc * sizeof(SDE_INDEX),
+                                   MYF(0));
+    if (keys == NULL)
+      break;
+    bulk_keys[i] = keys;
+  }
+  if (i < table->s->keys)
+    DBUG_RETURN(flush_bulk_keys());
+  bulk_alloc *= 2;
   DBUG_RETURN(0);
 }
 
-
 /*
-  Positions an index cursor to the index specified in key. Fetches the
-  row if any.  This is only used to read whole keys.
+  Merge the keys collected by a bulk insert into the indexes so they
+  match the data file, and start collecting again. The keys are all of
+  keys that allow dupes, so none is left out. The caller holds
+  data_mutex. Returns 0 or HA_ERR_INTERNAL_ERROR if an index could not
+  take its keys.
 */
-int ha_spartan::index_read_idx(byte * buf, uint index, const byte * key,
-                               uint key_len __attribute__((unused)),
-                               enum ha_rkey_function find_flag
-                               __attribute__((unused)))
+int ha_spartan::flush_bulk_keys()
 {
-  long long pos;
+  int rc = 0;
+  uint i;
 
-  DBUG_ENTER("ha_spartan::index_read_idx");
-  pos = share->index_class->get_index_pos((byte *)key, key_len);
-  if (pos == -1)
-    DBUG_RETURN(HA_ERR_KEY_NOT_FOUND);
-  share->data_class->read_row(buf, table->s->rec_buff_length, pos);
-  DBUG_RETURN(0);
+  DBUG_ENTER("ha_spartan::flush_bulk_keys");
+  if (bulk_count == 0)
+    DBUG_RETURN(0);
+  for (i = 0; i < table->s->keys; i++)
+  {
+    if ((bulk_keys[i] != NULL) &&
+        (share->index_class[i]->bulk_insert(bulk_keys[i], bulk_count,
+                                            true) != bulk_count))
+      rc = HA_ERR_INTERNAL_ERROR;
+  }
+  bulk_count = 0;
+  DBUG_RETURN(rc);
 }
 
-
 /*
-  Used to read forward through the index.
+  Look for a row other than the one at pos (-1 for a new row) with the
+  same value as record in a unique key. A key with a null part is not
+  looked for (see key_has_null()). Returns HA_ERR_FOUND_DUPP_KEY with
+  errkey set to the key if there is one, else 0. The caller holds
+  data_mutex.
 */
-int ha_spartan::index_next(byte * buf)
+int ha_spartan::find_dupp_key(const byte *record, long long pos)
 {
-  byte *key = 0;
-  long long pos;
+  SDE_INDEX ndx;
+  long long found;
+  uint i;
 
-  DBUG_ENTER("ha_spartan::index_next");
-  key = share->index_class->get_next_key();
-  if (key == 0)
-    DBUG_RETURN(HA_ERR_END_OF_FILE);
-  pos = share->index_class->get_index_pos((byte *)key, get_key_len());
-  share->index_class->seek_index(key, get_key_len());
-  share->index_class->get_next_key();
-  if (pos == -1)
-    DBUG_RETURN(HA_ERR_KEY_NOT_FOUND);
-  share->data_class->read_row(buf, table->s->rec_buff_length, pos);
+  DBUG_ENTER("ha_spartan::find_dupp_key");
+  for (i = 0; i < table->s->keys; i++)
+  {
+    if (allow_dupes(i))
+      continue;
+    make_key(i, record, &ndx);
+    if (key_has_null(i, &ndx))
+      continue;
+    found = share->index_class[i]->get_index_pos(ndx.key, ndx.length);
+    if ((found != -1) && (found != pos))
+    {
+      errkey = i;
+      DBUG_RETURN(HA_ERR_FOUND_DUPP_KEY);
+    }
+  }
   DBUG_RETURN(0);
 }
 
-
 /*
-  Used to read backwards through the index.
+  Give the row at pos, written from record, an entry in the index of
+  each key. During a bulk insert the keys that are not unique are kept
+  for end_bulk_insert(); if there is no room for them the keys so far
+  are merged in now. A unique key always goes in at once so the next
+  row is checked against it; one with a null part goes in beside equal
+  keys (see key_has_null()). If a key cannot go in, the entries already
+  made for the row are taken out again and HA_ERR_FOUND_DUPP_KEY (with
+  errkey set) or HA_ERR_INTERNAL_ERROR is returned. The caller holds
+  data_mutex.
 */
-int ha_spartan::index_prev(byte * buf)
+int ha_spartan::insert_keys(const byte *record, long long pos)
 {
-  byte *key = 0;
-  long long pos;
-
-  DBUG_ENTER("ha_spartan::index_prev");
-  key = share->index_class->get_prev_key();
-  if (key == 0)
-    DBUG_RETURN(HA_ERR_END_OF_FILE);
-  pos = share->index_class->get_index_pos((byte *)key, get_key_len());
-  share->index_class->seek_index(key, get_key_len());
-  share->index_class->get_prev_key();
-  if (pos == -1)
-    DBUG_RETURN(HA_ERR_KEY_NOT_FOUND);
-  share->data_class->read_row(buf, table->s->rec_buff_length, pos);
+  SDE_INDEX ndx;
+  int rc = 0;
+  uint i;
+
+  DBUG_ENTER("ha_spartan::insert_keys");
+  if ((bulk_alloc > 0) && (bulk_count == bulk_alloc) &&
+      (rc = grow_bulk_keys()))
+    DBUG_RETURN(rc);
+  for (i = 0; i < table->s->keys; i++)
+  {
+    make_key(i, record, &ndx);
+    ndx.pos = pos;
+    if ((bulk_keys[i] != NULL) && (bulk_count < bulk_alloc))
+      bulk_keys[i][bulk_count] = ndx;
+    else if (share->index_class[i]->insert_key(&ndx, allow_dupes(i) ||
+                                               key_has_null(i, &ndx)) == -1)
+      break;
+  }
+  if (i < table->s->keys)
+  {
+    /*
+      A unique key is refused if it is already in the index; any other
+      failure is an error. The keys kept in bulk_keys are dropped by
+      not counting the row.
+    */
+    rc = (allow_dupes(i) || key_has_null(i, &ndx)) ? HA_ERR_INTERNAL_ERROR :
+         HA_ERR_FOUND_DUPP_KEY;
+    errkey = i;
+    while (i-- > 0)
+    {
+      if ((bulk_keys[i] != NULL) && (bulk_count < bulk_alloc))
+        continue;
+      make_key(i, record, &ndx);
+      share->index_class[i]->delete_key(ndx.key, pos, ndx.length);
+    }
+    DBUG_RETURN(rc);
+  }
+  if ((bulk_alloc > 0) && (bulk_count < bulk_alloc))
+    bulk_count++;
   DBUG_RETURN(0);
 }
 
+/* free the lists of keys (one for each key) in keys */
+void ha_spartan::free_keys(SDE_INDEX **keys)
+{
+  uint i;
 
-/*
-  index_first() asks for the first key in the index.
+  DBUG_ENTER("ha_spartan::free_keys");
+  for (i = 0; i < SPARTAN_MAX_KEYS; i++)
+  {
+    if (keys[i] != NULL)
+      my_free((gptr)keys[i], MYF(0));
+    keys[i] = NULL;
+  }
+  DBUG_VOID_RETURN;
+}
 
-  Called from opt_range.cc, opt_sum.cc, sql_handler.cc,
-  and sql_select.cc.
+/*
+  Get the bytes a part of a key takes in the index (see make_key()):
+  its sort image, after a byte for null if the field can be null.
 */
-int ha_spartan::index_first(byte * buf)
+static uint sort_part_length(KEY_PART_INFO *part)
 {
-  byte *key = 0;
-
-  DBUG_ENTER("ha_spartan::index_first");
-  key = share->index_class->get_first_key();
-  if (key == 0)
-    DBUG_RETURN(HA_ERR_END_OF_FILE);
-  memcpy(buf, key, get_key_len());
-  DBUG_RETURN(0);
+  DBUG_ENTER("sort_part_length");
+  DBUG_RETURN(part->length + (part->null_bit ? 1 : 0));
 }
 
-
 /*
-  index_last() asks for the last key in the index.
-
-  Called from opt_range.cc, opt_sum.cc, sql_handler.cc,
-  and sql_select.cc.
+  Put a part of a key into to (see make_key()) from its field, or as
+  null. Returns the bytes put.
 */
-int ha_spartan::index_last(byte * buf)
+static uint sort_part(KEY_PART_INFO *part, bool is_null, byte *to)
 {
-  byte *key = 0;
-
-  DBUG_ENTER("ha_spartan::index_last");
-  key = share->index_class->get_last_key();
-  if (key == 0)
-    DBUG_RETURN(HA_ERR_END_OF_FILE);
-  memcpy(buf, key, get_key_len());
-  DBUG_RETURN(0);
+  DBUG_ENTER("sort_part");
+  if (part->null_bit)
+    *to++ = is_null ? 0 : 1;
+  if (is_null)
+    memset(to, 0, part->length);
+  else
+    part->field->sort_string((char *)to, part->length);
+  DBUG_RETURN(sort_part_length(part));
 }
 
-
 /*
-  rnd_init() is called when the system wants the storage engine to do a table
-  scan.
-  See the spartan in the introduction at the top of this file to see when
-  rnd_init() is called.
+  Build the key of key inx of the table from record into ndx as the
+  index keeps it: the key parts one after the other, each the sort
+  image of its field (see Field::sort_string(), what filesort orders
+  rows by) after a byte that is 0 for null and 1 if the field can be
+  null. memcmp() of two keys then orders them part by part the way the
+  server does: numbers by value, strings by their collation. A whole
+  key is key_length bytes, zero after the parts, as the index file was
+  created with. The VARCHAR and blob parts are read through their
+  fields, so the fields are pointed at record while the key is made.
+*/
+void ha_spartan::make_key(uint inx, const byte *record, SDE_INDEX *ndx)
+{
+  KEY *key_info = table->key_info + inx;
+  KEY_PART_INFO *part;
+  my_ptrdiff_t row_offset = (my_ptrdiff_t)(record - table->record[0]);
+  byte *to = ndx->key;
+  uint i;
+
+  DBUG_ENTER("ha_spartan::make_key");
+  memset(ndx->key, 0, sizeof(ndx->key));
+  for (i = 0; i < key_info->key_parts; i++)
+  {
+    part = key_info->key_part + i;
+    part->field->ptr += row_offset;
+    to += sort_part(part, part->null_bit &&
+                          (record[part->null_offset] & part->null_bit), to);
+    part->field->ptr -= row_offset;
+  }
+  ndx->length = key_info->key_length;
+  ndx->pos = -1;
+  DBUG_VOID_RETURN;
+}
 
-  Called from filesort.cc, records.cc, sql_handler.cc, sql_select.cc, sql_table.cc,
-  and sql_update.cc.
+/*
+  Build the key to look for in the index of key inx (see make_key())
+  from the first key_len bytes of a key as the server passes it to
+  index_read() (see key_copy()): the first parts of the key, each after
+  a null byte if it can be null. Each value is put back in its field,
+  pointed at key_rec, to get its sort image. The whole key is as long
+  as the key of a row; the first parts of it are as long as their
+  parts. Returns 0 or HA_ERR_OUT_OF_MEM.
 */
-int ha_spartan::rnd_init(bool scan)
+int ha_spartan::make_search_key(uint inx, const byte *key, uint key_len,
+                                SDE_INDEX *ndx)
 {
-  DBUG_ENTER("ha_spartan::rnd_init");
-  current_position = 0;
-  records = 0;
-  ref_length = sizeof(long long);
+  KEY *key_info = table->key_info + inx;
+  KEY_PART_INFO *part;
+  my_ptrdiff_t row_offset;
+  const byte *end = key + key_len;
+  byte *to = ndx->key;
+  bool is_null;
+  uint i;
+
+  DBUG_ENTER("ha_spartan::make_search_key");
+  if (key_rec == NULL)
+    DBUG_RETURN(HA_ERR_OUT_OF_MEM);
+  row_offset = (my_ptrdiff_t)(key_rec - table->record[0]);
+  memset(ndx->key, 0, sizeof(ndx->key));
+  for (i = 0; (i < key_info->key_parts) &&
+              (key + key_info->key_part[i].store_length <= end); i++)
+  {
+    part = key_info->key_part + i;
+    is_null = part->null_bit && *key;
+    part->field->ptr += row_offset;
+    if (!is_null)
+      part->field->set_key_image((char *)key + (part->null_bit ? 1 : 0),
+                                 part->length);
+    to += sort_part(part, is_null, to);
+    part->field->ptr -= row_offset;
+    key += part->store_length;
+  }
+  ndx->length = (i == key_info->key_parts) ? key_info->key_length :
+                (int)(to - ndx->key);
+  ndx->pos = -1;
   DBUG_RETURN(0);
 }
 
-int ha_spartan::rnd_end()
+/* may the index of key inx hold equal keys (it is not unique) */
+bool ha_spartan::allow_dupes(uint inx)
 {
-  DBUG_ENTER("ha_spartan::rnd_end");
-  DBUG_RETURN(0);
+  DBUG_ENTER("ha_spartan::allow_dupes");
+  DBUG_RETURN(!(table->key_info[inx].flags & HA_NOSAME));
 }
 
 /*
-  This is called for each row of the table scan. When you run out of records
-  you should return HA_ERR_END_OF_FILE. Fill buff up with the row information.
-  The Field structure for the table is the key to getting data into buf
-  in a manner that will allow the server to understand it.
-
-  Called from filesort.cc, records.cc, sql_handler.cc, sql_select.cc, sql_table.cc,
-  and sql_update.cc.
+  Has ndx, a key of key inx as the index keeps it (see make_key()), a
+  part that is null? Every null is kept as the same bytes, but NULL is
+  equal to no value, so a unique index holds such a key as often as it
+  comes and it is never used to find a row.
 */
-int ha_spartan::rnd_next(byte *buf)
+bool ha_spartan::key_has_null(uint inx, SDE_INDEX *ndx)
 {
-  int rc;
+  KEY *key_info = table->key_info + inx;
+  KEY_PART_INFO *part;
+  byte *key = ndx->key;
+  uint i;
 
-  DBUG_ENTER("ha_spartan::rnd_next"); 
-  ha_statistic_increment(&SSV::ha_read_rnd_next_count);
-  /*
-    Read the row from the data file.
-  */
-  rc = share->data_class->read_row(buf, table->s->rec_buff_length,
-                                   current_position); 
-  if (rc != -1)
-    current_position = (off_t)share->data_class->cur_position();
-  else
-    DBUG_RETURN(HA_ERR_END_OF_FILE);
-  records++;  
-  DBUG_RETURN(0);
+  DBUG_ENTER("ha_spartan::key_has_null");
+  for (i = 0; i < key_info->key_parts; i++)
+  {
+    part = key_info->key_part + i;
+    if (part->null_bit && (*key == 0))
+      DBUG_RETURN(true);
+    key += sort_part_length(part);
+  }
+  DBUG_RETURN(false);
 }
 
-
 /*
-  position() is called after each call to rnd_next() if the data needs
-  to be ordered. You can do something like the following to store
-  the position:
-  my_store_ptr(ref, ref_length, current_position);
-
-  The server uses ref to store data. ref_length in the above case is
-  the size needed to store current_position. ref is just a byte array
-  that the server will maintain. If you are using offsets to mark rows, then
-  current_position should be the offset. If it is a primary key like in
-  BDB, then it needs to be a primary key.
-
-  Called from filesort.cc, sql_select.cc, sql_delete.cc and sql_update.cc.
+  Move the keys with a null part (see key_has_null()) among the count
+  keys of key inx in keys to the end of them and get how many there
+  are.
 */
-void ha_spartan::position(const byte *record)
+int ha_spartan::move_null_keys(uint inx, SDE_INDEX *keys, int count)
 {
-  DBUG_ENTER("ha_spartan::position"); 
-  my_store_ptr(ref, ref_length, current_position);
-  DBUG_VOID_RETURN;
-}
+  SDE_INDEX ndx;
+  int nulls = 0;
+  int i;
 
+  DBUG_ENTER("ha_spartan::move_null_keys");
+  for (i = count - 1; i >= 0; i--)
+  {
+    if (!key_has_null(inx, keys + i))
+      continue;
+    nulls++;
+    ndx = keys[i];
+    keys[i] = keys[count - nulls];
+    keys[count - nulls] = ndx;
+  }
+  DBUG_RETURN(nulls);
+}
 
 /*
-  This is like rnd_next, but you are given a position to use
-  to determine the row. The position will be of the type that you stored in
-  ref. You can use ha_get_ptr(pos,ref_length) to retrieve whatever key
-  or position you saved when position() was called.
-  Called from filesort.cc records.cc sql_insert.cc sql_select.cc sql_update.cc.
+  Get the number of index files of the table: one for each key, or the
+  one a table without keys is created with.
 */
-int ha_spartan::rnd_pos(byte * buf, byte *pos)
+uint ha_spartan::index_files()
 {
-  DBUG_ENTER("ha_spartan::rnd_pos");
-  ha_statistic_increment(&SSV::ha_read_rnd_next_count);
-  current_position = (off_t)my_get_ptr(pos,ref_length);
-  share->data_class->read_row(buf, current_position, -1);
+  DBUG_ENTER("ha_spartan::index_files");
+  DBUG_RETURN((table->s->keys > 0) ? table->s->keys : 1);
+}
+
+/*
+  Yes, update_row() does what you expect, it updates a row. old_data will have
+  the previous row record in it, while new_data will have the newest data in
+  it.
+  Keep in mind that the server can do updates based on ordering if an ORDER BY
+  clause was used. Consecutive ordering is not guarenteed.
+  Currently new_data will not have an updated auto_increament record, or
+  and updated timestamp field. You can do these for spartan by doing these:
+  if (table->timestamp_field_type & TIMESTAMP_AUTO_SET_ON_UPDATE)
+    table->timestamp_field->set_time();
+  if (table->next_number_field && record == table->record[0])
+    update_auto_increment();
+
+  Called from sql_select.cc, sql_acl.cc, sql_update.cc, and sql_insert.cc.
+*/
+int ha_spartan::update_row(const byte * old_data, byte * new_data)
+{
+  long long pos;
+  long long row_pos;
+  long long *old_pos;
+  byte *old_rec;
+  int length;
+  SDE_INDEX ndx;
+  SDE_INDEX old_ndx;
+  int rc;
+  uint i;
+
+  DBUG_ENTER("ha_spartan::update_row");
+  pthread_mutex_lock(&share->data_mutex);
+  pos = find_row(old_data);
+  row_pos = pos;
+  /*
+    A new value of a unique key that another row has leaves the row as
+    it was.
+  */
+  if ((rc = flush_bulk_keys()) || (rc = find_dupp_key(new_data, row_pos)))
+  {
+    pthread_mutex_unlock(&share->data_mutex);
+    DBUG_RETURN(rc);
+  }
+  if (table->found_next_number_field && new_data == table->record[0])
+    save_auto_increment(table->found_next_number_field);
+  /*
+    A packed row that grew is moved by the data class. New blob values
+    are written before the row and the old ones removed after it, so
+    the row never points at a value that is not there.
+  */
+  if (packed)
+  {
+    old_rec = rec_buf + max_row_length();
+    old_pos = blob_pos + table->s->blob_fields;
+    find_blobs(pos, old_pos);
+    if (write_blobs(new_data, blob_pos))
+    {
+      free_blobs(blob_pos);
+      pthread_mutex_unlock(&share->data_mutex);
+      DBUG_RETURN(HA_ERR_INTERNAL_ERROR);
+    }
+    pack_row(old_rec, old_data, old_pos);
+    length = pack_row(rec_buf, new_data, blob_pos);
+    pos = share->data_class->update_row(old_rec, rec_buf, length, pos,
+                                        &row_pos);
+    free_blobs((pos == -1) ? blob_pos : old_pos);
+  }
+  else
+    pos = share->data_class->update_row((byte *)old_data, new_data,
+                   table->s->rec_buff_length, pos, &row_pos);
+  /*
+    The data class says where the row was if it had to look for it; the
+    zone map and the indexes are changed at that position.
+  */
+  if ((pos == -1) || (row_pos == -1))
+  {
+    pthread_mutex_unlock(&share->data_mutex);
+    DBUG_RETURN(HA_ERR_INTERNAL_ERROR);
+  }
+  /*
+    A row that moved leaves its old zone and joins the one it went to.
+  */
+  if (zone_col != NULL)
+  {
+    zone_values(new_data);
+    if (row_pos == pos)
+      share->zone_class->update_row(pos, zone_val, zone_null);
+    else
+    {
+      share->zone_class->delete_row(row_pos);
+      share->zone_class->add_row(pos, zone_val, zone_null);
+    }
+  }
+  /*
+    Move the row's entry in the index of each key from its old key and
+    position to the new ones; an index is not searched if the row kept
+    its place and the key did not change. The pages it changes are saved
+    (and logged) when the statement ends.
+  */
+  for (i = 0; i < table->s->keys; i++)
+  {
+    make_key(i, old_data, &old_ndx);
+    make_key(i, new_data, &ndx);
+    if (((row_pos != pos) || memcmp(old_ndx.key, ndx.key, ndx.length)) &&
+        share->index_class[i]->update_key(old_ndx.key, row_pos, ndx.key,
+                                          pos, ndx.length))
+      rc = HA_ERR_INTERNAL_ERROR;
+  }
+  pthread_mutex_unlock(&share->data_mutex);
+  DBUG_RETURN(rc);
+}
+
+
+/*
+  This will delete a row. buf will contain a copy of the row to be deleted.
+  The server will call this right after the current row has been called (from
+  either a previous rnd_nexT() or index call).
+  If you keep a pointer to the last row or can access a primary key it will
+  make doing the deletion quite a bit easier.
+  Keep in mind that the server does no guarentee consecutive deletions. ORDER BY
+  clauses can be used.
+
+  Called in sql_acl.cc and sql_udf.cc to manage internal table information.
+  Called in sql_delete.cc, sql_insert.cc, and sql_select.cc. In sql_select it is
+  used for removing duplicates while in insert it is used for REPLACE calls.
+*/
+int ha_spartan::delete_row(const byte * buf)
+{
+  long long pos;
+  SDE_INDEX ndx;
+  int rc = 0;
+  uint i;
+
+  DBUG_ENTER("ha_spartan::delete_row");
+  pthread_mutex_lock(&share->data_mutex);
+  if ((rc = flush_bulk_keys()))
+  {
+    pthread_mutex_unlock(&share->data_mutex);
+    DBUG_RETURN(rc);
+  }
+  pos = find_row(buf);
+  /*
+    The data class gets the position of the row deleted (it looks for
+    the row if it was not known); the zone map and the entries that
+    point at it go too. The blob values go only with the row.
+  */
+  if (packed)
+  {
+    find_blobs(pos, blob_pos);
+    pos = share->data_class->delete_row(rec_buf,
+                                        pack_row(rec_buf, buf, blob_pos),
+                                        pos);
+    if (pos != -1)
+      free_blobs(blob_pos);
+  }
+  else
+    pos = share->data_class->delete_row((byte *)buf,
+                                        table->s->rec_buff_length, pos);
+  if (pos == -1)
+    rc = HA_ERR_INTERNAL_ERROR;
+  else
+  {
+    share->zone_class->delete_row(pos);
+    for (i = 0; i < table->s->keys; i++)
+    {
+      make_key(i, buf, &ndx);
+      share->index_class[i]->delete_key(ndx.key, pos, ndx.length);
+    }
+  }
+  pthread_mutex_unlock(&share->data_mutex);
+  DBUG_RETURN(rc);
+}
+
+
+/*
+  Return the position in the data file of the row that is being updated
+  or deleted. This is the row last read by this handler; if that is not
+  known the row is looked up in the index of its first unique key
+  without a null part in the row (the others may hold the key of more
+  than one row). Returns -1 (the data class then searches the file)
+  only if neither is available.
+*/
+long long ha_spartan::find_row(const byte *record)
+{
+  SDE_INDEX ndx;
+  uint i;
+
+  DBUG_ENTER("ha_spartan::find_row");
+  if (current_row != -1)
+    DBUG_RETURN(current_row);
+  for (i = 0; i < table->s->keys; i++)
+  {
+    if (allow_dupes(i))
+      continue;
+    make_key(i, record, &ndx);
+    if (!key_has_null(i, &ndx))
+      DBUG_RETURN(share->index_class[i]->get_index_pos(ndx.key,
+                                                       ndx.length));
+  }
+  DBUG_RETURN(-1);
+}
+
+
+/*
+  Get the length of the longest packed row of the table. A packed field
+  may take a length byte or two more than in the record and a blob field
+  keeps a file position (long long) in place of its pointer.
+*/
+int ha_spartan::max_row_length()
+{
+  DBUG_ENTER("ha_spartan::max_row_length");
+  DBUG_RETURN(table->s->rec_buff_length + 2 * table->s->fields +
+              table->s->blob_fields * sizeof(long long));
+}
+
+/*
+  Pack record into to and return the length of the packed row. The rows
+  of a table with VARCHAR or blob fields are stored packed: the null
+  bytes followed by each field that is not null in its packed form, so a
+  VARCHAR takes only as many bytes as its value. A blob field is its
+  length followed by the position of its value in the overflow file,
+  taken from positions (one per blob field, -1 = no value; NULL = none).
+*/
+int ha_spartan::pack_row(byte *to, const byte *record, long long *positions)
+{
+  byte *ptr;
+  const byte *from;
+  long long blob_pos;
+  uint packlength;
+  uint blob = 0;
+  my_ptrdiff_t row_offset = (my_ptrdiff_t)(record - table->record[0]);
+
+  DBUG_ENTER("ha_spartan::pack_row");
+  memcpy(to, record, table->s->null_bytes);
+  ptr = to + table->s->null_bytes;
+  for (Field **field=table->field ; *field ; field++)
+  {
+    from = record + ((*field)->ptr - table->record[0]);
+    if ((*field)->flags & BLOB_FLAG)
+    {
+      blob_pos = (positions != NULL) ? positions[blob] : -1;
+      blob++;
+      if ((*field)->is_null(row_offset))
+        continue;
+      packlength = ((Field_blob *)*field)->pack_length_no_ptr();
+      memcpy(ptr, from, packlength);
+      memcpy(ptr + packlength, &blob_pos, sizeof(long long));
+      ptr += packlength + sizeof(long long);
+    }
+    else if (!(*field)->is_null(row_offset))
+      ptr = (byte *)(*field)->pack((char *)ptr, (char *)from);
+  }
+  DBUG_RETURN((int)(ptr - to));
+}
+
+/*
+  Unpack the packed row at from into record and return the length of the
+  packed row (-1 if a blob value could not be read).
+
+  Blob values are read from blob_data into blobs, and the blob fields
+  of record point into it, only for the fields in cols (cols[i + 1] is
+  field i as for read_row(); NULL = all of them). Other blob fields are
+  left empty so a scan that does not ask for a blob never reads it; no
+  blob is read at all if blob_data is NULL. The overflow positions of
+  the blob fields are put in positions unless it is NULL.
+*/
+int ha_spartan::unpack_row(byte *record, const byte *from,
+                           Spartan_data *blob_data, bool *cols,
+                           String *blobs, long long *positions)
+{
+  const byte *start = from;
+  byte *to;
+  char *data;
+  long long blob_pos;
+  uint32 length;
+  uint32 total = 0;
+  uint packlength;
+  uint blob = 0;
+  uint i = 0;
+  my_ptrdiff_t row_offset = (my_ptrdiff_t)(record - table->record[0]);
+
+  DBUG_ENTER("ha_spartan::unpack_row");
+  memcpy(record, from, table->s->null_bytes);
+  from += table->s->null_bytes;
+  for (Field **field=table->field ; *field ; field++, i++)
+  {
+    to = record + ((*field)->ptr - table->record[0]);
+    if (!((*field)->flags & BLOB_FLAG))
+    {
+      if (!(*field)->is_null(row_offset))
+        from = (const byte *)(*field)->unpack((char *)to, (const char *)from);
+      continue;
+    }
+    blob_pos = -1;
+    if (!(*field)->is_null(row_offset))
+    {
+      packlength = ((Field_blob *)*field)->pack_length_no_ptr();
+      memcpy(to, from, packlength);
+      memcpy(&blob_pos, from + packlength, sizeof(long long));
+      from += packlength + sizeof(long long);
+      length = ((Field_blob *)*field)->get_length((const char *)to);
+      /*
+        Read the value onto the end of blobs. The buffer may move as it
+        grows so the field holds the offset of its value until the row
+        is done.
+      */
+      if ((length > 0) && (blob_pos != -1) && (blob_data != NULL) &&
+          ((cols == NULL) || cols[i + 1]))
+      {
+        if (blobs->realloc(total + length) ||
+            (blob_data->read_row((byte *)blobs->ptr() + total, length,
+                                 blob_pos) == -1))
+          DBUG_RETURN(-1);
+        data = (char *)(size_t)total;
+        total += length;
+      }
+      else
+      {
+        bzero(to, packlength);
+        data = NULL;
+      }
+      memcpy_fixed(to + packlength, &data, sizeof(char *));
+    }
+    if (positions != NULL)
+      positions[blob] = blob_pos;
+    blob++;
+  }
+  /*
+    Point the blob fields read at their values.
+  */
+  if (total > 0)
+  {
+    for (Field **field=table->field ; *field ; field++)
+    {
+      if (!((*field)->flags & BLOB_FLAG) || (*field)->is_null(row_offset))
+        continue;
+      to = record + ((*field)->ptr - table->record[0]);
+      packlength = ((Field_blob *)*field)->pack_length_no_ptr();
+      if (((Field_blob *)*field)->get_length((const char *)to) == 0)
+        continue;
+      memcpy_fixed(&data, to + packlength, sizeof(char *));
+      data = (char *)blobs->ptr() + (size_t)data;
+      memcpy_fixed(to + packlength, &data, sizeof(char *));
+    }
+  }
+  DBUG_RETURN((int)(from - start));
+}
+
+/*
+  Write the values of the blob fields of record to the overflow file
+  and put their positions in positions. The caller holds data_mutex.
+  Returns 0 or -1 on error.
+*/
+int ha_spartan::write_blobs(const byte *record, long long *positions)
+{
+  const byte *from;
+  char *data;
+  uint32 length;
+  uint packlength;
+  uint blob;
+  my_ptrdiff_t row_offset = (my_ptrdiff_t)(record - table->record[0]);
+
+  DBUG_ENTER("ha_spartan::write_blobs");
+  for (blob = 0; blob < table->s->blob_fields; blob++)
+    positions[blob] = -1;
+  blob = 0;
+  for (Field **field=table->field ; *field ; field++)
+  {
+    if (!((*field)->flags & BLOB_FLAG))
+      continue;
+    from = record + ((*field)->ptr - table->record[0]);
+    packlength = ((Field_blob *)*field)->pack_length_no_ptr();
+    length = ((Field_blob *)*field)->get_length((const char *)from);
+    if (!(*field)->is_null(row_offset) && (length > 0))
+    {
+      memcpy_fixed(&data, from + packlength, sizeof(char *));
+      positions[blob] = share->blob_class->write_row((byte *)data, length);
+      share->blobs_changed = true;
+      if (positions[blob] == -1)
+        DBUG_RETURN(-1);
+    }
+    blob++;
+  }
+  DBUG_RETURN(0);
+}
+
+/*
+  Put the overflow positions of the blobs of the row at pos in
+  positions. The caller holds data_mutex. Returns 0 or -1 on error.
+*/
+int ha_spartan::find_blobs(long long pos, long long *positions)
+{
+  byte *row = rec_buf + max_row_length();
+  byte *record = rec_buf + 2 * max_row_length();
+  uint blob;
+
+  DBUG_ENTER("ha_spartan::find_blobs");
+  for (blob = 0; blob < table->s->blob_fields; blob++)
+    positions[blob] = -1;
+  if (table->s->blob_fields == 0)
+    DBUG_RETURN(0);
+  if ((pos == -1) ||
+      (share->data_class->read_row(row, max_row_length(), pos) == -1) ||
+      (share->data_class->last_position() != pos))
+    DBUG_RETURN(-1);
+  unpack_row(record, row, NULL, NULL, NULL, positions);
+  DBUG_RETURN(0);
+}
+
+/*
+  Remove the blob values at positions from the overflow file. The caller
+  holds data_mutex and has made the change that dropped them from their
+  row. A crash before the change is committed brings the row back, so
+  the values are only freed by release_blobs() once it is; until then
+  their slots cannot be reused.
+*/
+void ha_spartan::free_blobs(long long *positions)
+{
+  SPARTAN_FREED_BLOB *more;
+  long long lsn = share->log_class->end_lsn();
+  uint blob;
+
+  DBUG_ENTER("ha_spartan::free_blobs");
+  for (blob = 0; blob < table->s->blob_fields; blob++)
+  {
+    if (positions[blob] == -1)
+      continue;
+    if (share->freed_count == share->freed_alloc)
+    {
+      more = (SPARTAN_FREED_BLOB *)
+        my_realloc((gptr)share->freed_blobs,
+                   (share->freed_alloc + SPARTAN_BULK_KEYS) *
+                   sizeof(SPARTAN_FREED_BLOB),
+                   MYF(MY_WME | MY_ALLOW_ZERO_PTR));
+      /*
+        Out of memory: the value is left where it is. REPAIR TABLE
+        frees it (see free_orphan_blobs()).
+      */
+      if (more == NULL)
+        continue;
+      share->freed_blobs = more;
+      share->freed_alloc += SPARTAN_BULK_KEYS;
+    }
+    share->freed_blobs[share->freed_count].pos = positions[blob];
+    share->freed_blobs[share->freed_count].lsn = lsn;
+    share->freed_count++;
+  }
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Free the blob values free_blobs() kept whose rows were changed before
+  lsn, the end of the redo log the caller has committed. Freeing them is
+  logged; a crash before that is committed leaves them unused until
+  REPAIR TABLE frees them. The caller holds data_mutex.
+*/
+void ha_spartan::release_blobs(long long lsn)
+{
+  uint i;
+  uint kept = 0;
+
+  DBUG_ENTER("ha_spartan::release_blobs");
+  for (i = 0; i < share->freed_count; i++)
+  {
+    if (share->freed_blobs[i].lsn <= lsn)
+      share->blob_class->delete_row(NULL, 0, share->freed_blobs[i].pos);
+    else
+      share->freed_blobs[kept++] = share->freed_blobs[i];
+  }
+  if (kept < share->freed_count)
+    share->blob_class->flush_data();
+  share->freed_count = kept;
+  DBUG_VOID_RETURN;
+}
+
+/* compare two positions in the overflow file (for qsort()) */
+static int cmp_blob_pos(const void *a, const void *b)
+{
+  long long pos_a = *(const long long *)a;
+  long long pos_b = *(const long long *)b;
+
+  return (pos_a < pos_b) ? -1 : ((pos_a > pos_b) ? 1 : 0);
+}
+
+/*
+  Free the blob values no row points at: those of the rows repair()
+  deleted (their positions are in the rows, which cannot be trusted)
+  and any a crash left before release_blobs() was committed. The values
+  waiting for a commit are kept. The caller holds data_mutex. Returns
+  the number of values freed or -1 on error.
+*/
+int ha_spartan::free_orphan_blobs()
+{
+  byte *row = rec_buf + max_row_length();
+  byte *record = rec_buf + 2 * max_row_length();
+  long long *used;
+  long long *more;
+  long long pos = 0;
+  long long value_pos;
+  uint count = 0;
+  uint alloc;
+  int freed = 0;
+  byte probe;
+  uint blob;
+  uint i;
+
+  DBUG_ENTER("ha_spartan::free_orphan_blobs");
+  if (!packed || (table->s->blob_fields == 0))
+    DBUG_RETURN(0);
+  /*
+    Collect the positions of the values in use, sorted.
+  */
+  alloc = share->freed_count + SPARTAN_BULK_KEYS;
+  if ((used = (long long *)my_malloc(alloc * sizeof(long long),
+                                     MYF(MY_WME))) == NULL)
+    DBUG_RETURN(-1);
+  for (i = 0; i < share->freed_count; i++)
+    used[count++] = share->freed_blobs[i].pos;
+  while (share->data_class->read_row(row, max_row_length(), pos) != -1)
+  {
+    pos = share->data_class->cur_position();
+    unpack_row(record, row, NULL, NULL, NULL, blob_pos);
+    if (count + table->s->blob_fields > alloc)
+    {
+      alloc = 2 * alloc + table->s->blob_fields;
+      more = (long long *)my_realloc((gptr)used, alloc * sizeof(long long),
+                                     MYF(MY_WME));
+      if (more == NULL)
+      {
+        my_free((gptr)used, MYF(0));
+        DBUG_RETURN(-1);
+      }
+      used = more;
+    }
+    for (blob = 0; blob < table->s->blob_fields; blob++)
+      if (blob_pos[blob] != -1)
+        used[count++] = blob_pos[blob];
+  }
+  qsort(used, count, sizeof(long long), cmp_blob_pos);
+  /*
+    Free the others.
+  */
+  share->blob_class->flush_data();
+  pos = 0;
+  while (share->blob_class->read_row(&probe, sizeof(byte), pos) != -1)
+  {
+    value_pos = share->blob_class->last_position();
+    pos = share->blob_class->cur_position();
+    if (bsearch(&value_pos, used, count, sizeof(long long),
+                cmp_blob_pos) != NULL)
+      continue;
+    if (share->blob_class->delete_row(NULL, 0, value_pos) != -1)
+      freed++;
+  }
+  share->blob_class->flush_data();
+  my_free((gptr)used, MYF(0));
+  DBUG_RETURN(freed);
+}
+
+/*
+  Raise the auto-increment counter to the value of field (the
+  auto-increment field of a row written) if it is behind, and save it
+  in the data file header. The caller holds data_mutex. The header is
+  written with the next flush, which is logged before the statement
+  commits, so this costs no extra I/O. After a crash open() also checks
+  the counter against the index (see recover_auto_increment()).
+*/
+void ha_spartan::save_auto_increment(Field *field)
+{
+  ulonglong value = (ulonglong)field->val_int();
+
+  DBUG_ENTER("ha_spartan::save_auto_increment");
+  if (!(field->flags & UNSIGNED_FLAG) && (field->val_int() < 0))
+    value = 0;
+  pthread_mutex_lock(&share->mutex);
+  if (share->auto_increment < value)
+    share->auto_increment = value;
+  value = share->auto_increment;
+  pthread_mutex_unlock(&share->mutex);
+  share->data_class->set_auto_increment(value);
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Raise the auto-increment counter to the largest value of the
+  auto-increment field in the index of its key. The counter in the
+  header is only as new as the last header written, so after the redo
+  log is replayed it may be behind the rows it brought back. The index
+  keeps the sort images of the values (see make_key()), so the rows its
+  entries point at are read, from the last entry back; if the field is
+  the first part of the key the last entry has the largest value. The
+  caller holds data_mutex.
+*/
+void ha_spartan::recover_auto_increment()
+{
+  Field *field = table->found_next_number_field;
+  uint inx = table->s->next_number_index;
+  Spartan_index *index;
+  SDE_INDEX *ndx;
+  ulonglong max_value = 0;
+
+  DBUG_ENTER("ha_spartan::recover_auto_increment");
+  if ((field == NULL) || (inx >= index_files()))
+    DBUG_VOID_RETURN;
+  index = share->index_class[inx];
+  for (ndx = index->seek_end(true); ndx != NULL; ndx = index->prev_entry())
+  {
+    if (read_data(share->data_class, table->record[0], ndx->pos, NULL,
+                  rec_buf) == -1)
+      continue;
+    if (!field->is_null() &&
+        ((field->flags & UNSIGNED_FLAG) || (field->val_int() >= 0)) &&
+        ((ulonglong)field->val_int() > max_value))
+      max_value = (ulonglong)field->val_int();
+    if (table->s->next_number_key_offset == 0)
+      break;
+  }
+  pthread_mutex_lock(&share->mutex);
+  if (share->auto_increment < max_value)
+    share->auto_increment = max_value;
+  max_value = share->auto_increment;
+  pthread_mutex_unlock(&share->mutex);
+  share->data_class->set_auto_increment(max_value);
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Count rec_per_key of every part of every key into the share: the rows
+  over the number of distinct values of the first parts of the key,
+  from a walk of its index (see Spartan_index::count_prefixes()). A
+  count that is not known is left 0. The caller holds data_mutex.
+*/
+void ha_spartan::count_key_stats(int rows)
+{
+  int lengths[MAX_REF_PARTS];
+  ulong counts[MAX_REF_PARTS];
+  KEY *key_info;
+  int length;
+  uint i;
+  uint j;
+
+  DBUG_ENTER("ha_spartan::count_key_stats");
+  for (i = 0; i < table->s->keys; i++)
+  {
+    key_info = table->key_info + i;
+    length = 0;
+    for (j = 0; j < key_info->key_parts; j++)
+    {
+      length += sort_part_length(key_info->key_part + j);
+      lengths[j] = length;
+    }
+    if (share->index_class[i]->count_prefixes(lengths, key_info->key_parts,
+                                              counts))
+      bzero((char *)counts, sizeof(counts));
+    for (j = 0; j < key_info->key_parts; j++)
+      share->rec_per_key[i][j] =
+        (counts[j] == 0) ? 0 :
+        (((ulong)rows > counts[j]) ? (ulong)rows / counts[j] : 1);
+  }
+  share->stats_rows = rows;
+  share->stats_counted = true;
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Get the values of the zone map columns of record into zone_val and
+  zone_null.
+*/
+void ha_spartan::zone_values(const byte *record)
+{
+  my_ptrdiff_t row_offset = (my_ptrdiff_t)(record - table->record[0]);
+  int col;
+
+  DBUG_ENTER("ha_spartan::zone_values");
+  for (Field **field=table->field ; *field ; field++)
+  {
+    if ((col = zone_col[field - table->field]) == -1)
+      continue;
+    zone_null[col] = (*field)->is_null(row_offset);
+    if (!zone_null[col])
+    {
+      (*field)->ptr += row_offset;
+      zone_val[col] = (long long)(*field)->val_int();
+      (*field)->ptr -= row_offset;
+    }
+  }
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Build the zone map again from the rows in the data file. Only the
+  null bytes and the zone map columns are read. The caller holds
+  data_mutex. Returns 0 or -1 on error (the zone map is then not used).
+*/
+int ha_spartan::rebuild_zones()
+{
+  byte *record;
+  bool *cols;
+  long long pos = 0;
+  uint i;
+
+  DBUG_ENTER("ha_spartan::rebuild_zones");
+  if (zone_val == NULL)
+    DBUG_RETURN(-1);
+  record = (byte *)my_malloc(table->s->rec_buff_length + table->s->fields +
+                             1, MYF(MY_WME));
+  if (record == NULL)
+    DBUG_RETURN(-1);
+  cols = (bool *)(record + table->s->rec_buff_length);
+  cols[0] = true;
+  for (i = 0; i < table->s->fields; i++)
+    cols[i + 1] = (zone_col[i] != -1);
+  share->zone_class->trunc_zones();
+  while ((zone_cols > 0) &&
+         (read_data(share->data_class, record, pos, cols, rec_buf) != -1))
+  {
+    zone_values(record);
+    share->zone_class->add_row(share->data_class->last_position(), zone_val,
+                               zone_null);
+    pos = share->data_class->cur_position();
+  }
+  my_free((gptr)record, MYF(0));
+  DBUG_RETURN(0);
+}
+
+/*
+  Read the row at pos through data into buf. A packed row is read into
+  row_buf (max_row_length() bytes) and unpacked from there with the blob
+  values in cols (from this handler's overflow cursor if data is its
+  cursor). The caller holds data_mutex if data is the shared data
+  class. Returns 0 or -1 at end of file or on error.
+*/
+int ha_spartan::read_data(Spartan_data *data, byte *buf, long long pos,
+                          bool *cols, byte *row_buf)
+{
+  DBUG_ENTER("ha_spartan::read_data");
+  if (!packed)
+    DBUG_RETURN(data->read_row(buf, table->s->rec_buff_length, pos, cols));
+  if ((data->read_row(row_buf, max_row_length(), pos) == -1) ||
+      (unpack_row(buf, row_buf,
+                  (data == cursor) ? blob_cursor : share->blob_class, cols,
+                  &blob_buf, NULL) == -1))
+    DBUG_RETURN(-1);
+  DBUG_RETURN(0);
+}
+
+
+/*
+  Get the data class to read rows through. Nothing writes the table
+  while it is read locked, so under a read lock each handler reads
+  through a read only cursor of its own on the data file (and one on
+  the overflow file), opened on first use and closed by
+  external_lock(). Readers then do not wait for each other. Under a
+  write lock the rows may still be in the buffers of the shared data
+  class, so it is used with data_mutex held. The data class is handed
+  back with release_data().
+*/
+Spartan_data *ha_spartan::acquire_data()
+{
+  char name_buff[FN_REFLEN];
+
+  DBUG_ENTER("ha_spartan::acquire_data");
+  if (read_lock && (cursor == NULL))
+  {
+    cursor = new Spartan_data();
+    if (cursor->open_table(fn_format(name_buff, share->table_name, "",
+                                     SDE_EXT,
+                                     MY_REPLACE_EXT|MY_UNPACK_FILENAME),
+                           true))
+      close_cursor();
+    else if (table->s->blob_fields > 0)
+    {
+      blob_cursor = new Spartan_data();
+      if (blob_cursor->open_table(fn_format(name_buff, share->table_name,
+                                            "", SDO_EXT,
+                                            MY_REPLACE_EXT|MY_UNPACK_FILENAME),
+                                  true))
+        close_cursor();
+    }
+  }
+  if (read_lock && (cursor != NULL))
+    DBUG_RETURN(cursor);
+  pthread_mutex_lock(&share->data_mutex);
+  DBUG_RETURN(share->data_class);
+}
+
+/* hand back the data class acquire_data() gave */
+void ha_spartan::release_data(Spartan_data *data)
+{
+  DBUG_ENTER("ha_spartan::release_data");
+  if (data == share->data_class)
+    pthread_mutex_unlock(&share->data_mutex);
+  DBUG_VOID_RETURN;
+}
+
+/* close the read only cursors of this handler */
+void ha_spartan::close_cursor()
+{
+  DBUG_ENTER("ha_spartan::close_cursor");
+  if (cursor != NULL)
+  {
+    cursor->close_table();
+    delete cursor;
+  }
+  if (blob_cursor != NULL)
+  {
+    blob_cursor->close_table();
+    delete blob_cursor;
+  }
+  cursor = NULL;
+  blob_cursor = NULL;
+  direct_io = false;
+  mapped = false;
+  DBUG_VOID_RETURN;
+}
+
+
+/*
+  Read the row at pos, where an index entry points, into buf. pos is
+  -1 if the index cursor found no entry (HA_ERR_END_OF_FILE). An entry
+  that points at no row means the index is damaged.
+*/
+int ha_spartan::read_entry(byte *buf, long long pos)
+{
+  Spartan_data *data;
+  int rc = 0;
+
+  DBUG_ENTER("ha_spartan::read_entry");
+  if (pos == -1)
+    DBUG_RETURN(HA_ERR_END_OF_FILE);
+  data = acquire_data();
+  if ((read_data(data, buf, pos, NULL, rec_buf) == -1) ||
+      (data->last_position() != pos))
+    rc = HA_ERR_CRASHED;
+  else
+  {
+    current_row = pos;
+    current_position = data->cur_position();
+  }
+  release_data(data);
+  DBUG_RETURN(rc);
+}
+
+/* the row position of the entry an index cursor found (-1 = none) */
+static long long entry_pos(SDE_INDEX *ndx)
+{
+  return (ndx != NULL) ? ndx->pos : -1;
+}
+
+
+/*
+  Set the cursor of this handler on the index of key inx to the entry
+  find_flag asks for with the key ndx (see make_search_key()) and get
+  the row position it points at in *pos (-1 if there is none): the
+  first key equal to, not less than or greater than ndx, or the last
+  key not greater than or less than it or starting with it. A read
+  forward leaves the cursor on the entry after the one found, for
+  index_next(); a read of a last key leaves it on the entry before, for
+  index_prev(). A hash index finds equal keys only. The caller holds
+  data_mutex. Returns 0 or HA_ERR_WRONG_COMMAND for a find_flag the
+  index cannot do.
+*/
+int ha_spartan::seek_key(uint inx, SDE_INDEX *ndx,
+                         enum ha_rkey_function find_flag, long long *pos)
+{
+  Spartan_index *index = share->index_class[inx];
+  SDE_CURSOR *cur = &key_cursor[inx];
+  SDE_INDEX *found;
+  bool back = false;
+
+  DBUG_ENTER("ha_spartan::seek_key");
+  *pos = -1;
+  if ((table->key_info[inx].algorithm == HA_KEY_ALG_HASH) &&
+      (find_flag != HA_READ_KEY_EXACT) && (find_flag != HA_READ_PREFIX))
+    DBUG_RETURN(HA_ERR_WRONG_COMMAND);
+  switch (find_flag) {
+  case HA_READ_KEY_EXACT:
+  case HA_READ_PREFIX:
+    found = index->seek_index(ndx->key, ndx->length, cur);
+    break;
+  case HA_READ_KEY_OR_NEXT:
+    found = index->seek_bound(ndx->key, ndx->length, false, false, cur);
+    break;
+  case HA_READ_AFTER_KEY:
+    found = index->seek_bound(ndx->key, ndx->length, true, false, cur);
+    break;
+  case HA_READ_BEFORE_KEY:
+    found = index->seek_bound(ndx->key, ndx->length, false, true, cur);
+    back = true;
+    break;
+  case HA_READ_KEY_OR_PREV:
+  case HA_READ_PREFIX_LAST_OR_PREV:
+    found = index->seek_bound(ndx->key, ndx->length, true, true, cur);
+    back = true;
+    break;
+  case HA_READ_PREFIX_LAST:
+    found = index->seek_bound(ndx->key, ndx->length, true, true, cur);
+    if ((found != NULL) && memcmp(found->key, ndx->key, ndx->length))
+      found = NULL;
+    back = true;
+    break;
+  default:
+    DBUG_RETURN(HA_ERR_WRONG_COMMAND);
+  }
+  if ((*pos = entry_pos(found)) != -1)
+  {
+    if (back)
+      index->prev_entry(cur);
+    else
+      index->next_entry(cur);
+  }
+  DBUG_RETURN(0);
+}
+
+
+/*
+  Positions an index cursor to the index specified in the handle. Fetches the
+  row if available. If the key value is null, begin at the first key of the
+  index. The key may be the first parts of a key of several fields (key_len
+  bytes of it); find_flag says which key is read (see seek_key()). A row
+  that cannot be read is reported by read_entry().
+*/
+int ha_spartan::index_read(byte * buf, const byte * key, uint key_len,
+                           enum ha_rkey_function find_flag)
+{
+  Spartan_index *index = share->index_class[active_index];
+  SDE_CURSOR *cur = &key_cursor[active_index];
+  SDE_INDEX ndx;
+  long long pos;
+  int rc;
+
+  DBUG_ENTER("ha_spartan::index_read");
+  /*
+    The index is shared, so the cursor is moved under data_mutex; the
+    row is read after the mutex is let go (see acquire_data()).
+  */
+  pthread_mutex_lock(&share->data_mutex);
+  if ((rc = flush_bulk_keys()) ||
+      ((key != NULL) &&
+       (rc = make_search_key(active_index, key, key_len, &ndx))))
+  {
+    pthread_mutex_unlock(&share->data_mutex);
+    DBUG_RETURN(rc);
+  }
+  if (key != NULL)
+    rc = seek_key(active_index, &ndx, find_flag, &pos);
+  else if ((pos = entry_pos(index->seek_end(false, cur))) != -1)
+  {
+    /*
+      Move the cursor past the row read for index_next().
+    */
+    index->next_entry(cur);
+  }
+  pthread_mutex_unlock(&share->data_mutex);
+  if (rc == 0)
+    rc = read_entry(buf, pos);
+  DBUG_RETURN((rc == HA_ERR_END_OF_FILE) ? HA_ERR_KEY_NOT_FOUND : rc);
+}
+
+
+/*
+  Positions an index cursor to the index specified in key. Fetches the
+  row if any, as index_read() does.
+*/
+int ha_spartan::index_read_idx(byte * buf, uint index, const byte * key,
+                               uint key_len, enum ha_rkey_function find_flag)
+{
+  SDE_INDEX ndx;
+  long long pos;
+  int rc;
+
+  DBUG_ENTER("ha_spartan::index_read_idx");
+  pthread_mutex_lock(&share->data_mutex);
+  if ((rc = flush_bulk_keys()) ||
+      (rc = make_search_key(index, key, key_len, &ndx)))
+  {
+    pthread_mutex_unlock(&share->data_mutex);
+    DBUG_RETURN(rc);
+  }
+  rc = seek_key(index, &ndx, find_flag, &pos);
+  pthread_mutex_unlock(&share->data_mutex);
+  if (rc == 0)
+    rc = read_entry(buf, pos);
+  DBUG_RETURN((rc == HA_ERR_END_OF_FILE) ? HA_ERR_KEY_NOT_FOUND : rc);
+}
+
+
+/*
+  Used to read forward through the index. The cursor walks the entries,
+  so the rows of equal keys in an index that is not unique are each read
+  once, in the order of their positions.
+*/
+int ha_spartan::index_next(byte * buf)
+{
+  long long pos;
+
+  DBUG_ENTER("ha_spartan::index_next");
+  pthread_mutex_lock(&share->data_mutex);
+  pos = entry_pos(share->index_class[active_index]->
+                  next_entry(&key_cursor[active_index]));
+  pthread_mutex_unlock(&share->data_mutex);
+  DBUG_RETURN(read_entry(buf, pos));
+}
+
+
+/*
+  Used to read backwards through the index.
+*/
+int ha_spartan::index_prev(byte * buf)
+{
+  long long pos;
+
+  DBUG_ENTER("ha_spartan::index_prev");
+  pthread_mutex_lock(&share->data_mutex);
+  pos = entry_pos(share->index_class[active_index]->
+                  prev_entry(&key_cursor[active_index]));
+  pthread_mutex_unlock(&share->data_mutex);
+  DBUG_RETURN(read_entry(buf, pos));
+}
+
+
+/*
+  index_first() asks for the first key in the index. The row it points
+  at is read and the cursor left on the key after it.
+
+  Called from opt_range.cc, opt_sum.cc, sql_handler.cc,
+  and sql_select.cc.
+*/
+int ha_spartan::index_first(byte * buf)
+{
+  Spartan_index *index = share->index_class[active_index];
+  SDE_CURSOR *cur = &key_cursor[active_index];
+  long long pos;
+
+  int rc;
+
+  DBUG_ENTER("ha_spartan::index_first");
+  pthread_mutex_lock(&share->data_mutex);
+  rc = flush_bulk_keys();
+  if ((pos = entry_pos(index->seek_end(false, cur))) != -1)
+    index->next_entry(cur);
+  pthread_mutex_unlock(&share->data_mutex);
+  DBUG_RETURN(rc ? rc : read_entry(buf, pos));
+}
+
+
+/*
+  index_last() asks for the last key in the index. The row it points
+  at is read and the cursor left on the key before it.
+
+  Called from opt_range.cc, opt_sum.cc, sql_handler.cc,
+  and sql_select.cc.
+*/
+int ha_spartan::index_last(byte * buf)
+{
+  Spartan_index *index = share->index_class[active_index];
+  SDE_CURSOR *cur = &key_cursor[active_index];
+  long long pos;
+
+  int rc;
+
+  DBUG_ENTER("ha_spartan::index_last");
+  pthread_mutex_lock(&share->data_mutex);
+  rc = flush_bulk_keys();
+  if ((pos = entry_pos(index->seek_end(true, cur))) != -1)
+    index->prev_entry(cur);
+  pthread_mutex_unlock(&share->data_mutex);
+  DBUG_RETURN(rc ? rc : read_entry(buf, pos));
+}
+
+
+/*
+  rnd_init() is called when the system wants the storage engine to do a table
+  scan.
+  See the spartan in the introduction at the top of this file to see when
+  rnd_init() is called.
+
+  Called from filesort.cc, records.cc, sql_handler.cc, sql_select.cc, sql_table.cc,
+  and sql_update.cc.
+*/
+int ha_spartan::rnd_init(bool scan)
+{
+  Spartan_data *data;
+  uint i;
+
+  DBUG_ENTER("ha_spartan::rnd_init");
+  current_position = 0;
+  current_row = -1;
+  records = 0;
+  deleted = 0;
+  ref_length = sizeof(long long);
+  project = false;
+  /*
+    Rows a packed table moves while it is scanned (an update made them
+    longer) go to the end of the file; the scan stops before them.
+  */
+  pthread_mutex_lock(&share->data_mutex);
+  scan_limit = packed ? share->data_class->end_position() : -1;
+  pthread_mutex_unlock(&share->data_mutex);
+  /*
+    A table scan done under a read lock copies the rows straight out
+    of a memory mapping of the data file rather than reading them. A
+    very large table is read with direct I/O instead so the scan does
+    not fill the OS cache with it.
+  */
+  if (scan && (lock.type >= TL_READ) && (lock.type <= TL_READ_NO_INSERT))
+  {
+    data = acquire_data();
+    if (data == cursor)
+    {
+      direct_io = (cursor->direct_scan(true) == 0);
+      if (!direct_io)
+        mapped = (cursor->map_table() == 0);
+    }
+    release_data(data);
+    /*
+      The scan only returns the columns in the read set. Column 0 is
+      the null bytes and column i is field i (read set bit i). A PAX
+      table skips the minipages of the other columns. Scans under a
+      write lock always read whole rows since they may be written back.
+    */
+    if ((read_columns != NULL) && !ha_get_all_bit_in_read_set())
+    {
+      read_columns[0] = true;
+      for (i = 1; i <= table->s->fields; i++)
+        read_columns[i] = ha_get_bit_in_read_set(i);
+      project = true;
+    }
+  }
+  DBUG_RETURN(0);
+}
+
+/*
+  End the scan: stop the direct I/O or drop the mapping rnd_init() set
+  up on the cursor, so the address space of a large table is not held
+  between statements.
+*/
+int ha_spartan::rnd_end()
+{
+  DBUG_ENTER("ha_spartan::rnd_end");
+  if (direct_io)
+    cursor->direct_scan(false);
+  else if (mapped)
+    cursor->unmap_table();
+  direct_io = false;
+  mapped = false;
+  DBUG_RETURN(0);
+}
+
+/*
+  This is called for each row of the table scan. When you run out of records
+  you should return HA_ERR_END_OF_FILE. Fill buff up with the row information.
+  The Field structure for the table is the key to getting data into buf
+  in a manner that will allow the server to understand it.
+
+  Called from filesort.cc, records.cc, sql_handler.cc, sql_select.cc, sql_table.cc,
+  and sql_update.cc.
+*/
+int ha_spartan::rnd_next(byte *buf)
+{
+  Spartan_data *data;
+  int rc;
+  long long pos;
+
+  DBUG_ENTER("ha_spartan::rnd_next"); 
+  ha_statistic_increment(&SSV::ha_read_rnd_next_count);
+  /*
+    Read the row from the data file. Under a read lock it is read
+    through this handler's own cursor, so scans of the same table do
+    not wait for each other; otherwise it is read through the shared
+    data class under data_mutex (see acquire_data()).
+  */
+  data = acquire_data();
+  /*
+    Skip the zones that cannot hold a row matching the pushed
+    conditions. The zone map is shared and the open() of another
+    handler may build it again (see rebuild_zones()) even while the
+    table is read locked, so it is read under data_mutex; the shared
+    data class is only handed out with the mutex held already.
+  */
+  rc = 0;
+  if (zone_preds > 0)
+  {
+    if (data != share->data_class)
+      pthread_mutex_lock(&share->data_mutex);
+    pos = share->zone_class->skip_zones(current_position, zone_pred,
+                                        zone_preds);
+    if (data != share->data_class)
+      pthread_mutex_unlock(&share->data_mutex);
+    if (pos == -1)
+      rc = -1;
+    else
+      current_position = (off_t)pos;
+  }
+  if (rc != -1)
+    rc = read_data(data, buf, current_position,
+                   project ? read_columns : NULL, rec_buf);
+  if ((rc != -1) && (scan_limit != -1) &&
+      (data->last_position() >= scan_limit))
+    rc = -1;
+  if (rc != -1)
+  {
+    current_row = data->last_position();
+    current_position = (off_t)data->cur_position();
+    /*
+      Count the deleted rows the scan passed over for the optimizer.
+    */
+    deleted += data->skipped_records();
+  }
+  release_data(data);
+  if (rc == -1)
+    DBUG_RETURN(HA_ERR_END_OF_FILE);
+  records++;  
+  DBUG_RETURN(0);
+}
+
+
+/*
+  Start a parallel scan of the table in up to *parts ranges (*parts is
+  set to the number of ranges made; a small table has fewer). Each range
+  gets a cursor of its own: a private instance of the data class opened
+  read only on the data file, so the cursors share no file descriptor,
+  buffer or seek position with each other or with the shared data class
+  and never write to the file. The caller holds a read lock on the
+  table for the whole scan.
+
+  check() tests the checksums of the rows this way, a thread per range
+  (see verify_rows()).
+*/
+int ha_spartan::parallel_scan_init(uint *parts)
+{
+  char data_name[FN_REFLEN];
+  char blob_name[FN_REFLEN];
+  long long *ranges;
+  uint i;
+  int rc = 0;
+
+  DBUG_ENTER("ha_spartan::parallel_scan_init");
+  parallel_scan_end();
+  if (*parts < 1)
+    *parts = 1;
+  ranges = (long long *)my_malloc((*parts + 1) * sizeof(long long),
+                                  MYF(MY_WME));
+  scan_pos = (long long *)my_malloc(2 * *parts * sizeof(long long),
+                                    MYF(MY_WME));
+  scan_data = (Spartan_data **)my_malloc(2 * *parts * sizeof(Spartan_data *),
+                                         MYF(MY_WME | MY_ZEROFILL));
+  if (!ranges || !scan_pos || !scan_data)
+  {
+    my_free((gptr)ranges, MYF(MY_ALLOW_ZERO_PTR));
+    parallel_scan_end();
+    DBUG_RETURN(HA_ERR_OUT_OF_MEM);
+  }
+  scan_end = scan_pos + *parts;
+  /*
+    Get every row into the data file so the cursors see them all.
+  */
+  pthread_mutex_lock(&share->data_mutex);
+  share->data_class->flush_data();
+  share->blob_class->flush_data();
+  scan_parts = share->data_class->scan_ranges(*parts,
+                                              table->s->rec_buff_length,
+                                              ranges);
+  pthread_mutex_unlock(&share->data_mutex);
+  if (packed)
+  {
+    scan_buf = (byte *)my_malloc(scan_parts * max_row_length(), MYF(MY_WME));
+    scan_blobs = new String[scan_parts];
+    if (scan_buf == NULL)
+    {
+      my_free((gptr)ranges, MYF(0));
+      parallel_scan_end();
+      DBUG_RETURN(HA_ERR_OUT_OF_MEM);
+    }
+  }
+  fn_format(data_name, share->table_name, "", SDE_EXT,
+            MY_REPLACE_EXT|MY_UNPACK_FILENAME);
+  fn_format(blob_name, share->table_name, "", SDO_EXT,
+            MY_REPLACE_EXT|MY_UNPACK_FILENAME);
+  for (i = 0; (i < scan_parts) && (rc == 0); i++)
+  {
+    scan_data[i] = new Spartan_data();
+    rc = scan_data[i]->open_table(data_name, true);
+    if (rc == 0)
+      scan_data[i]->map_table();
+    /*
+      A range of a table with blob fields also gets a cursor of its own
+      on the overflow file, kept after the row cursors.
+    */
+    if ((rc == 0) && (table->s->blob_fields > 0))
+    {
+      scan_data[scan_parts + i] = new Spartan_data();
+      rc = scan_data[scan_parts + i]->open_table(blob_name, true);
+    }
+    scan_pos[i] = ranges[i];
+    scan_end[i] = ranges[i + 1];
+  }
+  my_free((gptr)ranges, MYF(0));
+  if (rc)
+  {
+    parallel_scan_end();
+    DBUG_RETURN(rc);
+  }
+  *parts = scan_parts;
+  DBUG_RETURN(0);
+}
+
+/*
+  Read the next row of range part of a parallel scan into buf. Only the
+  cursors of that range are used, so threads scanning different ranges
+  need no locking (each needs a buf of its own). The blob fields of buf
+  point into a buffer of the range that the next call reuses.
+*/
+int ha_spartan::parallel_scan_next(uint part, byte *buf)
+{
+  Spartan_data *cursor;
+  byte *row;
+  int rc;
+
+  DBUG_ENTER("ha_spartan::parallel_scan_next");
+  if ((part >= scan_parts) || (scan_pos[part] >= scan_end[part]))
+    DBUG_RETURN(HA_ERR_END_OF_FILE);
+  cursor = scan_data[part];
+  /*
+    The row found may be past the end of the range if the rest of the
+    range is deleted rows; it belongs to the next range then.
+  */
+  if (packed)
+  {
+    row = scan_buf + part * max_row_length();
+    rc = cursor->read_row(row, max_row_length(), scan_pos[part]);
+    if ((rc != -1) && (cursor->last_position() < scan_end[part]))
+      rc = unpack_row(buf, row, scan_data[scan_parts + part], NULL,
+                      scan_blobs + part, NULL);
+  }
+  else
+    rc = cursor->read_row(buf, table->s->rec_buff_length, scan_pos[part]);
+  if ((rc == -1) || (cursor->last_position() >= scan_end[part]))
+  {
+    scan_pos[part] = scan_end[part];
+    DBUG_RETURN(HA_ERR_END_OF_FILE);
+  }
+  scan_pos[part] = cursor->cur_position();
+  DBUG_RETURN(0);
+}
+
+/* close the cursors of a parallel scan */
+int ha_spartan::parallel_scan_end()
+{
+  uint i;
+
+  DBUG_ENTER("ha_spartan::parallel_scan_end");
+  if (scan_data != NULL)
+  {
+    for (i = 0; i < 2 * scan_parts; i++)
+      if (scan_data[i] != NULL)
+      {
+        scan_data[i]->close_table();
+        delete scan_data[i];
+      }
+    my_free((gptr)scan_data, MYF(0));
+  }
+  if (scan_pos != NULL)
+    my_free((gptr)scan_pos, MYF(0));
+  if (scan_buf != NULL)
+    my_free((gptr)scan_buf, MYF(0));
+  scan_buf = NULL;
+  if (scan_blobs != NULL)
+    delete [] scan_blobs;
+  scan_blobs = NULL;
+  scan_data = NULL;
+  scan_pos = NULL;
+  scan_end = NULL;
+  scan_parts = 0;
+  DBUG_RETURN(0);
+}
+
+/*
+  Test the checksum of every row of range part of a parallel scan. The
+  rows are read as they are stored (packed rows are not unpacked) so a
+  damaged row is counted in bad rather than ending the range. rows is
+  set to the rows found. Like parallel_scan_next() only the cursor of
+  the range is used. Returns 0 or HA_ERR_OUT_OF_MEM.
+*/
+int ha_spartan::verify_range(uint part, int *rows, int *bad)
+{
+  Spartan_data *cursor = scan_data[part];
+  int length = packed ? max_row_length() : table->s->rec_buff_length;
+  byte *buf;
+
+  DBUG_ENTER("ha_spartan::verify_range");
+  *rows = 0;
+  *bad = 0;
+  buf = (byte *)my_malloc(length, MYF(MY_WME));
+  if (buf == NULL)
+    DBUG_RETURN(HA_ERR_OUT_OF_MEM);
+  while ((scan_pos[part] < scan_end[part]) &&
+         (cursor->read_row(buf, length, scan_pos[part]) != -1) &&
+         (cursor->last_position() < scan_end[part]))
+  {
+    (*rows)++;
+    if (cursor->verify_row(cursor->last_position()) != 0)
+      (*bad)++;
+    scan_pos[part] = cursor->cur_position();
+  }
+  scan_pos[part] = scan_end[part];
+  my_free((gptr)buf, MYF(0));
+  DBUG_RETURN(0);
+}
+
+
+/*
+  position() is called after each call to rnd_next() if the data needs
+  to be ordered. We store the position of the row itself (current_row)
+  so that rnd_pos() reads the same row back:
+  my_store_ptr(ref, ref_length, current_row);
+
+  The server uses ref to store data. ref_length in the above case is
+  the size needed to store current_position. ref is just a byte array
+  that the server will maintain. If you are using offsets to mark rows, then
+  current_position should be the offset. If it is a primary key like in
+  BDB, then it needs to be a primary key.
+
+  Called from filesort.cc, sql_select.cc, sql_delete.cc and sql_update.cc.
+*/
+void ha_spartan::position(const byte *record)
+{
+  DBUG_ENTER("ha_spartan::position"); 
+  my_store_ptr(ref, ref_length, current_row);
+  DBUG_VOID_RETURN;
+}
+
+
+/*
+  This is like rnd_next, but you are given a position to use
+  to determine the row. The position will be of the type that you stored in
+  ref. You can use ha_get_ptr(pos,ref_length) to retrieve whatever key
+  or position you saved when position() was called.
+  Called from filesort.cc records.cc sql_insert.cc sql_select.cc sql_update.cc.
+*/
+int ha_spartan::rnd_pos(byte * buf, byte *pos)
+{
+  Spartan_data *data;
+  long long row;
+
+  DBUG_ENTER("ha_spartan::rnd_pos");
+  ha_statistic_increment(&SSV::ha_read_rnd_next_count);
+  row = my_get_ptr(pos,ref_length);
+  data = acquire_data();
+  if (read_data(data, buf, row, NULL, rec_buf) == -1)
+  {
+    release_data(data);
+    DBUG_RETURN(HA_ERR_END_OF_FILE);
+  }
+  /*
+    The data class steps over deleted rows to the next live one. If the
+    row at the position was deleted since it was remembered, say so
+    rather than hand back some other row.
+  */
+  if (data->last_position() != row)
+  {
+    release_data(data);
+    DBUG_RETURN(HA_ERR_RECORD_DELETED);
+  }
+  current_row = row;
+  current_position = (off_t)data->cur_position();
+  release_data(data);
   DBUG_RETURN(0);
 }
 
@@ -706,12 +2525,261 @@ int ha_spartan::rnd_pos(byte * buf, byte *pos)
     sql_update.cc
 
 */
-void ha_spartan::info(uint flag)
+void ha_spartan::info(uint flag)
+{
+  int rows;
+  uint i;
+  uint j;
+
+  DBUG_ENTER("ha_spartan::info");
+  /*
+    The data class keeps exact counts of the live and deleted rows and
+    the index knows how many keys it holds, so the optimizer is given
+    real numbers. The overflow file counts as part of the data.
+  */
+  if (flag & HA_STATUS_VARIABLE)
+  {
+    pthread_mutex_lock(&share->data_mutex);
+    records = share->data_class->records();
+    deleted = share->data_class->del_records();
+    data_file_length = share->data_class->data_length();
+    if (table->s->blob_fields > 0)
+      data_file_length += share->blob_class->data_length();
+    index_file_length = 0;
+    for (i = 0; i < index_files(); i++)
+      index_file_length += share->index_class[i]->index_length();
+    pthread_mutex_unlock(&share->data_mutex);
+    mean_rec_length = (records > 0) ?
+                      (ulong)(data_file_length / (records + deleted)) :
+                      table->s->rec_buff_length;
+    delete_length = (ulonglong)deleted * mean_rec_length;
+  }
+  /*
+    rec_per_key of every part of every key is counted from the index
+    (see count_key_stats()). That walks every key, so the counts are
+    kept in the share and only taken again by ANALYZE TABLE or once the
+    rows have changed by more than a tenth since.
+  */
+  if (flag & HA_STATUS_CONST)
+  {
+    pthread_mutex_lock(&share->data_mutex);
+    rows = share->data_class->records();
+    if (!share->stats_counted ||
+        (abs(rows - share->stats_rows) > share->stats_rows / 10))
+      count_key_stats(rows);
+    for (i = 0; i < table->s->keys; i++)
+      for (j = 0; j < table->key_info[i].key_parts; j++)
+        table->key_info[i].rec_per_key[j] = share->rec_per_key[i][j];
+    pthread_mutex_unlock(&share->data_mutex);
+  }
+  if (flag & HA_STATUS_AUTO)
+  {
+    pthread_mutex_lock(&share->mutex);
+    auto_increment_value = share->auto_increment + 1;
+    pthread_mutex_unlock(&share->mutex);
+  }
+  DBUG_VOID_RETURN;
+}
+
+
+/*
+  Hand out the next auto-increment value. The counter lives in the
+  share so inserts from every handler of the table draw from it
+  without reading the index; the share mutex is held only for the
+  increment. A value is never handed out twice, even if the row it
+  was meant for is not written.
+
+  Called from handler.cc by handler::update_auto_increment().
+*/
+ulonglong ha_spartan::get_auto_increment()
+{
+  ulonglong nr;
+
+  DBUG_ENTER("ha_spartan::get_auto_increment");
+  pthread_mutex_lock(&share->mutex);
+  nr = ++share->auto_increment;
+  pthread_mutex_unlock(&share->mutex);
+  DBUG_RETURN(nr);
+}
+
+
+/*
+  Make value the next auto-increment value handed out.
+
+  Called from sql_delete.cc by mysql_delete() for TRUNCATE.
+*/
+int ha_spartan::reset_auto_increment(ulonglong value)
+{
+  DBUG_ENTER("ha_spartan::reset_auto_increment");
+  pthread_mutex_lock(&share->data_mutex);
+  pthread_mutex_lock(&share->mutex);
+  share->auto_increment = (value > 0) ? value - 1 : 0;
+  share->data_class->set_auto_increment(share->auto_increment);
+  pthread_mutex_unlock(&share->mutex);
+  pthread_mutex_unlock(&share->data_mutex);
+  DBUG_RETURN(0);
+}
+
+
+/*
+  Report the next auto-increment value for SHOW CREATE TABLE and so
+  ALTER TABLE carries it over to the new table.
+*/
+void ha_spartan::update_create_info(HA_CREATE_INFO *create_info)
+{
+  DBUG_ENTER("ha_spartan::update_create_info");
+  info(HA_STATUS_AUTO);
+  if (!(create_info->used_fields & HA_CREATE_USED_AUTO))
+    create_info->auto_increment_value = auto_increment_value;
+  DBUG_VOID_RETURN;
+}
+
+
+/*
+  Push a condition down to the handler. The comparisons of an integer
+  field with an integer constant in it (on their own or joined by AND)
+  are kept for rnd_next(), which skips the zones of the data file that
+  cannot hold a matching row. Rows in the other zones are returned
+  whether they match or not, so all of the condition is handed back
+  for the caller to check.
+
+  Called from sql_select.cc by make_join_select() (with
+  engine_condition_pushdown on) and by DBXP's Query_tree::prepare().
+*/
+const COND *ha_spartan::cond_push(const COND *cond)
+{
+  DBUG_ENTER("ha_spartan::cond_push");
+  if (pushed_conds < SDZ_MAX_PREDICATES)
+  {
+    cond_mark[pushed_conds] = zone_preds;
+    if (zone_val != NULL)
+      add_predicates(cond);
+  }
+  pushed_conds++;
+  DBUG_RETURN(cond);
+}
+
+
+/*
+  Remove the predicates of the condition pushed last.
+*/
+void ha_spartan::cond_pop()
 {
-  DBUG_ENTER("ha_spartan::info");
-  /* This is a lie, but you don't want the optimizer to see zero or 1 */
-  if (records < 2) 
-    records= 2;
+  DBUG_ENTER("ha_spartan::cond_pop");
+  if ((pushed_conds > 0) && (--pushed_conds < SDZ_MAX_PREDICATES))
+    zone_preds = cond_mark[pushed_conds];
+  DBUG_VOID_RETURN;
+}
+
+
+/*
+  Add the predicates the zone map can test from cond to zone_pred:
+  field op constant or constant op field, where op is =, <, <=, > or
+  >=, the field is in the zone map and the constant is an integer.
+  The arguments of an AND are added one by one; anything else is
+  left out.
+*/
+void ha_spartan::add_predicates(const COND *cond)
+{
+  Item_func *func;
+  Item **args;
+  Item *value;
+  Item_field *item;
+  Field *field = NULL;
+  long long val;
+  int op;
+  int col;
+
+  DBUG_ENTER("ha_spartan::add_predicates");
+  if (cond->type() == Item::COND_ITEM)
+  {
+    if (((Item_cond *)cond)->functype() == Item_func::COND_AND_FUNC)
+    {
+      List_iterator<Item> li(*((Item_cond *)cond)->argument_list());
+      Item *arg;
+
+      while ((arg = li++))
+        add_predicates(arg);
+    }
+    DBUG_VOID_RETURN;
+  }
+  if ((cond->type() != Item::FUNC_ITEM) ||
+      (((Item_func *)cond)->argument_count() != 2))
+    DBUG_VOID_RETURN;
+  func = (Item_func *)cond;
+  switch (func->functype()) {
+  case Item_func::EQ_FUNC:
+    op = SDZ_EQ;
+    break;
+  case Item_func::LT_FUNC:
+    op = SDZ_LT;
+    break;
+  case Item_func::LE_FUNC:
+    op = SDZ_LE;
+    break;
+  case Item_func::GT_FUNC:
+    op = SDZ_GT;
+    break;
+  case Item_func::GE_FUNC:
+    op = SDZ_GE;
+    break;
+  default:
+    DBUG_VOID_RETURN;
+  }
+  /*
+    Put the field on the left (constant op field is field op' constant).
+  */
+  args = func->arguments();
+  if ((args[0]->type() == Item::FIELD_ITEM) && args[1]->const_item())
+  {
+    item = (Item_field *)args[0];
+    value = args[1];
+  }
+  else if ((args[1]->type() == Item::FIELD_ITEM) && args[0]->const_item())
+  {
+    item = (Item_field *)args[1];
+    value = args[0];
+    if (op == SDZ_LT)
+      op = SDZ_GT;
+    else if (op == SDZ_GT)
+      op = SDZ_LT;
+    else if (op == SDZ_LE)
+      op = SDZ_GE;
+    else if (op == SDZ_GE)
+      op = SDZ_LE;
+  }
+  else
+    DBUG_VOID_RETURN;
+  /*
+    Find the field in this table; DBXP items may only be named.
+  */
+  if ((item->field != NULL) && (item->field->table == table))
+    field = item->field;
+  else
+    for (Field **f=table->field ; *f ; f++)
+      if (!my_strcasecmp(system_charset_info, (*f)->field_name,
+                         item->field_name) &&
+          ((item->table_name == NULL) ||
+           !my_strcasecmp(system_charset_info, item->table_name,
+                          table->s->table_name.str)))
+        field = *f;
+  if ((field == NULL) || ((col = zone_col[field->field_index]) == -1))
+    DBUG_VOID_RETURN;
+  /*
+    Only an integer constant is compared the way the zone map compares.
+  */
+  if (value->result_type() != INT_RESULT)
+    DBUG_VOID_RETURN;
+  val = (long long)value->val_int();
+  if (value->null_value || (value->unsigned_flag && (val < 0)))
+    DBUG_VOID_RETURN;
+  if (zone_preds < SDZ_MAX_PREDICATES)
+  {
+    zone_pred[zone_preds].column = col;
+    zone_pred[zone_preds].op = op;
+    zone_pred[zone_preds].value = val;
+    zone_preds++;
+  }
   DBUG_VOID_RETURN;
 }
 
@@ -724,6 +2792,8 @@ void ha_spartan::info(uint flag)
 int ha_spartan::extra(enum ha_extra_function operation)
 {
   DBUG_ENTER("ha_spartan::extra");
+  if (operation == HA_EXTRA_RESET)
+    DBUG_RETURN(reset());
   DBUG_RETURN(0);
 }
 
@@ -737,6 +2807,11 @@ int ha_spartan::extra(enum ha_extra_function operation)
 int ha_spartan::reset(void)
 {
   DBUG_ENTER("ha_spartan::reset");
+  /*
+    Empty the stack of pushed conditions.
+  */
+  zone_preds = 0;
+  pushed_conds = 0;
   DBUG_RETURN(0);
 }
 
@@ -753,16 +2828,663 @@ int ha_spartan::reset(void)
 */
 int ha_spartan::delete_all_rows()
 {
+  uint i;
+
   DBUG_ENTER("ha_spartan::delete_all_rows");
-  pthread_mutex_lock(&spartan_mutex);
+  pthread_mutex_lock(&share->data_mutex);
   share->data_class->trunc_table();
-  share->index_class->destroy_index();
-  share->index_class->trunc_index();
-  pthread_mutex_unlock(&spartan_mutex);
+  share->freed_count = 0;
+  if (table->s->blob_fields > 0)
+    share->blob_class->trunc_table();
+  share->zone_class->trunc_zones();
+  for (i = 0; i < index_files(); i++)
+  {
+    share->index_class[i]->destroy_index();
+    share->index_class[i]->trunc_index();
+  }
+  pthread_mutex_unlock(&share->data_mutex);
+  DBUG_RETURN(0);
+}
+
+
+/*
+  optimize() rewrites the data file without the deleted rows and moves
+  the index entries to the new row positions. The live rows are copied
+  to a temporary file while other threads keep reading the table (see
+  store_lock()). Readers are only held back while the new file is
+  renamed over the old one.
+
+  Called from sql_table.cc by mysql_optimize_table().
+*/
+int ha_spartan::optimize(THD* thd, HA_CHECK_OPT* check_opt)
+{
+  char data_name[FN_REFLEN];
+  char tmp_name[FN_REFLEN];
+  Spartan_data *old_data;
+  Spartan_data *new_data;
+  int *col_offset;
+  int *col_length;
+  int cols;
+  long long *old_pos;
+  long long *new_pos;
+  long long *more;
+  long long pos = 0;
+  byte *buf;
+  int length = table->s->rec_buff_length;
+  int max_rows;
+  int del_rows;
+  int count = 0;
+  int rc = HA_ADMIN_OK;
+  struct timespec abstime;
+  int error;
+  uint i;
+
+  DBUG_ENTER("ha_spartan::optimize");
+  /*
+    Get every row into the data file. Writers are locked out so the
+    file does not change until we are done.
+  */
+  pthread_mutex_lock(&share->data_mutex);
+  share->data_class->flush_data();
+  max_rows = share->data_class->records();
+  del_rows = share->data_class->del_records();
+  pthread_mutex_unlock(&share->data_mutex);
+  if (del_rows == 0)
+    DBUG_RETURN(HA_ADMIN_OK);
+  fn_format(data_name, share->table_name, "", SDE_EXT,
+            MY_REPLACE_EXT|MY_UNPACK_FILENAME);
+  fn_format(tmp_name, share->table_name, "", SDT_EXT,
+            MY_REPLACE_EXT|MY_UNPACK_FILENAME);
+  my_delete(tmp_name, MYF(0));
+  buf = (byte *)my_malloc(length, MYF(MY_WME));
+  old_pos = (long long *)my_malloc((max_rows + 1) * sizeof(long long),
+                                   MYF(MY_WME));
+  new_pos = (long long *)my_malloc((max_rows + 1) * sizeof(long long),
+                                   MYF(MY_WME));
+  if (!buf || !old_pos || !new_pos)
+  {
+    my_free((gptr)buf, MYF(MY_ALLOW_ZERO_PTR));
+    my_free((gptr)old_pos, MYF(MY_ALLOW_ZERO_PTR));
+    my_free((gptr)new_pos, MYF(MY_ALLOW_ZERO_PTR));
+    DBUG_RETURN(HA_ADMIN_FAILED);
+  }
+  /*
+    Copy the live rows to the temporary file through private instances
+    of the data class so the shared one is free for the readers; the
+    old file is only read, like the scan cursors do. The new file gets
+    the same layout as the old one.
+  */
+  old_data = new Spartan_data();
+  new_data = new Spartan_data();
+  if (old_data->open_table(data_name, true))
+    rc = HA_ADMIN_FAILED;
+  else
+  {
+    cols = old_data->get_columns(&col_offset, &col_length);
+    if (new_data->create_table(tmp_name, old_data->get_layout() |
+                               (packed ? SDE_PACKED_ROWS : 0), cols,
+                               col_offset, col_length))
+      rc = HA_ADMIN_FAILED;
+    pthread_mutex_lock(&share->mutex);
+    new_data->set_auto_increment(share->auto_increment);
+    pthread_mutex_unlock(&share->mutex);
+  }
+  while ((rc == HA_ADMIN_OK) &&
+         (old_data->read_row(packed ? rec_buf : buf,
+                             packed ? max_row_length() : length, pos) != -1))
+  {
+    /*
+      The row count in the header may be behind the file (see check()),
+      so the lists of positions grow as more rows turn up; every row
+      to the end of the file is copied.
+    */
+    if (count > max_rows)
+    {
+      max_rows = 2 * max_rows + 1;
+      more = (long long *)my_realloc((gptr)old_pos,
+                                     (max_rows + 1) * sizeof(long long),
+                                     MYF(MY_WME));
+      if (more != NULL)
+      {
+        old_pos = more;
+        more = (long long *)my_realloc((gptr)new_pos,
+                                       (max_rows + 1) * sizeof(long long),
+                                       MYF(MY_WME));
+      }
+      if (more == NULL)
+      {
+        rc = HA_ADMIN_FAILED;
+        break;
+      }
+      new_pos = more;
+    }
+    /*
+      A packed row is written at its own length (found by unpacking it)
+      rather than the length of the slot it was in. Its blob values stay
+      where they are in the overflow file.
+    */
+    old_pos[count] = old_data->last_position();
+    if (packed)
+      new_pos[count] = new_data->write_row(rec_buf,
+                                           unpack_row(buf, rec_buf, NULL, NULL,
+                                                      NULL, NULL));
+    else
+      new_pos[count] = new_data->write_row(buf, length);
+    if (new_pos[count] == -1)
+      rc = HA_ADMIN_FAILED;
+    pos = old_data->cur_position();
+    count++;
+  }
+  if ((rc == HA_ADMIN_OK) && new_data->sync_data())
+    rc = HA_ADMIN_FAILED;
+  old_data->close_table();
+  new_data->close_table();
+  delete old_data;
+  delete new_data;
+  my_free((gptr)buf, MYF(0));
+  if (rc == HA_ADMIN_OK)
+  {
+    /*
+      Wait for the other statements using the table to finish (this
+      handler holds the only lock left), then move the index to the new
+      positions and swap the files. A reader that keeps the table
+      locked (LOCK TABLES) would hold us up for good, so the wait gives
+      up after table_lock_wait_timeout seconds and the table is left as
+      it was.
+    */
+    set_timespec(abstime, table_lock_wait_timeout);
+    pthread_mutex_lock(&share->mutex);
+    share->swapping = true;
+    while ((share->lock_count > 1) && (rc == HA_ADMIN_OK))
+    {
+      error = pthread_cond_timedwait(&share->swap_cond, &share->mutex,
+                                     &abstime);
+      if ((error == ETIMEDOUT) || (error == ETIME))
+        rc = HA_ADMIN_FAILED;
+    }
+    if (rc != HA_ADMIN_OK)
+    {
+      share->swapping = false;
+      pthread_cond_broadcast(&share->swap_cond);
+      sql_print_error("SPARTAN: %s: the table stayed locked, not optimized",
+                      share->table_name);
+    }
+    pthread_mutex_unlock(&share->mutex);
+  }
+  if (rc == HA_ADMIN_OK)
+  {
+    /*
+      The indexes are remapped before the rename: an index whose pages
+      change writes its header with SDI_CRASHED set (see
+      spartan_index.h), so if the server stops before they are saved
+      the index is reported crashed rather than pointing at the offsets
+      of the other file. If the rename fails they are mapped back.
+    */
+    pthread_mutex_lock(&share->data_mutex);
+    for (i = 0; i < table->s->keys; i++)
+      share->index_class[i]->remap_positions(old_pos, new_pos, count);
+    share->data_class->close_table();
+    if (my_rename(tmp_name, data_name, MYF(MY_WME)))
+      rc = HA_ADMIN_FAILED;
+    share->data_class->open_table(data_name);
+    for (i = 0; i < table->s->keys; i++)
+    {
+      if (rc != HA_ADMIN_OK)
+        share->index_class[i]->remap_positions(new_pos, old_pos, count);
+      share->index_class[i]->save_index();
+    }
+    if (rc == HA_ADMIN_OK)
+      rebuild_zones();
+    pthread_mutex_unlock(&share->data_mutex);
+    pthread_mutex_lock(&share->mutex);
+    share->swapping = false;
+    pthread_cond_broadcast(&share->swap_cond);
+    pthread_mutex_unlock(&share->mutex);
+  }
+  if (rc != HA_ADMIN_OK)
+    my_delete(tmp_name, MYF(0));
+  my_free((gptr)old_pos, MYF(0));
+  my_free((gptr)new_pos, MYF(0));
+  DBUG_RETURN(rc);
+}
+
+
+/*
+  Read up to max rows of the data file from *pos for check() and
+  repair(), which call this until it finds fewer and let data_mutex go
+  in between. A row whose checksum does not match is counted in *bad
+  and, if fix is set, deleted; the keys and position of every other row
+  go into keys, a list of max of them for each key of the table (see
+  alloc_keys()), and are counted in *count. *pos is set to where the
+  next call starts. The caller holds data_mutex. Returns 0 or -1 on
+  error.
+*/
+int ha_spartan::scan_keys(bool fix, SDE_INDEX **keys, int max,
+                          long long *pos, int *count, int *bad)
+{
+  byte *buf;
+  byte *row;
+  int length = table->s->rec_buff_length;
+  int rc;
+  long long row_pos;
+  uint i;
+
+  DBUG_ENTER("ha_spartan::scan_keys");
+  *count = 0;
+  buf = (byte *)my_malloc(length, MYF(MY_WME | MY_ZEROFILL));
+  if (buf == NULL)
+    DBUG_RETURN(-1);
+  row = packed ? rec_buf : buf;
+  while ((*count < max) &&
+         (share->data_class->read_row(row,
+                                      packed ? max_row_length() : length,
+                                      *pos) != -1))
+  {
+    row_pos = share->data_class->last_position();
+    *pos = share->data_class->cur_position();
+    if ((rc = share->data_class->verify_row(row_pos)) != 0)
+    {
+      (*bad)++;
+      if (fix && (rc == 1))
+      {
+        share->data_class->delete_row(row, 0, row_pos);
+        share->zone_class->delete_row(row_pos);
+      }
+      continue;
+    }
+    /*
+      The keys of a packed row are found by unpacking it (its blob
+      values are read too, as a key may take the start of one).
+    */
+    if (packed)
+      unpack_row(buf, rec_buf, share->blob_class, NULL, &blob_buf, NULL);
+    for (i = 0; i < table->s->keys; i++)
+    {
+      make_key(i, buf, keys[i] + *count);
+      keys[i][*count].pos = row_pos;
+    }
+    (*count)++;
+  }
+  my_free((gptr)buf, MYF(0));
+  DBUG_RETURN(0);
+}
+
+/*
+  Allocate a list of count keys for each key of the table in keys (to
+  be freed with free_keys()). Returns 0 or -1 if there is no memory.
+*/
+int ha_spartan::alloc_keys(SDE_INDEX **keys, int count)
+{
+  uint i;
+
+  DBUG_ENTER("ha_spartan::alloc_keys");
+  memset(keys, 0, SPARTAN_MAX_KEYS * sizeof(SDE_INDEX *));
+  for (i = 0; i < table->s->keys; i++)
+  {
+    keys[i] = (SDE_INDEX *)my_malloc(count * sizeof(SDE_INDEX), MYF(MY_WME));
+    if (keys[i] == NULL)
+    {
+      free_keys(keys);
+      DBUG_RETURN(-1);
+    }
+  }
   DBUG_RETURN(0);
 }
 
 
+/*
+  The work of the threads of verify_rows(): the ranges of the parallel
+  scan left to test and the totals so far, all under mutex.
+*/
+typedef struct st_spartan_verify {
+  ha_spartan *handler;
+  pthread_mutex_t mutex;
+  pthread_cond_t done;       /* signalled when a thread ends */
+  uint parts;                /* ranges of the scan */
+  uint next;                 /* next range to test */
+  uint running;              /* threads that have not ended */
+  int rows;
+  int bad;
+  int rc;
+} SPARTAN_VERIFY;
+
+/* test ranges until there are none left */
+static void verify_parts(SPARTAN_VERIFY *verify)
+{
+  uint part;
+  int rows;
+  int bad;
+  int rc;
+
+  for (;;)
+  {
+    pthread_mutex_lock(&verify->mutex);
+    part = verify->next++;
+    pthread_mutex_unlock(&verify->mutex);
+    if (part >= verify->parts)
+      break;
+    rc = verify->handler->verify_range(part, &rows, &bad);
+    pthread_mutex_lock(&verify->mutex);
+    verify->rows += rows;
+    verify->bad += bad;
+    if (rc != 0)
+      verify->rc = rc;
+    pthread_mutex_unlock(&verify->mutex);
+  }
+}
+
+pthread_handler_t spartan_verify_thread(void *arg)
+{
+  SPARTAN_VERIFY *verify = (SPARTAN_VERIFY *)arg;
+
+  my_thread_init();
+  verify_parts(verify);
+  pthread_mutex_lock(&verify->mutex);
+  verify->running--;
+  pthread_cond_signal(&verify->done);
+  pthread_mutex_unlock(&verify->mutex);
+  my_thread_end();
+  pthread_exit(0);
+  return 0;
+}
+
+/*
+  Test the checksum of every row of the data file with up to
+  SPARTAN_CHECK_THREADS threads, each taking ranges of a parallel scan
+  until none are left (this thread is one of them, so the test is done
+  even if no thread can be started). rows is set to the rows found and
+  bad to the ones that fail. The caller holds a read lock on the table.
+  Returns 0 or an error code.
+*/
+int ha_spartan::verify_rows(int *rows, int *bad)
+{
+  SPARTAN_VERIFY verify;
+  pthread_t thread;
+  pthread_attr_t attr;
+  uint parts = SPARTAN_CHECK_THREADS;
+  uint i;
+  int rc;
+
+  DBUG_ENTER("ha_spartan::verify_rows");
+  if ((rc = parallel_scan_init(&parts)))
+    DBUG_RETURN(rc);
+  verify.handler = this;
+  verify.parts = parts;
+  verify.next = 0;
+  verify.running = 0;
+  verify.rows = 0;
+  verify.bad = 0;
+  verify.rc = 0;
+  pthread_mutex_init(&verify.mutex, MY_MUTEX_INIT_FAST);
+  pthread_cond_init(&verify.done, NULL);
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_mutex_lock(&verify.mutex);
+  for (i = 1; i < parts; i++)
+    if (!pthread_create(&thread, &attr, spartan_verify_thread,
+                        (void *)&verify))
+      verify.running++;
+  pthread_mutex_unlock(&verify.mutex);
+  verify_parts(&verify);
+  pthread_mutex_lock(&verify.mutex);
+  while (verify.running > 0)
+    pthread_cond_wait(&verify.done, &verify.mutex);
+  pthread_mutex_unlock(&verify.mutex);
+  pthread_attr_destroy(&attr);
+  pthread_cond_destroy(&verify.done);
+  pthread_mutex_destroy(&verify.mutex);
+  parallel_scan_end();
+  *rows = verify.rows;
+  *bad = verify.bad;
+  DBUG_RETURN(verify.rc);
+}
+
+
+/*
+  check() reads the whole table and tests the checksum of every row of
+  the data file (see verify_rows()) and the overflow file, the row count
+  in the data file header and the index of each key: it must be in key
+  order and hold one entry for each row, with the row's key and
+  position. A unique key that can be null may hold equal keys (see
+  key_has_null()), so equal entries are not counted against its index;
+  write_row() and update_row() keep the values that are not null from
+  repeating. The entries and the keys of the rows are compared by the
+  sum of their fingerprints (see spartan_key_fingerprint()), so neither
+  is kept in memory. The table is marked crashed if the data file or an
+  index was left marked crashed.
+
+  The files are read SPARTAN_CHECK_ROWS rows or SPARTAN_CHECK_PAGES
+  index pages at a time, letting data_mutex go in between so readers of
+  the table are not held up for the whole check. The server holds a
+  read lock on the table, so nothing changes meanwhile.
+
+  Called from sql_table.cc by mysql_check_table().
+*/
+int ha_spartan::check(THD* thd, HA_CHECK_OPT* check_opt)
+{
+  SDE_INDEX *keys[SPARTAN_MAX_KEYS];
+  ulonglong row_sum[SPARTAN_MAX_KEYS];
+  ulonglong key_sum;
+  int count;
+  int found = 0;
+  int rows;
+  int bad;
+  int skipped = 0;
+  int listed;
+  int from;
+  int problems;
+  int bad_blobs = 0;
+  int bad_keys = 0;
+  int rc = HA_ADMIN_OK;
+  long long pos = 0;
+  byte probe;
+  uint i;
+  int j;
+
+  DBUG_ENTER("ha_spartan::check");
+  if (verify_rows(&rows, &bad) || alloc_keys(keys, SPARTAN_CHECK_ROWS))
+    DBUG_RETURN(HA_ADMIN_FAILED);
+  memset(row_sum, 0, sizeof(row_sum));
+  do
+  {
+    pthread_mutex_lock(&share->data_mutex);
+    problems = scan_keys(false, keys, SPARTAN_CHECK_ROWS, &pos, &count,
+                         &skipped);
+    pthread_mutex_unlock(&share->data_mutex);
+    if (problems)
+    {
+      free_keys(keys);
+      DBUG_RETURN(HA_ADMIN_FAILED);
+    }
+    for (i = 0; i < table->s->keys; i++)
+      for (j = 0; j < count; j++)
+        row_sum[i] += spartan_key_fingerprint(keys[i][j].key,
+                                              keys[i][j].length,
+                                              keys[i][j].pos);
+    found += count;
+  } while (count == SPARTAN_CHECK_ROWS);
+  free_keys(keys);
+  for (i = 0; i < table->s->keys; i++)
+  {
+    from = 0;
+    listed = 0;
+    key_sum = 0;
+    do
+    {
+      pthread_mutex_lock(&share->data_mutex);
+      problems = share->index_class[i]->
+        check_index(allow_dupes(i) ||
+                    (table->key_info[i].flags & HA_NULL_PART_KEY),
+                    &from, SPARTAN_CHECK_PAGES, &listed, &key_sum);
+      pthread_mutex_unlock(&share->data_mutex);
+      if (problems != 0)
+        bad_keys++;
+    } while ((problems != -1) && (from != -1));
+    pthread_mutex_lock(&share->data_mutex);
+    if ((listed != found) || (key_sum != row_sum[i]) ||
+        (listed != share->index_class[i]->key_count()) ||
+        share->index_class[i]->is_crashed())
+      bad_keys++;
+    pthread_mutex_unlock(&share->data_mutex);
+  }
+  if (table->s->blob_fields > 0)
+  {
+    pos = 0;
+    do
+    {
+      pthread_mutex_lock(&share->data_mutex);
+      if (pos == 0)
+        share->blob_class->flush_data();
+      for (count = 0;
+           (count < SPARTAN_CHECK_ROWS) &&
+           (share->blob_class->read_row(&probe, sizeof(byte), pos) != -1);
+           count++)
+      {
+        if (share->blob_class->verify_row(share->blob_class->last_position()))
+          bad_blobs++;
+        pos = share->blob_class->cur_position();
+      }
+      pthread_mutex_unlock(&share->data_mutex);
+    } while (count == SPARTAN_CHECK_ROWS);
+  }
+  if (bad > 0)
+  {
+    sql_print_error("SPARTAN: %s: %d rows fail their checksum",
+                    share->table_name, bad);
+    rc = HA_ADMIN_CORRUPT;
+  }
+  if (bad_blobs > 0)
+  {
+    sql_print_error("SPARTAN: %s: %d blob values fail their checksum",
+                    share->table_name, bad_blobs);
+    rc = HA_ADMIN_CORRUPT;
+  }
+  pthread_mutex_lock(&share->data_mutex);
+  if (rows != share->data_class->records())
+  {
+    sql_print_error("SPARTAN: %s: %d rows found, the header says %d",
+                    share->table_name, rows,
+                    share->data_class->records());
+    rc = HA_ADMIN_CORRUPT;
+  }
+  if (share->data_class->is_crashed())
+    rc = HA_ADMIN_CORRUPT;
+  pthread_mutex_unlock(&share->data_mutex);
+  if (bad_keys != 0)
+  {
+    sql_print_error("SPARTAN: %s: the index does not match the rows",
+                    share->table_name);
+    rc = HA_ADMIN_CORRUPT;
+  }
+  DBUG_RETURN(rc);
+}
+
+
+/*
+  repair() deletes the rows of the data file that fail their checksum,
+  sets the row count in the header to the rows that are left and
+  builds the index of each key again from their keys. The blob values
+  of the rows deleted are freed (see free_orphan_blobs()). Damaged blob
+  values cannot be put right and are left where they are. A row with
+  the value of a unique key of an earlier row cannot go in the index
+  of that key; such rows are counted and reported, and the table is
+  left corrupt until they are deleted or changed. A key with a null
+  part (see key_has_null()) is no duplicate: those keys go in after the
+  others of their batch, beside any equal ones.
+
+  The rows are read SPARTAN_CHECK_ROWS at a time: the keys of the first
+  batch replace each index and those of the others are merged into it,
+  so only one batch of keys is in memory. data_mutex is let go between
+  batches; the server holds a write lock on the table, so no other
+  thread reads an index while it is half built.
+
+  Called from sql_table.cc by mysql_repair_table().
+*/
+int ha_spartan::repair(THD* thd, HA_CHECK_OPT* check_opt)
+{
+  SDE_INDEX *keys[SPARTAN_MAX_KEYS];
+  int count;
+  int rows = 0;
+  int bad = 0;
+  int dupes = 0;
+  int added;
+  int nulls;
+  int more;
+  int rc = HA_ADMIN_OK;
+  long long pos = 0;
+  uint i;
+
+  DBUG_ENTER("ha_spartan::repair");
+  if (alloc_keys(keys, SPARTAN_CHECK_ROWS))
+    DBUG_RETURN(HA_ADMIN_FAILED);
+  pthread_mutex_lock(&share->data_mutex);
+  share->data_class->flush_data();
+  pthread_mutex_unlock(&share->data_mutex);
+  do
+  {
+    pthread_mutex_lock(&share->data_mutex);
+    if (scan_keys(true, keys, SPARTAN_CHECK_ROWS, &pos, &count, &bad))
+      rc = HA_ADMIN_FAILED;
+    for (i = 0; (rc == HA_ADMIN_OK) && (i < table->s->keys); i++)
+    {
+      nulls = allow_dupes(i) ? 0 : move_null_keys(i, keys[i], count);
+      if (rows == 0)
+        added = share->index_class[i]->rebuild_index(keys[i], count - nulls,
+                                                     allow_dupes(i));
+      else
+        added = share->index_class[i]->bulk_insert(keys[i], count - nulls,
+                                                   allow_dupes(i));
+      if ((added != -1) && (nulls > 0))
+      {
+        more = share->index_class[i]->bulk_insert(keys[i] + count - nulls,
+                                                  nulls, true);
+        added = (more == -1) ? -1 : added + more;
+      }
+      if (added == -1)
+        rc = HA_ADMIN_FAILED;
+      else
+        dupes += count - added;
+    }
+    pthread_mutex_unlock(&share->data_mutex);
+    rows += count;
+  } while ((rc == HA_ADMIN_OK) && (count == SPARTAN_CHECK_ROWS));
+  free_keys(keys);
+  pthread_mutex_lock(&share->data_mutex);
+  for (i = 0; (rc == HA_ADMIN_OK) && (i < table->s->keys); i++)
+    share->index_class[i]->save_index();
+  if ((rc == HA_ADMIN_OK) && (free_orphan_blobs() == -1))
+    rc = HA_ADMIN_FAILED;
+  if ((rc == HA_ADMIN_OK) &&
+      share->data_class->repair_header(rows,
+                                       share->data_class->del_records()))
+    rc = HA_ADMIN_FAILED;
+  pthread_mutex_unlock(&share->data_mutex);
+  if ((rc == HA_ADMIN_OK) && (dupes > 0))
+  {
+    sql_print_error("SPARTAN: %s: %d rows duplicate a unique key, "
+                    "left out of its index", share->table_name, dupes);
+    rc = HA_ADMIN_CORRUPT;
+  }
+  DBUG_RETURN(rc);
+}
+
+
+/*
+  analyze() counts the rows per value of every part of every key again
+  (see count_key_stats()); the server then reads them with info().
+
+  Called from sql_table.cc by mysql_analyze_table().
+*/
+int ha_spartan::analyze(THD* thd, HA_CHECK_OPT* check_opt)
+{
+  DBUG_ENTER("ha_spartan::analyze");
+  pthread_mutex_lock(&share->data_mutex);
+  count_key_stats(share->data_class->records());
+  pthread_mutex_unlock(&share->data_mutex);
+  DBUG_RETURN(HA_ADMIN_OK);
+}
+
+
 /*
   First you should go read the section "locking functions for mysql" in
   lock.cc to understand this.
@@ -777,6 +3499,74 @@ int ha_spartan::delete_all_rows()
 int ha_spartan::external_lock(THD *thd, int lock_type)
 {
   DBUG_ENTER("ha_spartan::external_lock");
+  long long lsn;
+  uint i;
+
+  /*
+    The statement is done with the table. Write any rows still held
+    in the data class write buffer to the data file, then commit the
+    statement by syncing the redo log up to its last record. The sync
+    is done outside the mutex so statements ending together share it
+    (group commit). A log that has grown too long is checkpointed.
+  */
+  if (lock_type == F_UNLCK)
+  {
+    close_cursor();
+    pthread_mutex_lock(&share->data_mutex);
+    share->data_class->flush_data();
+    /*
+      Save the index pages the statement changed; they are logged so
+      the commit below covers them.
+    */
+    for (i = 0; i < index_files(); i++)
+      share->index_class[i]->save_index();
+    /*
+      The same for the blob values still in the write buffer of the
+      overflow file.
+    */
+    if (share->blobs_changed)
+    {
+      share->blob_class->flush_data();
+      share->blobs_changed = false;
+    }
+    lsn = share->log_class->end_lsn();
+    pthread_mutex_unlock(&share->data_mutex);
+    /*
+      Once the statement is committed the blob values it freed can be
+      reused.
+    */
+    if (!share->log_class->commit(lsn) && (table->s->blob_fields > 0))
+    {
+      pthread_mutex_lock(&share->data_mutex);
+      release_blobs(lsn);
+      pthread_mutex_unlock(&share->data_mutex);
+    }
+    if (share->log_class->log_size() > SDL_CHECKPOINT_SIZE)
+    {
+      pthread_mutex_lock(&share->data_mutex);
+      share->data_class->checkpoint();
+      pthread_mutex_unlock(&share->data_mutex);
+    }
+  }
+  /*
+    Count the handlers using the table so optimize() can tell when
+    it is safe to swap in the new data file. No new statement may
+    start using the table while the swap is going on.
+  */
+  read_lock = (lock_type == F_RDLCK);
+  pthread_mutex_lock(&share->mutex);
+  if (lock_type == F_UNLCK)
+  {
+    share->lock_count--;
+    pthread_cond_broadcast(&share->swap_cond);
+  }
+  else
+  {
+    while (share->swapping)
+      pthread_cond_wait(&share->swap_cond, &share->mutex);
+    share->lock_count++;
+  }
+  pthread_mutex_unlock(&share->mutex);
   DBUG_RETURN(0);
 }
 
@@ -815,7 +3605,29 @@ THR_LOCK_DATA **ha_spartan::store_lock(THD *thd,
                                        enum thr_lock_type lock_type)
 {
   if (lock_type != TL_IGNORE && lock.type == TL_UNLOCK)
+  {
+    /*
+      OPTIMIZE TABLE copies the rows while other threads go on reading
+      the table (like ALTER TABLE does) so it only keeps writers out.
+    */
+    if ((lock_type == TL_WRITE) &&
+        (thd->lex->sql_command == SQLCOM_OPTIMIZE))
+      lock_type = TL_WRITE_ALLOW_READ;
+    /*
+      The statements that bulk insert leave keys out of the indexes
+      until end_bulk_insert() (see start_bulk_insert()), so they keep
+      every other thread out of the table.
+    */
+    if ((lock_type >= TL_WRITE_ALLOW_WRITE) &&
+        (lock_type <= TL_WRITE_CONCURRENT_INSERT) &&
+        ((thd->lex->sql_command == SQLCOM_INSERT) ||
+         (thd->lex->sql_command == SQLCOM_INSERT_SELECT) ||
+         (thd->lex->sql_command == SQLCOM_REPLACE) ||
+         (thd->lex->sql_command == SQLCOM_REPLACE_SELECT) ||
+         (thd->lex->sql_command == SQLCOM_LOAD)))
+      lock_type = TL_WRITE;
     lock.type=lock_type;
+  }
   *to++= &lock; 
   return to;
 }
@@ -838,19 +3650,28 @@ int ha_spartan::delete_table(const char *name)
 {
   DBUG_ENTER("ha_spartan::delete_table");
   char name_buff[FN_REFLEN];
+  uint i;
 
-  /*
-    Begin critical section by locking the spatan mutex variable.
-  */
-  pthread_mutex_lock(&spartan_mutex);
   if (!(share = get_share(name, table)))
     DBUG_RETURN(1);
+  /*
+    Begin critical section by locking the table's data mutex.
+  */
+  pthread_mutex_lock(&share->data_mutex);
   share->data_class->close_table();
+  share->blob_class->close_table();
+  share->freed_count = 0;
+  share->log_class->close_log();
   /*
-    Destroy the index in memory and close it.
+    Empty the indexes and close them. The table is not known here, so
+    every index the share has is closed and every index file a table
+    may have is deleted below.
   */
-  share->index_class->destroy_index();
-  share->index_class->close_index();
+  for (i = 0; i < SPARTAN_MAX_KEYS; i++)
+  {
+    share->index_class[i]->destroy_index();
+    share->index_class[i]->close_index();
+  }
   /*
     Call the mysql delete file method.
     Note: the fn_format() method correctly creates a file name from the
@@ -863,12 +3684,20 @@ int ha_spartan::delete_table(const char *name)
     Note: the fn_format() method correctly creates a file name from the
     name passed into the method.
   */
-  my_delete(fn_format(name_buff, name, "", SDI_EXT,
+  for (i = 0; i < SPARTAN_MAX_KEYS; i++)
+    my_delete(fn_format(name_buff, name, "", spartan_index_exts[i],
+              MY_REPLACE_EXT|MY_UNPACK_FILENAME), MYF(0));
+  my_delete(fn_format(name_buff, name, "", SDL_EXT,
+            MY_REPLACE_EXT|MY_UNPACK_FILENAME), MYF(0));
+  my_delete(fn_format(name_buff, name, "", SDO_EXT,
+            MY_REPLACE_EXT|MY_UNPACK_FILENAME), MYF(0));
+  share->zone_class->close_zones();
+  my_delete(fn_format(name_buff, name, "", SDZ_EXT,
             MY_REPLACE_EXT|MY_UNPACK_FILENAME), MYF(0));
   /*
-    End critical section by unlocking the spatan mutex variable.
+    End critical section by unlocking the table's data mutex.
   */
-  pthread_mutex_unlock(&spartan_mutex);
+  pthread_mutex_unlock(&share->data_mutex);
   DBUG_RETURN(0);
 }
 
@@ -888,14 +3717,31 @@ int ha_spartan::rename_table(const char * from, const char * to)
   char data_to[FN_REFLEN];
   char index_from[FN_REFLEN];
   char index_to[FN_REFLEN];
+  char log_name[FN_REFLEN];
+  char blob_from[FN_REFLEN];
+  char blob_to[FN_REFLEN];
+  char zone_from[FN_REFLEN];
+  char zone_to[FN_REFLEN];
+  uint i;
 
   if (!(share = get_share(from, table)))
     DBUG_RETURN(1);
   /*
-    Begin critical section by locking the spatan mutex variable.
+    Begin critical section by locking the table's data mutex.
   */
-  pthread_mutex_lock(&spartan_mutex);
+  pthread_mutex_lock(&share->data_mutex);
+  release_blobs(share->log_class->end_lsn());
+  share->blob_class->flush_data();
   share->data_class->close_table();
+  /*
+    Closing the table emptied the redo log so it is not copied; a new
+    one is started for the new name.
+  */
+  share->log_class->close_log();
+  my_delete(fn_format(log_name, from, "", SDL_EXT,
+            MY_REPLACE_EXT|MY_UNPACK_FILENAME), MYF(0));
+  share->log_class->open_log(fn_format(log_name, to, "", SDL_EXT,
+                             MY_REPLACE_EXT|MY_UNPACK_FILENAME));
   /*
     Close the table then copy it then reopen new file.
   */
@@ -904,27 +3750,48 @@ int ha_spartan::rename_table(const char * from, const char * to)
           fn_format(data_to, to, "", SDE_EXT,
           MY_REPLACE_EXT|MY_UNPACK_FILENAME), MYF(0));
   share->data_class->open_table(data_to);
-  share->index_class->close_index();
   /*
-    Close the table then copy it then reopen new file.
+    Close each index then copy it then reopen new file (the table has
+    the index files that are there) and delete the old one.
   */
-  my_copy(fn_format(index_from, from, "", SDI_EXT,
+  for (i = 0; i < SPARTAN_MAX_KEYS; i++)
+  {
+    share->index_class[i]->close_index();
+    if (my_copy(fn_format(index_from, from, "", spartan_index_exts[i],
+                MY_REPLACE_EXT|MY_UNPACK_FILENAME),
+                fn_format(index_to, to, "", spartan_index_exts[i],
+                MY_REPLACE_EXT|MY_UNPACK_FILENAME), MYF(0)))
+      continue;
+    share->index_class[i]->open_index(index_to);
+    my_delete(index_from, MYF(0));
+  }
+  /*
+    Copy the overflow file (if the table has one); it is opened again
+    when the table is.
+  */
+  share->blob_class->close_table();
+  my_copy(fn_format(blob_from, from, "", SDO_EXT,
           MY_REPLACE_EXT|MY_UNPACK_FILENAME),
-          fn_format(index_to, to, "", SDI_EXT,
+          fn_format(blob_to, to, "", SDO_EXT,
           MY_REPLACE_EXT|MY_UNPACK_FILENAME), MYF(0));
-  share->index_class->open_index(index_to);
   /*
-    End critical section by unlocking the spatan mutex variable.
+    The same for the zone map.
   */
-  pthread_mutex_unlock(&spartan_mutex);
+  share->zone_class->close_zones();
+  my_copy(fn_format(zone_from, from, "", SDZ_EXT,
+          MY_REPLACE_EXT|MY_UNPACK_FILENAME),
+          fn_format(zone_to, to, "", SDZ_EXT,
+          MY_REPLACE_EXT|MY_UNPACK_FILENAME), MYF(0));
   /*
-    Delete the file using MySQL's delete file method.
+    End critical section by unlocking the table's data mutex.
   */
-  my_delete(data_from, MYF(0));
+  pthread_mutex_unlock(&share->data_mutex);
   /*
     Delete the file using MySQL's delete file method.
   */
-  my_delete(index_from, MYF(0));
+  my_delete(data_from, MYF(0));
+  my_delete(blob_from, MYF(0));
+  my_delete(zone_from, MYF(0));
   DBUG_RETURN(0);
 }
 
@@ -938,8 +3805,43 @@ int ha_spartan::rename_table(const char * from, const char * to)
 ha_rows ha_spartan::records_in_range(uint inx, key_range *min_key,
                                      key_range *max_key)
 {
+  SDE_INDEX min_ndx;
+  SDE_INDEX max_ndx;
+  int rows;
+
   DBUG_ENTER("ha_spartan::records_in_range");
-  DBUG_RETURN(10);                         // low number to force index usage
+  /*
+    Count the keys in the range by walking the leaves of the index. The
+    start key is included unless it is HA_READ_AFTER_KEY and the end
+    key is included if it is. A hash index counts only one whole key
+    (-1 for any other range).
+  */
+  pthread_mutex_lock(&share->data_mutex);
+  if (flush_bulk_keys() ||
+      (min_key && make_search_key(inx, min_key->key, min_key->length,
+                                  &min_ndx)) ||
+      (max_key && make_search_key(inx, max_key->key, max_key->length,
+                                  &max_ndx)))
+  {
+    pthread_mutex_unlock(&share->data_mutex);
+    DBUG_RETURN(HA_POS_ERROR);
+  }
+  rows = share->index_class[inx]->count_range(
+           min_key ? min_ndx.key : NULL,
+           min_key ? min_ndx.length : 0,
+           min_key ? (min_key->flag != HA_READ_AFTER_KEY) : true,
+           max_key ? max_ndx.key : NULL,
+           max_key ? max_ndx.length : 0,
+           max_key ? (max_key->flag == HA_READ_AFTER_KEY) : true);
+  pthread_mutex_unlock(&share->data_mutex);
+  if (rows == -1)
+    DBUG_RETURN(HA_POS_ERROR);
+  /*
+    The optimizer takes 0 to mean the range is certainly empty.
+  */
+  if (rows == 0)
+    rows = 1;
+  DBUG_RETURN((ha_rows)rows);
 }
 
 
@@ -951,6 +3853,13 @@ ha_rows ha_spartan::records_in_range(uint inx, key_range *min_key,
   point if you wish to change the table definition, but there are no methods
   currently provided for doing that.
 
+  A table created with COMMENT='PAX' stores its rows in the PAX layout
+  (see spartan_data.h). Its columns are the null bytes followed by the
+  fields in the order of the table definition. A table created with
+  ROW_FORMAT=COMPRESSED stores its rows in compressed blocks.
+  The rows of other tables with VARCHAR or blob fields are stored
+  packed, with the blob values in an overflow file.
+
   Called from handle.cc by ha_create_table().
 */
 int ha_spartan::create(const char *name, TABLE *table_arg,
@@ -958,27 +3867,126 @@ int ha_spartan::create(const char *name, TABLE *table_arg,
 {
   DBUG_ENTER("ha_spartan::create");
   char name_buff[FN_REFLEN];
+  int *col_offset = NULL;
+  int *col_length = NULL;
+  int cols = 0;
+  byte layout = SDE_ROW_LAYOUT;
+  uint i;
+  int key_len;
+  int rc;
 
   if (!(share = get_share(name, table)))
     DBUG_RETURN(1);
+  if (create_info->comment &&
+      !my_strcasecmp(system_charset_info, create_info->comment,
+                     SPARTAN_PAX_COMMENT))
+  {
+    layout = SDE_PAX_LAYOUT;
+    cols = table_arg->s->fields + 1;
+    col_offset = (int *)my_malloc(2 * cols * sizeof(int), MYF(MY_WME));
+    if (col_offset == NULL)
+      DBUG_RETURN(HA_ERR_OUT_OF_MEM);
+    col_length = col_offset + cols;
+    col_offset[0] = 0;
+    col_length[0] = table_arg->s->null_bytes;
+    for (i = 0; i < table_arg->s->fields; i++)
+    {
+      col_offset[i + 1] = (int)((byte *)table_arg->field[i]->ptr -
+                                table_arg->record[0]);
+      col_length[i + 1] = table_arg->field[i]->pack_length();
+    }
+  }
+  else if (create_info->row_type == ROW_TYPE_COMPRESSED)
+    layout = SDE_ZIP_LAYOUT;
+  /*
+    The rows of a table with VARCHAR fields are packed (see pack_row())
+    unless the table is stored in the PAX layout, whose columns have
+    fixed widths.
+  */
+  if (layout != SDE_PAX_LAYOUT)
+    for (i = 0; i < table_arg->s->fields; i++)
+      if ((table_arg->field[i]->real_type() == MYSQL_TYPE_VARCHAR) ||
+          (table_arg->field[i]->flags & BLOB_FLAG))
+        layout |= SDE_PACKED_ROWS;
+  /*
+    Blob values are kept in an overflow file (see unpack_row()). A PAX
+    table cannot hold the positions of its blobs in fixed-width columns.
+  */
+  if (table_arg->s->blob_fields > 0)
+  {
+    if (layout == SDE_PAX_LAYOUT)
+    {
+      my_free((gptr)col_offset, MYF(0));
+      DBUG_RETURN(HA_WRONG_CREATE_OPTION);
+    }
+    if (share->blob_class->create_table(fn_format(name_buff, name, "",
+                                        SDO_EXT,
+                                        MY_REPLACE_EXT|MY_UNPACK_FILENAME)))
+      DBUG_RETURN(-1);
+    share->blob_class->close_table();
+  }
+  /*
+    Remove any redo log left behind by an old table of the same name so
+    it is not replayed over the new one.
+  */
+  my_delete(fn_format(name_buff, name, "", SDL_EXT,
+            MY_REPLACE_EXT|MY_UNPACK_FILENAME), MYF(0));
   /*
     Call the data class create table method.
     Note: the fn_format() method correctly creates a file name from the
     name passed into the method.
   */
-  if (share->data_class->create_table(fn_format(name_buff, name, "", SDE_EXT,
-                                      MY_REPLACE_EXT|MY_UNPACK_FILENAME)))
+  rc = share->data_class->create_table(fn_format(name_buff, name, "", SDE_EXT,
+                                       MY_REPLACE_EXT|MY_UNPACK_FILENAME),
+                                       layout, cols, col_offset, col_length);
+  if (col_offset != NULL)
+    my_free((gptr)col_offset, MYF(0));
+  if (rc)
     DBUG_RETURN(-1);
   /*
-    Call the data class create index method.
+    Start the auto-increment counter at AUTO_INCREMENT= if given.
+  */
+  pthread_mutex_lock(&share->mutex);
+  share->auto_increment = (create_info->auto_increment_value > 0) ?
+                          create_info->auto_increment_value - 1 : 0;
+  share->data_class->set_auto_increment(share->auto_increment);
+  pthread_mutex_unlock(&share->mutex);
+  /*
+    Call the data class create index method for each key with the
+    length of the key (all its parts), so the index keeps no more bytes
+    of a key than it has. A key created USING HASH gets a hash index. A
+    table without keys gets one index file of 128 byte keys.
     Note: the fn_format() method correctly creates a file name from the
     name passed into the method.
   */
-  if (share->index_class->create_index(fn_format(name_buff, name, "", SDI_EXT,
+  for (i = 0; (i == 0) || (i < table_arg->s->keys); i++)
+  {
+    key_len = (i < table_arg->s->keys) ?
+              (int)table_arg->key_info[i].key_length :
+              (int)max_supported_key_length();
+    fn_format(name_buff, name, "", spartan_index_exts[i],
+              MY_REPLACE_EXT|MY_UNPACK_FILENAME);
+    if ((i < table_arg->s->keys) &&
+        (table_arg->key_info[i].algorithm == HA_KEY_ALG_HASH))
+      rc = share->index_class[i]->create_hash(name_buff, key_len);
+    else
+      rc = share->index_class[i]->create_index(name_buff, key_len);
+    if (rc)
+      DBUG_RETURN(-1);
+    share->index_class[i]->close_index();
+  }
+  /*
+    Create an empty zone map over the integer fields.
+  */
+  cols = 0;
+  for (i = 0; i < table_arg->s->fields; i++)
+    if (zone_field(table_arg->field[i]))
+      cols++;
+  if (share->zone_class->create_zones(fn_format(name_buff, name, "", SDZ_EXT,
                                       MY_REPLACE_EXT|MY_UNPACK_FILENAME),
-                                      128))
+                                      cols))
     DBUG_RETURN(-1);
-  share->index_class->close_index();
+  share->zone_class->close_zones();
   share->data_class->close_table();
   DBUG_RETURN(0);
 }
@@ -23,22 +23,55 @@
 
 #include "spartan_data.h"
 #include "spartan_index.h"
+#include "spartan_zones.h"
 
 #ifdef USE_PRAGMA_INTERFACE
 #pragma interface			/* gcc class implementation */
 #endif
 
+/*
+  Most keys a table can have. Each key has its own index file and they
+  all share the redo log of the table.
+*/
+#define SPARTAN_MAX_KEYS SDL_MAX_INDEXES
+
 /*
   SPARTAN_SHARE is a structure that will be shared amoung all open handlers
   The spartan implements the minimum of what you will probably need.
 */
+
+/*
+  A blob value whose row is gone, kept from reuse until the change of
+  the row is committed (the redo log is synced past lsn).
+*/
+typedef struct st_spartan_freed_blob {
+  long long pos;             /* position of the value in the overflow file */
+  long long lsn;             /* end of the redo log when it was freed */
+} SPARTAN_FREED_BLOB;
+
 typedef struct st_spartan_share {
   char *table_name;
   uint table_name_length,use_count;
   pthread_mutex_t mutex;
+  pthread_mutex_t data_mutex;  /* serializes use of data_class and index_class */
   THR_LOCK lock;
+  pthread_cond_t swap_cond;  /* signalled when lock_count or swapping change */
+  uint lock_count;           /* handlers holding an external lock */
+  bool swapping;             /* optimize() is swapping in a new data file */
   Spartan_data *data_class;
-  Spartan_index *index_class;
+  Spartan_index *index_class[SPARTAN_MAX_KEYS];  /* index of each key */
+  Spartan_log *log_class;    /* redo log of data_class */
+  Spartan_data *blob_class;  /* overflow file of the blob values */
+  Spartan_zones *zone_class; /* zone map of the data file */
+  bool blobs_changed;        /* blob_class needs flushing at commit */
+  SPARTAN_FREED_BLOB *freed_blobs;  /* values to free at commit (data_mutex) */
+  uint freed_count;
+  uint freed_alloc;
+  ulonglong auto_increment;  /* last auto-increment value used (mutex) */
+  uint bulk_inserts;         /* bulk inserts running (data_mutex) */
+  ulong rec_per_key[SPARTAN_MAX_KEYS][MAX_REF_PARTS];  /* (data_mutex) */
+  int stats_rows;            /* rows when rec_per_key was counted */
+  bool stats_counted;        /* rec_per_key has been counted */
 } SPARTAN_SHARE;
 
 /*
@@ -49,6 +82,41 @@ class ha_spartan: public handler
   THR_LOCK_DATA lock;      /* MySQL lock */
   SPARTAN_SHARE *share;    /* Shared lock info */
   off_t current_position;  /* Current position in the file during a file scan */
+  long long current_row;   /* Position of the row last read (-1 = unknown) */
+  bool *read_columns;      /* Columns a read only scan needs (PAX tables) */
+  bool project;            /* Pass read_columns to the data class */
+  bool direct_io;          /* This scan reads with direct I/O */
+  bool mapped;             /* This scan mapped the data file */
+  long long scan_limit;    /* End of the file when the scan began (-1 = none) */
+  bool packed;             /* Rows are packed (see pack_row()) */
+  byte *rec_buf;           /* Packed new and old rows, a scratch record */
+  byte *key_rec;           /* Record the values of a key read are put in */
+  byte *scan_buf;          /* Parallel scan: a packed row per range */
+  String blob_buf;         /* Values of the blob fields of the row read */
+  String *scan_blobs;      /* Parallel scan: blob values per range */
+  long long *blob_pos;     /* Overflow positions of new and old blobs */
+  bool read_lock;          /* The table is read locked (external_lock()) */
+  Spartan_data *cursor;    /* Read lock: read only cursor on the data file */
+  Spartan_data *blob_cursor;  /* Read lock: and on the overflow file */
+  Spartan_data **scan_data;  /* Parallel scan: a cursor per range */
+  long long *scan_pos;     /* Parallel scan: next position in each range */
+  long long *scan_end;     /* Parallel scan: end of each range */
+  uint scan_parts;         /* Parallel scan: number of ranges */
+  int *zone_col;           /* Zone map column of each field (-1 = none) */
+  int zone_cols;           /* Number of zone map columns */
+  long long *zone_val;     /* Zone map column values of a row */
+  bool *zone_null;         /* Zone map column is null in the row */
+  SDZ_PREDICATE zone_pred[SDZ_MAX_PREDICATES];  /* Pushed predicates */
+  int zone_preds;          /* Number of pushed predicates */
+  int cond_mark[SDZ_MAX_PREDICATES];  /* zone_preds before each cond_push */
+  int pushed_conds;        /* Conditions pushed (see cond_push()) */
+  SDE_INDEX *bulk_keys[SPARTAN_MAX_KEYS];  /* Bulk insert: keys of the rows
+                                             written, for each key that
+                                             is not unique */
+  int bulk_count;          /* Bulk insert: rows in bulk_keys */
+  int bulk_alloc;          /* Bulk insert: keys allocated (0 = no bulk insert) */
+  SDE_CURSOR key_cursor[SPARTAN_MAX_KEYS];  /* Where the reads of each
+                                              index are (data_mutex) */
 
 public:
   ha_spartan(TABLE_SHARE *table_arg);
@@ -61,16 +129,23 @@ public:
     The name of the index type that will be used for display
     don't implement this method unless you really have indexes
    */
-  const char *index_type(uint inx) { return "Spartan_index class"; }
+  const char *index_type(uint inx)
+  {
+    return ((table_share->key_info[inx].algorithm == HA_KEY_ALG_HASH) ?
+            "HASH" : "Spartan_index class");
+  }
   const char **bas_ext() const;
   /*
     This is a list of flags that says what the storage engine
     implements. The current table flags are documented in
     handler.h
+
+    A key may have parts that can be null: the index keeps a null byte
+    before each (see make_key()).
   */
   ulong table_flags() const
   {
-    return (HA_NO_BLOBS | HA_NO_AUTO_INCREMENT);
+    return (HA_NULL_IN_KEY);
   }
   /*
     This is a bitmap of flags that says how the storage engine
@@ -81,9 +156,15 @@ public:
     part is the key part to check. First key part is 0
     If all_parts it's set, MySQL want to know the flags for the combined
     index up to and including 'part'.
+
+    A key created USING HASH is kept in a hash index (see
+    spartan_hash.h), which finds whole keys only: it cannot read keys
+    in order or a range of them.
   */
   ulong index_flags(uint inx, uint part, bool all_parts) const
   {
+    if (table_share->key_info[inx].algorithm == HA_KEY_ALG_HASH)
+      return (HA_ONLY_WHOLE_INDEX | HA_KEY_SCAN_NOT_ROR);
     return (HA_READ_NEXT | HA_READ_PREV | HA_READ_RANGE |
             HA_READ_ORDER | HA_KEYREAD_ONLY);
   }
@@ -99,17 +180,26 @@ public:
     indexes.
   */
   uint max_supported_record_length() const { return HA_MAX_REC_LENGTH; }
-  uint max_supported_keys()          const { return 1; }
-  uint max_supported_key_parts()     const { return 1; }
+  uint max_supported_keys()          const { return SPARTAN_MAX_KEYS; }
+  uint max_supported_key_parts()     const { return MAX_REF_PARTS; }
   uint max_supported_key_length()    const { return 128; }
   /*
     Called in test_quick_select to determine if indexes should be used.
+    A scan reads the whole data file (see info()) in blocks of IO_SIZE.
   */
-  virtual double scan_time() { return (double) (records+deleted) / 20.0+10; }
+  virtual double scan_time()
+  { return ulonglong2double(data_file_length) / IO_SIZE + 2; }
   /*
-    The next method will never be called if you do not implement indexes.
+    The pages of the index are kept in a cache, so finding a range
+    costs next to nothing; each row is then read from the data file by position.
+    Never more blocks are read than the file has.
   */
-  virtual double read_time(ha_rows rows) { return (double) rows /  20.0+1; }
+  virtual double read_time(uint index, uint ranges, ha_rows rows)
+  {
+    double blocks = ulonglong2double(data_file_length) / IO_SIZE + 1;
+    return rows2double(ranges) / 10.0 +
+           ((rows2double(rows) < blocks) ? rows2double(rows) : blocks);
+  }
 
   /*
     Everything below are methods that we implment in ha_spartan.cc.
@@ -121,6 +211,12 @@ public:
   int close(void);                                              // required
 
   int write_row(byte * buf);
+  /*
+    Bulk insert (LOAD DATA, multi-row INSERT). The keys of the rows are
+    collected and merged into the index once at the end.
+  */
+  void start_bulk_insert(ha_rows rows);
+  int end_bulk_insert();
   int update_row(const byte * old_data, byte * new_data);
   int delete_row(const byte * buf);
   int index_read(byte * buf, const byte * key,
@@ -145,11 +241,42 @@ public:
   int rnd_pos(byte * buf, byte *pos);                           //required
   void position(const byte *record);                            //required
   void info(uint);                                              //required
+  /*
+    Parallel full table scan. parallel_scan_init() splits the table into
+    ranges and opens a read only cursor on each; parallel_scan_next()
+    and verify_range() may then be called for different ranges from
+    different threads at once.
+  */
+  int parallel_scan_init(uint *parts);
+  int parallel_scan_next(uint part, byte *buf);
+  int parallel_scan_end();
+  int verify_range(uint part, int *rows, int *bad);
+
+  ulonglong get_auto_increment();
+  int reset_auto_increment(ulonglong value);
+  void update_create_info(HA_CREATE_INFO *create_info);
+
+  /*
+    Conditions pushed down to the handler. A scan skips the zones of
+    the data file that cannot hold a row matching them (see
+    spartan_zones.h); the rows it returns must still be filtered.
+  */
+  const COND *cond_push(const COND *cond);
+  void cond_pop();
 
   int extra(enum ha_extra_function operation);
   int reset(void);
   int external_lock(THD *thd, int lock_type);                   //required
   int delete_all_rows(void);
+  int optimize(THD* thd, HA_CHECK_OPT* check_opt);
+  /*
+    CHECK TABLE tests the row checksums, the row count and the index
+    against the rows; REPAIR TABLE drops the damaged rows and builds
+    the index again from the rest.
+  */
+  int check(THD* thd, HA_CHECK_OPT* check_opt);
+  int repair(THD* thd, HA_CHECK_OPT* check_opt);
+  int analyze(THD* thd, HA_CHECK_OPT* check_opt);
   ha_rows records_in_range(uint inx, key_range *min_key,
                            key_range *max_key);
   int delete_table(const char *from);
@@ -159,7 +286,45 @@ public:
 
   THR_LOCK_DATA **store_lock(THD *thd, THR_LOCK_DATA **to,
                              enum thr_lock_type lock_type);     //required
-  byte *get_key();
-  int get_key_len();
+  void make_key(uint inx, const byte *record, SDE_INDEX *ndx);
+  int make_search_key(uint inx, const byte *key, uint key_len,
+                      SDE_INDEX *ndx);
+  bool allow_dupes(uint inx);
+  bool key_has_null(uint inx, SDE_INDEX *ndx);
+  int move_null_keys(uint inx, SDE_INDEX *keys, int count);
+  uint index_files();
+  long long find_row(const byte *record);
+  int max_row_length();
+  int pack_row(byte *to, const byte *record, long long *positions);
+  int unpack_row(byte *record, const byte *from, Spartan_data *blob_data,
+                 bool *cols, String *blobs, long long *positions);
+  int write_blobs(const byte *record, long long *positions);
+  int find_blobs(long long pos, long long *positions);
+  void free_blobs(long long *positions);
+  void release_blobs(long long lsn);
+  int free_orphan_blobs();
+  void save_auto_increment(Field *field);
+  void count_key_stats(int rows);
+  void recover_auto_increment();
+  int grow_bulk_keys();
+  int flush_bulk_keys();
+  int find_dupp_key(const byte *record, long long pos);
+  int insert_keys(const byte *record, long long pos);
+  void zone_values(const byte *record);
+  int rebuild_zones();
+  void add_predicates(const COND *cond);
+  int read_data(Spartan_data *data, byte *buf, long long pos, bool *cols,
+                byte *row_buf);
+  int read_entry(byte *buf, long long pos);
+  int seek_key(uint inx, SDE_INDEX *ndx, enum ha_rkey_function find_flag,
+               long long *pos);
+  Spartan_data *acquire_data();
+  void release_data(Spartan_data *data);
+  void close_cursor();
+  int verify_rows(int *rows, int *bad);
+  int scan_keys(bool fix, SDE_INDEX **keys, int max, long long *pos,
+                int *count, int *bad);
+  int alloc_keys(SDE_INDEX **keys, int count);
+  void free_keys(SDE_INDEX **keys);
 };
 
@@ -0,0 +1,126 @@
+/*
+  Spartan_crc.cpp
+
+  This file implements the CRC32C checksum of the Spartan data and index
+  files. The crc32 instruction is used when the processor has it (this
+  is checked once, when the table is built); otherwise the checksum is
+  computed a byte at a time from a table.
+*/
+#include "Spartan_crc.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <nmmintrin.h>
+#define SDE_CRC_HW
+#define SDE_CRC_TARGET
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <nmmintrin.h>
+#define SDE_CRC_HW
+#define SDE_CRC_TARGET __attribute__((target("sse4.2")))
+#endif
+
+/* CRC32C polynomial (reversed) */
+static const uint32 SDE_CRC_POLY = 0x82F63B78;
+
+/*
+  The table for the byte at a time checksum and whether the processor
+  has the crc32 instruction. Both are set up when the module is loaded.
+*/
+class Spartan_crc_table
+{
+public:
+  uint32 table[256];
+  bool hardware;
+  Spartan_crc_table()
+  {
+    uint32 crc;
+    int i;
+    int j;
+
+    for (i = 0; i < 256; i++)
+    {
+      crc = (uint32)i;
+      for (j = 0; j < 8; j++)
+        crc = (crc & 1) ? (crc >> 1) ^ SDE_CRC_POLY : crc >> 1;
+      table[i] = crc;
+    }
+    hardware = false;
+#if defined(SDE_CRC_HW) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    hardware = ((info[2] & (1 << 20)) != 0);
+#elif defined(SDE_CRC_HW)
+    unsigned int a, b, c, d;
+    if (__get_cpuid(1, &a, &b, &c, &d))
+      hardware = ((c & bit_SSE4_2) != 0);
+#endif
+  }
+};
+
+static Spartan_crc_table crc_table;
+
+#ifdef SDE_CRC_HW
+/* the checksum with the crc32 instruction */
+SDE_CRC_TARGET
+static uint32 crc32c_hw(uint32 crc, const byte *buf, int length)
+{
+  /*
+    Take single bytes up to an 8 byte boundary, then 8 bytes at a time.
+  */
+  while ((length > 0) && (((size_t)buf & 7) != 0))
+  {
+    crc = _mm_crc32_u8(crc, *buf++);
+    length--;
+  }
+#if defined(_M_X64) || defined(__x86_64__)
+  {
+    unsigned long long crc64 = crc;
+
+    while (length >= 8)
+    {
+      crc64 = _mm_crc32_u64(crc64, *(const unsigned long long *)buf);
+      buf += 8;
+      length -= 8;
+    }
+    crc = (uint32)crc64;
+  }
+#endif
+  while (length >= 4)
+  {
+    crc = _mm_crc32_u32(crc, *(const unsigned int *)buf);
+    buf += 4;
+    length -= 4;
+  }
+  while (length > 0)
+  {
+    crc = _mm_crc32_u8(crc, *buf++);
+    length--;
+  }
+  return crc;
+}
+#endif
+
+uint32 spartan_crc32c(uint32 crc, const byte *buf, int length)
+{
+  crc = ~crc;
+#ifdef SDE_CRC_HW
+  if (crc_table.hardware)
+    return ~crc32c_hw(crc, buf, length);
+#endif
+  while (length-- > 0)
+    crc = crc_table.table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+ulonglong spartan_key_fingerprint(const byte *key, int length,
+                                  long long pos)
+{
+  ulonglong h;
+
+  while ((length > 0) && (key[length - 1] == 0))
+    length--;
+  h = ((ulonglong)spartan_crc32c(0, key, length) << 32) ^ (ulonglong)pos;
+  h *= ULL(0x9E3779B97F4A7C15);
+  return h ^ (h >> 29);
+}
@@ -0,0 +1,29 @@
+/*
+  Spartan_crc.h
+
+  This header declares the CRC32C (Castagnoli) checksum the Spartan data
+  and index files keep for their rows and keys. On x86 processors with
+  SSE 4.2 the checksum is computed with the crc32 instruction, eight
+  bytes at a time; elsewhere a table is used. Both give the same result
+  so a file written on one machine checks on any other.
+*/
+#pragma once
+#pragma unmanaged
+#include "my_global.h"
+
+/*
+  Add length bytes at buf to the checksum crc (start with 0) and return
+  the new checksum.
+*/
+uint32 spartan_crc32c(uint32 crc, const byte *buf, int length);
+
+/*
+  Get a fingerprint of a key of length bytes and the row position it
+  points at. Fingerprints are added up: the sum over a set of keys does
+  not depend on their order, so CHECK TABLE can compare the keys in an
+  index with the keys of the rows without sorting either. Zero bytes at
+  the end of the key are left out, so a key counts the same however
+  far it is padded.
+*/
+ulonglong spartan_key_fingerprint(const byte *key, int length,
+                                  long long pos);
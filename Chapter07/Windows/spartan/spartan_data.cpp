@@ -6,37 +6,174 @@
   data to read or write. This allows for variable length records
   and the inclusion of extra fields (like blobs). The data is
   store in an uncompressed, unoptimized fashion.
+
+  Deleted rows are chained into a free list whose head is kept in the
+  file header. Each deleted slot holds the position of the next free
+  slot in the first bytes of its row data. write_row() reuses the slot
+  at the head of the list if the row fits in it. A slot keeps its
+  length when a shorter row is written into it so a scan still steps
+  over the whole slot; readers take what they need from the front.
+
+  Rows can be of any length (the handler packs its rows, see
+  packed_rows()). update_row() writes a row back in place if it fits
+  in its slot; a row that grew is deleted and appended, so its
+  position changes.
+
+  All file access for rows goes through read_block(), write_block()
+  and append_block(). These keep a write buffer for appended rows and
+  a read-ahead buffer for scans so a row is normally a memcpy rather
+  than a seek and several reads or writes. When the file is mapped
+  with map_table() reads are copied out of the mapping instead. The file
+  is only read and written with my_pread() and my_pwrite() at explicit
+  positions; nothing depends on the file offset of data_file.
+
+  A table created with a list of columns uses the PAX layout (see
+  Spartan_data.h). Rows are taken apart into the column minipages of a
+  page on write and put back together on read, so callers still see
+  whole rows. Deleted PAX slots are not reused; OPTIMIZE TABLE removes
+  them.
+
+  A compressed table keeps one block uncompressed in memory (block_buf).
+  Rows are appended to it and it is compressed and written when it is
+  full, when another block is needed or when the table is flushed.
+  Updates and deletes change the cached block; a block that no longer
+  fits in its space is written again at the end of the file. Deleted
+  rows in a compressed table are not reused either.
+
+  When a redo log is attached with set_log() every write to the file
+  goes through write_data(), which adds the bytes to the log and writes
+  the log out before the file is changed. The log is replayed by
+  open_table() and emptied by checkpoint() once the file is synced.
+  A file logged as a file of another log (see set_log()) leaves both
+  to the owner of the log.
 */
 #include "Spartan_data.h"
 #include <my_dir.h>
+#include <zlib.h>
+
+/* largest record header: deleted byte, length and checksum */
+static const int SDE_MAX_RECORD_HEADER = sizeof(byte) + sizeof(int) +
+                                         sizeof(uint32);
+
+/* add length zero bytes to the checksum crc */
+static uint32 crc_zeros(uint32 crc, int length)
+{
+  static const byte zeros[256] = {0};
+  int n;
+
+  while (length > 0)
+  {
+    n = (length > (int)sizeof(zeros)) ? (int)sizeof(zeros) : length;
+    crc = spartan_crc32c(crc, zeros, n);
+    length -= n;
+  }
+  return crc;
+}
 
 Spartan_data::Spartan_data(void)
 {
   data_file = -1;
+  read_only = false;
   number_records = -1;
   number_del_records = -1;
-  header_size = sizeof(bool) + sizeof(int) + sizeof(int);
+  free_head = -1;
+  header_changed = false;
+  has_auto_inc = false;
+  auto_inc = 0;
   record_header_size = sizeof(byte) + sizeof(int);
+  file_length = 0;
+  current_pos = 0;
+  last_pos = -1;
+  skipped = 0;
+  write_buf = NULL;
+  write_buf_len = 0;
+  write_buf_size = 0;
+  write_buf_pos = 0;
+  read_buf = NULL;
+  read_buf_len = 0;
+  read_buf_pos = 0;
+  mapped_file = NULL;
+  mapped_length = 0;
+  layout = SDE_ROW_LAYOUT;
+  packed = false;
+  checksums = false;
+  check_buf = NULL;
+  check_buf_size = 0;
+  check_block = -1;
+  check_rc = 0;
+  columns = 0;
+  crc_page_offset = 0;
+  set_header_size();
+  col_offset = NULL;
+  col_length = NULL;
+  col_page_offset = NULL;
+  page_rows = 0;
+  page_size = 0;
+  page_buf = NULL;
+  page_num = -1;
+  page_cols = NULL;
+  block_rows = 0;
+  block_count = 0;
+  block_index_size = 0;
+  block_index = NULL;
+  index_pos = 0;
+  index_changed = false;
+  block_num = -1;
+  block_cap = 0;
+  block_len = 0;
+  block_used = 0;
+  block_dirty = false;
+  block_buf = NULL;
+  block_buf_size = 0;
+  block_slot = NULL;
+  zip_buf = NULL;
+  zip_buf_size = 0;
+  log = NULL;
+  log_inx = -1;
+  data_path = NULL;
+  reader = NULL;
 }
 
 Spartan_data::~Spartan_data(void)
 {
 }
 
-/* create the data file */
-int Spartan_data::create_table(char *path)
+/*
+  Create the data file with the layout new_layout. A PAX layout table
+  has cols columns at offsets[] in the row and lengths[] bytes wide.
+  SDE_PACKED_ROWS may be or'ed into new_layout to record that the
+  caller packs its rows (the data class only keeps the flag).
+*/
+int Spartan_data::create_table(char *path, byte new_layout, int cols,
+                               int *offsets, int *lengths)
 {
   DBUG_ENTER("SpartanIndex::create_table");
   open_table(path);
   number_records = 0;
   number_del_records = 0;
+  free_head = -1;
   crashed = false;
+  auto_inc = 0;
+  has_auto_inc = true;
+  checksums = true;
+  free_columns();
+  free_blocks();
+  packed = ((new_layout & SDE_PACKED_ROWS) != 0);
+  new_layout &= ~SDE_PACKED_ROWS;
+  if (((new_layout == SDE_PAX_LAYOUT) &&
+       set_columns(cols, offsets, lengths, 0)) ||
+      ((new_layout == SDE_ZIP_LAYOUT) && set_blocks(SDE_BLOCK_ROWS, 0)))
+    DBUG_RETURN(ENOMEM);
   write_header();  
   DBUG_RETURN(0);
 }
 
-/* open table at location "path" = path + filename */
-int Spartan_data::open_table(char *path)
+/*
+  Open table at location "path" = path + filename. If read_only_arg is
+  set the file is only read: nothing is replayed from the log and no
+  write is made to the file (write_data() fails).
+*/
+int Spartan_data::open_table(char *path, bool read_only_arg)
 {
   DBUG_ENTER("Spartan_data::open_table");
   /*
@@ -44,10 +181,66 @@ int Spartan_data::open_table(char *path)
     create the file if not found, 
     treat file as binary, and use default flags.
   */
-  data_file = my_open(path, O_RDWR | O_CREAT | O_BINARY | O_SHARE, MYF(0));
+  read_only = read_only_arg;
+  if (read_only)
+    data_file = my_open(path, O_RDONLY | O_BINARY | O_SHARE, MYF(0));
+  else
+    data_file = my_open(path, O_RDWR | O_CREAT | O_BINARY | O_SHARE, MYF(0));
   if(data_file == -1)
     DBUG_RETURN(errno);
-  read_header();
+  data_path = my_strdup(path, MYF(MY_WME));
+  if (!read_only && (log != NULL) && (log_inx != -1))
+    log->set_index(log_inx, data_file);
+  /*
+    Redo any changes in the log that did not make it to the file
+    before the header is read.
+  */
+  if (!read_only && (log != NULL) && (log_inx == -1) &&
+      log->replay(data_file))
+  {
+    my_close(data_file, MYF(0));
+    data_file = -1;
+    DBUG_RETURN(-1);
+  }
+  /*
+    Allocate the write and read-ahead buffers (a read only file has
+    no use for a write buffer).
+  */
+  if (!read_only)
+    write_buf = (byte *)my_malloc(SDE_BUFFER_SIZE, MYF(MY_WME));
+  read_buf = (byte *)my_malloc(SDE_BUFFER_SIZE, MYF(MY_WME));
+  if ((!read_only && (write_buf == NULL)) || (read_buf == NULL))
+  {
+    close_table();
+    DBUG_RETURN(ENOMEM);
+  }
+  write_buf_len = 0;
+  write_buf_size = read_only ? 0 : SDE_BUFFER_SIZE;
+  read_buf_len = 0;
+  if (read_header())
+  {
+    close_table();
+    DBUG_RETURN(ENOMEM);
+  }
+  file_length = my_seek(data_file, 0L, MY_SEEK_END, MYF(0));
+  if (layout == SDE_ZIP_LAYOUT)
+  {
+    /*
+      The block index is dropped from the end of the file; the next
+      block is written over it. Rebuild it if it is not all there (a
+      read only file keeps the rebuilt index in memory).
+    */
+    if ((block_count >= 0) &&
+        (index_pos + block_count * (long long)sizeof(long long) <=
+         file_length))
+      file_length = index_pos;
+    else if (rebuild_block_index())
+    {
+      close_table();
+      DBUG_RETURN(ENOMEM);
+    }
+  }
+  current_pos = header_size;
   DBUG_RETURN(0);
 }
 
@@ -55,45 +248,165 @@ int Spartan_data::open_table(char *path)
 long long Spartan_data::write_row(byte *buf, int length)
 {
   long long pos;
-  int i;
-  int len;
-  byte deleted = 0;
 
   DBUG_ENTER("Spartan_data::write_row");
+  if (layout == SDE_PAX_LAYOUT)
+    DBUG_RETURN(write_pax_row(buf, length));
+  if (layout == SDE_ZIP_LAYOUT)
+    DBUG_RETURN(write_zip_row(buf, length));
   /*
-    Write the deleted status byte and the length of the record.
-    Note: my_write() returns the bytes written or -1 on error
+    Reuse a deleted slot if there is one. Otherwise the row is
+    appended.
   */
-  pos = my_seek(data_file, 0L, MY_SEEK_END, MYF(0));
-  /*
-    Note: my_malloc takes a size of memory to be allocated,
-    MySQL flags (set to zero fill and with extra error checking).
-    Returns number of bytes allocated -- <= 0 indicates an error.
-  */
-  i = my_write(data_file, &deleted, sizeof(byte), MYF(0));
-  memcpy(&len, &length, sizeof(int));
-  i = my_write(data_file, (byte *)&len, sizeof(int), MYF(0));
-  /*
-    Write the row data to the file. Return new file pointer or
-    return -1 if error from my_write().
-  */
-  i = my_write(data_file, buf, length, MYF(0));
+  if ((pos = reuse_slot(buf, length)) != -1)
+  {
+    number_records++;
+    header_changed = true;
+    DBUG_RETURN(pos);
+  }
+  DBUG_RETURN(append_row(buf, length));
+}
+
+/*
+  Append a row of length bytes to the (logical) end of the file, which
+  is the position of the new row. Returns the position or -1 on error.
+*/
+long long Spartan_data::append_row(byte *buf, int length)
+{
+  long long pos;
+  int i = 0;
+  byte *ptr;
+  byte deleted = 0;
+  uint32 crc = 0;
+
+  DBUG_ENTER("Spartan_data::append_row");
+  if (checksums)
+    crc = spartan_crc32c(0, buf, length);
+  pos = file_length;
+  if (row_size(length) <= write_buf_size)
+  {
+    /*
+      Make room in the write buffer then copy the deleted status
+      byte, the length of the record and the row data into it.
+    */
+    if (write_buf_len + row_size(length) > write_buf_size)
+      if (flush_data())
+        DBUG_RETURN(-1);
+    if (write_buf_len == 0)
+      write_buf_pos = file_length;
+    ptr = write_buf + write_buf_len;
+    *ptr = deleted;
+    memcpy(ptr + sizeof(byte), &length, sizeof(int));
+    if (checksums)
+      memcpy(ptr + sizeof(byte) + sizeof(int), &crc, sizeof(uint32));
+    memcpy(ptr + record_header_size, buf, length);
+    write_buf_len += row_size(length);
+    file_length += row_size(length);
+  }
+  else
+  {
+    /*
+      Rows larger than the buffer are written straight through.
+    */
+    append_block(&deleted, sizeof(byte));
+    append_block((byte *)&length, sizeof(int));
+    if (checksums)
+      append_block((byte *)&crc, sizeof(uint32));
+    i = append_block(buf, length);
+  }
   if (i == -1)
     pos = i; 
   else
+  {
     number_records++;
+    header_changed = true;
+  }
+  DBUG_RETURN(pos);
+}
+
+/*
+  Write the row into the slot at the head of the free list and unlink
+  the slot from the list. Returns the position of the slot or -1 if
+  the row does not fit in the slot at the head of the list.
+*/
+long long Spartan_data::reuse_slot(byte *buf, int length)
+{
+  long long pos = free_head;
+  long long next;
+  int slot_len;
+
+  DBUG_ENTER("Spartan_data::reuse_slot");
+  if (pos == -1)
+    DBUG_RETURN(-1);
+  /*
+    Read the length of the slot and the link to the next free slot.
+  */
+  if ((read_block((byte *)&slot_len, sizeof(int),
+                  pos + sizeof(byte)) != sizeof(int)) ||
+      (slot_len < length) ||
+      (read_block((byte *)&next, sizeof(long long),
+                  pos + record_header_size) != sizeof(long long)))
+    DBUG_RETURN(-1);
+  if (write_slot(buf, length, slot_len, pos) == -1)
+    DBUG_RETURN(-1);
+  free_head = next;
+  number_del_records--;
+  header_changed = true;
   DBUG_RETURN(pos);
 }
 
-/* update a record in place */
+/*
+  Write the row of length bytes into the slot of slot_len bytes at
+  position and mark it live. With checksums the rest of the slot is
+  cleared so the checksum covers the whole slot.
+  Returns 0 or -1 on error.
+*/
+int Spartan_data::write_slot(byte *buf, int length, int slot_len,
+                             long long position)
+{
+  byte rec_header[SDE_MAX_RECORD_HEADER];
+  int pad = slot_len - length;
+  uint32 crc;
+
+  DBUG_ENTER("Spartan_data::write_slot");
+  rec_header[0] = 0;
+  memcpy(rec_header + sizeof(byte), &slot_len, sizeof(int));
+  if (checksums && (pad > 0))
+  {
+    if (grow_buffer(&check_buf, &check_buf_size, pad))
+      DBUG_RETURN(-1);
+    memset(check_buf, 0, pad);
+  }
+  if (checksums)
+  {
+    crc = spartan_crc32c(0, buf, length);
+    if (pad > 0)
+      crc = spartan_crc32c(crc, check_buf, pad);
+    memcpy(rec_header + sizeof(byte) + sizeof(int), &crc, sizeof(uint32));
+  }
+  if ((write_block(rec_header, record_header_size, position) == -1) ||
+      (write_block(buf, length, position + record_header_size) == -1) ||
+      (checksums && (pad > 0) &&
+       (write_block(check_buf, pad,
+                    position + record_header_size + length) == -1)))
+    DBUG_RETURN(-1);
+  DBUG_RETURN(0);
+}
+
+/*
+  Update a record in place (or move it, see below). Returns the position
+  of the row now, or -1 if it was not found or could not be written.
+  *old_position, if given, is set to where the row was (-1 if it was
+  not found).
+*/
 long long Spartan_data::update_row(byte *old_rec, byte *new_rec,
-                                   int length, long long position)
+                                   int length, long long position,
+                                   long long *old_position)
 {
   long long pos;
-  long long cur_pos;
-  byte *cmp_rec;
-  int len;
-  byte deleted = 0;
+  byte rec_header[SDE_MAX_RECORD_HEADER];
+  byte *ptr;
+  int rec_len = 0;
   int i = -1;  
   
   DBUG_ENTER("Spartan_data::update_row");
@@ -101,153 +414,243 @@ long long Spartan_data::update_row(byte *old_rec, byte *new_rec,
     position = header_size; //move past header
   pos = position;
   /* 
-    If position unknown, scan for the record by reading a row
-    at a time until found.
+    If position unknown, scan for the record. The handler passes the
+    position of the row so this is only a last resort.
   */
   if (position == -1) //don't know where it is...scan for it
+    pos = find_row(old_rec, length);
+  if (old_position != NULL)
+    *old_position = pos;
+  /*
+    If position found or provided, write the row.
+  */
+  if (pos != -1)
   {
-    cmp_rec = (byte *)my_malloc(length, MYF(MY_ZEROFILL | MY_WME));
-    pos = 0;
     /*
-      Note: my_seek() returns pos if no errors or -1 if error.
-    */
-    cur_pos = my_seek(data_file, header_size, MY_SEEK_SET, MYF(0));
-    /* 
-      Note: read_row() returns current file pointer if no error or
-      -1 if error.
+      Write the deleted byte, the length of the row, and the data
+      at the row's position.
+      Note: write_block() returns the bytes written or -1 on error
     */
-    while ((cur_pos != -1) && (pos != -1))
+    if (layout == SDE_PAX_LAYOUT)
+      i = write_pax_slot(new_rec, length, pos);
+    else if (layout == SDE_ZIP_LAYOUT)
     {
-      pos = read_row(cmp_rec, length, cur_pos);
-      if (memcmp(old_rec, cmp_rec, length) == 0)
+      /*
+        Change the row in the cached block. The block is compressed
+        and written when it is flushed or another block is read.
+      */
+      if ((ptr = find_zip_row(pos)) != NULL)
+        memcpy(&rec_len, ptr + sizeof(byte), sizeof(int));
+      if ((ptr != NULL) && (rec_len >= length))
       {
-        pos = cur_pos;      //found it!
-        cur_pos = -1;       //stop loop gracefully
+        *ptr = 0;
+        memcpy(ptr + record_header_size, new_rec, length);
+        block_dirty = true;
+        i = 0;
       }
-      else if (pos != -1)   //move ahead to next rec
-        cur_pos = cur_pos + length + record_header_size;
+      else if (ptr != NULL)
+        i = 1;
+    }
+    else
+    {
+      /*
+        The row keeps the length of its slot.
+      */
+      i = read_block(rec_header, record_header_size, pos);
+      memcpy(&rec_len, rec_header + sizeof(byte), sizeof(int));
+      if (i != record_header_size)
+        i = -1;
+      else if (rec_len < length)
+        i = 1;
+      else
+        i = write_slot(new_rec, length, rec_len, pos);
     }
-    my_free((gptr)cmp_rec, MYF(0));
-  }
-  /*
-    If position found or provided, write the row.
-  */
-  if (pos != -1)
-  {
     /*
-      Write the deleted byte, the length of the row, and the data
-      at the current file pointer.
-      Note: my_write() returns the bytes written or -1 on error
+      A row that no longer fits in its slot is moved to the end of the
+      file (never into a free slot) so a scan that started before the
+      update can stop at end_position() and not see the row again.
     */
-    my_seek(data_file, pos, MY_SEEK_SET, MYF(0));
-    i = my_write(data_file, &deleted, sizeof(byte), MYF(0));
-    memcpy(&len, &length, sizeof(int));
-    i = my_write(data_file, (byte *)&len, sizeof(int), MYF(0));
-    pos = i;
-    i = my_write(data_file, new_rec, length, MYF(0));
+    if (i == 1)
+    {
+      if (delete_row(old_rec, rec_len, pos) == -1)
+        DBUG_RETURN(-1);
+      if (layout == SDE_ZIP_LAYOUT)
+        DBUG_RETURN(write_zip_row(new_rec, length));
+      DBUG_RETURN(append_row(new_rec, length));
+    }
+    if (i == -1)
+      pos = -1;
   }
   DBUG_RETURN(pos);
 }
 
-/* delete a record in place */
-int Spartan_data::delete_row(byte *old_rec, int length, 
-                             long long position)
+/*
+  Delete a record in place. Returns the position of the row deleted
+  (also if it was deleted already) or -1 if it was not found or could
+  not be marked.
+*/
+long long Spartan_data::delete_row(byte *old_rec, int length,
+                                   long long position)
 {
   int i = -1;
   long long pos;
-  long long cur_pos;
-  byte *cmp_rec;
   byte deleted = 1;
+  byte *ptr;
+  byte rec_header[SDE_MAX_RECORD_HEADER];
+  int rec_len = 0;
+  int n;
   
   DBUG_ENTER("Spartan_data::delete_row");
   if (position == 0)
     position = header_size; //move past header
   pos = position;
   /* 
-    If position unknown, scan for the record by reading a row
-    at a time until found.
+    If position unknown, scan for the record. The handler passes the
+    position of the row so this is only a last resort.
   */
   if (position == -1) //don't know where it is...scan for it
+    pos = find_row(old_rec, length);
+  /*
+    If position found or provided, write the row.
+  */
+  if ((pos != -1) && (layout == SDE_ZIP_LAYOUT))
   {
-    cmp_rec = (byte *)my_malloc(length, MYF(MY_ZEROFILL | MY_WME));
-    pos = 0;
     /*
-      Note: my_seek() returns pos if no errors or -1 if error.
-    */
-    cur_pos = my_seek(data_file, header_size, MY_SEEK_SET, MYF(0));
-    /* 
-      Note: read_row() returns current file pointer if no error or
-      -1 if error.
+      Mark the row in the cached block (it is written with the block).
     */
-    while ((cur_pos != -1) && (pos != -1))
+    if ((ptr = find_zip_row(pos)) == NULL)
+      DBUG_RETURN(-1);
+    if (*ptr == 0)
     {
-      pos = read_row(cmp_rec, length, cur_pos);
-      if (memcmp(old_rec, cmp_rec, length) == 0)
-      {
-        number_records--;
-        number_del_records++;
-        pos = cur_pos;
-        cur_pos = -1;
-      }
-      else if (pos != -1)   //move ahead to next rec
-        cur_pos = cur_pos + length + record_header_size;
+      *ptr = 1;
+      block_dirty = true;
+      number_records--;
+      number_del_records++;
+      header_changed = true;
     }
-    my_free((gptr)cmp_rec, MYF(0));
+    DBUG_RETURN(pos);
   }
-  /*
-    If position found or provided, write the row.
-  */
   if (pos != -1)            //mark as deleted
   {
+    /*
+      A row that is already deleted is already on the free list. The
+      slot of a row layout row may be longer than the row in it.
+    */
+    n = (layout == SDE_ROW_LAYOUT) ? record_header_size : sizeof(byte);
+    i = read_block(rec_header, n, pos);
+    if (i != n)
+      DBUG_RETURN(-1);
+    if (rec_header[0] != 0)
+      DBUG_RETURN(pos);
+    if (layout == SDE_ROW_LAYOUT)
+      memcpy(&rec_len, rec_header + sizeof(byte), sizeof(int));
     /*
       Write the deleted byte set to 1 which marks row as deleted
-      at the current file pointer.
-      Note: my_write() returns the bytes written or -1 on error
+      at the row's position, then link the slot in at the head of
+      the free list (slots too short to hold the link are not reused).
+      Note: write_block() returns the bytes written or -1 on error
     */
-    pos = my_seek(data_file, pos, MY_SEEK_SET, MYF(0));
-    i = my_write(data_file, &deleted, sizeof(byte), MYF(0));
-    i = (i > 1) ? 0 : i;
+    deleted = 1;
+    i = write_block(&deleted, sizeof(byte), pos, SDL_DELETE);
+    if ((i != -1) && (layout == SDE_ROW_LAYOUT) &&
+        (rec_len >= (int)sizeof(long long)))
+    {
+      i = write_block((byte *)&free_head, sizeof(long long),
+                      pos + record_header_size, SDL_DELETE);
+      if (i != -1)
+        free_head = pos;
+    }
+    if (i != -1)
+    {
+      number_records--;
+      number_del_records++;
+      header_changed = true;
+    }
+    if (i == -1)
+      pos = -1;
   }
-  DBUG_RETURN(i);
+  DBUG_RETURN(pos);
+}
+
+/*
+  Find a row by comparing every live row in the file with rec.
+  Returns the position of the row or -1 if it is not found.
+*/
+long long Spartan_data::find_row(byte *rec, int length)
+{
+  long long pos = -1;
+  long long cur_pos = header_size;
+  byte *cmp_rec;
+
+  DBUG_ENTER("Spartan_data::find_row");
+  cmp_rec = (byte *)my_malloc(length, MYF(MY_ZEROFILL | MY_WME));
+  if (cmp_rec == NULL)
+    DBUG_RETURN(-1);
+  /*
+    Note: read_row() returns 0 if no error or -1 at end of file.
+  */
+  while (read_row(cmp_rec, length, cur_pos) != -1)
+  {
+    if (memcmp(rec, cmp_rec, length) == 0)
+    {
+      pos = last_pos;       //found it!
+      break;
+    }
+    cur_pos = current_pos;  //move ahead to next rec
+  }
+  my_free((gptr)cmp_rec, MYF(0));
+  DBUG_RETURN(pos);
 }
 
-/* read a row of length bytes from file at position */
-int Spartan_data::read_row(byte *buf, int length, long long position)
+/*
+  Read a row of length bytes from file at position. For a PAX layout
+  table cols lists the columns to read (NULL = all of them); the bytes
+  of the other columns in buf are left alone.
+*/
+int Spartan_data::read_row(byte *buf, int length, long long position,
+                           bool *cols)
 {
   int i;
   int rec_len;
-  long long pos; 
-  byte deleted = 2;
+  byte rec_header[SDE_MAX_RECORD_HEADER];
 
   DBUG_ENTER("Spartan_data::read_row");
+  if (layout == SDE_PAX_LAYOUT)
+    DBUG_RETURN(read_pax_row(buf, length, position, cols));
+  if (layout == SDE_ZIP_LAYOUT)
+    DBUG_RETURN(read_zip_row(buf, length, position));
   if (position <= 0)
     position = header_size; //move past header
-  pos = my_seek(data_file, position, MY_SEEK_SET, MYF(0));
+  skipped = 0;
   /*
-    If my_seek found the position, read the deleted byte.
-    Note: my_read() returns bytes read or -1 on error
+    Read record headers (the deleted byte and the record length) until
+    a row that is not deleted is found, skipping each deleted row by its
+    stored length. The headers come out of the read-ahead buffer (or the
+    mapping) so a run of deleted rows is walked in one buffered pass.
+    Note: read_block() returns bytes read, 0 at end of file or -1 on error
   */
-  if (pos != -1L)
+  for (;;)
   {
-    i = my_read(data_file, &deleted, sizeof(byte), MYF(0));
-    /*
-      If not deleted (deleted == 0), read the record length then
-      read the row.
-    */
-    if (deleted == 0) /* 0 = not deleted, 1 = deleted */
-    {
-      i = my_read(data_file, (byte *)&rec_len, sizeof(int), MYF(0));
-      i = my_read(data_file, buf, 
-                 (length < rec_len) ? length : rec_len, MYF(0));
-    }
-    else if (i == 0)
-      DBUG_RETURN(-1);      
-    else
-      DBUG_RETURN(read_row(buf, length, cur_position() + 
-                           length + (record_header_size - sizeof(byte))));
+    i = read_block(rec_header, record_header_size, position);
+    if (i != record_header_size)
+      DBUG_RETURN(-1);
+    memcpy(&rec_len, rec_header + sizeof(byte), sizeof(int));
+    if (rec_len < 0)
+      DBUG_RETURN(-1);
+    if (rec_header[0] == 0) /* 0 = not deleted, 1 = deleted */
+      break;
+    skipped++;
+    position += record_header_size + rec_len;
   }
-  else
+  /*
+    Read the row.
+  */
+  i = read_block(buf, (length < rec_len) ? length : rec_len,
+                 position + record_header_size);
+  if (i == -1)
     DBUG_RETURN(-1);
+  last_pos = position;
+  current_pos = position + record_header_size + rec_len;
   DBUG_RETURN(0);
 }
 
@@ -257,9 +660,217 @@ int Spartan_data::close_table()
   DBUG_ENTER("Spartan_data::close_table");
   if (data_file != -1)
   {
+    if (!read_only && (log != NULL) && (log_inx == -1))
+      checkpoint();
+    else
+      flush_data();
+    if (!read_only && (log != NULL) && (log_inx != -1))
+      log->set_index(log_inx, -1);
+    direct_scan(false);
+    unmap_table();
     my_close(data_file, MYF(0));
     data_file = -1;
   }
+  /*
+    Forget the header so a later open_table() reads it from the file.
+  */
+  number_records = -1;
+  number_del_records = -1;
+  if (write_buf != NULL)
+    my_free((gptr)write_buf, MYF(0));
+  write_buf = NULL;
+  write_buf_len = 0;
+  write_buf_size = 0;
+  if (read_buf != NULL)
+    my_free((gptr)read_buf, MYF(0));
+  read_buf = NULL;
+  read_buf_len = 0;
+  if (data_path != NULL)
+    my_free((gptr)data_path, MYF(0));
+  data_path = NULL;
+  if (check_buf != NULL)
+    my_free((gptr)check_buf, MYF(0));
+  check_buf = NULL;
+  check_buf_size = 0;
+  free_columns();
+  free_blocks();
+  DBUG_RETURN(0);
+}
+
+/* flush the table and force it to disk */
+int Spartan_data::sync_data()
+{
+  DBUG_ENTER("Spartan_data::sync_data");
+  if (flush_data())
+    DBUG_RETURN(-1);
+  if ((data_file != -1) && my_sync(data_file, MYF(MY_WME)))
+    DBUG_RETURN(-1);
+  DBUG_RETURN(0);
+}
+
+/*
+  Flush the table, force it to disk and empty the redo log; the changes
+  in the log are all in the file now.
+*/
+int Spartan_data::checkpoint()
+{
+  DBUG_ENTER("Spartan_data::checkpoint");
+  if (sync_data())
+    DBUG_RETURN(-1);
+  if ((log != NULL) && (log_inx == -1) && log->reset())
+    DBUG_RETURN(-1);
+  DBUG_RETURN(0);
+}
+
+/*
+  Attach the redo log (NULL = none) used for changes to the file. With
+  inx set the file is file inx of a log another file owns; it is synced
+  when that file checkpoints the log.
+*/
+void Spartan_data::set_log(Spartan_log *new_log, int inx)
+{
+  DBUG_ENTER("Spartan_data::set_log");
+  log = new_log;
+  log_inx = (log != NULL) ? inx : -1;
+  if ((log_inx != -1) && (data_file != -1) && !read_only)
+    log->set_index(log_inx, data_file);
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Write any buffered rows (the cached block of a compressed table, the
+  block index and a changed header) to the file.
+*/
+int Spartan_data::flush_data()
+{
+  int i = 0;
+
+  DBUG_ENTER("Spartan_data::flush_data");
+  if (read_only)
+    DBUG_RETURN(0);
+  if ((layout == SDE_ZIP_LAYOUT) && flush_zip_block())
+    DBUG_RETURN(-1);
+  if ((data_file != -1) && (write_buf_len > 0))
+  {
+    i = write_data(SDL_APPEND, write_buf, write_buf_len, write_buf_pos);
+    /*
+      Drop the read-ahead block if it holds old copies of these bytes
+      (a compressed table writes over its block index).
+    */
+    if ((read_buf_len > 0) && (read_buf_pos < write_buf_pos + write_buf_len) &&
+        (read_buf_pos + read_buf_len > write_buf_pos))
+      read_buf_len = 0;
+    write_buf_len = 0;
+  }
+  if ((data_file != -1) && index_changed && (i != -1))
+    write_block_index();
+  if ((data_file != -1) && header_changed)
+    write_header();
+  DBUG_RETURN((i == -1) ? -1 : 0);
+}
+
+/*
+  Map the data file into memory for scanning. Any buffered rows are
+  flushed first so the mapping covers the whole file. Calling this on
+  a mapped file that has grown replaces the mapping with a larger one.
+*/
+int Spartan_data::map_table()
+{
+  DBUG_ENTER("Spartan_data::map_table");
+#ifdef HAVE_MMAP
+  if (reader != NULL)
+    DBUG_RETURN(-1);
+  if ((mapped_file != NULL) && (mapped_length == file_length))
+    DBUG_RETURN(0);
+  if (flush_data())
+    DBUG_RETURN(-1);
+  unmap_table();
+  if (file_length > header_size)
+  {
+    /*
+      Note: my_mmap() returns MAP_FAILED if the file cannot be mapped.
+      Reads then fall back to the read-ahead buffer.
+    */
+    mapped_file = (byte *)my_mmap(NULL, (size_t)file_length, PROT_READ,
+                                  MAP_SHARED, data_file, 0);
+    if (mapped_file == (byte *)MAP_FAILED)
+    {
+      mapped_file = NULL;
+      DBUG_RETURN(-1);
+    }
+    mapped_length = file_length;
+  }
+#endif
+  DBUG_RETURN(0);
+}
+
+/*
+  Start (on = true) or stop reading the file with direct I/O for scans.
+  Only files of SDE_DIRECT_SCAN_SIZE bytes or more are read this way and
+  only where direct I/O is available; the mapping is dropped while it is
+  in use. Returns 0 if scans use direct I/O and -1 if they do not.
+*/
+int Spartan_data::direct_scan(bool on)
+{
+  DBUG_ENTER("Spartan_data::direct_scan");
+  if (!on)
+  {
+    if (reader != NULL)
+      delete reader;
+    reader = NULL;
+    DBUG_RETURN(-1);
+  }
+  if (reader != NULL)
+    DBUG_RETURN(0);
+  if ((data_path == NULL) || (file_length < SDE_DIRECT_SCAN_SIZE))
+    DBUG_RETURN(-1);
+  reader = new Spartan_reader();
+  if (reader->open_reader(data_path))
+  {
+    delete reader;
+    reader = NULL;
+    DBUG_RETURN(-1);
+  }
+  unmap_table();
+  read_buf_len = 0;
+  DBUG_RETURN(0);
+}
+
+/*
+  Start (on = true) or stop a bulk insert. While it lasts the write
+  buffer holds SDE_BULK_BUFFER_SIZE bytes so appended rows are written
+  to the file in fewer, larger writes. Returns 0 or -1 if the buffer
+  could not be resized (the old one is still used).
+*/
+int Spartan_data::bulk_write(bool on)
+{
+  int size = on ? SDE_BULK_BUFFER_SIZE : SDE_BUFFER_SIZE;
+  byte *buf;
+
+  DBUG_ENTER("Spartan_data::bulk_write");
+  if ((write_buf == NULL) || (size == write_buf_size))
+    DBUG_RETURN(0);
+  if (flush_data())
+    DBUG_RETURN(-1);
+  buf = (byte *)my_malloc(size, MYF(MY_WME));
+  if (buf == NULL)
+    DBUG_RETURN(-1);
+  my_free((gptr)write_buf, MYF(0));
+  write_buf = buf;
+  write_buf_size = size;
+  DBUG_RETURN(0);
+}
+
+/* remove the memory mapping of the data file */
+int Spartan_data::unmap_table()
+{
+  DBUG_ENTER("Spartan_data::unmap_table");
+#ifdef HAVE_MMAP
+  if (mapped_file != NULL)
+    my_munmap(mapped_file, (size_t)mapped_length);
+#endif
+  mapped_file = NULL;
+  mapped_length = 0;
   DBUG_RETURN(0);
 }
 
@@ -282,48 +893,430 @@ int Spartan_data::read_header()
 {
   int i;
   int len;
+  int rows;
+  int cols;
+  int *col_list;
+  long long pos;
+  long long off = 0;
 
   DBUG_ENTER("Spartan_data::read_header");
   if (number_records == -1)
   {  
-    my_seek(data_file, 0l, MY_SEEK_SET, MYF(0));
-    i = my_read(data_file, (byte *)&crashed, sizeof(bool), MYF(0));
-    i = my_read(data_file, (byte *)&len, sizeof(int), MYF(0));
+    i = my_pread(data_file, (byte *)&crashed, sizeof(bool), off, MYF(0));
+    off += sizeof(bool);
+    i = my_pread(data_file, (byte *)&len, sizeof(int), off, MYF(0));
+    off += sizeof(int);
     memcpy(&number_records, &len, sizeof(int));
-    i = my_read(data_file, (byte *)&len, sizeof(int), MYF(0));
+    i = my_pread(data_file, (byte *)&len, sizeof(int), off, MYF(0));
+    off += sizeof(int);
     memcpy(&number_del_records, &len, sizeof(int));
+    i = my_pread(data_file, (byte *)&free_head, sizeof(long long), off,
+                 MYF(0));
+    off += sizeof(long long);
+    i = my_pread(data_file, &layout, sizeof(byte), off, MYF(0));
+    off += sizeof(byte);
+    if (i != sizeof(byte))
+      layout = SDE_ROW_LAYOUT;
+    packed = ((layout & SDE_PACKED_ROWS) != 0);
+    has_auto_inc = ((layout & SDE_AUTO_INCREMENT) != 0);
+    checksums = ((layout & SDE_CHECKSUMS) != 0);
+    layout &= ~(SDE_PACKED_ROWS | SDE_AUTO_INCREMENT | SDE_CHECKSUMS);
+    auto_inc = 0;
+    if (has_auto_inc)
+    {
+      my_pread(data_file, (byte *)&auto_inc, sizeof(ulonglong), off, MYF(0));
+      off += sizeof(ulonglong);
+    }
+    set_header_size();
+    if (layout == SDE_PAX_LAYOUT)
+    {
+      /*
+        Read the page geometry and the column list.
+      */
+      my_pread(data_file, (byte *)&rows, sizeof(int), off, MYF(0));
+      off += sizeof(int);
+      my_pread(data_file, (byte *)&cols, sizeof(int), off, MYF(0));
+      off += sizeof(int);
+      col_list = (int *)my_malloc(2 * cols * sizeof(int), MYF(MY_WME));
+      if (col_list == NULL)
+        DBUG_RETURN(-1);
+      i = my_pread(data_file, (byte *)col_list, 2 * cols * sizeof(int), off,
+                   MYF(0));
+      if ((i == -1) || set_columns(cols, col_list, col_list + cols, rows))
+        i = -1;
+      my_free((gptr)col_list, MYF(0));
+      if (i == -1)
+        DBUG_RETURN(-1);
+    }
+    if (layout == SDE_ZIP_LAYOUT)
+    {
+      /*
+        Read the block geometry and the block index. If the index is
+        not all there, block_count is set to -1 so open_table()
+        rebuilds it.
+      */
+      my_pread(data_file, (byte *)&rows, sizeof(int), off, MYF(0));
+      off += sizeof(int);
+      my_pread(data_file, (byte *)&cols, sizeof(int), off, MYF(0));
+      off += sizeof(int);
+      my_pread(data_file, (byte *)&pos, sizeof(long long), off, MYF(0));
+      if (set_blocks(rows, cols))
+        DBUG_RETURN(-1);
+      index_pos = pos;
+      block_count = cols;
+      if ((pos < header_size) ||
+          ((number_records + number_del_records + rows - 1) / rows != cols))
+        block_count = -1;
+      else if (cols > 0)
+      {
+        i = my_pread(data_file, (byte *)block_index,
+                     cols * sizeof(long long), pos, MYF(0));
+        if (i != (int)(cols * sizeof(long long)))
+          block_count = -1;
+      }
+    }
   }
-  else
-    my_seek(data_file, header_size, MY_SEEK_SET, MYF(0));
   DBUG_RETURN(0);
 }
 
 /* write header to file */
 int Spartan_data::write_header()
 {
-  int i;
+  int i = 0;
+  byte *hdr;
+  byte *ptr;
 
   DBUG_ENTER("Spartan_data::write_header");
   if (number_records != -1)
   {
-    my_seek(data_file, 0l, MY_SEEK_SET, MYF(0));
-    i = my_write(data_file, (byte *)&crashed, sizeof(bool), MYF(0));
-    i = my_write(data_file, (byte *)&number_records, sizeof(int), MYF(0));
-    i = my_write(data_file, (byte *)&number_del_records, sizeof(int), MYF(0));
+    /*
+      Build the header in memory so it is written (and logged) in one
+      piece.
+    */
+    hdr = (byte *)my_malloc(header_size, MYF(MY_WME));
+    if (hdr == NULL)
+      DBUG_RETURN(-1);
+    ptr = hdr;
+    memcpy(ptr, &crashed, sizeof(bool));
+    ptr += sizeof(bool);
+    memcpy(ptr, &number_records, sizeof(int));
+    ptr += sizeof(int);
+    memcpy(ptr, &number_del_records, sizeof(int));
+    ptr += sizeof(int);
+    memcpy(ptr, &free_head, sizeof(long long));
+    ptr += sizeof(long long);
+    *ptr = layout | (packed ? SDE_PACKED_ROWS : 0) |
+           (has_auto_inc ? SDE_AUTO_INCREMENT : 0) |
+           (checksums ? SDE_CHECKSUMS : 0);
+    ptr += sizeof(byte);
+    if (has_auto_inc)
+    {
+      memcpy(ptr, &auto_inc, sizeof(ulonglong));
+      ptr += sizeof(ulonglong);
+    }
+    if (layout == SDE_PAX_LAYOUT)
+    {
+      memcpy(ptr, &page_rows, sizeof(int));
+      ptr += sizeof(int);
+      memcpy(ptr, &columns, sizeof(int));
+      ptr += sizeof(int);
+      memcpy(ptr, col_offset, columns * sizeof(int));
+      ptr += columns * sizeof(int);
+      memcpy(ptr, col_length, columns * sizeof(int));
+      ptr += columns * sizeof(int);
+    }
+    if (layout == SDE_ZIP_LAYOUT)
+    {
+      memcpy(ptr, &block_rows, sizeof(int));
+      ptr += sizeof(int);
+      memcpy(ptr, &block_count, sizeof(int));
+      ptr += sizeof(int);
+      memcpy(ptr, &index_pos, sizeof(long long));
+      ptr += sizeof(long long);
+    }
+    i = write_data(SDL_HEADER, hdr, (int)(ptr - hdr), 0);
+    my_free((gptr)hdr, MYF(0));
+    header_changed = false;
+    if (file_length < header_size)
+      file_length = header_size;
   }
-  DBUG_RETURN(0);
+  DBUG_RETURN((i == -1) ? -1 : 0);
 }
 
-/* get position of the data file */
-long long Spartan_data::cur_position()
+/*
+  Read length bytes at position. A mapped file is read from the mapping.
+  Otherwise pending appends are flushed first if the range reaches into
+  them, then the read is served from the read-ahead buffer (refilling it
+  with one large read if needed). If read_ahead is false a read that
+  misses the buffer goes straight to the caller and the buffer is kept.
+  Returns the number of bytes read, 0 at end of file or -1 on error.
+*/
+int Spartan_data::read_block(byte *buf, int length, long long position,
+                             bool read_ahead)
 {
-  long long pos;
+  int i;
+
+  DBUG_ENTER("Spartan_data::read_block");
+  if (position >= file_length)
+    DBUG_RETURN(0);
+  if (position + length > file_length)
+    length = (int)(file_length - position);
+  /*
+    If the file is mapped, copy straight out of the mapping. A read
+    past the end of the mapping means the file has grown so remap it.
+  */
+  if (mapped_file != NULL)
+  {
+    if (position + length > mapped_length)
+      map_table();
+    if ((mapped_file != NULL) && (position + length <= mapped_length))
+    {
+      memcpy(buf, mapped_file + position, length);
+      DBUG_RETURN(length);
+    }
+  }
+  if ((write_buf_len > 0) && (position + length > write_buf_pos))
+    if (flush_data())
+      DBUG_RETURN(-1);
+  /*
+    Serve the read from the read-ahead buffer if it is all there.
+  */
+  if ((read_buf_len > 0) && (position >= read_buf_pos) &&
+      (position + length <= read_buf_pos + read_buf_len))
+  {
+    memcpy(buf, read_buf + (position - read_buf_pos), length);
+    DBUG_RETURN(length);
+  }
+  /*
+    Reads larger than the buffer go straight to the caller.
+  */
+  if ((length > SDE_BUFFER_SIZE) || !read_ahead)
+    DBUG_RETURN(my_pread(data_file, buf, length, position, MYF(0)));
+  /*
+    Refill the read-ahead buffer starting at position. With direct I/O
+    it is copied out of the reader's ring (the bytes still in the write
+    buffer are not on disk yet). If the reader fails, direct I/O is
+    dropped and the file is read as usual.
+  */
+  i = -1;
+  if (reader != NULL)
+  {
+    i = reader->read(read_buf, SDE_BUFFER_SIZE, position,
+                     (write_buf_len > 0) ? write_buf_pos : file_length);
+    if (i == -1)
+      direct_scan(false);
+  }
+  if (i == -1)
+    i = my_pread(data_file, read_buf, SDE_BUFFER_SIZE, position, MYF(0));
+  if (i == -1)
+  {
+    read_buf_len = 0;
+    DBUG_RETURN(-1);
+  }
+  read_buf_pos = position;
+  read_buf_len = i;
+  if (length > i)
+    length = i;
+  memcpy(buf, read_buf, length);
+  DBUG_RETURN(length);
+}
+
+/*
+  Overwrite length bytes at position. Bytes still in the write buffer
+  are changed in memory; otherwise the file is written and any copy of
+  those bytes in the read-ahead buffer is patched to match.
+  Returns the number of bytes written or -1 on error.
+*/
+int Spartan_data::write_block(byte *buf, int length, long long position,
+                              byte log_type)
+{
+  int i;
+  long long start;
+  long long end;
+
+  DBUG_ENTER("Spartan_data::write_block");
+  if ((page_num != -1) &&
+      (position < header_size + (page_num + 1) * page_size) &&
+      (position + length > header_size + page_num * page_size))
+    page_num = -1;
+  if ((write_buf_len > 0) && (position >= write_buf_pos))
+  {
+    memcpy(write_buf + (position - write_buf_pos), buf, length);
+    DBUG_RETURN(length);
+  }
+  if ((write_buf_len > 0) && (position + length > write_buf_pos))
+    if (flush_data())
+      DBUG_RETURN(-1);
+  if ((read_buf_len > 0) && (position < read_buf_pos + read_buf_len) &&
+      (position + length > read_buf_pos))
+  {
+    start = (position > read_buf_pos) ? position : read_buf_pos;
+    end = (position + length < read_buf_pos + read_buf_len) ?
+          position + length : read_buf_pos + read_buf_len;
+    memcpy(read_buf + (start - read_buf_pos), buf + (start - position),
+           (int)(end - start));
+  }
+  i = write_data(log_type, buf, length, position);
+  DBUG_RETURN(i);
+}
+
+/*
+  Append length bytes to the end of the file through the write buffer.
+  Returns the number of bytes written or -1 on error.
+*/
+int Spartan_data::append_block(byte *buf, int length)
+{
+  int i = length;
+
+  DBUG_ENTER("Spartan_data::append_block");
+  if (write_buf_len + length > write_buf_size)
+    if (flush_data())
+      DBUG_RETURN(-1);
+  if (length > write_buf_size)
+    i = write_data(SDL_APPEND, buf, length, file_length);
+  else
+  {
+    if (write_buf_len == 0)
+      write_buf_pos = file_length;
+    memcpy(write_buf + write_buf_len, buf, length);
+    write_buf_len += length;
+  }
+  if (i != -1)
+    file_length += length;
+  DBUG_RETURN(i);
+}
+
+/*
+  Split the file into parts ranges of about the same size for a
+  parallel scan. The ranges start on row boundaries (page boundaries in
+  a PAX table and block boundaries in a compressed one) so each can be
+  scanned on its own: range i holds the rows read starting at ranges[i]
+  whose position is before ranges[i + 1]. The rows of a row layout
+  table are all length bytes long unless they are packed; see
+  packed_ranges() for a packed row layout file. ranges must have room
+  for parts + 1 positions. Returns the number of ranges, which is less
+  than parts if the file is too small to split that far.
+*/
+int Spartan_data::scan_ranges(int parts, int length, long long *ranges)
+{
+  long long units;           /* rows, pages or blocks in the file */
+  long long unit_size;       /* bytes (positions) in each */
+  long long rows = (long long)number_records + number_del_records;
+  int i;
+
+  DBUG_ENTER("Spartan_data::scan_ranges");
+  if ((layout == SDE_ROW_LAYOUT) && packed)
+    DBUG_RETURN(packed_ranges(parts, ranges));
+  if (layout == SDE_PAX_LAYOUT)
+  {
+    units = (rows + page_rows - 1) / page_rows;
+    unit_size = page_size;
+  }
+  else if (layout == SDE_ZIP_LAYOUT)
+  {
+    units = (rows + block_rows - 1) / block_rows;
+    unit_size = block_rows;
+  }
+  else
+  {
+    unit_size = row_size(length);
+    units = (file_length - header_size) / unit_size;
+  }
+  if (parts > units)
+    parts = (int)units;
+  if (parts < 1)
+    parts = 1;
+  for (i = 0; i <= parts; i++)
+    ranges[i] = header_size + (units * i / parts) * unit_size;
+  /*
+    The last block of a compressed table may not be full.
+  */
+  if (layout == SDE_ZIP_LAYOUT)
+    ranges[parts] = header_size + rows;
+  DBUG_RETURN(parts);
+}
 
+/*
+  Split a packed row layout file for scan_ranges(). Its rows are of
+  different lengths, so the file is cut into parts blocks of about the
+  same size and each range starts at the first row at or after the
+  start of its block. The rows are found by stepping from one record
+  header to the next through the read-ahead buffer (or the mapping);
+  the rows themselves are not read. A range may be empty if a row is
+  longer than a block. Returns the number of ranges.
+*/
+int Spartan_data::packed_ranges(int parts, long long *ranges)
+{
+  byte rec_header[SDE_MAX_RECORD_HEADER];
+  long long block_size;
+  long long pos = header_size;
+  int rec_len;
+  int i;
+
+  DBUG_ENTER("Spartan_data::packed_ranges");
+  block_size = (file_length - header_size) / ((parts > 0) ? parts : 1);
+  if (block_size < SDE_BUFFER_SIZE)
+    parts = (int)((file_length - header_size) / SDE_BUFFER_SIZE);
+  if (parts < 1)
+    parts = 1;
+  ranges[0] = header_size;
+  for (i = 1; i < parts; i++)
+  {
+    while ((pos < header_size + (file_length - header_size) * i / parts) &&
+           (read_block(rec_header, record_header_size, pos) ==
+            record_header_size))
+    {
+      memcpy(&rec_len, rec_header + sizeof(byte), sizeof(int));
+      if (rec_len < 0)
+        break;
+      pos += record_header_size + rec_len;
+    }
+    ranges[i] = (pos < file_length) ? pos : file_length;
+  }
+  ranges[parts] = file_length;
+  DBUG_RETURN(parts);
+}
+
+/* get position of the last row read */
+long long Spartan_data::last_position()
+{
+  DBUG_ENTER("Spartan_data::last_position");
+  DBUG_RETURN(last_pos);
+}
+
+/*
+  Get the position the next row appended to the file will have. Rows
+  at or after it were written after this was called.
+*/
+long long Spartan_data::end_position()
+{
+  DBUG_ENTER("Spartan_data::end_position");
+  if (layout == SDE_ZIP_LAYOUT)
+    DBUG_RETURN(header_size + (long long)number_records + number_del_records);
+  DBUG_RETURN(file_length);
+}
+
+/* get the length of the file (including rows not yet written to it) */
+long long Spartan_data::data_length()
+{
+  DBUG_ENTER("Spartan_data::data_length");
+  DBUG_RETURN(file_length);
+}
+
+/* get the number of deleted rows the last read_row() skipped over */
+int Spartan_data::skipped_records()
+{
+  DBUG_ENTER("Spartan_data::skipped_records");
+  DBUG_RETURN(skipped);
+}
+
+/* get position of the data file following the last row read */
+long long Spartan_data::cur_position()
+{
   DBUG_ENTER("Spartan_data::cur_position");
-  pos = my_seek(data_file, 0L, MY_SEEK_CUR, MYF(0));
-  if (pos == 0)
+  if (current_pos == 0)
     DBUG_RETURN(header_size);
-  DBUG_RETURN(pos);
+  DBUG_RETURN(current_pos);
 }
 
 /* truncate the data file */
@@ -332,7 +1325,30 @@ int Spartan_data::trunc_table()
   DBUG_ENTER("Spartan_data::trunc_table");
   if (data_file != -1 )
   {
+    /*
+      Throw away anything buffered; it is being truncated anyway.
+    */
+    write_buf_len = 0;
+    read_buf_len = 0;
+    unmap_table();
+    if (log != NULL)
+      log->write_log(log->write_record(record_type(SDL_TRUNCATE), 0, NULL,
+                                       0));
     my_chsize(data_file, 0, 0, MYF(MY_WME));
+    if (reader != NULL)
+      reader->invalidate(0, -1);
+    file_length = 0;
+    page_num = -1;
+    block_count = 0;
+    block_num = -1;
+    block_dirty = false;
+    check_block = -1;
+    index_changed = false;
+    index_pos = 0;
+    current_pos = header_size;
+    number_records = 0;
+    number_del_records = 0;
+    free_head = -1;
     write_header();
   }
   DBUG_RETURN(0);
@@ -344,3 +1360,883 @@ int Spartan_data::row_size(int length)
   DBUG_ENTER("Spartan_data::row_size");
   DBUG_RETURN(length + record_header_size);
 }
+
+/* get the column list of a PAX layout table (returns 0 for rows) */
+int Spartan_data::get_columns(int **offsets, int **lengths)
+{
+  DBUG_ENTER("Spartan_data::get_columns");
+  *offsets = col_offset;
+  *lengths = col_length;
+  DBUG_RETURN(columns);
+}
+
+/*
+  Switch to the PAX layout with cols columns. The minipages are laid out
+  in column order after the status bytes. If rows is 0 the page holds as
+  many rows as fit in SDE_PAX_PAGE_SIZE. The checksum minipage (if the
+  file has checksums) comes last.
+*/
+int Spartan_data::set_columns(int cols, int *offsets, int *lengths, int rows)
+{
+  int i;
+  int width = 0;
+  int crc_width = checksums ? sizeof(uint32) : 0;
+
+  DBUG_ENTER("Spartan_data::set_columns");
+  free_columns();
+  col_offset = (int *)my_malloc(3 * cols * sizeof(int), MYF(MY_WME));
+  page_cols = (bool *)my_malloc(cols * sizeof(bool), MYF(MY_WME));
+  if ((col_offset == NULL) || (page_cols == NULL))
+  {
+    free_columns();
+    DBUG_RETURN(-1);
+  }
+  col_length = col_offset + cols;
+  col_page_offset = col_length + cols;
+  for (i = 0; i < cols; i++)
+  {
+    col_offset[i] = offsets[i];
+    col_length[i] = lengths[i];
+    width += lengths[i];
+  }
+  if (rows <= 0)
+    rows = SDE_PAX_PAGE_SIZE / (sizeof(byte) + width + crc_width);
+  page_rows = (rows > 0) ? rows : 1;
+  page_size = page_rows * (sizeof(byte) + width + crc_width);
+  col_page_offset[0] = page_rows;
+  for (i = 1; i < cols; i++)
+    col_page_offset[i] = col_page_offset[i - 1] +
+                         page_rows * col_length[i - 1];
+  crc_page_offset = page_rows * (sizeof(byte) + width);
+  page_buf = (byte *)my_malloc(page_size, MYF(MY_WME));
+  if (page_buf == NULL)
+  {
+    free_columns();
+    DBUG_RETURN(-1);
+  }
+  columns = cols;
+  page_num = -1;
+  layout = SDE_PAX_LAYOUT;
+  set_header_size();
+  DBUG_RETURN(0);
+}
+
+/* drop the column list and go back to the row layout */
+void Spartan_data::free_columns()
+{
+  DBUG_ENTER("Spartan_data::free_columns");
+  if (col_offset != NULL)
+    my_free((gptr)col_offset, MYF(0));
+  if (page_cols != NULL)
+    my_free((gptr)page_cols, MYF(0));
+  if (page_buf != NULL)
+    my_free((gptr)page_buf, MYF(0));
+  col_offset = NULL;
+  col_length = NULL;
+  col_page_offset = NULL;
+  page_cols = NULL;
+  page_buf = NULL;
+  page_num = -1;
+  columns = 0;
+  layout = SDE_ROW_LAYOUT;
+  set_header_size();
+  DBUG_VOID_RETURN;
+}
+
+/* PAX: get the position of the row in slot number slot */
+long long Spartan_data::slot_position(long long slot)
+{
+  DBUG_ENTER("Spartan_data::slot_position");
+  DBUG_RETURN(header_size + (slot / page_rows) * page_size +
+              (slot % page_rows));
+}
+
+/* PAX: get the slot number of the row at position (or -1) */
+long long Spartan_data::slot_number(long long position)
+{
+  long long offset = position - header_size;
+
+  DBUG_ENTER("Spartan_data::slot_number");
+  if ((offset < 0) || (offset % page_size >= page_rows))
+    DBUG_RETURN(-1);
+  DBUG_RETURN((offset / page_size) * page_rows + (offset % page_size));
+}
+
+/*
+  PAX: append a row to the next unused slot and return its position.
+  Slots are filled in order and deleted slots stay in use, so the next
+  unused slot is the number of live and deleted rows. An empty page is
+  appended when the last one is full.
+*/
+long long Spartan_data::write_pax_row(byte *buf, int length)
+{
+  long long slot = (long long)number_records + number_del_records;
+  long long pos = slot_position(slot);
+
+  DBUG_ENTER("Spartan_data::write_pax_row");
+  if (slot % page_rows == 0)
+  {
+    page_num = -1;
+    memset(page_buf, 0, page_size);
+    memset(page_buf, 2, page_rows);
+    if (append_block(page_buf, page_size) == -1)
+      DBUG_RETURN(-1);
+  }
+  if (write_pax_slot(buf, length, pos) == -1)
+    DBUG_RETURN(-1);
+  number_records++;
+  header_changed = true;
+  DBUG_RETURN(pos);
+}
+
+/*
+  PAX: write the row into the slot at position. The status byte is
+  set to live and each column goes to its minipage.
+  Returns 0 or -1 on error.
+*/
+int Spartan_data::write_pax_slot(byte *buf, int length, long long position)
+{
+  int c;
+  byte live = 0;
+  long long slot = slot_number(position);
+  long long page_start = position - (slot % page_rows);
+  uint32 crc;
+
+  DBUG_ENTER("Spartan_data::write_pax_slot");
+  if ((slot == -1) || (write_block(&live, sizeof(byte), position) == -1))
+    DBUG_RETURN(-1);
+  for (c = 0; c < columns; c++)
+    if ((col_length[c] > 0) && (col_offset[c] + col_length[c] <= length))
+      if (write_block(buf + col_offset[c], col_length[c],
+                      page_start + col_page_offset[c] +
+                      (slot % page_rows) * col_length[c]) == -1)
+        DBUG_RETURN(-1);
+  /*
+    The checksum counts the columns buf does not reach as zeros, so
+    they are cleared in the page.
+  */
+  if (checksums)
+  {
+    for (c = 0; c < columns; c++)
+      if ((col_length[c] > 0) && (col_offset[c] + col_length[c] > length))
+      {
+        if (grow_buffer(&check_buf, &check_buf_size, col_length[c]))
+          DBUG_RETURN(-1);
+        memset(check_buf, 0, col_length[c]);
+        if (write_block(check_buf, col_length[c],
+                        page_start + col_page_offset[c] +
+                        (slot % page_rows) * col_length[c]) == -1)
+          DBUG_RETURN(-1);
+      }
+    crc = pax_checksum(buf, length);
+    if (write_block((byte *)&crc, sizeof(uint32),
+                    page_start + crc_page_offset +
+                    (slot % page_rows) * sizeof(uint32)) == -1)
+      DBUG_RETURN(-1);
+  }
+  DBUG_RETURN(0);
+}
+
+/*
+  PAX: get the checksum of the column values of the row in buf (length
+  bytes). Columns past the end of buf count as zeros.
+*/
+uint32 Spartan_data::pax_checksum(byte *buf, int length)
+{
+  uint32 crc = 0;
+  int c;
+
+  DBUG_ENTER("Spartan_data::pax_checksum");
+  for (c = 0; c < columns; c++)
+    if (col_offset[c] + col_length[c] <= length)
+      crc = spartan_crc32c(crc, buf + col_offset[c], col_length[c]);
+    else
+      crc = crc_zeros(crc, col_length[c]);
+  DBUG_RETURN(crc);
+}
+
+/*
+  PAX: read the first live row at or after position. Only the columns
+  in cols (NULL = all) are copied into buf.
+  Returns 0 or -1 at end of file or on error.
+*/
+int Spartan_data::read_pax_row(byte *buf, int length, long long position,
+                               bool *cols)
+{
+  int c;
+  int s;
+  long long slot;
+  long long slots = (long long)number_records + number_del_records;
+  byte *ptr;
+
+  DBUG_ENTER("Spartan_data::read_pax_row");
+  if (position <= 0)
+    position = header_size; //move past header
+  skipped = 0;
+  if ((slot = slot_number(position)) == -1)
+    DBUG_RETURN(-1);
+  /*
+    Walk the status bytes of the pages until a live row is found. A
+    page is only read once for a run of slots in it.
+  */
+  for (; slot < slots; slot++)
+  {
+    if (read_page(slot / page_rows, cols))
+      DBUG_RETURN(-1);
+    s = (int)(slot % page_rows);
+    if (page_buf[s] == 0) /* 0 = live, 1 = deleted, 2 = unused */
+      break;
+    if (page_buf[s] != 1)
+      DBUG_RETURN(-1);
+    skipped++;
+  }
+  if (slot >= slots)
+    DBUG_RETURN(-1);
+  /*
+    Put the row back together from the minipages.
+  */
+  for (c = 0; c < columns; c++)
+    if (((cols == NULL) || cols[c]) &&
+        (col_offset[c] + col_length[c] <= length))
+    {
+      ptr = page_buf + col_page_offset[c] + s * col_length[c];
+      memcpy(buf + col_offset[c], ptr, col_length[c]);
+    }
+  last_pos = slot_position(slot);
+  current_pos = slot_position(slot + 1);
+  DBUG_RETURN(0);
+}
+
+/*
+  PAX: get the status bytes and the minipages of the columns in cols
+  (NULL = all) of page number page into page_buf. Minipages already
+  read for the page are kept; the others are not read at all.
+  Returns 0 or -1 on error.
+*/
+int Spartan_data::read_page(long long page, bool *cols)
+{
+  int c;
+  int len;
+  long long page_start = header_size + page * page_size;
+
+  DBUG_ENTER("Spartan_data::read_page");
+  if (page != page_num)
+  {
+    page_num = -1;
+    if (read_block(page_buf, page_rows, page_start, false) != page_rows)
+      DBUG_RETURN(-1);
+    memset(page_cols, 0, columns * sizeof(bool));
+    page_num = page;
+  }
+  for (c = 0; c < columns; c++)
+    if (((cols == NULL) || cols[c]) && !page_cols[c])
+    {
+      len = page_rows * col_length[c];
+      if ((len > 0) &&
+          (read_block(page_buf + col_page_offset[c], len,
+                      page_start + col_page_offset[c], false) != len))
+      {
+        page_num = -1;
+        DBUG_RETURN(-1);
+      }
+      page_cols[c] = true;
+    }
+  DBUG_RETURN(0);
+}
+
+/*
+  Check the checksum of the row at position. Deleted rows and files
+  without checksums always pass. A row of a compressed table is checked
+  with its block (see verify_zip_block()), with or without checksums.
+  Returns 0 if the row is good, 1 if its checksum does not match or -1
+  if it cannot be read.
+*/
+int Spartan_data::verify_row(long long position)
+{
+  byte rec_header[SDE_MAX_RECORD_HEADER];
+  int rec_len;
+  int width = 0;
+  int c;
+  int s;
+  long long slot;
+  uint32 crc;
+
+  DBUG_ENTER("Spartan_data::verify_row");
+  if (layout == SDE_ZIP_LAYOUT)
+    DBUG_RETURN(verify_zip_block((position - header_size) / block_rows));
+  if (!checksums)
+    DBUG_RETURN(0);
+  if (layout == SDE_PAX_LAYOUT)
+  {
+    /*
+      Put the row back together from the page and compare it with the
+      checksum minipage.
+    */
+    if (((slot = slot_number(position)) == -1) ||
+        read_page(slot / page_rows, NULL))
+      DBUG_RETURN(-1);
+    s = (int)(slot % page_rows);
+    if (page_buf[s] != 0)
+      DBUG_RETURN(0);
+    for (c = 0; c < columns; c++)
+      if (col_offset[c] + col_length[c] > width)
+        width = col_offset[c] + col_length[c];
+    if (grow_buffer(&check_buf, &check_buf_size, width + 1) ||
+        (read_block((byte *)&crc, sizeof(uint32),
+                    position - s + crc_page_offset + s * sizeof(uint32),
+                    false) != sizeof(uint32)))
+      DBUG_RETURN(-1);
+    memset(check_buf, 0, width);
+    for (c = 0; c < columns; c++)
+      memcpy(check_buf + col_offset[c],
+             page_buf + col_page_offset[c] + s * col_length[c],
+             col_length[c]);
+    DBUG_RETURN((pax_checksum(check_buf, width) == crc) ? 0 : 1);
+  }
+  if (read_block(rec_header, record_header_size, position) !=
+      record_header_size)
+    DBUG_RETURN(-1);
+  if (rec_header[0] != 0)
+    DBUG_RETURN(0);
+  memcpy(&rec_len, rec_header + sizeof(byte), sizeof(int));
+  memcpy(&crc, rec_header + sizeof(byte) + sizeof(int), sizeof(uint32));
+  if ((rec_len < 0) || grow_buffer(&check_buf, &check_buf_size, rec_len + 1) ||
+      (read_block(check_buf, rec_len, position + record_header_size) !=
+       rec_len))
+    DBUG_RETURN(-1);
+  DBUG_RETURN((spartan_crc32c(0, check_buf, rec_len) == crc) ? 0 : 1);
+}
+
+/* is the crashed flag in the header set */
+bool Spartan_data::is_crashed()
+{
+  DBUG_ENTER("Spartan_data::is_crashed");
+  DBUG_RETURN(crashed);
+}
+
+/*
+  Set the row counts in the header to the ones REPAIR TABLE found and
+  clear the crashed flag. Returns 0 or -1 on error.
+*/
+int Spartan_data::repair_header(int records, int del_records)
+{
+  DBUG_ENTER("Spartan_data::repair_header");
+  number_records = records;
+  number_del_records = del_records;
+  crashed = false;
+  header_changed = true;
+  DBUG_RETURN(flush_data());
+}
+
+/* get the layout of the data file */
+byte Spartan_data::get_layout()
+{
+  DBUG_ENTER("Spartan_data::get_layout");
+  DBUG_RETURN(layout);
+}
+
+/* get the auto-increment counter kept in the header */
+ulonglong Spartan_data::auto_increment()
+{
+  DBUG_ENTER("Spartan_data::auto_increment");
+  DBUG_RETURN(auto_inc);
+}
+
+/*
+  Set the auto-increment counter. It is written with the rest of the
+  header at the next flush. A file created before the counter was kept
+  has no room for it and ignores it.
+*/
+void Spartan_data::set_auto_increment(ulonglong value)
+{
+  DBUG_ENTER("Spartan_data::set_auto_increment");
+  if (has_auto_inc && (value != auto_inc))
+  {
+    auto_inc = value;
+    header_changed = true;
+  }
+  DBUG_VOID_RETURN;
+}
+
+/* were the rows of the file packed by the caller */
+bool Spartan_data::packed_rows()
+{
+  DBUG_ENTER("Spartan_data::packed_rows");
+  DBUG_RETURN(packed);
+}
+
+/*
+  Make sure buf (size bytes allocated) holds at least length bytes.
+  Returns 0 or -1 if it cannot be grown.
+*/
+int Spartan_data::grow_buffer(byte **buf, int *size, int length)
+{
+  int new_size;
+  byte *ptr;
+
+  DBUG_ENTER("Spartan_data::grow_buffer");
+  if (*size >= length)
+    DBUG_RETURN(0);
+  new_size = (length > 2 * *size) ? length : 2 * *size;
+  ptr = (byte *)my_realloc((gptr)*buf, new_size,
+                           MYF(MY_WME | MY_ALLOW_ZERO_PTR));
+  if (ptr == NULL)
+    DBUG_RETURN(-1);
+  *buf = ptr;
+  *size = new_size;
+  DBUG_RETURN(0);
+}
+
+/*
+  Switch to the compressed layout with rows rows per block and room in
+  the block index for count blocks.
+*/
+int Spartan_data::set_blocks(int rows, int count)
+{
+  DBUG_ENTER("Spartan_data::set_blocks");
+  free_blocks();
+  if (rows <= 0)
+    DBUG_RETURN(-1);
+  block_slot = (int *)my_malloc(rows * sizeof(int), MYF(MY_WME));
+  if ((block_slot == NULL) ||
+      grow_buffer((byte **)&block_index, &block_index_size,
+                  ((count > 64) ? count : 64) * sizeof(long long)))
+  {
+    free_blocks();
+    DBUG_RETURN(-1);
+  }
+  block_rows = rows;
+  layout = SDE_ZIP_LAYOUT;
+  set_header_size();
+  DBUG_RETURN(0);
+}
+
+/*
+  Work out the size of the file header from the layout, the column
+  list and whether the header holds an auto-increment counter.
+*/
+void Spartan_data::set_header_size()
+{
+  DBUG_ENTER("Spartan_data::set_header_size");
+  header_size = sizeof(bool) + sizeof(int) + sizeof(int) +
+                sizeof(long long) + sizeof(byte);
+  record_header_size = sizeof(byte) + sizeof(int);
+  if (checksums && (layout == SDE_ROW_LAYOUT))
+    record_header_size += sizeof(uint32);
+  if (has_auto_inc)
+    header_size += sizeof(ulonglong);
+  if (layout == SDE_PAX_LAYOUT)
+    header_size += 2 * sizeof(int) + 2 * columns * sizeof(int);
+  if (layout == SDE_ZIP_LAYOUT)
+    header_size += 2 * sizeof(int) + sizeof(long long);
+  DBUG_VOID_RETURN;
+}
+
+/* drop the block index and cached block and go back to the row layout */
+void Spartan_data::free_blocks()
+{
+  DBUG_ENTER("Spartan_data::free_blocks");
+  if (block_index != NULL)
+    my_free((gptr)block_index, MYF(0));
+  if (block_slot != NULL)
+    my_free((gptr)block_slot, MYF(0));
+  if (block_buf != NULL)
+    my_free((gptr)block_buf, MYF(0));
+  if (zip_buf != NULL)
+    my_free((gptr)zip_buf, MYF(0));
+  block_index = NULL;
+  block_index_size = 0;
+  block_slot = NULL;
+  block_buf = NULL;
+  block_buf_size = 0;
+  zip_buf = NULL;
+  zip_buf_size = 0;
+  block_rows = 0;
+  block_count = 0;
+  block_num = -1;
+  block_dirty = false;
+  check_block = -1;
+  index_changed = false;
+  index_pos = 0;
+  if (layout == SDE_ZIP_LAYOUT)
+  {
+    layout = SDE_ROW_LAYOUT;
+    set_header_size();
+  }
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Rebuild the block index by walking the block headers in the file.
+  A block written again at the end of the file comes after its old
+  copy, so the last copy of each block wins. The walk stops at the
+  first header that does not make sense (like the old block index).
+*/
+int Spartan_data::rebuild_block_index()
+{
+  int hdr[4];
+  long long pos = header_size;
+  long long blocks;
+
+  DBUG_ENTER("Spartan_data::rebuild_block_index");
+  blocks = ((long long)number_records + number_del_records + block_rows - 1) /
+           block_rows;
+  block_count = 0;
+  while (pos + (long long)sizeof(hdr) <= file_length)
+  {
+    if ((my_pread(data_file, (byte *)hdr, sizeof(hdr), pos, MYF(0)) !=
+         sizeof(hdr)) ||
+        (hdr[1] <= 0) || (hdr[1] > hdr[0]) || (hdr[2] < 0) ||
+        (hdr[3] < 0) || (hdr[3] > block_count) || (hdr[3] >= blocks) ||
+        (pos + (long long)sizeof(hdr) + hdr[0] > file_length))
+      break;
+    if (grow_buffer((byte **)&block_index, &block_index_size,
+                    (hdr[3] + 1) * sizeof(long long)))
+      DBUG_RETURN(-1);
+    block_index[hdr[3]] = pos;
+    if (hdr[3] == block_count)
+      block_count++;
+    pos += sizeof(hdr) + hdr[0];
+  }
+  file_length = pos;
+  index_pos = pos;
+  index_changed = true;
+  header_changed = true;
+  DBUG_RETURN(0);
+}
+
+/*
+  Write the block index at the end of the file. It is not counted in
+  file_length so the next block appended goes over it.
+*/
+int Spartan_data::write_block_index()
+{
+  int i = 0;
+
+  DBUG_ENTER("Spartan_data::write_block_index");
+  if (block_count > 0)
+    i = write_data(SDL_HEADER, (byte *)block_index,
+                   block_count * sizeof(long long), file_length);
+  index_pos = file_length;
+  index_changed = false;
+  header_changed = true;
+  DBUG_RETURN((i == -1) ? -1 : 0);
+}
+
+/*
+  ZIP: append a row to the last block and return its position. A new
+  block is started when the last one is full.
+*/
+long long Spartan_data::write_zip_row(byte *buf, int length)
+{
+  long long row = (long long)number_records + number_del_records;
+  int slot = (int)(row % block_rows);
+  byte *ptr;
+
+  DBUG_ENTER("Spartan_data::write_zip_row");
+  if (slot == 0)
+  {
+    if (flush_zip_block())
+      DBUG_RETURN(-1);
+    block_num = row / block_rows;
+    block_cap = 0;
+    block_len = 0;
+    block_used = 0;
+  }
+  else if (read_zip_block(row / block_rows) || (block_used != slot))
+    DBUG_RETURN(-1);
+  if (grow_buffer(&block_buf, &block_buf_size, block_len + row_size(length)))
+    DBUG_RETURN(-1);
+  ptr = block_buf + block_len;
+  *ptr = 0;
+  memcpy(ptr + sizeof(byte), &length, sizeof(int));
+  memcpy(ptr + record_header_size, buf, length);
+  block_slot[slot] = block_len;
+  block_len += row_size(length);
+  block_used++;
+  block_dirty = true;
+  number_records++;
+  header_changed = true;
+  /*
+    Write the block out as soon as it is full.
+  */
+  if ((block_used == block_rows) && flush_zip_block())
+    DBUG_RETURN(-1);
+  DBUG_RETURN(header_size + row);
+}
+
+/*
+  ZIP: get the row at position in the cached block, reading the block
+  if needed. Returns a pointer to the row's deleted byte or NULL.
+*/
+byte *Spartan_data::find_zip_row(long long position)
+{
+  long long row = position - header_size;
+  int slot;
+
+  DBUG_ENTER("Spartan_data::find_zip_row");
+  if ((row < 0) || (row >= (long long)number_records + number_del_records) ||
+      read_zip_block(row / block_rows))
+    DBUG_RETURN(NULL);
+  slot = (int)(row % block_rows);
+  if (slot >= block_used)
+    DBUG_RETURN(NULL);
+  DBUG_RETURN(block_buf + block_slot[slot]);
+}
+
+/*
+  ZIP: read the first live row at or after position. The rows of a
+  block that cannot be read are passed over, so the scan goes on with
+  the next block (CHECK TABLE finds the rows missing).
+  Returns 0 or -1 at end of file or on error.
+*/
+int Spartan_data::read_zip_row(byte *buf, int length, long long position)
+{
+  long long rows = (long long)number_records + number_del_records;
+  int rec_len;
+  byte *ptr;
+
+  DBUG_ENTER("Spartan_data::read_zip_row");
+  if (position <= 0)
+    position = header_size; //move past header
+  skipped = 0;
+  for (;;)
+  {
+    if (position - header_size >= rows)
+      DBUG_RETURN(-1);
+    if ((ptr = find_zip_row(position)) == NULL)
+      position = header_size +
+                 ((position - header_size) / block_rows + 1) * block_rows;
+    else if (*ptr != 0)
+    {
+      skipped++;
+      position++;
+    }
+    else
+      break;
+  }
+  memcpy(&rec_len, ptr + sizeof(byte), sizeof(int));
+  memcpy(buf, ptr + record_header_size, (length < rec_len) ? length : rec_len);
+  last_pos = position;
+  current_pos = position + 1;
+  DBUG_RETURN(0);
+}
+
+/*
+  ZIP: get block number block into block_buf, writing out the cached
+  block first if it changed.
+  Returns 0 or -1 on error.
+*/
+int Spartan_data::read_zip_block(long long block)
+{
+  int hdr[4];
+  int pos = 0;
+  int rec_len;
+  uLongf len;
+
+  DBUG_ENTER("Spartan_data::read_zip_block");
+  if (block == block_num)
+    DBUG_RETURN(0);
+  if (flush_zip_block())
+    DBUG_RETURN(-1);
+  block_num = -1;
+  if ((block < 0) || (block >= block_count))
+    DBUG_RETURN(-1);
+  if ((read_block((byte *)hdr, sizeof(hdr), block_index[block]) !=
+       sizeof(hdr)) ||
+      (hdr[1] <= 0) || (hdr[1] > hdr[0]) || (hdr[2] < 0) ||
+      (hdr[3] != block))
+    DBUG_RETURN(-1);
+  if (grow_buffer(&zip_buf, &zip_buf_size, hdr[1]) ||
+      grow_buffer(&block_buf, &block_buf_size, hdr[2]) ||
+      (read_block(zip_buf, hdr[1], block_index[block] + sizeof(hdr)) !=
+       hdr[1]))
+    DBUG_RETURN(-1);
+  len = hdr[2];
+  if ((uncompress(block_buf, &len, zip_buf, hdr[1]) != Z_OK) ||
+      (len != (uLongf)hdr[2]))
+    DBUG_RETURN(-1);
+  /*
+    Find where each row of the block starts.
+  */
+  block_used = 0;
+  while ((pos + record_header_size <= hdr[2]) && (block_used < block_rows))
+  {
+    memcpy(&rec_len, block_buf + pos + sizeof(byte), sizeof(int));
+    if (rec_len < 0)
+      DBUG_RETURN(-1);
+    block_slot[block_used++] = pos;
+    pos += record_header_size + rec_len;
+  }
+  block_len = hdr[2];
+  block_cap = hdr[0];
+  block_num = block;
+  block_dirty = false;
+  DBUG_RETURN(0);
+}
+
+/*
+  ZIP: check block number block as it is in the file: its header must
+  match the block index and its compressed stream must inflate to the
+  length the header gives, which has zlib test the Adler-32 kept in the
+  stream. The stream is inflated IO_SIZE bytes at a time and thrown
+  away, so the block in block_buf is left alone. A block not written
+  yet passes. The last block checked is remembered, as verify_row() is
+  called for each of its rows.
+  Returns 0 if the block is good, 1 if it is damaged or -1 if it cannot
+  be read.
+*/
+int Spartan_data::verify_zip_block(long long block)
+{
+  int hdr[4];
+  byte out[IO_SIZE];
+  z_stream stream;
+  int zrc;
+
+  DBUG_ENTER("Spartan_data::verify_zip_block");
+  if ((block == block_num) && block_dirty)
+    DBUG_RETURN(0);
+  if (block == check_block)
+    DBUG_RETURN(check_rc);
+  if ((block < 0) || (block >= block_count) ||
+      (read_block((byte *)hdr, sizeof(hdr), block_index[block], false) !=
+       sizeof(hdr)))
+    DBUG_RETURN(-1);
+  if ((hdr[1] <= 0) || (hdr[1] > hdr[0]) || (hdr[2] < 0) ||
+      (hdr[3] != block))
+    zrc = Z_DATA_ERROR;
+  else if (grow_buffer(&check_buf, &check_buf_size, hdr[1]) ||
+           (read_block(check_buf, hdr[1], block_index[block] + sizeof(hdr),
+                       false) != hdr[1]))
+    DBUG_RETURN(-1);
+  else
+  {
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK)
+      DBUG_RETURN(-1);
+    stream.next_in = check_buf;
+    stream.avail_in = hdr[1];
+    do
+    {
+      stream.next_out = out;
+      stream.avail_out = sizeof(out);
+      zrc = inflate(&stream, Z_NO_FLUSH);
+    } while (zrc == Z_OK);
+    if ((zrc == Z_STREAM_END) && (stream.total_out != (uLong)hdr[2]))
+      zrc = Z_DATA_ERROR;
+    inflateEnd(&stream);
+  }
+  check_block = block;
+  check_rc = (zrc == Z_STREAM_END) ? 0 : 1;
+  DBUG_RETURN(check_rc);
+}
+
+/*
+  ZIP: compress the cached block and write it. It goes back in its own
+  space if it fits. The last block in the file is cut off and written
+  again. Any other block that grew is written at the end of the file
+  and the block index is pointed at the new copy.
+  Returns 0 or -1 on error.
+*/
+int Spartan_data::write_zip_block()
+{
+  int hdr[4];
+  long long pos = -1;
+  uLongf len;
+
+  DBUG_ENTER("Spartan_data::write_zip_block");
+  check_block = -1;
+  if (grow_buffer(&zip_buf, &zip_buf_size, compressBound(block_len)))
+    DBUG_RETURN(-1);
+  len = zip_buf_size;
+  if (compress2(zip_buf, &len, block_buf, block_len, Z_BEST_SPEED) != Z_OK)
+    DBUG_RETURN(-1);
+  hdr[1] = (int)len;
+  hdr[2] = block_len;
+  hdr[3] = (int)block_num;
+  if (block_cap > 0)
+    pos = block_index[block_num];
+  if ((block_cap > 0) && (hdr[1] <= block_cap))
+  {
+    hdr[0] = block_cap;
+    if ((write_block((byte *)hdr, sizeof(hdr), pos) == -1) ||
+        (write_block(zip_buf, hdr[1], pos + sizeof(hdr)) == -1))
+      DBUG_RETURN(-1);
+    DBUG_RETURN(0);
+  }
+  if ((block_cap > 0) && (pos + (long long)sizeof(hdr) + block_cap ==
+                          file_length))
+  {
+    if ((write_buf_len > 0) && (pos < write_buf_pos) && flush_data())
+      DBUG_RETURN(-1);
+    if (write_buf_len > 0)
+      write_buf_len = (int)(pos - write_buf_pos);
+    file_length = pos;
+  }
+  pos = file_length;
+  hdr[0] = hdr[1];
+  if ((append_block((byte *)hdr, sizeof(hdr)) == -1) ||
+      (append_block(zip_buf, hdr[1]) == -1))
+    DBUG_RETURN(-1);
+  if (block_num >= block_count)
+  {
+    if (grow_buffer((byte **)&block_index, &block_index_size,
+                    (int)(block_num + 1) * sizeof(long long)))
+      DBUG_RETURN(-1);
+    block_count = (int)block_num + 1;
+  }
+  block_index[block_num] = pos;
+  block_cap = hdr[0];
+  index_changed = true;
+  DBUG_RETURN(0);
+}
+
+/* ZIP: write the cached block if it has changed */
+int Spartan_data::flush_zip_block()
+{
+  DBUG_ENTER("Spartan_data::flush_zip_block");
+  if (!block_dirty)
+    DBUG_RETURN(0);
+  block_dirty = false;
+  DBUG_RETURN(write_zip_block());
+}
+
+/*
+  Write length bytes at position of the file. If there is a redo log
+  the bytes are added to it as a record of type log_type and the log is
+  written out first so the change can be redone if the write is torn.
+  Returns the number of bytes written or -1 on error.
+*/
+int Spartan_data::write_data(byte log_type, byte *buf, int length,
+                             long long position)
+{
+  long long lsn;
+  int i;
+
+  DBUG_ENTER("Spartan_data::write_data");
+  if (read_only)
+    DBUG_RETURN(-1);
+  if (log != NULL)
+  {
+    lsn = log->write_record(record_type(log_type), position, buf, length);
+    if ((lsn == -1) || log->write_log(lsn))
+      DBUG_RETURN(-1);
+  }
+  i = my_pwrite(data_file, buf, length, position, MYF(0));
+  if (reader != NULL)
+    reader->invalidate(position, length);
+  DBUG_RETURN(i);
+}
+
+/*
+  The type of the log record for a change of type log_type. The file
+  of another log is written and cut like an index file.
+*/
+byte Spartan_data::record_type(byte log_type)
+{
+  DBUG_ENTER("Spartan_data::record_type");
+  if (log_inx == -1)
+    DBUG_RETURN(log_type);
+  DBUG_RETURN((byte)(((log_type == SDL_TRUNCATE) ? SDL_INDEX_TRUNCATE :
+                      SDL_INDEX) + log_inx * SDL_INDEX_STEP));
+}
@@ -5,37 +5,264 @@
   from disk. The data written is in byte format so it can be anything you 
   want it to be. The write_row and read_row accept the length of the data 
   item to be read.
+
+  File Layout:
+    SOF                              crashed (bool)
+    SOF + 1                          number_records (int)
+    SOF + 5                          number_del_records (int)
+    SOF + 9                          free_head (long long)
+    SOF + 17                         layout (byte)
+    SOF + 18                         DATA BEGINS HERE
+  Each row is a deleted byte, the row length (int) and the row data.
+  The layout byte has SDE_PACKED_ROWS set if the rows were packed by
+  the caller (they are then of different lengths). It has
+  SDE_AUTO_INCREMENT set if an auto-increment counter (unsigned long
+  long) follows it; everything after it in the header then moves up by
+  8 bytes. Files are created with the counter.
+
+  Files are also created with SDE_CHECKSUMS set in the layout byte. The
+  row length is then followed by the CRC32C (see Spartan_crc.h) of the
+  row's slot; a row written into a longer slot is padded with zeros so
+  the checksum always covers the whole slot. Deleted slots are not
+  checked. Reads do not test the checksum; verify_row() does (CHECK
+  TABLE).
+
+  PAX Layout:
+    SOF + 18                         rows per page (int)
+    SOF + 22                         number of columns (int)
+    SOF + 26                         column offsets in the row (int each)
+                                     column widths (int each)
+    then                             PAGES BEGIN HERE
+  A table created with columns is stored in pages instead of rows. Each
+  page starts with a status byte per row (0 = live, 1 = deleted, 2 =
+  unused) followed by one minipage per column that holds the value of
+  that column for every row of the page. A scan that asks for only some
+  of the columns reads only their minipages. The position of a row is
+  the position of its status byte. With SDE_CHECKSUMS the last minipage
+  of a page holds the CRC32C of each row's column values (uint32 each).
+
+  Compressed Layout:
+    SOF + 18                         rows per block (int)
+    SOF + 22                         number of blocks (int)
+    SOF + 26                         block index position (long long)
+    SOF + 34                         BLOCKS BEGIN HERE
+  A table created compressed groups its rows into blocks of a fixed
+  number of rows. Each block holds the rows in the row layout compressed
+  with zlib behind a block header: the space kept for the block (int),
+  the compressed length (int), the uncompressed length (int) and the
+  block number (int). The block index is the file position of each
+  block (long long each) and is written after the last block. The
+  position of a row is header_size plus its row number, so a row is
+  found through the block index. A block needs no checksum of its own:
+  zlib keeps an Adler-32 of the block in the compressed stream and the
+  block is not read if it does not match.
+
+  Rows are not written to the file one at a time. Appends are collected in
+  a write buffer and reads are served from a read-ahead buffer so the file
+  is touched in large blocks. The write buffer is flushed when it fills,
+  before any read that overlaps it, and when flush_data() or close_table()
+  is called. A bulk insert can make the write buffer larger with
+  bulk_write(true) so rows go to the file SDE_BULK_BUFFER_SIZE bytes at
+  a time.
+
+  A full scan can be split with scan_ranges() into ranges that start on
+  row (page, block) boundaries. Each range can be read through its own
+  instance of the class opened on the file so the scans share nothing.
+  Such an instance is opened read only (open_table(path, true)): it
+  never writes to the file, not even a block index it had to rebuild,
+  so it cannot change the file behind the back of the instance that
+  writes it and its redo log.
+
+  For scans the file can also be memory mapped with map_table(). Reads
+  inside the mapping are copied straight out of it with no system calls.
+  A read past the end of the mapping (the file has grown) remaps the file.
+
+  Scans of files of SDE_DIRECT_SCAN_SIZE bytes or more can read the file
+  with direct I/O instead (see Spartan_reader.h) after direct_scan(true)
+  so a table scan does not push everything else out of the OS cache.
+
+  Changes to the file can be protected by a redo log (see Spartan_log.h)
+  attached with set_log(). checkpoint() syncs the file and empties it.
+  The file can instead be logged as file n of the log of another file
+  (the overflow file of a table, in the log of its data file): its
+  writes are logged like those of an index file and the other file
+  replays and empties the log.
 */
 #pragma once
 #pragma unmanaged
 #include "my_global.h"
 #include "my_sys.h"
+#include "spartan_log.h"
+#include "spartan_reader.h"
+#include "spartan_crc.h"
+
+/* size of the write and read-ahead buffers (bytes) */
+const int SDE_BUFFER_SIZE = 64 * 1024;
+
+/* data file layouts */
+const byte SDE_ROW_LAYOUT = 0;
+const byte SDE_PAX_LAYOUT = 1;
+const byte SDE_ZIP_LAYOUT = 2;
+
+/* flag in the layout byte: rows are packed by the caller */
+const byte SDE_PACKED_ROWS = 0x80;
+
+/* flag in the layout byte: the header holds an auto-increment counter */
+const byte SDE_AUTO_INCREMENT = 0x40;
+
+/* flag in the layout byte: rows (PAX: pages) carry CRC32C checksums */
+const byte SDE_CHECKSUMS = 0x20;
+
+/* size of the write buffer during a bulk insert (bytes) */
+const int SDE_BULK_BUFFER_SIZE = 1024 * 1024;
+
+/* size of a page of a PAX layout file (bytes) */
+const int SDE_PAX_PAGE_SIZE = SDE_BUFFER_SIZE;
+
+/* number of rows in a block of a compressed layout file */
+const int SDE_BLOCK_ROWS = 128;
+
+/* size of file from which scans use direct I/O (bytes) */
+const long long SDE_DIRECT_SCAN_SIZE = 1024 * 1024 * 1024;
 
 class Spartan_data
 {
 public:
   Spartan_data(void);
   ~Spartan_data(void);
-  int create_table(char *path);
-  int open_table(char *path);
+  int create_table(char *path, byte new_layout = SDE_ROW_LAYOUT,
+                   int cols = 0, int *offsets = NULL, int *lengths = NULL);
+  int open_table(char *path, bool read_only_arg = false);
   long long write_row(byte *buf, int length);
   long long update_row(byte *old_rec, byte *new_rec,
-                       int length, long long position);
-  int read_row(byte *buf, int length, long long position);
-  int delete_row(byte *old_rec, int length, long long position);
+                       int length, long long position,
+                       long long *old_position = NULL);
+  int read_row(byte *buf, int length, long long position,
+               bool *cols = NULL);
+  long long delete_row(byte *old_rec, int length, long long position);
   int close_table();
+  int flush_data();
+  int sync_data();
+  int checkpoint();
+  void set_log(Spartan_log *new_log, int inx = -1);
+  int map_table();
+  int unmap_table();
+  int direct_scan(bool on);
+  int bulk_write(bool on);
   long long cur_position();
+  long long last_position();
+  long long end_position();
+  long long data_length();
+  int skipped_records();
   int records();
   int del_records();
   int trunc_table();
   int row_size(int length);
+  byte get_layout();
+  bool packed_rows();
+  ulonglong auto_increment();
+  void set_auto_increment(ulonglong value);
+  int get_columns(int **offsets, int **lengths);
+  int scan_ranges(int parts, int length, long long *ranges);
+  int verify_row(long long position);
+  bool is_crashed();
+  int repair_header(int records, int del_records);
 private:
   File data_file;
+  bool read_only;            /* opened for reading only (a cursor) */
   int header_size;
   int record_header_size;
   bool crashed;
   int number_records;
   int number_del_records;
+  long long free_head;       /* first deleted slot free for reuse (or -1) */
+  bool header_changed;       /* header needs writing at next flush */
+  long long file_length;     /* logical end of file (includes write buffer) */
+  long long current_pos;     /* file position following the last row read */
+  long long last_pos;        /* file position of the last row read */
+  int skipped;               /* deleted rows skipped by the last read */
+  byte *write_buf;           /* pending appends */
+  int write_buf_len;
+  int write_buf_size;        /* bytes allocated for write_buf */
+  long long write_buf_pos;   /* file position of the first pending byte */
+  byte *read_buf;            /* read-ahead block */
+  int read_buf_len;
+  long long read_buf_pos;    /* file position of the first buffered byte */
+  byte *mapped_file;         /* memory mapping of the file (scans) */
+  long long mapped_length;
+  byte layout;               /* SDE_ROW_LAYOUT, SDE_PAX_LAYOUT or ZIP */
+  bool packed;               /* rows are packed by the caller */
+  bool has_auto_inc;         /* header holds auto_inc */
+  bool checksums;            /* rows (pages) carry checksums */
+  byte *check_buf;           /* verify_row(): the row being checked */
+  int check_buf_size;
+  long long check_block;     /* ZIP: last block verify_row() checked */
+  int check_rc;              /* ZIP: and what it found */
+  ulonglong auto_inc;        /* auto-increment counter */
+  int columns;               /* PAX: number of columns */
+  int *col_offset;           /* PAX: offset of each column in the row */
+  int *col_length;           /* PAX: width of each column */
+  int *col_page_offset;      /* PAX: offset of each column's minipage */
+  int crc_page_offset;       /* PAX: offset of the checksum minipage */
+  int page_rows;             /* PAX: rows per page */
+  int page_size;             /* PAX: bytes per page */
+  byte *page_buf;            /* PAX: the page last read */
+  long long page_num;        /* PAX: number of the page in page_buf (or -1) */
+  bool *page_cols;           /* PAX: minipages of page_buf that are read */
+  int block_rows;            /* ZIP: rows per block */
+  int block_count;           /* ZIP: number of blocks in the block index */
+  int block_index_size;      /* ZIP: bytes allocated for block_index */
+  long long *block_index;    /* ZIP: file position of each block */
+  long long index_pos;       /* ZIP: file position of the block index */
+  bool index_changed;        /* ZIP: block index needs writing */
+  long long block_num;       /* ZIP: number of the block in block_buf (or -1) */
+  int block_cap;             /* ZIP: space kept for it in the file (0 = new) */
+  int block_len;             /* ZIP: bytes used in block_buf */
+  int block_used;            /* ZIP: rows in block_buf */
+  bool block_dirty;          /* ZIP: block_buf needs writing */
+  byte *block_buf;           /* ZIP: uncompressed block */
+  int block_buf_size;
+  int *block_slot;           /* ZIP: offset of each row in block_buf */
+  byte *zip_buf;             /* ZIP: compressed block */
+  int zip_buf_size;
+  Spartan_log *log;          /* redo log for changes to the file (or NULL) */
+  int log_inx;               /* number of the file in log (-1 = its own) */
+  char *data_path;           /* name of the data file */
+  Spartan_reader *reader;    /* direct I/O reads for scans (or NULL) */
   int read_header();
   int write_header();
+  void set_header_size();
+  long long reuse_slot(byte *buf, int length);
+  long long append_row(byte *buf, int length);
+  int write_slot(byte *buf, int length, int slot_len, long long position);
+  uint32 pax_checksum(byte *buf, int length);
+  long long find_row(byte *rec, int length);
+  int set_columns(int cols, int *offsets, int *lengths, int rows);
+  void free_columns();
+  long long slot_position(long long slot);
+  long long slot_number(long long position);
+  long long write_pax_row(byte *buf, int length);
+  int write_pax_slot(byte *buf, int length, long long position);
+  int read_pax_row(byte *buf, int length, long long position, bool *cols);
+  int read_page(long long page, bool *cols);
+  int set_blocks(int rows, int count);
+  void free_blocks();
+  int rebuild_block_index();
+  int write_block_index();
+  long long write_zip_row(byte *buf, int length);
+  int read_zip_row(byte *buf, int length, long long position);
+  byte *find_zip_row(long long position);
+  int read_zip_block(long long block);
+  int verify_zip_block(long long block);
+  int write_zip_block();
+  int flush_zip_block();
+  int grow_buffer(byte **buf, int *size, int length);
+  int packed_ranges(int parts, long long *ranges);
+  int read_block(byte *buf, int length, long long position,
+                 bool read_ahead = true);
+  int write_block(byte *buf, int length, long long position,
+                  byte log_type = SDL_UPDATE);
+  int append_block(byte *buf, int length);
+  int write_data(byte log_type, byte *buf, int length, long long position);
+  byte record_type(byte log_type);
 };
@@ -0,0 +1,1053 @@
+/*
+  Spartan_hash.cpp
+
+  This class reads and writes a hash index file for use with the
+  Spartan data class (see Spartan_hash.h). The whole file is kept in
+  memory as it is on disk, so bucket b is at SDI_PAGE_SIZE + b times
+  SDH_BUCKET_SIZE in both and a change marks the page it falls in to be
+  written by the next save.
+*/
+#include "Spartan_hash.h"
+#include <my_dir.h>
+
+Spartan_hash::Spartan_hash(void)
+{
+  index_file = -1;
+  log = NULL;
+  log_inx = 0;
+  max_key_len = -1;
+  entry_len = 0;
+  buckets = 0;
+  entries = 0;
+  entry_alloc = 0;
+  keys = 0;
+  used = 0;
+  free_head = -1;
+  crashed = false;
+  clean = true;
+  image = NULL;
+  dirty = NULL;
+  dirty_alloc = 0;
+  rebuilds = 0;
+}
+
+Spartan_hash::~Spartan_hash(void)
+{
+  close_index();
+}
+
+/* create an empty hash index at location "path" for keys of keylen */
+int Spartan_hash::create_index(char *path, int keylen)
+{
+  DBUG_ENTER("Spartan_hash::create_index");
+  if (open_index(path))
+    DBUG_RETURN(-1);
+  max_key_len = keylen;
+  entry_len = max_key_len + sizeof(long long);
+  crashed = false;
+  if (reset_table(SDH_MIN_BUCKETS))
+    DBUG_RETURN(-1);
+  DBUG_RETURN(save_index());
+}
+
+/* open index specified as path (pat+filename) */
+int Spartan_hash::open_index(char *path)
+{
+  DBUG_ENTER("Spartan_hash::open_index");
+  index_file = my_open(path, O_RDWR | O_CREAT | O_BINARY | O_SHARE, MYF(0));
+  if (index_file == -1)
+    DBUG_RETURN(errno);
+  if (log != NULL)
+    log->set_index(log_inx, index_file);
+  read_header();
+  DBUG_RETURN(0);
+}
+
+/*
+  Empty the table in memory and give it new_buckets buckets. Every
+  bucket is marked to be written.
+*/
+int Spartan_hash::reset_table(int new_buckets)
+{
+  DBUG_ENTER("Spartan_hash::reset_table");
+  buckets = new_buckets;
+  entries = 0;
+  keys = 0;
+  used = 0;
+  free_head = -1;
+  rebuilds++;
+  if (grow_image(SDH_MIN_ENTRIES))
+    DBUG_RETURN(-1);
+  memset(image, 0, SDI_PAGE_SIZE);
+  memset(image + SDI_PAGE_SIZE, 0xff, buckets * SDH_BUCKET_SIZE);
+  memset(dirty, 0, dirty_alloc * sizeof(bool));
+  mark_dirty(SDI_PAGE_SIZE, buckets * SDH_BUCKET_SIZE);
+  DBUG_RETURN(0);
+}
+
+/* read the header from the file (a new file has none) */
+int Spartan_hash::read_header()
+{
+  byte header[SDH_HEADER_SIZE];
+  int fields[5];
+
+  DBUG_ENTER("Spartan_hash::read_header");
+  if (my_pread(index_file, header, SDH_HEADER_SIZE, 0, MYF(0)) !=
+      SDH_HEADER_SIZE)
+    DBUG_RETURN(0);
+  memcpy(&max_key_len, header, sizeof(int));
+  entry_len = max_key_len + sizeof(long long);
+  crashed = ((header[sizeof(int)] & SDI_CRASHED) != 0);
+  memcpy(fields, header + METADATA_SIZE, sizeof(fields));
+  buckets = fields[0];
+  entries = fields[1];
+  keys = fields[2];
+  used = fields[3];
+  free_head = fields[4];
+  clean = true;
+  DBUG_RETURN(0);
+}
+
+/*
+  Write the header to the file. SDI_CRASHED is set while changes in
+  memory are not yet written.
+*/
+int Spartan_hash::write_header()
+{
+  byte header[SDH_HEADER_SIZE];
+  int fields[5];
+
+  DBUG_ENTER("Spartan_hash::write_header");
+  if (max_key_len <= 0)
+    DBUG_RETURN(0);
+  memcpy(header, &max_key_len, sizeof(int));
+  header[sizeof(int)] = ((crashed || !clean) ? SDI_CRASHED : 0) | SDI_HASHED;
+  fields[0] = buckets;
+  fields[1] = entries;
+  fields[2] = keys;
+  fields[3] = used;
+  fields[4] = free_head;
+  memcpy(header + METADATA_SIZE, fields, sizeof(fields));
+  DBUG_RETURN(write_file(header, SDH_HEADER_SIZE, 0));
+}
+
+/*
+  Write length bytes of buf at position of the file, logging them first
+  if there is a redo log. Returns 0 or -1 on error.
+*/
+int Spartan_hash::write_file(byte *buf, int length, long long position)
+{
+  long long lsn;
+
+  DBUG_ENTER("Spartan_hash::write_file");
+  if (log != NULL)
+  {
+    lsn = log->write_record(SDL_INDEX + log_inx * SDL_INDEX_STEP, position,
+                            buf, length);
+    if ((lsn == -1) || log->write_log(lsn))
+      DBUG_RETURN(-1);
+  }
+  if (my_pwrite(index_file, buf, length, position, MYF(MY_WME)) !=
+      (uint)length)
+    DBUG_RETURN(-1);
+  DBUG_RETURN(0);
+}
+
+/* cut the file to length bytes (logged like a write) */
+int Spartan_hash::cut_file(long long length)
+{
+  DBUG_ENTER("Spartan_hash::cut_file");
+  if (log != NULL)
+    log->write_log(log->write_record(SDL_INDEX_TRUNCATE +
+                                     log_inx * SDL_INDEX_STEP,
+                                     length, NULL, 0));
+  DBUG_RETURN(my_chsize(index_file, length, 0, MYF(MY_WME)));
+}
+
+/*
+  Attach the redo log (NULL = none) the writes to the file are logged
+  in, as index file inx of the log.
+*/
+void Spartan_hash::set_log(Spartan_log *new_log, int inx)
+{
+  DBUG_ENTER("Spartan_hash::set_log");
+  log = new_log;
+  log_inx = inx;
+  if (log != NULL)
+    log->set_index(log_inx, index_file);
+  DBUG_VOID_RETURN;
+}
+
+/* get the offset of the first entry in the file */
+long long Spartan_hash::entry_start()
+{
+  return SDI_PAGE_SIZE + (long long)buckets * SDH_BUCKET_SIZE;
+}
+
+/* get the length of the file: the header page, buckets and entries */
+long long Spartan_hash::image_length()
+{
+  return entry_start() + (long long)entries * entry_len;
+}
+
+/* get the hashes of the slots of a bucket */
+uint32 *Spartan_hash::bucket_hash(int bucket)
+{
+  return (uint32 *)(image + SDI_PAGE_SIZE +
+                    (long long)bucket * SDH_BUCKET_SIZE);
+}
+
+/* get the entry numbers of the slots of a bucket (after the hashes) */
+int *Spartan_hash::bucket_entry(int bucket)
+{
+  return (int *)(bucket_hash(bucket) + SDH_BUCKET_SLOTS);
+}
+
+/* get the key of an entry */
+byte *Spartan_hash::entry_key(int entry)
+{
+  return image + entry_start() + (long long)entry * entry_len;
+}
+
+/* get the row position of an entry */
+long long Spartan_hash::entry_pos(int entry)
+{
+  long long pos;
+
+  memcpy(&pos, entry_key(entry) + max_key_len, sizeof(long long));
+  return pos;
+}
+
+/* set the row position of an entry */
+void Spartan_hash::set_entry_pos(int entry, long long pos)
+{
+  memcpy(entry_key(entry) + max_key_len, &pos, sizeof(long long));
+  mark_dirty(entry_start() + (long long)entry * entry_len, entry_len);
+}
+
+/* get the hash of a key: the CRC32C of all max_key_len bytes */
+uint32 Spartan_hash::hash_key(byte *key)
+{
+  return spartan_crc32c(0, key, max_key_len);
+}
+
+/*
+  Note that length bytes at offset of the file have changed. The first
+  change after the file was saved marks it crashed until it is saved
+  again.
+*/
+void Spartan_hash::mark_dirty(long long offset, long length)
+{
+  long long page;
+
+  DBUG_ENTER("Spartan_hash::mark_dirty");
+  for (page = offset / SDI_PAGE_SIZE;
+       page <= (offset + length - 1) / SDI_PAGE_SIZE; page++)
+    dirty[page] = true;
+  if (clean)
+  {
+    clean = false;
+    write_header();
+  }
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Make room in memory for new_alloc entries after the buckets. Returns
+  0 or -1 if out of memory.
+*/
+int Spartan_hash::grow_image(int new_alloc)
+{
+  long long length = entry_start() + (long long)new_alloc * entry_len;
+  int pages = (int)((length + SDI_PAGE_SIZE - 1) / SDI_PAGE_SIZE);
+  byte *more;
+  bool *more_dirty;
+
+  DBUG_ENTER("Spartan_hash::grow_image");
+  more = (byte *)my_realloc((gptr)image, (uint)length,
+                            MYF(MY_WME | MY_ALLOW_ZERO_PTR));
+  if (more == NULL)
+    DBUG_RETURN(-1);
+  image = more;
+  entry_alloc = new_alloc;
+  if (pages > dirty_alloc)
+  {
+    more_dirty = (bool *)my_realloc((gptr)dirty, pages * sizeof(bool),
+                                    MYF(MY_WME | MY_ALLOW_ZERO_PTR));
+    if (more_dirty == NULL)
+      DBUG_RETURN(-1);
+    memset(more_dirty + dirty_alloc, 0, (pages - dirty_alloc) * sizeof(bool));
+    dirty = more_dirty;
+    dirty_alloc = pages;
+  }
+  DBUG_RETURN(0);
+}
+
+/*
+  Get an entry for a new key: the first free one or a new one at the
+  end of the file. Returns -1 if out of memory.
+*/
+int Spartan_hash::new_entry()
+{
+  int entry;
+
+  DBUG_ENTER("Spartan_hash::new_entry");
+  if (free_head != -1)
+  {
+    entry = free_head;
+    free_head = (int)entry_pos(entry);
+    DBUG_RETURN(entry);
+  }
+  if ((entries == entry_alloc) &&
+      grow_image((entry_alloc > SDH_MIN_ENTRIES / 2) ?
+                 entry_alloc * 2 : SDH_MIN_ENTRIES))
+    DBUG_RETURN(-1);
+  DBUG_RETURN(entries++);
+}
+
+/* put an entry on the free list */
+void Spartan_hash::free_entry(int entry)
+{
+  DBUG_ENTER("Spartan_hash::free_entry");
+  set_entry_pos(entry, free_head);
+  free_head = entry;
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Put entry in the first slot that has no key (empty or deleted) of
+  the bucket hash picks or the buckets after it.
+*/
+void Spartan_hash::put_slot(uint32 hash, int entry)
+{
+  uint32 *h;
+  int *e;
+  int bucket = hash & (buckets - 1);
+  int slot;
+
+  DBUG_ENTER("Spartan_hash::put_slot");
+  for (;;)
+  {
+    h = bucket_hash(bucket);
+    e = bucket_entry(bucket);
+    for (slot = 0; slot < SDH_BUCKET_SLOTS; slot++)
+    {
+      if (e[slot] < 0)
+      {
+        if (e[slot] == SDH_EMPTY)
+          used++;
+        h[slot] = hash;
+        e[slot] = entry;
+        mark_dirty((byte *)h - image, SDH_BUCKET_SIZE);
+        DBUG_VOID_RETURN;
+      }
+    }
+    bucket = (bucket + 1) & (buckets - 1);
+  }
+}
+
+/*
+  Take the key out of a slot. The slot is left deleted so lookups go
+  on past it, or empty (with the deleted slots before it) if the slots
+  after it in the bucket are empty: lookups stop in this bucket anyway.
+*/
+void Spartan_hash::clear_slot(int bucket, int slot)
+{
+  int *e = bucket_entry(bucket);
+
+  DBUG_ENTER("Spartan_hash::clear_slot");
+  e[slot] = SDH_DELETED;
+  while ((slot >= 0) && (slot < SDH_BUCKET_SLOTS - 1) &&
+         (e[slot] == SDH_DELETED) && (e[slot + 1] == SDH_EMPTY))
+  {
+    e[slot--] = SDH_EMPTY;
+    used--;
+  }
+  mark_dirty((byte *)bucket_hash(bucket) - image, SDH_BUCKET_SIZE);
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Find the slot of key (whose hash is hash) that points at the row at
+  pos (any if pos is -1), starting at *slot of *bucket. Sets them to
+  the slot and returns true if there is one; the search stops at the
+  first empty slot.
+*/
+bool Spartan_hash::find_slot(byte *key, uint32 hash, long long pos,
+                             int *bucket, int *slot)
+{
+  uint32 *h;
+  int *e;
+  int n;
+
+  for (n = 0; n < buckets; n++)
+  {
+    h = bucket_hash(*bucket);
+    e = bucket_entry(*bucket);
+    for (; *slot < SDH_BUCKET_SLOTS; (*slot)++)
+    {
+      if (e[*slot] == SDH_EMPTY)
+        return false;
+      if ((e[*slot] >= 0) && (h[*slot] == hash) &&
+          (memcmp(entry_key(e[*slot]), key, max_key_len) == 0) &&
+          ((pos == -1) || (entry_pos(e[*slot]) == pos)))
+        return true;
+    }
+    *bucket = (*bucket + 1) & (buckets - 1);
+    *slot = 0;
+  }
+  return false;
+}
+
+/*
+  Build the table again with new_buckets buckets, dropping the deleted
+  slots. The entries keep their numbers; they move in the file as the
+  buckets before them grow, so every page is written at the next save.
+*/
+int Spartan_hash::rehash(int new_buckets)
+{
+  byte *old_image = image;
+  long long old_start = entry_start();
+  int old_buckets = buckets;
+  uint32 *h;
+  int *e;
+  int bucket;
+  int slot;
+
+  DBUG_ENTER("Spartan_hash::rehash");
+  buckets = new_buckets;
+  image = (byte *)my_malloc((uint)(entry_start() +
+                                   (long long)entry_alloc * entry_len),
+                            MYF(MY_WME));
+  if ((image == NULL) || grow_image(entry_alloc))
+  {
+    my_free((gptr)image, MYF(MY_ALLOW_ZERO_PTR));
+    image = old_image;
+    buckets = old_buckets;
+    DBUG_RETURN(-1);
+  }
+  memcpy(image, old_image, SDI_PAGE_SIZE);
+  memset(image + SDI_PAGE_SIZE, 0xff, buckets * SDH_BUCKET_SIZE);
+  memcpy(image + entry_start(), old_image + old_start,
+         (size_t)entry_alloc * entry_len);
+  used = 0;
+  for (bucket = 0; bucket < old_buckets; bucket++)
+  {
+    h = (uint32 *)(old_image + SDI_PAGE_SIZE +
+                   (long long)bucket * SDH_BUCKET_SIZE);
+    e = (int *)(h + SDH_BUCKET_SLOTS);
+    for (slot = 0; slot < SDH_BUCKET_SLOTS; slot++)
+      if (e[slot] >= 0)
+        put_slot(h[slot], e[slot]);
+  }
+  my_free((gptr)old_image, MYF(0));
+  mark_dirty(SDI_PAGE_SIZE, (long)(image_length() - SDI_PAGE_SIZE));
+  rebuilds++;
+  DBUG_RETURN(0);
+}
+
+/*
+  Make sure a key can be added with no more than three quarters of the
+  slots used. The table doubles if the keys fill more than half of
+  that; otherwise dropping the deleted slots is enough.
+*/
+int Spartan_hash::make_room()
+{
+  int slots = buckets * SDH_BUCKET_SLOTS;
+
+  DBUG_ENTER("Spartan_hash::make_room");
+  if ((used + 1) * 4 <= slots * 3)
+    DBUG_RETURN(0);
+  DBUG_RETURN(rehash(((keys + 1) * 8 > slots * 3) ? buckets * 2 : buckets));
+}
+
+/*
+  Insert a key into the index. If dupes are not allowed and the key is
+  already in it, nothing is inserted and -1 is returned.
+*/
+int Spartan_hash::insert_key(SDE_INDEX *ndx, bool allow_dupes)
+{
+  uint32 hash;
+  int bucket;
+  int slot = 0;
+  int entry;
+
+  DBUG_ENTER("Spartan_hash::insert_key");
+  if (image == NULL)
+    DBUG_RETURN(-1);
+  hash = hash_key(ndx->key);
+  bucket = hash & (buckets - 1);
+  if (!allow_dupes && find_slot(ndx->key, hash, -1, &bucket, &slot))
+    DBUG_RETURN(-1);
+  if (make_room() || ((entry = new_entry()) == -1))
+    DBUG_RETURN(-1);
+  memcpy(entry_key(entry), ndx->key, max_key_len);
+  set_entry_pos(entry, ndx->pos);
+  put_slot(hash, entry);
+  keys++;
+  DBUG_RETURN(1);
+}
+
+/*
+  Insert count keys into the index. The table is grown once for all of
+  them first. A key equal to one already in the index or earlier in
+  ndx is left out if dupes are not allowed. Returns the number of keys
+  inserted or -1 on error.
+*/
+int Spartan_hash::bulk_insert(SDE_INDEX *ndx, int count, bool allow_dupes)
+{
+  int new_buckets = buckets;
+  int added = 0;
+  int i;
+
+  DBUG_ENTER("Spartan_hash::bulk_insert");
+  if (image == NULL)
+    DBUG_RETURN(-1);
+  while ((keys + count) * 4LL > new_buckets * 3LL * SDH_BUCKET_SLOTS)
+    new_buckets *= 2;
+  if ((new_buckets != buckets) && rehash(new_buckets))
+    DBUG_RETURN(-1);
+  if ((entries + count > entry_alloc) && grow_image(entries + count))
+    DBUG_RETURN(-1);
+  for (i = 0; i < count; i++)
+    if (insert_key(&ndx[i], allow_dupes) == 1)
+      added++;
+  DBUG_RETURN(added);
+}
+
+/* delete a key from the index; with a position, the key pointing at it */
+int Spartan_hash::delete_key(byte *buf, long long pos, int key_len)
+{
+  uint32 hash;
+  int bucket;
+  int slot = 0;
+  int entry;
+
+  DBUG_ENTER("Spartan_hash::delete_key");
+  if ((image == NULL) || (key_len < max_key_len))
+    DBUG_RETURN(0);
+  hash = hash_key(buf);
+  bucket = hash & (buckets - 1);
+  if (find_slot(buf, hash, pos, &bucket, &slot))
+  {
+    entry = bucket_entry(bucket)[slot];
+    clear_slot(bucket, slot);
+    free_entry(entry);
+    keys--;
+  }
+  DBUG_RETURN(0);
+}
+
+/*
+  Move the entry of the row that was at old_pos with the key old_key
+  to the key in buf and the position pos. If the key did not change
+  only the position of the entry is set; otherwise the entry is moved
+  to a slot for its new hash. Returns 0 or -1 if the entry is not in
+  the index or cannot be put back.
+*/
+int Spartan_hash::update_key(byte *old_key, long long old_pos, byte *buf,
+                             long long pos, int key_len)
+{
+  uint32 hash;
+  int bucket;
+  int slot = 0;
+  int entry;
+
+  DBUG_ENTER("Spartan_hash::update_key");
+  if ((image == NULL) || (key_len < max_key_len))
+    DBUG_RETURN(0);
+  hash = hash_key(old_key);
+  bucket = hash & (buckets - 1);
+  if (!find_slot(old_key, hash, old_pos, &bucket, &slot))
+    DBUG_RETURN(-1);
+  entry = bucket_entry(bucket)[slot];
+  if (memcmp(old_key, buf, max_key_len) == 0)
+  {
+    if (entry_pos(entry) != pos)
+      set_entry_pos(entry, pos);
+    DBUG_RETURN(0);
+  }
+  clear_slot(bucket, slot);
+  if (make_room())
+  {
+    free_entry(entry);
+    keys--;
+    DBUG_RETURN(-1);
+  }
+  memcpy(entry_key(entry), buf, max_key_len);
+  set_entry_pos(entry, pos);
+  put_slot(hash_key(buf), entry);
+  DBUG_RETURN(0);
+}
+
+/* get the row position of a key (-1 if it is not in the index) */
+long long Spartan_hash::get_index_pos(byte *buf, int key_len)
+{
+  SDE_CURSOR cur;
+  SDE_INDEX *ndx;
+
+  DBUG_ENTER("Spartan_hash::get_index_pos");
+  ndx = seek_index(buf, key_len, &cur);
+  DBUG_RETURN((ndx != NULL) ? ndx->pos : -1);
+}
+
+/*
+  Get the entry at the cursor and move the cursor past it: the next
+  entry of the key walked, or of any key if every entry is walked.
+  Returns NULL at the end, or if the table was rebuilt since the cursor
+  was set.
+*/
+SDE_INDEX *Spartan_hash::scan_entry(SDE_CURSOR *cur)
+{
+  int entry = -1;
+
+  DBUG_ENTER("Spartan_hash::scan_entry");
+  if ((cur->bucket == -1) || (cur->rebuilds != rebuilds))
+    DBUG_RETURN(NULL);
+  if (cur->all)
+  {
+    for (; (cur->bucket < buckets) && (entry < 0); cur->slot++)
+    {
+      if (cur->slot == SDH_BUCKET_SLOTS)
+      {
+        cur->slot = 0;
+        if (++cur->bucket == buckets)
+          break;
+      }
+      entry = bucket_entry(cur->bucket)[cur->slot];
+    }
+  }
+  else if (find_slot(cur->key.key, cur->hash, -1, &cur->bucket, &cur->slot))
+    entry = bucket_entry(cur->bucket)[cur->slot++];
+  if (entry < 0)
+  {
+    cur->bucket = -1;
+    DBUG_RETURN(NULL);
+  }
+  memcpy(cur->found.key, entry_key(entry), max_key_len);
+  cur->found.pos = entry_pos(entry);
+  cur->found.length = max_key_len;
+  DBUG_RETURN(&cur->found);
+}
+
+/*
+  Find the first entry of a key (whole keys only) and set the cursor
+  so next_entry() gets the others.
+*/
+SDE_INDEX *Spartan_hash::seek_index(byte *key, int key_len, SDE_CURSOR *cur)
+{
+  DBUG_ENTER("Spartan_hash::seek_index");
+  cur->bucket = -1;
+  if ((image == NULL) || (key_len < max_key_len))
+    DBUG_RETURN(NULL);
+  memcpy(cur->key.key, key, max_key_len);
+  cur->hash = hash_key(key);
+  cur->all = false;
+  cur->rebuilds = rebuilds;
+  cur->bucket = cur->hash & (buckets - 1);
+  cur->slot = 0;
+  DBUG_RETURN(scan_entry(cur));
+}
+
+/* get the next entry at the cursor (NULL at the end) */
+SDE_INDEX *Spartan_hash::next_entry(SDE_CURSOR *cur)
+{
+  DBUG_ENTER("Spartan_hash::next_entry");
+  DBUG_RETURN(scan_entry(cur));
+}
+
+/*
+  Start a walk of every entry and get the first (NULL if the index is
+  empty). The entries are in no order, so there is no last one.
+*/
+SDE_INDEX *Spartan_hash::seek_end(bool last, SDE_CURSOR *cur)
+{
+  DBUG_ENTER("Spartan_hash::seek_end");
+  cur->bucket = -1;
+  if ((image == NULL) || last)
+    DBUG_RETURN(NULL);
+  cur->all = true;
+  cur->rebuilds = rebuilds;
+  cur->bucket = 0;
+  cur->slot = 0;
+  DBUG_RETURN(scan_entry(cur));
+}
+
+/* close the index, writing the changes */
+int Spartan_hash::close_index()
+{
+  DBUG_ENTER("Spartan_hash::close_index");
+  if (index_file != -1)
+  {
+    if (!clean)
+      save_index();
+    if (log != NULL)
+      log->set_index(log_inx, -1);
+    my_close(index_file, MYF(0));
+    index_file = -1;
+  }
+  if (image != NULL)
+    my_free((gptr)image, MYF(0));
+  if (dirty != NULL)
+    my_free((gptr)dirty, MYF(0));
+  image = NULL;
+  dirty = NULL;
+  dirty_alloc = 0;
+  entry_alloc = 0;
+  rebuilds++;
+  clean = true;
+  DBUG_RETURN(0);
+}
+
+/*
+  Check that every slot of the table read from the file points at an
+  entry of the file whose key has the hash of the slot, that the free
+  list is whole and that the counts in the header match.
+*/
+bool Spartan_hash::check_table()
+{
+  uint32 *h;
+  int *e;
+  int bucket;
+  int slot;
+  int entry;
+  int listed = 0;
+  int taken = 0;
+  int n;
+
+  DBUG_ENTER("Spartan_hash::check_table");
+  for (bucket = 0; bucket < buckets; bucket++)
+  {
+    h = bucket_hash(bucket);
+    e = bucket_entry(bucket);
+    for (slot = 0; slot < SDH_BUCKET_SLOTS; slot++)
+    {
+      if ((e[slot] >= entries) || (e[slot] < SDH_DELETED))
+        DBUG_RETURN(false);
+      if (e[slot] != SDH_EMPTY)
+        taken++;
+      if (e[slot] >= 0)
+      {
+        listed++;
+        if (h[slot] != hash_key(entry_key(e[slot])))
+          DBUG_RETURN(false);
+      }
+    }
+  }
+  for (entry = free_head, n = 0; entry != -1; n++)
+  {
+    if ((entry < 0) || (entry >= entries) || (n == entries))
+      DBUG_RETURN(false);
+    entry = (int)entry_pos(entry);
+  }
+  DBUG_RETURN((listed == keys) && (taken == used) && (keys + n == entries) &&
+              (used < buckets * SDH_BUCKET_SLOTS));
+}
+
+/*
+  Read the whole file into memory once the redo log has been replayed
+  over it. A file that does not hold a sound table leaves the index
+  empty and marked crashed.
+*/
+int Spartan_hash::load_index()
+{
+  DBUG_ENTER("Spartan_hash::load_index");
+  if (index_file == -1)
+    DBUG_RETURN(0);
+  read_header();
+  if (max_key_len <= 0)
+    DBUG_RETURN(0);
+  rebuilds++;
+  if ((max_key_len <= (int)sizeof(((SDE_INDEX *)0)->key)) &&
+      (buckets >= SDH_MIN_BUCKETS) && ((buckets & (buckets - 1)) == 0) &&
+      (entries >= 0) &&
+      (my_seek(index_file, 0L, MY_SEEK_END, MYF(0)) >=
+       (my_off_t)image_length()) &&
+      !grow_image((entries > SDH_MIN_ENTRIES) ? entries : SDH_MIN_ENTRIES) &&
+      (my_pread(index_file, image, (uint)image_length(), 0, MYF(0)) ==
+       (uint)image_length()) &&
+      check_table())
+  {
+    memset(dirty, 0, dirty_alloc * sizeof(bool));
+    DBUG_RETURN(0);
+  }
+  crashed = true;
+  DBUG_RETURN(reset_table(SDH_MIN_BUCKETS));
+}
+
+/*
+  Write the pages that changed since the index was last saved, then the
+  header. Nothing is written if nothing changed.
+*/
+int Spartan_hash::save_index()
+{
+  long long length;
+  long long offset;
+  int pages;
+  int page;
+  int error = 0;
+
+  DBUG_ENTER("Spartan_hash::save_index");
+  if ((index_file == -1) || clean)
+    DBUG_RETURN(0);
+  length = image_length();
+  pages = (int)((length + SDI_PAGE_SIZE - 1) / SDI_PAGE_SIZE);
+  for (page = 1; page < pages; page++)
+  {
+    if (!dirty[page])
+      continue;
+    offset = (long long)page * SDI_PAGE_SIZE;
+    if (write_file(image + offset,
+                   (int)((length - offset < SDI_PAGE_SIZE) ?
+                         length - offset : SDI_PAGE_SIZE), offset))
+      error = -1;
+    dirty[page] = false;
+  }
+  if (my_seek(index_file, 0L, MY_SEEK_END, MYF(0)) > (my_off_t)length)
+    cut_file(length);
+  if (error == 0)
+    clean = true;
+  write_header();
+  DBUG_RETURN(error);
+}
+
+/* empty the index and cut the file back to the empty table */
+int Spartan_hash::destroy_index()
+{
+  DBUG_ENTER("Spartan_hash::destroy_index");
+  if (max_key_len <= 0)
+    DBUG_RETURN(0);
+  if (index_file != -1)
+    cut_file(SDI_PAGE_SIZE);
+  if (reset_table(SDH_MIN_BUCKETS))
+    DBUG_RETURN(-1);
+  DBUG_RETURN(save_index());
+}
+
+/* truncate the index file: it is written again as an empty table */
+int Spartan_hash::trunc_index()
+{
+  DBUG_ENTER("Spartan_hash::trunc_index");
+  if ((index_file == -1) || (max_key_len <= 0))
+    DBUG_RETURN(0);
+  cut_file(0);
+  crashed = false;
+  if (reset_table(SDH_MIN_BUCKETS))
+    DBUG_RETURN(-1);
+  DBUG_RETURN(save_index());
+}
+
+/*
+  Move every key to the new position of its row after the data file
+  has been rewritten. old_pos is in ascending order and new_pos[i] is
+  where the row at old_pos[i] is now.
+*/
+int Spartan_hash::remap_positions(long long *old_pos, long long *new_pos,
+                                  int count)
+{
+  int *e;
+  long long pos;
+  int bucket;
+  int slot;
+  int lo;
+  int hi;
+  int mid = 0;
+
+  DBUG_ENTER("Spartan_hash::remap_positions");
+  if (image == NULL)
+    DBUG_RETURN(0);
+  for (bucket = 0; bucket < buckets; bucket++)
+  {
+    e = bucket_entry(bucket);
+    for (slot = 0; slot < SDH_BUCKET_SLOTS; slot++)
+    {
+      if (e[slot] < 0)
+        continue;
+      pos = entry_pos(e[slot]);
+      lo = 0;
+      hi = count - 1;
+      while (lo <= hi)
+      {
+        mid = (lo + hi) / 2;
+        if (old_pos[mid] == pos)
+          break;
+        if (old_pos[mid] < pos)
+          lo = mid + 1;
+        else
+          hi = mid - 1;
+      }
+      if ((lo <= hi) && (pos != new_pos[mid]))
+        set_entry_pos(e[slot], new_pos[mid]);
+    }
+  }
+  DBUG_RETURN(0);
+}
+
+/* get the number of keys in the index */
+int Spartan_hash::key_count()
+{
+  DBUG_ENTER("Spartan_hash::key_count");
+  DBUG_RETURN(keys);
+}
+
+/* get the length of the index file once it is saved */
+long long Spartan_hash::index_length()
+{
+  DBUG_ENTER("Spartan_hash::index_length");
+  if (max_key_len <= 0)
+    DBUG_RETURN(0);
+  DBUG_RETURN(image_length());
+}
+
+/*
+  Count the keys from min_key to max_key. Without an order only one
+  whole key (both bounds equal and included) can be counted, or every
+  key if there are no bounds; any other range returns -1.
+*/
+int Spartan_hash::count_range(byte *min_key, int min_len, bool min_incl,
+                              byte *max_key, int max_len, bool max_incl)
+{
+  uint32 hash;
+  int bucket;
+  int slot = 0;
+  int count = 0;
+
+  DBUG_ENTER("Spartan_hash::count_range");
+  if ((min_key == NULL) && (max_key == NULL))
+    DBUG_RETURN(keys);
+  if ((image == NULL) || (min_key == NULL) || (max_key == NULL) ||
+      !min_incl || !max_incl || (min_len < max_key_len) ||
+      (max_len < max_key_len) ||
+      (memcmp(min_key, max_key, max_key_len) != 0))
+    DBUG_RETURN(-1);
+  hash = hash_key(min_key);
+  bucket = hash & (buckets - 1);
+  for (; find_slot(min_key, hash, -1, &bucket, &slot); slot++)
+    count++;
+  DBUG_RETURN(count);
+}
+
+/*
+  Count the distinct keys for each of the parts prefixes as
+  Spartan_index::count_prefixes() does. With no order only whole keys
+  can be told apart, so a shorter prefix gets 0 (not known). A key is
+  counted at the slot a lookup of it finds first.
+*/
+int Spartan_hash::count_prefixes(int *lengths, int parts, ulong *counts)
+{
+  uint32 *h;
+  int *e;
+  int bucket;
+  int slot;
+  int first_bucket;
+  int first_slot;
+  ulong distinct = 0;
+  int p;
+
+  DBUG_ENTER("Spartan_hash::count_prefixes");
+  for (bucket = 0; (image != NULL) && (bucket < buckets); bucket++)
+  {
+    h = bucket_hash(bucket);
+    e = bucket_entry(bucket);
+    for (slot = 0; slot < SDH_BUCKET_SLOTS; slot++)
+    {
+      if (e[slot] < 0)
+        continue;
+      first_bucket = h[slot] & (buckets - 1);
+      first_slot = 0;
+      if (find_slot(entry_key(e[slot]), h[slot], -1, &first_bucket,
+                    &first_slot) &&
+          (first_bucket == bucket) && (first_slot == slot))
+        distinct++;
+    }
+  }
+  for (p = 0; p < parts; p++)
+    counts[p] = (lengths[p] >= max_key_len) ? distinct : 0;
+  DBUG_RETURN(0);
+}
+
+/* is the index marked crashed (the file was not saved or not sound) */
+bool Spartan_hash::is_crashed()
+{
+  DBUG_ENTER("Spartan_hash::is_crashed");
+  DBUG_RETURN(crashed);
+}
+
+/*
+  Check the index a few pages of buckets at a time for CHECK TABLE,
+  which calls this until *from is -1 and lets data_mutex go in between.
+  The buckets of pages pages are walked from bucket *from; each entry
+  must be the one a lookup of its key and position finds and, if dupes
+  are not allowed, the first one a lookup of its key finds. The entries
+  walked are counted in *listed and their fingerprints (see
+  spartan_key_fingerprint()) added to *sum for the caller to compare
+  with the rows. *from is set to the next bucket, or -1 after the last.
+  Returns the number of problems found or -1 on error.
+*/
+int Spartan_hash::check_index(bool allow_dupes, int *from, int pages,
+                              int *listed, ulonglong *sum)
+{
+  byte *key;
+  int *e;
+  uint32 hash;
+  int bucket;
+  int slot;
+  int at_bucket;
+  int at_slot;
+  int end;
+  int bad = 0;
+
+  DBUG_ENTER("Spartan_hash::check_index");
+  if (image == NULL)
+    DBUG_RETURN(-1);
+  end = *from + pages * SDH_MIN_BUCKETS;
+  if (end > buckets)
+    end = buckets;
+  for (bucket = *from; bucket < end; bucket++)
+  {
+    e = bucket_entry(bucket);
+    for (slot = 0; slot < SDH_BUCKET_SLOTS; slot++)
+    {
+      if (e[slot] < 0)
+        continue;
+      key = entry_key(e[slot]);
+      (*listed)++;
+      *sum += spartan_key_fingerprint(key, max_key_len, entry_pos(e[slot]));
+      hash = hash_key(key);
+      at_bucket = hash & (buckets - 1);
+      at_slot = 0;
+      if (!find_slot(key, hash, entry_pos(e[slot]), &at_bucket, &at_slot) ||
+          (at_bucket != bucket) || (at_slot != slot))
+      {
+        bad++;
+        continue;
+      }
+      at_bucket = hash & (buckets - 1);
+      at_slot = 0;
+      if (!allow_dupes &&
+          (!find_slot(key, hash, -1, &at_bucket, &at_slot) ||
+           (at_bucket != bucket) || (at_slot != slot)))
+        bad++;
+    }
+  }
+  *from = (end < buckets) ? end : -1;
+  DBUG_RETURN(bad);
+}
+
+/*
+  Replace the index with the count keys in ndx taken from the rows of
+  the data file (REPAIR TABLE) and write it to disk with the crashed
+  flag cleared. Returns the number of keys in the index or -1 on error.
+*/
+int Spartan_hash::rebuild_index(SDE_INDEX *ndx, int count, bool allow_dupes)
+{
+  int added;
+
+  DBUG_ENTER("Spartan_hash::rebuild_index");
+  crashed = false;
+  destroy_index();
+  if ((added = bulk_insert(ndx, count, allow_dupes)) == -1)
+    DBUG_RETURN(-1);
+  save_index();
+  DBUG_RETURN(added);
+}
@@ -0,0 +1,150 @@
+/*
+  Spartan_hash.h
+
+  This header defines a hash index class for the Spartan data class,
+  used for the keys of a table created with USING HASH. It maps whole
+  keys to row positions like Spartan_index but keeps no order, so a
+  lookup of a key takes O(1) instead of a search down the tree: the
+  optimizer is told the index cannot read ranges or keys in order (see
+  ha_spartan::index_flags()). A Spartan_index whose file is a hash
+  index hands every call on to this class, so the handler uses both
+  the same way.
+
+  The table is open addressing over buckets of SDH_BUCKET_SIZE bytes
+  (a cache line). A bucket holds SDH_BUCKET_SLOTS slots: the hash of
+  each key (CRC32C of the whole key, see Spartan_crc.h) and then the
+  entry it is kept in. A key goes in the bucket its hash picks, or the
+  next bucket with a free slot after it, so a lookup reads one cache
+  line of hashes and compares only keys whose hash matches; it stops
+  at the first bucket with an empty slot. A deleted key leaves its slot
+  deleted (not empty) so the keys after it are still found, unless
+  only empty slots follow it in its bucket. The table is rebuilt twice
+  as large (or the same size, dropping the deleted slots) when more
+  than three quarters of the slots are used.
+
+  The whole file is read into memory when the index is loaded. The
+  pages that changed are written by save_index(); like Spartan_index
+  the header is written with SDI_CRASHED set on the first change after
+  a save and cleared by the next one, and every write is logged first
+  if there is a redo log.
+
+  seek_index() finds the first entry of a key and next_entry() the
+  others with the same key; seek_end(false) starts a walk of every
+  entry in no order. They move the cursor they are given (see
+  Spartan_index.h). Keys inserted while a walk is under way may
+  rebuild the table, which ends the walk.
+
+  File Layout:
+    SOF                              max_key_len (int)
+    SOF + sizeof(int)                flags (byte, SDI_HASHED set)
+    SOF + 5                          number of buckets (int)
+    SOF + 9                          number of entries (int)
+    SOF + 13                         number of keys (int)
+    SOF + 17                         slots used or deleted (int)
+    SOF + 21                         first free entry (int)
+    SOF + SDI_PAGE_SIZE              BUCKETS BEGIN HERE
+  Each bucket is SDH_BUCKET_SLOTS hashes (uint32) and as many entry
+  numbers (int, SDH_EMPTY or SDH_DELETED if the slot has none). The
+  entries follow the buckets, each the key (max_key_len bytes) and the
+  row position (long long). Free entries are chained through their row
+  position.
+*/
+#pragma once
+#pragma unmanaged
+#include "spartan_index.h"
+
+/* size of a bucket (a cache line) */
+const int SDH_BUCKET_SIZE = 64;
+
+/* slots in a bucket: a hash (uint32) and an entry number (int) each */
+const int SDH_BUCKET_SLOTS = SDH_BUCKET_SIZE / (sizeof(uint32) + sizeof(int));
+
+/* entry number of an empty slot and of a slot whose key was deleted */
+const int SDH_EMPTY = -1;
+const int SDH_DELETED = -2;
+
+/* buckets of a new table (one page) */
+const int SDH_MIN_BUCKETS = SDI_PAGE_SIZE / SDH_BUCKET_SIZE;
+
+/* entries allocated at first */
+const int SDH_MIN_ENTRIES = 64;
+
+/* size of the header */
+const long SDH_HEADER_SIZE = METADATA_SIZE + 5 * sizeof(int);
+
+class Spartan_hash
+{
+public:
+  Spartan_hash(void);
+  ~Spartan_hash(void);
+  int open_index(char *path);
+  int create_index(char *path, int keylen);
+  int insert_key(SDE_INDEX *ndx, bool allow_dupes);
+  int bulk_insert(SDE_INDEX *ndx, int count, bool allow_dupes);
+  int delete_key(byte *buf, long long pos, int key_len);
+  int update_key(byte *old_key, long long old_pos, byte *buf, long long pos,
+                 int key_len);
+  long long get_index_pos(byte *buf, int key_len);
+  SDE_INDEX *seek_index(byte *key, int key_len, SDE_CURSOR *cur);
+  SDE_INDEX *next_entry(SDE_CURSOR *cur);
+  SDE_INDEX *seek_end(bool last, SDE_CURSOR *cur);
+  int close_index();
+  int load_index();
+  int destroy_index();
+  int save_index();
+  int trunc_index();
+  int remap_positions(long long *old_pos, long long *new_pos, int count);
+  int key_count();
+  long long index_length();
+  int count_range(byte *min_key, int min_len, bool min_incl,
+                  byte *max_key, int max_len, bool max_incl);
+  int count_prefixes(int *lengths, int parts, ulong *counts);
+  bool is_crashed();
+  int check_index(bool allow_dupes, int *from, int pages, int *listed,
+                  ulonglong *sum);
+  int rebuild_index(SDE_INDEX *ndx, int count, bool allow_dupes);
+  void set_log(Spartan_log *new_log, int inx);
+private:
+  File index_file;
+  Spartan_log *log;          /* redo log for writes to the file (or NULL) */
+  int log_inx;               /* number of the file in the log */
+  int max_key_len;
+  int entry_len;             /* size of an entry */
+  int buckets;               /* buckets in the table (a power of two) */
+  int entries;               /* entries in the file (used or free) */
+  int entry_alloc;           /* entries there is room for in memory */
+  int keys;                  /* number of keys in the index */
+  int used;                  /* slots used or deleted */
+  int free_head;             /* first free entry (-1 = none) */
+  bool crashed;
+  bool clean;                /* the file matches the table in memory */
+  byte *image;               /* the file in memory */
+  bool *dirty;               /* pages of image changed since the save */
+  int dirty_alloc;           /* pages dirty has room for */
+  ulong rebuilds;            /* times the table was rebuilt (ends walks) */
+  int reset_table(int new_buckets);
+  int read_header();
+  int write_header();
+  int write_file(byte *buf, int length, long long position);
+  int cut_file(long long length);
+  long long image_length();
+  long long entry_start();
+  uint32 *bucket_hash(int bucket);
+  int *bucket_entry(int bucket);
+  byte *entry_key(int entry);
+  long long entry_pos(int entry);
+  void set_entry_pos(int entry, long long pos);
+  uint32 hash_key(byte *key);
+  void mark_dirty(long long offset, long length);
+  int grow_image(int new_alloc);
+  int new_entry();
+  void free_entry(int entry);
+  int rehash(int new_buckets);
+  int make_room();
+  void put_slot(uint32 hash, int entry);
+  void clear_slot(int bucket, int slot);
+  bool find_slot(byte *key, uint32 hash, long long pos, int *bucket,
+                 int *slot);
+  SDE_INDEX *scan_entry(SDE_CURSOR *cur);
+  bool check_table();
+};
@@ -2,36 +2,118 @@
   Spartan_index.cpp
 
   This class reads and writes an index file for use with the Spartan data 
-  class. The file format is a simple binary storage of the 
-  Spartan_index::SDE_INDEX structure. The size of the key can be set via 
-  the constructor.
+  class. The file is a B+tree of fixed size pages each holding as many
+  keys as fit in SDI_PAGE_SIZE bytes (see Spartan_index.h). The size of
+  the key can be set via the constructor.
 */
 #include "Spartan_index.h"
+#include "Spartan_hash.h"
 #include <my_dir.h>
 
+/*
+  Order two keys the way insert_key() orders the list. Equal keys stay
+  in the order they were given in (the order of the pointers).
+*/
+static int cmp_index_ptr(const void *a, const void *b)
+{
+  SDE_INDEX *x = *(SDE_INDEX **)a;
+  SDE_INDEX *y = *(SDE_INDEX **)b;
+  int icmp;
+
+  DBUG_ENTER("cmp_index_ptr");
+  icmp = memcmp(x->key, y->key,
+                (x->length > y->length) ? x->length : y->length);
+  if (icmp == 0)
+    icmp = (x < y) ? -1 : ((x > y) ? 1 : 0);
+  DBUG_RETURN(icmp);
+}
+
 /* constuctor takes the maximum key length for the keys */
 Spartan_index::Spartan_index(int keylen)
 {
-  root = NULL;
+  root = 0;
+  pages = 1;
+  free_head = 0;
+  keys = 0;
   crashed = false;
+  checksums = true;
+  paged = true;
+  old_pages = false;
+  clean = true;
+  cache = NULL;
+  cache_size = 0;
+  cached = 0;
+  newest = NULL;
+  oldest = NULL;
+  page_buf = NULL;
+  split_keys = NULL;
+  split_child = NULL;
+  lost = NULL;
+  log = NULL;
+  log_inx = 0;
+  hash = NULL;
+  depth = 0;
+  cursors = &own;
+  own.next = NULL;
+  reset_cursors();
   max_key_len = keylen;
   index_file = -1;
-  block_size = max_key_len + sizeof(long long) + sizeof(int);
+  set_block_size();
 }
 
 /* constuctor (overloaded) assumes existing file */
 Spartan_index::Spartan_index()
 {
-  root = NULL;
+  root = 0;
+  pages = 1;
+  free_head = 0;
+  keys = 0;
   crashed = false;
+  checksums = false;
+  paged = false;
+  old_pages = false;
+  clean = true;
+  cache = NULL;
+  cache_size = 0;
+  cached = 0;
+  newest = NULL;
+  oldest = NULL;
+  page_buf = NULL;
+  split_keys = NULL;
+  split_child = NULL;
+  lost = NULL;
+  log = NULL;
+  log_inx = 0;
+  hash = NULL;
+  depth = 0;
+  cursors = &own;
+  own.next = NULL;
+  reset_cursors();
   max_key_len = -1;
   index_file = -1;
   block_size = -1;
+  page_size = 0;
+  leaf_keys = 0;
+  inner_keys = 0;
 }
 
 /* destructor */
 Spartan_index::~Spartan_index(void)
 {
+  drop_cache();
+  if (cache != NULL)
+    my_free((gptr)cache, MYF(0));
+  if (page_buf != NULL)
+    my_free((gptr)page_buf, MYF(0));
+  if (split_keys != NULL)
+    my_free((gptr)split_keys, MYF(0));
+  if (lost != NULL)
+  {
+    my_free((gptr)lost->data, MYF(MY_ALLOW_ZERO_PTR));
+    delete lost;
+  }
+  if (hash != NULL)
+    delete hash;
 }
 
 /* create the index file */
@@ -40,18 +122,139 @@ int Spartan_index::create_index(char *path, int keylen)
   DBUG_ENTER("Spartan_index::create_index");
   open_index(path);
   max_key_len = keylen;
-  /* 
-    Block size is the key length plus the size of the index
-    length variable.
-  */
-  block_size = max_key_len + sizeof(long long);
+  crashed = false;
+  checksums = true;
+  paged = true;
+  old_pages = false;
+  set_block_size();
+  reset_tree();
   write_header();  
   DBUG_RETURN(0);
 }
 
+/*
+  Create the index file as a hash index (see Spartan_hash.h), which
+  every call is then handed on to.
+*/
+int Spartan_index::create_hash(char *path, int keylen)
+{
+  DBUG_ENTER("Spartan_index::create_hash");
+  close_index();
+  hash = new Spartan_hash();
+  hash->set_log(log, log_inx);
+  DBUG_RETURN(hash->create_index(path, keylen));
+}
+
+/*
+  Work out the size of an entry in an older file (the key, the row
+  position, the key length and the checksum if there is one) and how
+  many entries a node may hold, and get a buffer for a page and for the
+  entries of a node being split.
+
+  A node holds as many entries as fit in the page, which is more the
+  longer the prefix of its keys is. It may hold no more than two less
+  than twice the number that fit without a prefix, so when an entry
+  added to a full node is left without a prefix the two halves of the
+  split still fit.
+*/
+void Spartan_index::set_block_size()
+{
+  SDE_INDEX *more;
+  byte *buf;
+  int most;
+
+  DBUG_ENTER("Spartan_index::set_block_size");
+  block_size = max_key_len + sizeof(long long) + sizeof(int);
+  if (checksums)
+    block_size += sizeof(uint32);
+  page_size = SDI_PAGE_SIZE;
+  leaf_keys = 2 * ((SDI_PAGE_SIZE - SDI_PAGE_HEADER) /
+                   entry_size(true, 0)) - 2;
+  inner_keys = 2 * ((SDI_PAGE_SIZE - SDI_PAGE_HEADER) /
+                    entry_size(false, 0)) - 2;
+  buf = (byte *)my_realloc((gptr)page_buf, page_size,
+                           MYF(MY_WME | MY_ALLOW_ZERO_PTR));
+  if (buf != NULL)
+    page_buf = buf;
+  most = ((leaf_keys > inner_keys) ? leaf_keys : inner_keys) + 1;
+  more = (SDE_INDEX *)my_realloc((gptr)split_keys,
+                                 most * (sizeof(SDE_INDEX) + sizeof(int)),
+                                 MYF(MY_WME | MY_ALLOW_ZERO_PTR));
+  if (more != NULL)
+  {
+    split_keys = more;
+    split_child = (int *)(split_keys + most);
+  }
+  DBUG_VOID_RETURN;
+}
+
+/* forget the tree: the index is empty */
+void Spartan_index::reset_tree()
+{
+  DBUG_ENTER("Spartan_index::reset_tree");
+  drop_cache();
+  root = 0;
+  pages = 1;
+  free_head = 0;
+  keys = 0;
+  reset_cursors();
+  clean = true;
+  DBUG_VOID_RETURN;
+}
+
+/* set every cursor on the index to no entry */
+void Spartan_index::reset_cursors()
+{
+  SDE_CURSOR *cur;
+
+  DBUG_ENTER("Spartan_index::reset_cursors");
+  for (cur = cursors; cur != NULL; cur = cur->next)
+  {
+    cur->page = 0;
+    cur->slot = 0;
+    cur->bucket = -1;
+  }
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Add cur to the cursors set on the index, which are kept on their keys
+  as keys are inserted and removed, and set it to no entry. The caller
+  removes it (remove_cursor()) before it goes away.
+*/
+void Spartan_index::add_cursor(SDE_CURSOR *cur)
+{
+  DBUG_ENTER("Spartan_index::add_cursor");
+  cur->page = 0;
+  cur->slot = 0;
+  cur->bucket = -1;
+  cur->next = own.next;
+  own.next = cur;
+  DBUG_VOID_RETURN;
+}
+
+/* take cur out of the cursors set on the index */
+void Spartan_index::remove_cursor(SDE_CURSOR *cur)
+{
+  SDE_CURSOR *c;
+
+  DBUG_ENTER("Spartan_index::remove_cursor");
+  for (c = cursors; c != NULL; c = c->next)
+  {
+    if (c->next == cur)
+    {
+      c->next = cur->next;
+      break;
+    }
+  }
+  DBUG_VOID_RETURN;
+}
+
 /* open index specified as path (pat+filename) */
 int Spartan_index::open_index(char *path)
 {
+  byte header[METADATA_SIZE];
+
   DBUG_ENTER("Spartan_index::open_index");
   /*
     Open the file with read/write mode,
@@ -61,92 +264,151 @@ int Spartan_index::open_index(char *path)
   index_file = my_open(path, O_RDWR | O_CREAT | O_BINARY | O_SHARE, MYF(0));
   if(index_file == -1)
     DBUG_RETURN(errno);
+  /*
+    A hash index (SDI_HASHED in the flags) is opened by Spartan_hash and
+    every call is handed on to it.
+  */
+  if ((my_pread(index_file, header, METADATA_SIZE, 0, MYF(0)) ==
+       METADATA_SIZE) && (header[sizeof(int)] & SDI_HASHED))
+  {
+    my_close(index_file, MYF(0));
+    index_file = -1;
+    hash = new Spartan_hash();
+    hash->set_log(log, log_inx);
+    DBUG_RETURN(hash->open_index(path));
+  }
+  if (log != NULL)
+    log->set_index(log_inx, index_file);
   read_header();
   DBUG_RETURN(0);
 }
 
-/* read header from file */
+/*
+  Read header from file. A new (empty) file has none; create_index()
+  writes it.
+*/
 int Spartan_index::read_header()
 {
   int i;
-  byte len;
+  byte flags = 0;
+  int fields[4];
 
   DBUG_ENTER("Spartan_index::read_header");
-  if (block_size == -1)
+  reset_tree();
+  /*
+    Seek the start of the file.
+    Read the maximum key length value.
+  */
+  my_seek(index_file, 0l, MY_SEEK_SET, MYF(0));
+  i = my_read(index_file, (byte *)&max_key_len, sizeof(int), MYF(0));
+  if (i != sizeof(int))
+    DBUG_RETURN(0);
+  /*
+    Read the flags byte (once just the crashed status) and calculate
+    the block size from them. A paged file goes on with the root, the
+    page count, the key count and the free list.
+  */
+  i = my_read(index_file, &flags, sizeof(bool), MYF(0));
+  crashed = ((flags & SDI_CRASHED) != 0);
+  checksums = ((flags & SDI_CHECKSUMS) != 0);
+  paged = ((flags & SDI_PAGED) != 0) && ((flags & SDI_PACKED) != 0);
+  old_pages = ((flags & SDI_PAGED) != 0) && !paged;
+  set_block_size();
+  if ((flags & SDI_PAGED) != 0)
   {  
-    /*
-      Seek the start of the file.
-      Read the maximum key length value.
-    */
-    my_seek(index_file, 0l, MY_SEEK_SET, MYF(0));
-    i = my_read(index_file, &len, sizeof(int), MYF(0));
-    memcpy(&max_key_len, &len, sizeof(int));
-    /*
-      Calculate block size as maximum key length plus
-      the size of the key plus the crashed status byte.
-    */
-    block_size = max_key_len + sizeof(long long) + sizeof(int);
-    i = my_read(index_file, &len, sizeof(bool), MYF(0));
-    memcpy(&crashed, &len, sizeof(bool));
-  }
-  else
-  {
-    i = (int)my_seek(index_file, sizeof(int) + sizeof(bool), MY_SEEK_SET, MYF(0));
+    i = my_read(index_file, (byte *)fields, sizeof(fields), MYF(0));
+    if (i != sizeof(fields))
+    {
+      crashed = true;
+      DBUG_RETURN(0);
+    }
+    root = fields[0];
+    pages = fields[1];
+    keys = fields[2];
+    free_head = fields[3];
   }
   DBUG_RETURN(0);
 }
 
-/* write header to file */
+/*
+  Write header to file. SDI_CRASHED is set while pages in memory are
+  not yet written.
+*/
 int Spartan_index::write_header()
 {
-  int i;
-  byte len;
+  byte header[SDI_HEADER_SIZE];
+  int fields[4];
+  int i = 0;
 
   DBUG_ENTER("Spartan_index::write_header");
   if (block_size != -1)
   {
     /*
-      Seek the start of the file and write the maximum key length
-      then write the crashed status byte.
+      Write the maximum key length then the flags byte and the rest of
+      the header at the start of the file.
     */
-    my_seek(index_file, 0l, MY_SEEK_SET, MYF(0));
-    memcpy(&len, &max_key_len, sizeof(int));
-    i = my_write(index_file, &len, sizeof(int), MYF(0));
-    memcpy(&len, &crashed, sizeof(bool));
-    i = my_write(index_file, &len, sizeof(bool), MYF(0));
+    memcpy(header, &max_key_len, sizeof(int));
+    header[sizeof(int)] = ((crashed || !clean) ? SDI_CRASHED : 0) |
+                          (checksums ? SDI_CHECKSUMS : 0) |
+                          (paged ? (SDI_PAGED | SDI_PACKED) : 0);
+    fields[0] = root;
+    fields[1] = pages;
+    fields[2] = keys;
+    fields[3] = free_head;
+    memcpy(header + METADATA_SIZE, fields, sizeof(fields));
+    i = write_file(header, paged ? SDI_HEADER_SIZE : METADATA_SIZE, 0);
+  }
+  DBUG_RETURN(i);
+}
+
+/*
+  Write length bytes of buf at position of the file, logging them first
+  if there is a redo log. Returns 0 or -1 on error.
+*/
+int Spartan_index::write_file(byte *buf, int length, long long position)
+{
+  long long lsn;
+
+  DBUG_ENTER("Spartan_index::write_file");
+  if (log != NULL)
+  {
+    lsn = log->write_record(SDL_INDEX + log_inx * SDL_INDEX_STEP, position,
+                            buf, length);
+    if ((lsn == -1) || log->write_log(lsn))
+      DBUG_RETURN(-1);
   }
+  if (my_pwrite(index_file, buf, length, position, MYF(MY_WME)) !=
+      (uint)length)
+    DBUG_RETURN(-1);
   DBUG_RETURN(0);
 }
 
-/* write a row (SDE_INDEX struct) to the index file */
-long long Spartan_index::write_row(SDE_INDEX *ndx)
+/* cut the file to length bytes (logged like a write) */
+int Spartan_index::cut_file(long long length)
 {
-  long long pos;
-  int i;
-  int len;
+  DBUG_ENTER("Spartan_index::cut_file");
+  if (log != NULL)
+    log->write_log(log->write_record(SDL_INDEX_TRUNCATE +
+                                     log_inx * SDL_INDEX_STEP,
+                                     length, NULL, 0));
+  DBUG_RETURN(my_chsize(index_file, length, 0, MYF(MY_WME)));
+}
 
-  DBUG_ENTER("Spartan_index::write_row");
-  /* 
-     Seek the end of the file (always append)
-  */
-  pos = my_seek(index_file, 0l, MY_SEEK_END, MYF(0));
-  /*
-    Write the key value.
-  */
-  i = my_write(index_file, ndx->key, max_key_len, MYF(0));
-  memcpy(&pos, &ndx->pos, sizeof(long long));
-  /*
-    Write the file position for the key value.
-  */
-  i = i + my_write(index_file, (byte *)&pos, sizeof(long long), MYF(0));
-  memcpy(&len, &ndx->length, sizeof(int));
-  /*
-    Write the length of the key.
-  */
-  i = i + my_write(index_file, (byte *)&len, sizeof(int), MYF(0));
-  if (i == -1)
-    pos = i; 
-  DBUG_RETURN(pos);
+/*
+  Attach the redo log (NULL = none) the writes to the file are logged
+  in, as index file inx of the log (one log is shared by the indexes of
+  a table). The log is told which file they go to.
+*/
+void Spartan_index::set_log(Spartan_log *new_log, int inx)
+{
+  DBUG_ENTER("Spartan_index::set_log");
+  log = new_log;
+  log_inx = inx;
+  if (hash != NULL)
+    hash->set_log(log, log_inx);
+  else if (log != NULL)
+    log->set_index(log_inx, index_file);
+  DBUG_VOID_RETURN;
 }
 
 /* read a row (SDE_INDEX struct) from the index file */
@@ -181,337 +443,1673 @@ SDE_INDEX *Spartan_index::read_row(long long Position)
   DBUG_RETURN(ndx);
 }
 
-/* insert a key into the index in memory */
-int Spartan_index::insert_key(SDE_INDEX *ndx, bool allow_dupes)
+/*
+  Read the page of n from the file into n. Returns 0, or -1 if it could
+  not be read, does not match its checksum or its entries do not fit.
+*/
+int Spartan_index::read_page(SDE_BTREE_NODE *n)
 {
-  SDE_NDX_NODE *p = NULL;
-  SDE_NDX_NODE *n = NULL;
-  SDE_NDX_NODE *o = NULL;
-  int i = -1;
-  int icmp;
-  bool dupe = false;
-  bool done = false;
+  uint32 crc;
+  uint16 prefix;
 
-  DBUG_ENTER("Spartan_index::insert_key");
-  /*
-    If this is a new index, insert first key as the root node.
-  */
-  if (root == NULL)
-  {
-    root = new SDE_NDX_NODE();
-    root->next = NULL;
-    root->prev = NULL;
-    memcpy(root->key_ndx.key, ndx->key, max_key_len);
-    root->key_ndx.pos = ndx->pos;
-    root->key_ndx.length = ndx->length;
-  }
-  else //set pointer to root
-    p = root;
-  /*
-    Loop through the linked list until a value greater than the
-    key to be inserted, then insert new key before that one.
-  */
-  while ((p != NULL) && !done)
+  DBUG_ENTER("Spartan_index::read_page");
+  if (my_pread(index_file, n->data, SDI_PAGE_SIZE,
+               (my_off_t)n->page * SDI_PAGE_SIZE, MYF(0)) !=
+      (uint)SDI_PAGE_SIZE)
+    DBUG_RETURN(-1);
+  memcpy(&crc, n->data + SDI_PAGE_CRC, sizeof(uint32));
+  memset(n->data + SDI_PAGE_CRC, 0, sizeof(uint32));
+  if (spartan_crc32c(0, n->data, SDI_PAGE_SIZE) != crc)
+    DBUG_RETURN(-1);
+  n->leaf = (n->data[0] != 0);
+  memcpy(&n->count, n->data + sizeof(bool), sizeof(int));
+  memcpy(&n->next, n->data + sizeof(bool) + sizeof(int), sizeof(int));
+  memcpy(&n->prev, n->data + sizeof(bool) + 2 * sizeof(int), sizeof(int));
+  memcpy(&prefix, n->data + SDI_PAGE_PREFIX, sizeof(uint16));
+  n->prefix = prefix;
+  if ((n->prefix > max_key_len) || (n->count < 0) ||
+      (n->count > max_entries(n->leaf)) ||
+      (SDI_PAGE_HEADER + n->prefix +
+       n->count * entry_size(n->leaf, n->prefix) > SDI_PAGE_SIZE))
+    DBUG_RETURN(-1);
+  DBUG_RETURN(0);
+}
+
+/*
+  Write n to its page of the file: the header is filled in from n and
+  the bytes after the last entry are cleared.
+*/
+int Spartan_index::write_page(SDE_BTREE_NODE *n)
+{
+  uint32 crc;
+  uint16 prefix = (uint16)n->prefix;
+  int used;
+
+  DBUG_ENTER("Spartan_index::write_page");
+  n->data[0] = n->leaf ? 1 : 0;
+  memcpy(n->data + sizeof(bool), &n->count, sizeof(int));
+  memcpy(n->data + sizeof(bool) + sizeof(int), &n->next, sizeof(int));
+  memcpy(n->data + sizeof(bool) + 2 * sizeof(int), &n->prev, sizeof(int));
+  memset(n->data + SDI_PAGE_CRC, 0, sizeof(uint32));
+  memcpy(n->data + SDI_PAGE_PREFIX, &prefix, sizeof(uint16));
+  used = SDI_PAGE_HEADER + n->prefix +
+         n->count * entry_size(n->leaf, n->prefix);
+  memset(n->data + used, 0, SDI_PAGE_SIZE - used);
+  crc = spartan_crc32c(0, n->data, SDI_PAGE_SIZE);
+  memcpy(n->data + SDI_PAGE_CRC, &crc, sizeof(uint32));
+  if (write_file(n->data, SDI_PAGE_SIZE, (long long)n->page * SDI_PAGE_SIZE))
+    DBUG_RETURN(-1);
+  n->dirty = false;
+  DBUG_RETURN(0);
+}
+
+/*
+  Get a node for page in the cache as the most recently used one. The
+  node is not read.
+*/
+SDE_BTREE_NODE *Spartan_index::cache_node(int page)
+{
+  SDE_BTREE_NODE **more;
+  SDE_BTREE_NODE *n;
+  int size;
+
+  DBUG_ENTER("Spartan_index::cache_node");
+  if (page >= cache_size)
   {
-    icmp = memcmp(ndx->key, p->key_ndx.key, 
-                 (ndx->length > p->key_ndx.length) ? 
-                  ndx->length : p->key_ndx.length);
-    if (icmp > 0) // key is greater than current key in list
-    {
-      n = p;
-      p = p->next;
-    }
-    /*
-      If dupes not allowed, stop and return NULL
-    */
-    else if (!allow_dupes && (icmp == 0))
-    {
-      p = NULL;
-      dupe = true; 
-    }
-    else
-    {
-      n = p->prev; //stop, insert at n->prev
-      done = true;
-    }
+    size = (page >= 2 * cache_size) ? page + 1 : 2 * cache_size;
+    more = (SDE_BTREE_NODE **)my_realloc((gptr)cache,
+                                         size * sizeof(SDE_BTREE_NODE *),
+                                         MYF(MY_WME | MY_ALLOW_ZERO_PTR));
+    if (more == NULL)
+      DBUG_RETURN(NULL);
+    memset(more + cache_size, 0,
+           (size - cache_size) * sizeof(SDE_BTREE_NODE *));
+    cache = more;
+    cache_size = size;
   }
-  /*
-    If position found (n != NULL) and dupes permitted,
-    insert key. If p is NULL insert at end else insert in middle
-    of list.
-  */
-  if ((n != NULL) && !dupe)
+  n = new SDE_BTREE_NODE();
+  n->data = (byte *)my_malloc(SDI_PAGE_SIZE, MYF(MY_WME));
+  if (n->data == NULL)
   {
-    if (p == NULL) //insert at end
-    {
-      p = new SDE_NDX_NODE();
-      n->next = p;
-      p->prev = n;
-      memcpy(p->key_ndx.key, ndx->key, max_key_len);
-      p->key_ndx.pos = ndx->pos;
-      p->key_ndx.length = ndx->length;
-    }
-    else
-    {
-      o = new SDE_NDX_NODE();
-      memcpy(o->key_ndx.key, ndx->key, max_key_len);
-      o->key_ndx.pos = ndx->pos;
-      o->key_ndx.length = ndx->length;
-      o->next = p;
-      o->prev = n;
-      n->next = o;
-      p->prev = o;
-    }
-    i = 1;
+    delete n;
+    DBUG_RETURN(NULL);
   }
-  DBUG_RETURN(i);
+  n->page = page;
+  n->prefix = 0;
+  n->leaf = true;
+  n->count = 0;
+  n->next = 0;
+  n->prev = 0;
+  n->dirty = false;
+  n->newer = NULL;
+  n->older = newest;
+  if (newest != NULL)
+    newest->newer = n;
+  else
+    oldest = n;
+  newest = n;
+  cache[page] = n;
+  cached++;
+  DBUG_RETURN(n);
 }
 
-/* delete a key from the index in memory. Note:
-   position is included for indexes that allow dupes */
-int Spartan_index::delete_key(byte *buf, long long pos, int key_len)
+/*
+  Get the node of a page, reading it if it is not in memory. A page
+  that cannot be read is taken as an empty leaf and the index is marked
+  crashed. The node stays in memory until the next trim_cache().
+*/
+SDE_BTREE_NODE *Spartan_index::get_page(int page)
 {
-  SDE_NDX_NODE *p;
-  int icmp;
-  int buf_len;
-  bool done = false;
+  SDE_BTREE_NODE *n;
 
-  DBUG_ENTER("Spartan_index::delete_key");
-  p = root;
-  /*
-    Search for the key in the list. If found, delete it!
-  */
-  while ((p != NULL) && !done)
+  DBUG_ENTER("Spartan_index::get_page");
+  if ((page < cache_size) && ((n = cache[page]) != NULL))
   {
-    buf_len = p->key_ndx.length;
-    icmp = memcmp(buf, p->key_ndx.key, 
-                 (buf_len > key_len) ? buf_len : key_len);
-    if (icmp == 0)
+    /*
+      Move it to the front of the list.
+    */
+    if (n != newest)
     {
-      if (pos != -1)
-        if (pos == p->key_ndx.pos)
-          done = true;
+      n->newer->older = n->older;
+      if (n->older != NULL)
+        n->older->newer = n->newer;
       else
-        done = true;
+        oldest = n->newer;
+      n->newer = NULL;
+      n->older = newest;
+      newest->newer = n;
+      newest = n;
     }
-    else
-      p = p->next;
+    DBUG_RETURN(n);
   }
-  if (p != NULL)
+  if ((page <= 0) || (page >= pages))
   {
     /*
-      Reset pointers for deleted node in list.
+      A page that is not in the file (the index is damaged) is an
+      empty leaf that is never written.
     */
-    if (p->next != NULL)
-      p->next->prev = p->prev;
-    if (p->prev != NULL)
-      p->prev->next = p->next;
-    else
-      root = p->next;
-    delete p;
+    crashed = true;
+    if (lost == NULL)
+    {
+      lost = new SDE_BTREE_NODE();
+      lost->data = (byte *)my_malloc(SDI_PAGE_SIZE, MYF(MY_WME));
+    }
+    lost->page = -1;
+    lost->prefix = 0;
+    lost->leaf = true;
+    lost->count = 0;
+    lost->next = 0;
+    lost->prev = 0;
+    DBUG_RETURN(lost);
   }
-  DBUG_RETURN(0);
+  n = cache_node(page);
+  if ((n != NULL) && read_page(n))
+  {
+    crashed = true;
+    n->prefix = 0;
+    n->leaf = true;
+    n->count = 0;
+    n->next = 0;
+    n->prev = 0;
+  }
+  DBUG_RETURN(n);
 }
 
-/* update key in place (so if key changes!) */
-int Spartan_index::update_key(byte *buf, long long pos, int key_len)
+/* get an empty node on a free page (or a new one at the end) */
+SDE_BTREE_NODE *Spartan_index::new_page(bool leaf)
 {
-  SDE_NDX_NODE *p;
-  bool done = false;
+  SDE_BTREE_NODE *n;
 
-  DBUG_ENTER("Spartan_index::update_key");
-  p = root;
-  /*
-    Search for the key.
-  */
-  while ((p != NULL) && !done)
-  {
-    if (p->key_ndx.pos == pos)
-      done = true;
-    else
-      p = p->next;
-  }
-  /*
-    If key found, overwrite key value in node.
-  */
-  if (p != NULL)
+  DBUG_ENTER("Spartan_index::new_page");
+  if (free_head != 0)
   {
-    memcpy(p->key_ndx.key, buf, key_len);
+    n = get_page(free_head);
+    free_head = n->next;
   }
-  DBUG_RETURN(0);
+  else
+    n = cache_node(pages++);
+  n->prefix = 0;
+  n->leaf = leaf;
+  n->count = 0;
+  n->next = 0;
+  n->prev = 0;
+  mark_dirty(n);
+  DBUG_RETURN(n);
 }
 
-/* get the current position of the key in the index file */
-long long Spartan_index::get_index_pos(byte *buf, int key_len)
+/* put the page of n on the free list */
+void Spartan_index::free_page(SDE_BTREE_NODE *n)
 {
-  long long pos = -1;
-
-  DBUG_ENTER("Spartan_index::get_index_pos");
-  SDE_INDEX *ndx;
-  ndx = seek_index(buf, key_len);
-  if (ndx != NULL)
-    pos = ndx->pos;
-  DBUG_RETURN(pos);
+  DBUG_ENTER("Spartan_index::free_page");
+  if (n->page <= 0)
+    DBUG_VOID_RETURN;
+  n->prefix = 0;
+  n->leaf = true;
+  n->count = 0;
+  n->next = free_head;
+  n->prev = 0;
+  free_head = n->page;
+  mark_dirty(n);
+  DBUG_VOID_RETURN;
 }
 
-/* get next key in list */
-byte *Spartan_index::get_next_key()
+/*
+  Note that n has changed. The first change after the file was saved
+  marks it crashed until it is saved again.
+*/
+void Spartan_index::mark_dirty(SDE_BTREE_NODE *n)
 {
-  byte *key = 0;
-
-  DBUG_ENTER("Spartan_index::get_next_key");
-  if (range_ptr != NULL)
+  DBUG_ENTER("Spartan_index::mark_dirty");
+  n->dirty = true;
+  if (clean)
   {
-    key = (byte *)my_malloc(max_key_len, MYF(MY_ZEROFILL | MY_WME));
-    memcpy(key, range_ptr->key_ndx.key, range_ptr->key_ndx.length);
-    range_ptr = range_ptr->next;
+    clean = false;
+    write_header();
   }
-  DBUG_RETURN(key);
+  DBUG_VOID_RETURN;
 }
 
-/* get prev key in list */
-byte *Spartan_index::get_prev_key()
+/* write every changed page and then the header */
+int Spartan_index::flush_pages()
 {
-  byte *key = 0;
+  SDE_BTREE_NODE *n;
+  int error = 0;
 
-  DBUG_ENTER("Spartan_index::get_prev_key");
-  if (range_ptr != NULL)
-  {
-    key = (byte *)my_malloc(max_key_len, MYF(MY_ZEROFILL | MY_WME));
-    memcpy(key, range_ptr->key_ndx.key, range_ptr->key_ndx.length);
-    range_ptr = range_ptr->prev;
-  }
-  DBUG_RETURN(key);
+  DBUG_ENTER("Spartan_index::flush_pages");
+  for (n = oldest; n != NULL; n = n->newer)
+    if (n->dirty && write_page(n))
+      error = -1;
+  if (error == 0)
+    clean = true;
+  write_header();
+  DBUG_RETURN(error);
 }
 
-/* get first key in list */
-byte *Spartan_index::get_first_key()
+/*
+  Drop the least recently used nodes (writing the changed ones) until
+  no more than limit are left. No node got before the call may be used
+  after it.
+*/
+void Spartan_index::trim_cache(int limit)
 {
-  SDE_NDX_NODE *n = root;
-  byte *key = 0;
+  SDE_BTREE_NODE *n;
 
-  DBUG_ENTER("Spartan_index::get_first_key");
-  if (root != NULL)
+  DBUG_ENTER("Spartan_index::trim_cache");
+  while ((cached > limit) && (oldest != NULL))
   {
-    key = (byte *)my_malloc(max_key_len, MYF(MY_ZEROFILL | MY_WME));
-    memcpy(key, n->key_ndx.key, n->key_ndx.length);
+    n = oldest;
+    if (n->dirty)
+      write_page(n);
+    oldest = n->newer;
+    if (oldest != NULL)
+      oldest->older = NULL;
+    else
+      newest = NULL;
+    cache[n->page] = NULL;
+    cached--;
+    my_free((gptr)n->data, MYF(0));
+    delete n;
   }
-  DBUG_RETURN(key);
+  DBUG_VOID_RETURN;
 }
 
-/* get last key in list */
-byte *Spartan_index::get_last_key()
+/* drop every node in memory without writing it */
+void Spartan_index::drop_cache()
 {
-  SDE_NDX_NODE *n = root;
-  byte *key = 0;
+  SDE_BTREE_NODE *n;
 
-  DBUG_ENTER("Spartan_index::get_last_key");
-  while (n->next != NULL)
-    n = n->next;
-  if (n != NULL)
+  DBUG_ENTER("Spartan_index::drop_cache");
+  while (oldest != NULL)
   {
-    key = (byte *)my_malloc(max_key_len, MYF(MY_ZEROFILL | MY_WME));
-    memcpy(key, n->key_ndx.key, n->key_ndx.length);
+    n = oldest;
+    oldest = n->newer;
+    cache[n->page] = NULL;
+    my_free((gptr)n->data, MYF(0));
+    delete n;
   }
-  DBUG_RETURN(key);
+  newest = NULL;
+  cached = 0;
+  DBUG_VOID_RETURN;
 }
 
-/* just close the index */
-int Spartan_index::close_index()
+/*
+  Compare the key of ndx with key (key_len bytes) the way the index is
+  ordered. The keys are bytes: the handler puts each part of a key in
+  as its sort image (see ha_spartan::make_key()), so memcmp() orders
+  them part by part as the server does.
+*/
+static int cmp_key(SDE_INDEX *ndx, byte *key, int key_len)
 {
-  SDE_NDX_NODE *p;
-
-  DBUG_ENTER("Spartan_index::close_index");
-  if (index_file != -1)
-  {
-    my_close(index_file, MYF(0));
-    index_file = -1;
-  }
-  while (root != NULL)
-  {
-    p = root;
-    root = root->next;
-    delete p;     
-  }
-  DBUG_RETURN(0);
+  DBUG_ENTER("cmp_key");
+  DBUG_RETURN(memcmp(ndx->key, key,
+                     (ndx->length > key_len) ? ndx->length : key_len));
 }
 
-/* find a key in the index */
-SDE_INDEX *Spartan_index::seek_index(byte *key, int key_len)
+/* get the number of bytes (up to len) a and b start with */
+static int common_prefix(byte *a, byte *b, int len)
 {
-  SDE_INDEX *ndx = NULL;
-  SDE_NDX_NODE *n = root;
-  int buf_len;
-  bool done = false;
+  int i = 0;
 
-  DBUG_ENTER("Spartan_index::seek_index");
-  if (n != NULL)
-  {
-    while((n != NULL) && !done)
-    {
-      buf_len = n->key_ndx.length;
-      if (memcmp(n->key_ndx.key, key, 
-          (buf_len > key_len) ? buf_len : key_len) == 0)
-        done = true;
-      else
-        n = n->next;
-    } 
-  }
-  if (n != NULL)
-  {
-    ndx = &n->key_ndx;
-    range_ptr = n;
-  }
-  DBUG_RETURN(ndx);
+  DBUG_ENTER("common_prefix");
+  while ((i < len) && (a[i] == b[i]))
+    i++;
+  DBUG_RETURN(i);
 }
 
-/* find a key in the index and return position too */
-SDE_NDX_NODE *Spartan_index::seek_index_pos(byte *key, int key_len)
+/*
+  Get the size of an entry of a leaf or an inner node whose keys start
+  with prefix bytes kept once for the node.
+*/
+int Spartan_index::entry_size(bool leaf, int prefix)
 {
-  SDE_NDX_NODE *n = root;
-  int buf_len; 
-  bool done = false;
+  DBUG_ENTER("Spartan_index::entry_size");
+  DBUG_RETURN(max_key_len - prefix + sizeof(uint16) +
+              (leaf ? sizeof(long long) : sizeof(int)));
+}
 
-  DBUG_ENTER("Spartan_index::seek_index_pos");
-  if (n != NULL)
-  {
-    while((n->next != NULL) && !done)
-    {
-      buf_len = n->key_ndx.length;
-      if (memcmp(n->key_ndx.key, key, 
-          (buf_len > key_len) ? buf_len : key_len) == 0)
-        done = true;
-      else if (n->next != NULL)
-        n = n->next;
-    } 
-  }
-  DBUG_RETURN(n);
+/* get the most entries a leaf or an inner node may hold */
+int Spartan_index::max_entries(bool leaf)
+{
+  DBUG_ENTER("Spartan_index::max_entries");
+  DBUG_RETURN(leaf ? leaf_keys : inner_keys);
 }
 
-/* read the index file from disk and store in memory */
-int Spartan_index::load_index()
+/* get the start of entry i of n */
+byte *Spartan_index::entry(SDE_BTREE_NODE *n, int i)
 {
-  SDE_INDEX *ndx;
-  int i = 0;
+  DBUG_ENTER("Spartan_index::entry");
+  DBUG_RETURN(n->data + SDI_PAGE_HEADER + n->prefix +
+              i * entry_size(n->leaf, n->prefix));
+}
 
-  DBUG_ENTER("Spartan_index::load_index");
-  if (root != NULL)
-    destroy_index();
-  /*
-    First, read the metadata at the front of the index.
+/*
+  Compare the key of entry i of n with key (key_len bytes) the way the
+  index is ordered (see cmp_key()), the prefix first and then the rest
+  of the key, without putting the key together. Only the key_len bytes
+  of key are compared, so a key made of the first parts of a key of
+  several fields is equal to every key that starts with it.
+*/
+int Spartan_index::cmp_entry(SDE_BTREE_NODE *n, int i, byte *key,
+                             int key_len)
+{
+  byte *e = entry(n, i);
+  int len;
+  int head;
+  int icmp;
+
+  DBUG_ENTER("Spartan_index::cmp_entry");
+  len = (key_len < max_key_len) ? key_len : max_key_len;
+  head = (n->prefix < len) ? n->prefix : len;
+  icmp = memcmp(n->data + SDI_PAGE_HEADER, key, head);
+  if ((icmp != 0) || (len == head))
+    DBUG_RETURN(icmp);
+  DBUG_RETURN(memcmp(e, key + head, len - head));
+}
+
+/* copy entry i of n (the whole key) to ndx */
+void Spartan_index::get_entry(SDE_BTREE_NODE *n, int i, SDE_INDEX *ndx)
+{
+  byte *e = entry(n, i);
+  int rest = max_key_len - n->prefix;
+  uint16 length;
+
+  DBUG_ENTER("Spartan_index::get_entry");
+  memcpy(ndx->key, n->data + SDI_PAGE_HEADER, n->prefix);
+  memcpy(ndx->key + n->prefix, e, rest);
+  memset(ndx->key + max_key_len, 0, sizeof(ndx->key) - max_key_len);
+  memcpy(&length, e + rest, sizeof(uint16));
+  ndx->length = length;
+  ndx->pos = 0;
+  if (n->leaf)
+    memcpy(&ndx->pos, e + rest + sizeof(uint16), sizeof(long long));
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Get the key of entry i of n (max_key_len bytes, zero after the key).
+  It is kept in key_copy, so it is only good until the next call.
+*/
+byte *Spartan_index::entry_key(SDE_BTREE_NODE *n, int i)
+{
+  DBUG_ENTER("Spartan_index::entry_key");
+  get_entry(n, i, &key_copy);
+  DBUG_RETURN(copy_key(&key_copy));
+}
+
+/* get the row position of entry i of the leaf n */
+long long Spartan_index::entry_pos(SDE_BTREE_NODE *n, int i)
+{
+  long long pos;
+
+  DBUG_ENTER("Spartan_index::entry_pos");
+  memcpy(&pos, entry(n, i) + max_key_len - n->prefix + sizeof(uint16),
+         sizeof(long long));
+  DBUG_RETURN(pos);
+}
+
+/* set the row position of entry i of the leaf n */
+void Spartan_index::set_entry_pos(SDE_BTREE_NODE *n, int i, long long pos)
+{
+  DBUG_ENTER("Spartan_index::set_entry_pos");
+  memcpy(entry(n, i) + max_key_len - n->prefix + sizeof(uint16), &pos,
+         sizeof(long long));
+  DBUG_VOID_RETURN;
+}
+
+/* get the child page of entry i of the inner node n */
+int Spartan_index::entry_child(SDE_BTREE_NODE *n, int i)
+{
+  int child;
+
+  DBUG_ENTER("Spartan_index::entry_child");
+  memcpy(&child, entry(n, i) + max_key_len - n->prefix + sizeof(uint16),
+         sizeof(int));
+  DBUG_RETURN(child);
+}
+
+/*
+  Write ndx (and child, in an inner node) as entry i of n. The key must
+  start with the prefix of n.
+*/
+void Spartan_index::put_entry(SDE_BTREE_NODE *n, int i, SDE_INDEX *ndx,
+                              int child)
+{
+  byte *e = entry(n, i);
+  int rest = max_key_len - n->prefix;
+  uint16 length = (uint16)ndx->length;
+
+  DBUG_ENTER("Spartan_index::put_entry");
+  memcpy(e, ndx->key + n->prefix, rest);
+  memcpy(e + rest, &length, sizeof(uint16));
+  if (n->leaf)
+    memcpy(e + rest + sizeof(uint16), &ndx->pos, sizeof(long long));
+  else
+    memcpy(e + rest + sizeof(uint16), &child, sizeof(int));
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Empty n to be filled with entries from first to last (in key order,
+  see put_entry()): its prefix is what the two keys start with, which
+  every key between them starts with too.
+*/
+void Spartan_index::start_node(SDE_BTREE_NODE *n, SDE_INDEX *first,
+                               SDE_INDEX *last)
+{
+  DBUG_ENTER("Spartan_index::start_node");
+  n->count = 0;
+  n->prefix = common_prefix(first->key, last->key, max_key_len);
+  memcpy(n->data + SDI_PAGE_HEADER, first->key, n->prefix);
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Put ndx (and child, in an inner node) into n at slot. If the key does
+  not start with the whole prefix of n the prefix is cut back and the
+  entries widened to hold the rest of their keys. Returns false, with n
+  unchanged, if n is full or the entries would not fit in the page.
+*/
+bool Spartan_index::add_entry(SDE_BTREE_NODE *n, int slot, SDE_INDEX *ndx,
+                              int child)
+{
+  int prefix;
+  int size;
+  int old_size;
+  int cut;
+  int i;
+
+  DBUG_ENTER("Spartan_index::add_entry");
+  if (n->count == 0)
+    prefix = max_key_len;
+  else
+    prefix = common_prefix(n->data + SDI_PAGE_HEADER, ndx->key, n->prefix);
+  size = entry_size(n->leaf, prefix);
+  if ((n->count == max_entries(n->leaf)) ||
+      (SDI_PAGE_HEADER + prefix + (n->count + 1) * size > SDI_PAGE_SIZE))
+    DBUG_RETURN(false);
+  if (n->count == 0)
+  {
+    n->prefix = prefix;
+    memcpy(n->data + SDI_PAGE_HEADER, ndx->key, prefix);
+  }
+  else if (prefix < n->prefix)
+  {
+    /*
+      Each entry gets the bytes cut from the prefix in front of it. The
+      cut bytes and the entries are copied out first as the entries
+      move over each other.
+    */
+    old_size = entry_size(n->leaf, n->prefix);
+    cut = n->prefix - prefix;
+    memcpy(page_buf, n->data + SDI_PAGE_HEADER + prefix,
+           cut + n->count * old_size);
+    for (i = 0; i < n->count; i++)
+    {
+      memcpy(n->data + SDI_PAGE_HEADER + prefix + i * size, page_buf, cut);
+      memcpy(n->data + SDI_PAGE_HEADER + prefix + i * size + cut,
+             page_buf + cut + i * old_size, old_size);
+    }
+    n->prefix = prefix;
+  }
+  memmove(entry(n, slot + 1), entry(n, slot), (n->count - slot) * size);
+  put_entry(n, slot, ndx, child);
+  n->count++;
+  DBUG_RETURN(true);
+}
+
+/* take the entry at slot out of n */
+void Spartan_index::remove_entry(SDE_BTREE_NODE *n, int slot)
+{
+  DBUG_ENTER("Spartan_index::remove_entry");
+  memmove(entry(n, slot), entry(n, slot + 1),
+          (n->count - slot - 1) * entry_size(n->leaf, n->prefix));
+  n->count--;
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Split the full node n in two with ndx (and child) put in at slot: the
+  upper half of the entries moves to a new node, returned, and both
+  halves get the prefix of their own keys. sep is set to the first key
+  of the new node.
+*/
+SDE_BTREE_NODE *Spartan_index::split_node(SDE_BTREE_NODE *n, int slot,
+                                          SDE_INDEX *ndx, int child,
+                                          SDE_INDEX *sep)
+{
+  SDE_BTREE_NODE *half;
+  int count = n->count + 1;
+  int h = count / 2;
+  int i;
+
+  DBUG_ENTER("Spartan_index::split_node");
+  for (i = 0; i < n->count; i++)
+  {
+    get_entry(n, i, &split_keys[(i < slot) ? i : i + 1]);
+    if (!n->leaf)
+      split_child[(i < slot) ? i : i + 1] = entry_child(n, i);
+  }
+  split_keys[slot] = *ndx;
+  split_child[slot] = child;
+  half = new_page(n->leaf);
+  start_node(n, &split_keys[0], &split_keys[h - 1]);
+  for (i = 0; i < h; i++)
+    put_entry(n, n->count++, &split_keys[i], split_child[i]);
+  start_node(half, &split_keys[h], &split_keys[count - 1]);
+  for (i = h; i < count; i++)
+    put_entry(half, half->count++, &split_keys[i], split_child[i]);
+  *sep = split_keys[h];
+  mark_dirty(n);
+  DBUG_RETURN(half);
+}
+
+/*
+  Find the leaf a key belongs in: in each inner node take the last
+  child whose first key is less than the key (or the first child).
+  Every key less than the key is then in this leaf or to its left and
+  every key greater in it or to its right. The inner nodes on the way
+  are kept in path_page and path_slot.
+*/
+SDE_BTREE_NODE *Spartan_index::find_leaf(byte *key, int key_len)
+{
+  SDE_BTREE_NODE *n;
+  int lo;
+  int hi;
+  int mid;
+  int i;
+
+  DBUG_ENTER("Spartan_index::find_leaf");
+  depth = 0;
+  if (root == 0)
+    DBUG_RETURN(NULL);
+  n = get_page(root);
+  while ((n != NULL) && !n->leaf)
+  {
+    if (depth == SDI_MAX_DEPTH)
+    {
+      crashed = true;
+      DBUG_RETURN(NULL);
+    }
+    i = 0;
+    lo = 1;
+    hi = n->count - 1;
+    while (lo <= hi)
+    {
+      mid = (lo + hi) / 2;
+      if (cmp_entry(n, mid, key, key_len) < 0)
+      {
+        i = mid;
+        lo = mid + 1;
+      }
+      else
+        hi = mid - 1;
+    }
+    path_page[depth] = n->page;
+    path_slot[depth] = i;
+    depth++;
+    n = get_page(entry_child(n, i));
+  }
+  DBUG_RETURN(n);
+}
+
+/*
+  Find the way from page (at level) down to the leaf target, which
+  holds key. Only children whose keys can include key are followed:
+  with equal keys spread over several leaves find_leaf() goes to the
+  first one. Sets path_page, path_slot and depth and returns true if
+  it is found.
+*/
+bool Spartan_index::find_path(int page, int level, byte *key, int key_len,
+                              int target)
+{
+  SDE_BTREE_NODE *n;
+  int i;
+
+  DBUG_ENTER("Spartan_index::find_path");
+  if (page == target)
+  {
+    depth = level;
+    DBUG_RETURN(true);
+  }
+  n = get_page(page);
+  if (n->leaf || (level == SDI_MAX_DEPTH))
+    DBUG_RETURN(false);
+  for (i = 0; i < n->count; i++)
+  {
+    if ((i > 0) && (cmp_entry(n, i, key, key_len) > 0))
+      break;
+    if ((i + 1 < n->count) && (cmp_entry(n, i + 1, key, key_len) < 0))
+      continue;
+    path_page[level] = page;
+    path_slot[level] = i;
+    if (find_path(entry_child(n, i), level + 1, key, key_len, target))
+      DBUG_RETURN(true);
+  }
+  DBUG_RETURN(false);
+}
+
+/* get the slot of the first key in leaf not less than key */
+int Spartan_index::node_slot(SDE_BTREE_NODE *leaf, byte *key, int key_len)
+{
+  int lo = 0;
+  int hi = leaf->count;
+  int mid;
+
+  DBUG_ENTER("Spartan_index::node_slot");
+  while (lo < hi)
+  {
+    mid = (lo + hi) / 2;
+    if (cmp_entry(leaf, mid, key, key_len) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  DBUG_RETURN(lo);
+}
+
+/* get the leaf after n (or NULL) */
+SDE_BTREE_NODE *Spartan_index::next_leaf(SDE_BTREE_NODE *n)
+{
+  DBUG_ENTER("Spartan_index::next_leaf");
+  DBUG_RETURN((n->next != 0) ? get_page(n->next) : NULL);
+}
+
+/*
+  Find the first key not less than key. Sets *leaf and *slot to it or
+  to the end of the last leaf if every key is less. Returns true if the
+  key found is equal to key.
+*/
+bool Spartan_index::lower_bound(byte *key, int key_len,
+                                SDE_BTREE_NODE **leaf, int *slot)
+{
+  SDE_BTREE_NODE *n;
+
+  DBUG_ENTER("Spartan_index::lower_bound");
+  n = find_leaf(key, key_len);
+  *leaf = n;
+  *slot = 0;
+  if (n == NULL)
+    DBUG_RETURN(false);
+  *slot = node_slot(n, key, key_len);
+  /*
+    Every key in the leaf is less: the key found is the first of the
+    next leaf.
   */
-  read_header();
+  while ((*slot == (*leaf)->count) && ((*leaf)->next != 0))
+  {
+    *leaf = next_leaf(*leaf);
+    *slot = 0;
+  }
+  if (*slot < (*leaf)->count)
+    DBUG_RETURN(cmp_entry(*leaf, *slot, key, key_len) == 0);
+  DBUG_RETURN(false);
+}
+
+/*
+  Add the node right to the inner node at path_page[level], just after
+  the child at path_slot[level]. sep is the first key of right. A full
+  node is split and the new half added to the node above it the same
+  way; above the root (level -1) a new root is made.
+*/
+void Spartan_index::insert_child(int level, SDE_BTREE_NODE *right,
+                                 SDE_INDEX *sep)
+{
+  SDE_BTREE_NODE *p;
+  SDE_BTREE_NODE *half;
+  SDE_INDEX key = *sep;
+  SDE_INDEX first;
+  int i;
+
+  DBUG_ENTER("Spartan_index::insert_child");
+  if (level < 0)
+  {
+    /*
+      The first key of the old root goes with it so the keys of the new
+      root share what prefix they have.
+    */
+    p = new_page(false);
+    get_entry(get_page(root), 0, &first);
+    add_entry(p, 0, &first, root);
+    add_entry(p, 1, &key, right->page);
+    root = p->page;
+    DBUG_VOID_RETURN;
+  }
+  p = get_page(path_page[level]);
+  i = path_slot[level];
+  if (add_entry(p, i + 1, &key, right->page))
+    mark_dirty(p);
+  else
+  {
+    /*
+      The first key of the new half goes up as the key between the two.
+    */
+    half = split_node(p, i + 1, &key, right->page, &first);
+    insert_child(level - 1, half, &first);
+  }
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Put ndx into leaf at slot, splitting the leaf in two if it is full.
+  The leaf must be the last one find_leaf() found. Every cursor keeps
+  pointing at the same key.
+*/
+void Spartan_index::insert_at(SDE_BTREE_NODE *leaf, int slot, SDE_INDEX *ndx)
+{
+  SDE_BTREE_NODE *half;
+  SDE_BTREE_NODE *n;
+  SDE_CURSOR *cur;
+  SDE_INDEX sep;
+  int h;
+
+  DBUG_ENTER("Spartan_index::insert_at");
+  keys++;
+  if (add_entry(leaf, slot, ndx, 0))
+  {
+    mark_dirty(leaf);
+    for (cur = cursors; cur != NULL; cur = cur->next)
+      if ((cur->page == leaf->page) && (cur->slot >= slot))
+        cur->slot++;
+    DBUG_VOID_RETURN;
+  }
+  h = (leaf->count + 1) / 2;
+  half = split_node(leaf, slot, ndx, 0, &sep);
+  half->next = leaf->next;
+  half->prev = leaf->page;
+  if ((n = next_leaf(leaf)) != NULL)
+  {
+    n->prev = half->page;
+    mark_dirty(n);
+  }
+  leaf->next = half->page;
+  for (cur = cursors; cur != NULL; cur = cur->next)
+  {
+    if (cur->page != leaf->page)
+      continue;
+    if (cur->slot >= slot)
+      cur->slot++;
+    if (cur->slot >= h)
+    {
+      cur->page = half->page;
+      cur->slot -= h;
+    }
+  }
+  insert_child(depth - 1, half, &sep);
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Remove the key at slot from leaf. An empty leaf is taken out of the
+  tree (nodes are not merged; like the nodes of most B+trees they may
+  stay part full) and its page freed. A cursor on the key moves on to
+  the key that followed.
+*/
+void Spartan_index::remove_at(SDE_BTREE_NODE *leaf, int slot)
+{
+  SDE_BTREE_NODE *n;
+  SDE_BTREE_NODE *p;
+  SDE_CURSOR *cur;
+  SDE_INDEX gone;
+  int level;
+  int i;
+
+  DBUG_ENTER("Spartan_index::remove_at");
+  get_entry(leaf, slot, &gone);
+  remove_entry(leaf, slot);
+  keys--;
+  mark_dirty(leaf);
+  for (cur = cursors; cur != NULL; cur = cur->next)
+    if ((cur->page == leaf->page) && (cur->slot > slot))
+      cur->slot--;
+  if (leaf->count > 0)
+    DBUG_VOID_RETURN;
+  if (leaf->page == root)
+  {
+    free_page(leaf);
+    root = 0;
+    reset_cursors();
+    DBUG_VOID_RETURN;
+  }
+  /*
+    The empty leaf is left in place if the way down to it is not found
+    (the index is damaged); every search steps over it.
+  */
+  if (!find_path(root, 0, gone.key, gone.length, leaf->page))
+    DBUG_VOID_RETURN;
+  for (cur = cursors; cur != NULL; cur = cur->next)
+  {
+    if (cur->page == leaf->page)
+    {
+      cur->page = leaf->next;
+      cur->slot = 0;
+    }
+  }
+  if (leaf->prev != 0)
+  {
+    n = get_page(leaf->prev);
+    n->next = leaf->next;
+    mark_dirty(n);
+  }
+  if (leaf->next != 0)
+  {
+    n = get_page(leaf->next);
+    n->prev = leaf->prev;
+    mark_dirty(n);
+  }
+  free_page(leaf);
+  /*
+    Take the empty node out of its parent, and the parent out of its
+    own parent if that leaves it empty.
+  */
+  for (level = depth - 1; level >= 0; level--)
+  {
+    p = get_page(path_page[level]);
+    i = path_slot[level];
+    remove_entry(p, i);
+    mark_dirty(p);
+    if (p->count > 0)
+      break;
+    free_page(p);
+  }
+  if (level < 0)
+    root = 0;
+  /*
+    A root with one child is not needed.
+  */
+  while (root != 0)
+  {
+    n = get_page(root);
+    if (n->leaf || (n->count != 1))
+      break;
+    root = entry_child(n, 0);
+    free_page(n);
+  }
+  DBUG_VOID_RETURN;
+}
+
+/* get the leftmost (first) leaf */
+SDE_BTREE_NODE *Spartan_index::first_leaf()
+{
+  SDE_BTREE_NODE *n;
+  int level = 0;
+
+  DBUG_ENTER("Spartan_index::first_leaf");
+  if (root == 0)
+    DBUG_RETURN(NULL);
+  for (n = get_page(root); !n->leaf && (level < SDI_MAX_DEPTH); level++)
+    n = get_page(entry_child(n, 0));
+  DBUG_RETURN(n->leaf ? n : NULL);
+}
+
+/* get the rightmost (last) leaf */
+SDE_BTREE_NODE *Spartan_index::last_leaf()
+{
+  SDE_BTREE_NODE *n;
+  int level = 0;
+
+  DBUG_ENTER("Spartan_index::last_leaf");
+  if (root == 0)
+    DBUG_RETURN(NULL);
+  for (n = get_page(root); !n->leaf && (level < SDI_MAX_DEPTH); level++)
+    n = get_page(entry_child(n, n->count - 1));
+  DBUG_RETURN(n->leaf ? n : NULL);
+}
+
+/*
+  Get the end of the run of sorted keys from from that goes in one
+  node when a tree is built: as many as fit in SDI_PAGE_FILL bytes with
+  the prefix they share, up to three quarters of the most a node may
+  hold, so the next keys inserted do not split every node.
+*/
+int Spartan_index::fill_run(SDE_INDEX **sorted, int from, int count,
+                            bool leaf)
+{
+  int prefix = max_key_len;
+  int most = max_entries(leaf) * 3 / 4;
+  int end;
+
+  DBUG_ENTER("Spartan_index::fill_run");
+  for (end = from + 1; (end < count) && (end - from < most); end++)
+  {
+    prefix = common_prefix(sorted[from]->key, sorted[end]->key, prefix);
+    if (SDI_PAGE_HEADER + prefix +
+        (end - from + 1) * entry_size(leaf, prefix) > SDI_PAGE_FILL)
+      break;
+  }
+  DBUG_RETURN(end);
+}
+
+/*
+  Build the tree from count keys in key order when it is empty, from
+  the leaves up, each node taking the keys fill_run() gives it. Each
+  node is finished before the next is started so the cache writes them
+  out as it fills. Returns 0 or -1 on error.
+*/
+int Spartan_index::build_tree(SDE_INDEX **sorted, int count)
+{
+  SDE_BTREE_NODE *n = NULL;
+  SDE_BTREE_NODE *p;
+  SDE_INDEX *first;
+  SDE_INDEX **run;
+  int *level;
+  int nodes = 0;
+  int most;
+  int parents;
+  int end;
+  int i;
+  int j;
+
+  DBUG_ENTER("Spartan_index::build_tree");
+  if (count == 0)
+    DBUG_RETURN(0);
+  /*
+    The page and first key of each node of the level being built (a
+    node takes at least as many keys as fit in SDI_PAGE_FILL without a
+    prefix). Each level is written over the one below it.
+  */
+  most = count / ((SDI_PAGE_FILL - SDI_PAGE_HEADER) / entry_size(true, 0)) + 1;
+  level = (int *)my_malloc(most * sizeof(int), MYF(MY_WME));
+  first = (SDE_INDEX *)my_malloc(most * sizeof(SDE_INDEX), MYF(MY_WME));
+  run = (SDE_INDEX **)my_malloc(most * sizeof(SDE_INDEX *), MYF(MY_WME));
+  if ((level == NULL) || (first == NULL) || (run == NULL))
+  {
+    my_free((gptr)level, MYF(MY_ALLOW_ZERO_PTR));
+    my_free((gptr)first, MYF(MY_ALLOW_ZERO_PTR));
+    my_free((gptr)run, MYF(MY_ALLOW_ZERO_PTR));
+    DBUG_RETURN(-1);
+  }
+  for (i = 0; i < count; i = end)
+  {
+    end = fill_run(sorted, i, count, true);
+    p = new_page(true);
+    if (n != NULL)
+    {
+      n->next = p->page;
+      p->prev = n->page;
+    }
+    n = p;
+    start_node(n, sorted[i], sorted[end - 1]);
+    for (j = i; j < end; j++)
+      put_entry(n, n->count++, sorted[j], 0);
+    level[nodes] = n->page;
+    first[nodes++] = *sorted[i];
+    trim_cache(SDI_CACHE_PAGES);
+  }
+  keys = count;
+  while (nodes > 1)
+  {
+    for (i = 0; i < nodes; i++)
+      run[i] = &first[i];
+    parents = 0;
+    for (i = 0; i < nodes; i = end)
+    {
+      end = fill_run(run, i, nodes, false);
+      n = new_page(false);
+      start_node(n, run[i], run[end - 1]);
+      for (j = i; j < end; j++)
+        put_entry(n, n->count++, run[j], level[j]);
+      level[parents] = n->page;
+      first[parents++] = *run[i];
+      trim_cache(SDI_CACHE_PAGES);
+    }
+    nodes = parents;
+  }
+  root = level[0];
+  my_free((gptr)level, MYF(0));
+  my_free((gptr)first, MYF(0));
+  my_free((gptr)run, MYF(0));
+  DBUG_RETURN(0);
+}
+
+/* insert a key into the index */
+int Spartan_index::insert_key(SDE_INDEX *ndx, bool allow_dupes)
+{
+  SDE_BTREE_NODE *leaf;
+  SDE_BTREE_NODE *n;
+  int slot;
+
+  DBUG_ENTER("Spartan_index::insert_key");
+  if (hash != NULL)
+    DBUG_RETURN(hash->insert_key(ndx, allow_dupes));
+  trim_cache(SDI_CACHE_PAGES);
+  /*
+    If this is a new index, the first key goes in a leaf as the root.
+  */
+  if (root == 0)
+    root = new_page(true)->page;
+  /*
+    Insert the key before the first key not less than it (which may be
+    the first key of the next leaf). If dupes are not allowed and that
+    key is equal, stop and return -1.
+  */
+  if ((leaf = find_leaf(ndx->key, ndx->length)) == NULL)
+    DBUG_RETURN(-1);
+  slot = node_slot(leaf, ndx->key, ndx->length);
+  if (!allow_dupes)
+  {
+    for (n = leaf; (n != NULL) && (n->count == ((n == leaf) ? slot : 0)); )
+      n = next_leaf(n);
+    if ((n != NULL) &&
+        (cmp_entry(n, (n == leaf) ? slot : 0, ndx->key, ndx->length) == 0))
+      DBUG_RETURN(-1);
+  }
+  insert_at(leaf, slot, ndx);
+  DBUG_RETURN(1);
+}
+
+/*
+  Insert count keys into the index at once. The keys are sorted first;
+  an empty index is then built from them bottom up in one pass,
+  otherwise each is inserted in turn. The result is the same as
+  inserting them in order: if dupes are not allowed a key equal to one
+  already in the index or earlier in ndx is left out. Returns the
+  number of keys inserted or -1 on error.
+*/
+int Spartan_index::bulk_insert(SDE_INDEX *ndx, int count, bool allow_dupes)
+{
+  SDE_INDEX **sorted;
+  SDE_INDEX *last = NULL;
+  int i;
+  int added = 0;
+
+  DBUG_ENTER("Spartan_index::bulk_insert");
+  if (hash != NULL)
+    DBUG_RETURN(hash->bulk_insert(ndx, count, allow_dupes));
+  if (count <= 0)
+    DBUG_RETURN(0);
+  sorted = (SDE_INDEX **)my_malloc(count * sizeof(SDE_INDEX *), MYF(MY_WME));
+  if (sorted == NULL)
+    DBUG_RETURN(-1);
+  for (i = 0; i < count; i++)
+    sorted[i] = &ndx[i];
+  qsort(sorted, count, sizeof(SDE_INDEX *), cmp_index_ptr);
+  if (root == 0)
+  {
+    /*
+      Drop the dupes, then build the tree from what is left.
+    */
+    for (i = 0; i < count; i++)
+    {
+      if (!allow_dupes && (last != NULL) &&
+          (cmp_key(last, sorted[i]->key, sorted[i]->length) == 0))
+        continue;
+      last = sorted[i];
+      sorted[added++] = sorted[i];
+    }
+    if (build_tree(sorted, added))
+      added = -1;
+  }
+  else
+  {
+    for (i = 0; i < count; i++)
+      if (insert_key(sorted[i], allow_dupes) == 1)
+        added++;
+  }
+  my_free((gptr)sorted, MYF(0));
+  DBUG_RETURN(added);
+}
+
+/*
+  Find the entry with key (key_len bytes) that points at the row at pos
+  (any of the equal keys if pos is -1). Sets *leaf and *slot to it and
+  returns true if there is one.
+*/
+bool Spartan_index::find_entry(byte *key, int key_len, long long pos,
+                               SDE_BTREE_NODE **leaf, int *slot)
+{
+  DBUG_ENTER("Spartan_index::find_entry");
+  if (!lower_bound(key, key_len, leaf, slot))
+    DBUG_RETURN(false);
+  while ((*leaf != NULL) && (pos != -1))
+  {
+    if (*slot == (*leaf)->count)
+    {
+      *leaf = next_leaf(*leaf);
+      *slot = 0;
+    }
+    else if (cmp_entry(*leaf, *slot, key, key_len) != 0)
+      *leaf = NULL;
+    else if (entry_pos(*leaf, *slot) == pos)
+      break;
+    else
+      (*slot)++;
+  }
+  DBUG_RETURN(*leaf != NULL);
+}
+
+/* delete a key from the index. Note:
+   position is included for indexes that allow dupes */
+int Spartan_index::delete_key(byte *buf, long long pos, int key_len)
+{
+  SDE_BTREE_NODE *leaf;
+  int slot;
+
+  DBUG_ENTER("Spartan_index::delete_key");
+  if (hash != NULL)
+    DBUG_RETURN(hash->delete_key(buf, pos, key_len));
+  trim_cache(SDI_CACHE_PAGES);
+  /*
+    Search for the key in the index. If found, delete it! With a
+    position, the key among the equal ones that points at it.
+  */
+  if (find_entry(buf, key_len, pos, &leaf, &slot))
+    remove_at(leaf, slot);
+  DBUG_RETURN(0);
+}
+
+/*
+  Move the entry of the row that was at old_pos with the key old_key
+  to the key in buf and the position pos (the row may have moved). The
+  entry is found by its key, then taken out and inserted again at its
+  new place; if the key did not change it is left where it is. Only
+  the pages touched change. Returns 0 or -1 if the entry is not in the
+  index or cannot be put back.
+*/
+int Spartan_index::update_key(byte *old_key, long long old_pos, byte *buf,
+                              long long pos, int key_len)
+{
+  SDE_BTREE_NODE *leaf;
+  SDE_INDEX ndx;
+  int slot;
+
+  DBUG_ENTER("Spartan_index::update_key");
+  if (hash != NULL)
+    DBUG_RETURN(hash->update_key(old_key, old_pos, buf, pos, key_len));
+  trim_cache(SDI_CACHE_PAGES);
+  if (!find_entry(old_key, key_len, old_pos, &leaf, &slot))
+    DBUG_RETURN(-1);
+  if (memcmp(old_key, buf, key_len) == 0)
+  {
+    if (entry_pos(leaf, slot) != pos)
+    {
+      set_entry_pos(leaf, slot, pos);
+      mark_dirty(leaf);
+    }
+    DBUG_RETURN(0);
+  }
+  get_entry(leaf, slot, &ndx);
+  memcpy(ndx.key, buf, key_len);
+  ndx.pos = pos;
+  remove_at(leaf, slot);
+  if (root == 0)
+    root = new_page(true)->page;
+  if ((leaf = find_leaf(ndx.key, ndx.length)) == NULL)
+    DBUG_RETURN(-1);
+  insert_at(leaf, node_slot(leaf, ndx.key, ndx.length), &ndx);
+  DBUG_RETURN(0);
+}
+
+/* get the current position of the key in the index file */
+long long Spartan_index::get_index_pos(byte *buf, int key_len)
+{
+  long long pos = -1;
+
+  DBUG_ENTER("Spartan_index::get_index_pos");
+  if (hash != NULL)
+    DBUG_RETURN(hash->get_index_pos(buf, key_len));
+  SDE_INDEX *ndx;
+  ndx = seek_index(buf, key_len);
+  if (ndx != NULL)
+    pos = ndx->pos;
+  DBUG_RETURN(pos);
+}
+
+/*
+  Move cur off the end of its leaf (after keys were removed) to the
+  first key of the next one.
+*/
+void Spartan_index::fix_cursor(SDE_CURSOR *cur)
+{
+  SDE_BTREE_NODE *n;
+
+  DBUG_ENTER("Spartan_index::fix_cursor");
+  while ((cur->page != 0) &&
+         (cur->slot >= (n = get_page(cur->page))->count))
+  {
+    cur->page = n->next;
+    cur->slot = 0;
+  }
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Get the entry under the cursor and move the cursor on to the next
+  one (NULL at the end of the index). The entry is only good until the
+  next call.
+*/
+SDE_INDEX *Spartan_index::next_entry(SDE_CURSOR *cur)
+{
+  SDE_BTREE_NODE *n;
+  SDE_INDEX *ndx = NULL;
+
+  DBUG_ENTER("Spartan_index::next_entry");
+  if (cur == NULL)
+    cur = &own;
+  if (hash != NULL)
+    DBUG_RETURN(hash->next_entry(cur));
+  trim_cache(SDI_CACHE_PAGES);
+  fix_cursor(cur);
+  if (cur->page != 0)
+  {
+    n = get_page(cur->page);
+    get_entry(n, cur->slot, &cur->found);
+    ndx = &cur->found;
+    if (++cur->slot == n->count)
+    {
+      cur->page = n->next;
+      cur->slot = 0;
+    }
+  }
+  DBUG_RETURN(ndx);
+}
+
+/*
+  Get the entry under the cursor and move the cursor back to the one
+  before it (NULL at the start of the index). The entry is only good
+  until the next call.
+*/
+SDE_INDEX *Spartan_index::prev_entry(SDE_CURSOR *cur)
+{
+  SDE_BTREE_NODE *n;
+  SDE_INDEX *ndx = NULL;
+
+  DBUG_ENTER("Spartan_index::prev_entry");
+  if (cur == NULL)
+    cur = &own;
+  if (hash != NULL)
+    DBUG_RETURN(NULL);
+  trim_cache(SDI_CACHE_PAGES);
+  fix_cursor(cur);
+  if (cur->page != 0)
+  {
+    n = get_page(cur->page);
+    get_entry(n, cur->slot, &cur->found);
+    ndx = &cur->found;
+    /*
+      Step back to the last key of the first leaf before this one that
+      has any.
+    */
+    while (--cur->slot < 0)
+    {
+      cur->page = n->prev;
+      if (cur->page == 0)
+        break;
+      n = get_page(cur->page);
+      cur->slot = n->count;
+    }
+  }
+  DBUG_RETURN(ndx);
+}
+
+/*
+  Copy the key of ndx to key_copy (max_key_len bytes, zero after the
+  key) and get it, or NULL if ndx is NULL. The key is only good until
+  the next call.
+*/
+byte *Spartan_index::copy_key(SDE_INDEX *ndx)
+{
+  int length;
+
+  DBUG_ENTER("Spartan_index::copy_key");
+  if (ndx == NULL)
+    DBUG_RETURN(0);
+  length = (ndx->length < max_key_len) ? ndx->length : max_key_len;
+  if (ndx != &key_copy)
+    memcpy(key_copy.key, ndx->key, length);
+  memset(key_copy.key + length, 0, sizeof(key_copy.key) - length);
+  key_copy.length = length;
+  key_copy.pos = ndx->pos;
+  DBUG_RETURN(key_copy.key);
+}
+
+/* get next key in index */
+byte *Spartan_index::get_next_key()
+{
+  DBUG_ENTER("Spartan_index::get_next_key");
+  DBUG_RETURN(copy_key(next_entry()));
+}
+
+/* get prev key in index */
+byte *Spartan_index::get_prev_key()
+{
+  DBUG_ENTER("Spartan_index::get_prev_key");
+  DBUG_RETURN(copy_key(prev_entry()));
+}
+
+/*
+  Set the cursor to the first key of the index (last if last is set)
+  and get it (NULL if the index is empty). The entry is only good until
+  the next call.
+*/
+SDE_INDEX *Spartan_index::seek_end(bool last, SDE_CURSOR *cur)
+{
+  SDE_BTREE_NODE *n;
+  SDE_INDEX *ndx = NULL;
+
+  DBUG_ENTER("Spartan_index::seek_end");
+  if (cur == NULL)
+    cur = &own;
+  if (hash != NULL)
+    DBUG_RETURN(hash->seek_end(last, cur));
+  trim_cache(SDI_CACHE_PAGES);
+  cur->page = 0;
+  cur->slot = 0;
+  if (last)
+  {
+    for (n = last_leaf(); (n != NULL) && (n->count == 0); )
+      n = (n->prev != 0) ? get_page(n->prev) : NULL;
+  }
+  else
+  {
+    for (n = first_leaf(); (n != NULL) && (n->count == 0); )
+      n = next_leaf(n);
+  }
+  if (n != NULL)
+  {
+    cur->page = n->page;
+    cur->slot = last ? n->count - 1 : 0;
+    get_entry(n, cur->slot, &cur->found);
+    ndx = &cur->found;
+  }
+  DBUG_RETURN(ndx);
+}
+
+/* get first key in index */
+byte *Spartan_index::get_first_key()
+{
+  SDE_BTREE_NODE *n;
+  byte *key = 0;
+
+  DBUG_ENTER("Spartan_index::get_first_key");
+  trim_cache(SDI_CACHE_PAGES);
+  for (n = first_leaf(); (n != NULL) && (n->count == 0); )
+    n = next_leaf(n);
+  if (n != NULL)
+    key = entry_key(n, 0);
+  DBUG_RETURN(key);
+}
+
+/* get last key in index */
+byte *Spartan_index::get_last_key()
+{
+  SDE_BTREE_NODE *n;
+  byte *key = 0;
+
+  DBUG_ENTER("Spartan_index::get_last_key");
+  trim_cache(SDI_CACHE_PAGES);
+  for (n = last_leaf(); (n != NULL) && (n->count == 0); )
+    n = (n->prev != 0) ? get_page(n->prev) : NULL;
+  if (n != NULL)
+    key = entry_key(n, n->count - 1);
+  DBUG_RETURN(key);
+}
+
+/* close the index, writing the pages that changed */
+int Spartan_index::close_index()
+{
+  DBUG_ENTER("Spartan_index::close_index");
+  if (hash != NULL)
+  {
+    hash->close_index();
+    delete hash;
+    hash = NULL;
+  }
+  if (index_file != -1)
+  {
+    if (paged && !clean)
+      flush_pages();
+    if (log != NULL)
+      log->set_index(log_inx, -1);
+    my_close(index_file, MYF(0));
+    index_file = -1;
+  }
+  reset_tree();
+  DBUG_RETURN(0);
+}
+
+/* find a key in the index */
+SDE_INDEX *Spartan_index::seek_index(byte *key, int key_len,
+                                     SDE_CURSOR *cur)
+{
+  SDE_INDEX *ndx = NULL;
+  SDE_BTREE_NODE *leaf;
+  int slot;
+
+  DBUG_ENTER("Spartan_index::seek_index");
+  if (cur == NULL)
+    cur = &own;
+  if (hash != NULL)
+    DBUG_RETURN(hash->seek_index(key, key_len, cur));
+  trim_cache(SDI_CACHE_PAGES);
+  if (lower_bound(key, key_len, &leaf, &slot))
+  {
+    get_entry(leaf, slot, &cur->found);
+    ndx = &cur->found;
+    cur->page = leaf->page;
+    cur->slot = slot;
+  }
+  DBUG_RETURN(ndx);
+}
+
+/*
+  Set the cursor to the first key not less than key (greater than key
+  if after is set), or with last set to the key before that one, and
+  get it (NULL if there is none). Only the key_len bytes of key are
+  compared, as in seek_index(). The bound is found the way key_rank()
+  finds it, so equal keys that fill several leaves are not walked. A
+  hash index has no order and finds none.
+*/
+SDE_INDEX *Spartan_index::seek_bound(byte *key, int key_len, bool after,
+                                     bool last, SDE_CURSOR *cur)
+{
+  SDE_BTREE_NODE *n;
+  int page;
+  int slot;
+
+  DBUG_ENTER("Spartan_index::seek_bound");
+  if (cur == NULL)
+    cur = &own;
+  cur->page = 0;
+  cur->slot = 0;
+  cur->bucket = -1;
+  if (hash != NULL)
+    DBUG_RETURN(NULL);
+  trim_cache(SDI_CACHE_PAGES);
+  key_rank(key, key_len, after, &page, &slot);
+  if (page == 0)
+    DBUG_RETURN(NULL);
+  n = get_page(page);
+  if (last)
+  {
+    while (--slot < 0)
+    {
+      if (n->prev == 0)
+        DBUG_RETURN(NULL);
+      n = get_page(n->prev);
+      slot = n->count;
+    }
+  }
+  else
+  {
+    while (slot >= n->count)
+    {
+      if (n->next == 0)
+        DBUG_RETURN(NULL);
+      n = next_leaf(n);
+      slot = 0;
+    }
+  }
+  cur->page = n->page;
+  cur->slot = slot;
+  get_entry(n, slot, &cur->found);
+  DBUG_RETURN(&cur->found);
+}
+
+/*
+  Get the index ready for use once the redo log has been replayed over
+  the file. Only the header of a paged index is read again: its pages
+  are read as they are needed. An older file is read and written again
+  in pages.
+*/
+int Spartan_index::load_index()
+{
+  DBUG_ENTER("Spartan_index::load_index");
+  if (hash != NULL)
+    DBUG_RETURN(hash->load_index());
+  if (index_file != -1)
+    read_header();
+  if (paged || (max_key_len <= 0))
+    DBUG_RETURN(0);
+  DBUG_RETURN(convert_index());
+}
+
+/*
+  Read the entries of an index file in the oldest format (a list of
+  entries) into a new array *ndx of *count entries. Returns 0 or -1 on
+  error.
+*/
+int Spartan_index::read_old_entries(SDE_INDEX **ndx, int *count)
+{
+  SDE_INDEX *more;
+  int alloc = 0;
+  int i = 0;
+  uint32 crc;
+
+  DBUG_ENTER("Spartan_index::read_old_entries");
+  *ndx = NULL;
+  *count = 0;
+  my_seek(index_file, METADATA_SIZE, MY_SEEK_SET, MYF(0));
   while(!eof(index_file))
   {
-    ndx = new SDE_INDEX();
-    i = my_read(index_file, (byte *)&ndx->key, max_key_len, MYF(0));
-    i = my_read(index_file, (byte *)&ndx->pos, sizeof(long long), MYF(0));
-    i = my_read(index_file, (byte *)&ndx->length, sizeof(int), MYF(0));
-    insert_key(ndx, false);
+    if (*count == alloc)
+    {
+      alloc = (alloc > 0) ? 2 * alloc : 1024;
+      more = (SDE_INDEX *)my_realloc((gptr)*ndx, alloc * sizeof(SDE_INDEX),
+                                     MYF(MY_WME | MY_ALLOW_ZERO_PTR));
+      if (more == NULL)
+      {
+        my_free((gptr)*ndx, MYF(MY_ALLOW_ZERO_PTR));
+        DBUG_RETURN(-1);
+      }
+      *ndx = more;
+    }
+    more = *ndx + *count;
+    memset(more->key, 0, sizeof(more->key));
+    i = my_read(index_file, (byte *)&more->key, max_key_len, MYF(0));
+    i = my_read(index_file, (byte *)&more->pos, sizeof(long long), MYF(0));
+    i = my_read(index_file, (byte *)&more->length, sizeof(int), MYF(0));
+    /*
+      An entry that does not match its checksum is dropped; CHECK
+      TABLE then reports the index crashed.
+    */
+    if (checksums &&
+        ((my_read(index_file, (byte *)&crc, sizeof(uint32), MYF(0)) !=
+          sizeof(uint32)) ||
+         (spartan_crc32c(spartan_crc32c(spartan_crc32c(0, more->key,
+                                                       max_key_len),
+                                        (byte *)&more->pos,
+                                        sizeof(long long)),
+                         (byte *)&more->length, sizeof(int)) != crc)))
+      crashed = true;
+    else
+      (*count)++;
+  }
+  DBUG_RETURN(0);
+}
+
+/*
+  Read the keys of a paged file whose pages hold whole keys (see
+  Spartan_index.h) into a new array *ndx of *count entries. The leaves
+  are read in page order; one that does not match its checksum is left
+  out and the index marked crashed. Returns 0 or -1 on error.
+*/
+int Spartan_index::read_old_pages(SDE_INDEX **ndx, int *count)
+{
+  int entry = max_key_len + sizeof(long long) + sizeof(int);
+  int size = SDI_OLD_PAGE_HEADER + SDE_OLD_NODE_KEYS * (entry + sizeof(int));
+  byte *page;
+  byte *p;
+  uint32 crc;
+  int n;
+  int i;
+  int j;
+
+  DBUG_ENTER("Spartan_index::read_old_pages");
+  *count = 0;
+  page = (byte *)my_malloc(size, MYF(MY_WME));
+  *ndx = (SDE_INDEX *)my_malloc(((pages > 1) ? pages : 1) *
+                                SDE_OLD_NODE_KEYS * sizeof(SDE_INDEX),
+                                MYF(MY_WME | MY_ZEROFILL));
+  if ((page == NULL) || (*ndx == NULL))
+  {
+    my_free((gptr)page, MYF(MY_ALLOW_ZERO_PTR));
+    my_free((gptr)*ndx, MYF(MY_ALLOW_ZERO_PTR));
+    DBUG_RETURN(-1);
+  }
+  for (i = 1; i < pages; i++)
+  {
+    if (my_pread(index_file, page, size, (my_off_t)i * size, MYF(0)) !=
+        (uint)size)
+    {
+      crashed = true;
+      break;
+    }
+    memcpy(&crc, page + SDI_PAGE_CRC, sizeof(uint32));
+    memset(page + SDI_PAGE_CRC, 0, sizeof(uint32));
+    memcpy(&n, page + sizeof(bool), sizeof(int));
+    if ((spartan_crc32c(0, page, size) != crc) || (n < 0) ||
+        (n > SDE_OLD_NODE_KEYS))
+    {
+      crashed = true;
+      continue;
+    }
+    if (page[0] == 0)
+      continue;
+    p = page + SDI_OLD_PAGE_HEADER;
+    for (j = 0; j < n; j++, p += entry, (*count)++)
+    {
+      memcpy((*ndx)[*count].key, p, max_key_len);
+      memcpy(&(*ndx)[*count].pos, p + max_key_len, sizeof(long long));
+      memcpy(&(*ndx)[*count].length, p + max_key_len + sizeof(long long),
+             sizeof(int));
+    }
   }
+  my_free((gptr)page, MYF(0));
   DBUG_RETURN(0);
 }
 
+/*
+  Read an index file in an older format (see Spartan_index.h) and write
+  it again as a paged file. The entries are collected and the tree is
+  built from them in one pass.
+*/
+int Spartan_index::convert_index()
+{
+  SDE_INDEX *ndx;
+  int count;
+  int i;
+
+  DBUG_ENTER("Spartan_index::convert_index");
+  if (old_pages ? read_old_pages(&ndx, &count) :
+      read_old_entries(&ndx, &count))
+    DBUG_RETURN(-1);
+  /*
+    Start the file again in pages and build the tree into it.
+  */
+  cut_file(0);
+  paged = true;
+  old_pages = false;
+  checksums = true;
+  set_block_size();
+  reset_tree();
+  write_header();
+  i = bulk_insert(ndx, count, false);
+  my_free((gptr)ndx, MYF(MY_ALLOW_ZERO_PTR));
+  if (i == -1)
+    DBUG_RETURN(-1);
+  DBUG_RETURN(flush_pages());
+}
+
 /* get current position of index file */
 long long Spartan_index::curfpos()
 {
@@ -522,46 +2120,47 @@ long long Spartan_index::curfpos()
   DBUG_RETURN(pos);
 }
 
-/* write the index back to disk */
+/*
+  Write the pages that changed since the index was last saved, then the
+  header. Nothing is written if no page changed.
+*/
 int Spartan_index::save_index()
 {
-  SDE_NDX_NODE *n = root;
-  int i;
-  
   DBUG_ENTER("Spartan_index::save_index");
-  i = chsize(index_file, 0L);
-  write_header();
-  while (n != NULL)
-  {
-    write_row(&n->key_ndx);
-    n = n->next;
-  }
-  DBUG_RETURN(0);
+  if (hash != NULL)
+    DBUG_RETURN(hash->save_index());
+  if ((index_file == -1) || clean)
+    DBUG_RETURN(0);
+  DBUG_RETURN(flush_pages());
 }
 
+/* empty the index: every page is dropped and the file cut back */
 int Spartan_index::destroy_index()
 {
-  SDE_NDX_NODE *n = root;
-  
   DBUG_ENTER("Spartan_index::destroy_index");
-  while (root != NULL)
+  if (hash != NULL)
+    DBUG_RETURN(hash->destroy_index());
+  reset_tree();
+  if ((index_file != -1) && paged)
   {
-    n = root;
-    root = n->next;    
-    delete n;
+    cut_file(SDI_HEADER_SIZE);
+    write_header();
   }
-  root = NULL;
   DBUG_RETURN(0);
 }
 
 /* ket the file position of the first key in index */
 long long Spartan_index::get_first_pos()
 {
+  SDE_BTREE_NODE *n;
   long long pos = -1;
 
   DBUG_ENTER("Spartan_index::get_first_pos");
-  if (root != NULL)
-    pos = root->key_ndx.pos;
+  trim_cache(SDI_CACHE_PAGES);
+  for (n = first_leaf(); (n != NULL) && (n->count == 0); )
+    n = next_leaf(n);
+  if (n != NULL)
+    pos = entry_pos(n, 0);
   DBUG_RETURN(pos);
 }
 
@@ -569,10 +2168,332 @@ long long Spartan_index::get_first_pos()
 int Spartan_index::trunc_index()
 {
   DBUG_ENTER("Spartan_index::trunc_table");
+  if (hash != NULL)
+    DBUG_RETURN(hash->trunc_index());
   if (index_file != -1)
   {
-    my_chsize(index_file, 0, 0, MYF(MY_WME));
+    cut_file(0);
+    crashed = false;
+    checksums = true;
+    paged = true;
+    old_pages = false;
+    set_block_size();
+    reset_tree();
     write_header();
   }
   DBUG_RETURN(0);
 }
+
+/*
+  Move every key to the new position of its row after the data file
+  has been rewritten. old_pos is in ascending order (the order the rows
+  were copied in) and new_pos[i] is where the row at old_pos[i] is now.
+*/
+int Spartan_index::remap_positions(long long *old_pos, long long *new_pos,
+                                   int count)
+{
+  SDE_BTREE_NODE *n;
+  long long pos;
+  int lo;
+  int hi;
+  int mid = 0;
+  int next;
+  int i;
+
+  DBUG_ENTER("Spartan_index::remap_positions");
+  if (hash != NULL)
+    DBUG_RETURN(hash->remap_positions(old_pos, new_pos, count));
+  trim_cache(SDI_CACHE_PAGES);
+  for (n = first_leaf(); n != NULL; )
+  {
+    for (i = 0; i < n->count; i++)
+    {
+      /*
+        Binary search for the key's old position.
+      */
+      pos = entry_pos(n, i);
+      lo = 0;
+      hi = count - 1;
+      while (lo <= hi)
+      {
+        mid = (lo + hi) / 2;
+        if (old_pos[mid] == pos)
+          break;
+        if (old_pos[mid] < pos)
+          lo = mid + 1;
+        else
+          hi = mid - 1;
+      }
+      if ((lo <= hi) && (pos != new_pos[mid]))
+      {
+        set_entry_pos(n, i, new_pos[mid]);
+        mark_dirty(n);
+      }
+    }
+    next = n->next;
+    trim_cache(SDI_CACHE_PAGES);
+    n = (next != 0) ? get_page(next) : NULL;
+  }
+  DBUG_RETURN(0);
+}
+
+/* get the number of keys in the index */
+int Spartan_index::key_count()
+{
+  DBUG_ENTER("Spartan_index::key_count");
+  if (hash != NULL)
+    DBUG_RETURN(hash->key_count());
+  DBUG_RETURN(keys);
+}
+
+/* get the length of the index file once it is saved */
+long long Spartan_index::index_length()
+{
+  DBUG_ENTER("Spartan_index::index_length");
+  if (hash != NULL)
+    DBUG_RETURN(hash->index_length());
+  if (block_size == -1)
+    DBUG_RETURN(0);
+  DBUG_RETURN((long long)pages * page_size);
+}
+
+/*
+  Estimate the keys less than key (not greater than key if upper is
+  set) from the way down to the leaf it belongs in: the keys under each
+  inner node on the way are taken as shared evenly by its children, and
+  the slot it would take in the leaf is exact. Sets *page and *slot to
+  that leaf and slot (0 and 0 if the index is empty).
+*/
+double Spartan_index::key_rank(byte *key, int key_len, bool upper,
+                               int *page, int *slot)
+{
+  SDE_BTREE_NODE *n;
+  double rank = 0.0;
+  double share = 1.0;
+  int level = 0;
+  int lo;
+  int hi;
+  int mid;
+  int icmp;
+  int i;
+
+  DBUG_ENTER("Spartan_index::key_rank");
+  *page = 0;
+  *slot = 0;
+  if (root == 0)
+    DBUG_RETURN(0.0);
+  n = get_page(root);
+  while ((n != NULL) && !n->leaf && (level++ < SDI_MAX_DEPTH))
+  {
+    /*
+      Take the last child whose first key is less than the key (not
+      greater if upper is set), as find_leaf() does.
+    */
+    i = 0;
+    lo = 1;
+    hi = n->count - 1;
+    while (lo <= hi)
+    {
+      mid = (lo + hi) / 2;
+      icmp = cmp_entry(n, mid, key, key_len);
+      if ((icmp < 0) || (upper && (icmp == 0)))
+      {
+        i = mid;
+        lo = mid + 1;
+      }
+      else
+        hi = mid - 1;
+    }
+    share /= n->count;
+    rank += i * share;
+    n = get_page(entry_child(n, i));
+  }
+  if ((n == NULL) || !n->leaf)
+    DBUG_RETURN(0.0);
+  lo = 0;
+  hi = n->count;
+  while (lo < hi)
+  {
+    mid = (lo + hi) / 2;
+    icmp = cmp_entry(n, mid, key, key_len);
+    if ((icmp < 0) || (upper && (icmp == 0)))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *page = n->page;
+  *slot = lo;
+  if (n->count > 0)
+    rank += share * lo / n->count;
+  DBUG_RETURN(rank * keys);
+}
+
+/*
+  Count the keys from min_key to max_key, comparing them the way the
+  index is ordered. A bound is left out if its key is NULL and is
+  included if its incl flag is set. The count is exact if both bounds
+  fall in the same leaf; otherwise it is estimated from the ways down
+  to the two bounds (see key_rank()), so it takes two searches however
+  many keys the range holds.
+*/
+int Spartan_index::count_range(byte *min_key, int min_len, bool min_incl,
+                               byte *max_key, int max_len, bool max_incl)
+{
+  double lo = 0.0;
+  double hi = keys;
+  int lo_page = 0;
+  int lo_slot = 0;
+  int hi_page = 0;
+  int hi_slot = 0;
+  int count;
+
+  DBUG_ENTER("Spartan_index::count_range");
+  if (hash != NULL)
+    DBUG_RETURN(hash->count_range(min_key, min_len, min_incl,
+                                  max_key, max_len, max_incl));
+  trim_cache(SDI_CACHE_PAGES);
+  if (min_key != NULL)
+    lo = key_rank(min_key, min_len, !min_incl, &lo_page, &lo_slot);
+  if (max_key != NULL)
+    hi = key_rank(max_key, max_len, max_incl, &hi_page, &hi_slot);
+  if ((min_key != NULL) && (max_key != NULL) && (lo_page != 0) &&
+      (lo_page == hi_page))
+    DBUG_RETURN((hi_slot > lo_slot) ? hi_slot - lo_slot : 0);
+  count = (int)(hi - lo + 0.5);
+  DBUG_RETURN((count > 0) ? count : 0);
+}
+
+/*
+  Count the distinct values of the first lengths[p] bytes of the keys
+  for each of the parts prefixes: counts[p] gets the number. The keys
+  are walked in order, so a key starts a new value of every prefix
+  longer than the bytes it shares with the key before it. Returns 0 or
+  -1 on error.
+*/
+int Spartan_index::count_prefixes(int *lengths, int parts, ulong *counts)
+{
+  SDE_BTREE_NODE *n;
+  SDE_INDEX cur;
+  SDE_INDEX prev;
+  bool have_prev = false;
+  int same;
+  int slot;
+  int next;
+  int p;
+
+  DBUG_ENTER("Spartan_index::count_prefixes");
+  if (hash != NULL)
+    DBUG_RETURN(hash->count_prefixes(lengths, parts, counts));
+  for (p = 0; p < parts; p++)
+    counts[p] = 0;
+  trim_cache(SDI_CACHE_PAGES);
+  n = first_leaf();
+  while (n != NULL)
+  {
+    for (slot = 0; slot < n->count; slot++)
+    {
+      get_entry(n, slot, &cur);
+      same = have_prev ? common_prefix(prev.key, cur.key, max_key_len) : -1;
+      for (p = 0; p < parts; p++)
+        if (lengths[p] > same)
+          counts[p]++;
+      memcpy(prev.key, cur.key, max_key_len);
+      have_prev = true;
+    }
+    next = n->next;
+    trim_cache(SDI_CACHE_PAGES);
+    n = (next != 0) ? get_page(next) : NULL;
+  }
+  DBUG_RETURN(crashed ? -1 : 0);
+}
+
+/* is the index marked crashed (a page failed its checksum) */
+bool Spartan_index::is_crashed()
+{
+  DBUG_ENTER("Spartan_index::is_crashed");
+  if (hash != NULL)
+    DBUG_RETURN(hash->is_crashed());
+  DBUG_RETURN(crashed);
+}
+
+/*
+  Check the index a few leaves at a time for CHECK TABLE, which calls
+  this until *from is -1 and lets data_mutex go in between. pages
+  leaves are walked from leaf *from (0 = the first leaf); each key must
+  not be less than the key before it, nor equal if dupes are not
+  allowed. The keys walked are counted in *listed and their
+  fingerprints (see spartan_key_fingerprint()) added to *sum for the
+  caller to compare with the rows. *from is set to the next leaf, or
+  -1 after the last. Returns the number of problems found.
+*/
+int Spartan_index::check_index(bool allow_dupes, int *from, int pages,
+                               int *listed, ulonglong *sum)
+{
+  SDE_BTREE_NODE *n;
+  SDE_BTREE_NODE *p;
+  SDE_INDEX cur;
+  SDE_INDEX prev;
+  bool have_prev = false;
+  int slot;
+  int next;
+  int icmp;
+  int bad = 0;
+
+  DBUG_ENTER("Spartan_index::check_index");
+  if (hash != NULL)
+    DBUG_RETURN(hash->check_index(allow_dupes, from, pages, listed, sum));
+  trim_cache(SDI_CACHE_PAGES);
+  n = (*from == 0) ? first_leaf() : get_page(*from);
+  /*
+    A walk that goes on from an earlier call compares its first key
+    with the last key of the leaf before.
+  */
+  if ((n != NULL) && (*from != 0) && (n->prev != 0) &&
+      ((p = get_page(n->prev)) != NULL) && (p->count > 0))
+  {
+    get_entry(p, p->count - 1, &prev);
+    have_prev = true;
+  }
+  while ((n != NULL) && (pages-- > 0))
+  {
+    for (slot = 0; slot < n->count; slot++)
+    {
+      get_entry(n, slot, &cur);
+      (*listed)++;
+      *sum += spartan_key_fingerprint(cur.key, max_key_len, cur.pos);
+      if (have_prev)
+      {
+        icmp = cmp_key(&prev, cur.key, cur.length);
+        if ((icmp > 0) || (!allow_dupes && (icmp == 0)))
+          bad++;
+      }
+      prev = cur;
+      have_prev = true;
+    }
+    next = n->next;
+    trim_cache(SDI_CACHE_PAGES);
+    n = (next != 0) ? get_page(next) : NULL;
+  }
+  *from = (n != NULL) ? n->page : -1;
+  DBUG_RETURN(bad);
+}
+
+/*
+  Replace the index with the count keys in ndx taken from the rows of
+  the data file (REPAIR TABLE) and write it to disk with the crashed
+  flag cleared. Returns the number of keys in the index or -1 on error.
+*/
+int Spartan_index::rebuild_index(SDE_INDEX *ndx, int count, bool allow_dupes)
+{
+  int added;
+
+  DBUG_ENTER("Spartan_index::rebuild_index");
+  if (hash != NULL)
+    DBUG_RETURN(hash->rebuild_index(ndx, count, allow_dupes));
+  crashed = false;
+  destroy_index();
+  if ((added = bulk_insert(ndx, count, allow_dupes)) == -1)
+    DBUG_RETURN(-1);
+  save_index();
+  DBUG_RETURN(added);
+}
@@ -3,21 +3,137 @@
  
   This header file defines a simple index class that can
   be used to store file pointer indexes (long long). The 
-  class keeps the entire index in memory for fast access.
-  The internal memory structure is a linked list. While
-  not as efficient as a btree, it should be usable for
-  most testing environments. The constructor accepts the 
-  max key length. This is used for all nodes in the index.
+  index is a B+tree kept in the index file a page (node) at
+  a time: the keys are held in order in leaves of
+  SDI_PAGE_SIZE bytes, linked to the leaves on either side,
+  and a key is found by a binary search in each node on the
+  way down, so a lookup takes O(log n) and reads only the
+  pages on its path. The constructor accepts the max key
+  length. This is used for all keys in the index. Keys are
+  compared with memcmp(); the handler makes them so that
+  this is the order of their values (see
+  ha_spartan::make_key()).
+
+  A node in memory is its page as it is in the file, so a
+  key takes max_key_len bytes (the length of the key of the
+  table, not the 128 bytes of SDE_INDEX) and the bytes all
+  keys of a node start with are kept once for the node: a
+  leaf of 4 byte keys holds about 290 keys, a leaf of CHAR
+  keys with a long common prefix more than one of keys
+  without. How many keys fit in a node, and in the cache,
+  depends on their length.
+
+  Pages are read when they are first needed and kept in a
+  cache of SDI_CACHE_PAGES pages; the least recently used
+  page is dropped (written first if it changed) when the
+  cache is full. save_index() writes the pages that changed,
+  so opening the index reads only the header and a change
+  to one key writes only the pages it touched.
+
+  A cursor (SDE_CURSOR) is a leaf and a slot in it.
+  seek_index() sets it to the key it finds; next_entry() and
+  prev_entry() then return the entry under the cursor and
+  move it one key on (or back), so equal keys are walked by
+  their row positions. seek_end() sets it to the first or
+  the last key, and seek_bound() to the key on either side
+  of where a key would go. Each of these takes the cursor to
+  move: every handler has its own for each index (see
+  add_cursor()), so walks of the same index by different
+  statements, or twice in a self-join, do not move each
+  other. Without one they move the index's own cursor, the
+  one get_next_key() and get_prev_key() use. Keys inserted
+  or removed while a cursor is set leave it on the same key
+  (or, if that key was removed, the one after it). The entry
+  or key these return is only good until the next call with
+  the same cursor.
 
   File Layout:
     SOF                              max_key_len (int)
-    SOF + sizeof(int)                crashed (bool)
-    SOF + sizeof(int) + sizeof(bool) DATA BEGINS HERE
+    SOF + sizeof(int)                flags (byte)
+    SOF + 5                          root page (int)
+    SOF + 9                          number of pages (int)
+    SOF + 13                         number of keys (int)
+    SOF + 17                         first free page (int)
+    SOF + SDI_PAGE_SIZE              PAGES BEGIN HERE
+  The header is page 0 so page n is at n times SDI_PAGE_SIZE. A page
+  is the leaf flag (bool), the number of entries (int), the next and
+  the previous leaf (int each, 0 = none), the CRC32C (see
+  Spartan_crc.h) of the page taken with this field zero, the length of
+  the prefix (uint16) and the prefix: the bytes every key of the page
+  starts with. The entries follow, each the rest of the key
+  (max_key_len bytes less the prefix), the key length (uint16) and the
+  row position (long long) in a leaf or the child page (int) in an
+  inner page. Freed pages are chained through their next leaf. A page
+  whose checksum does not match is taken as an empty leaf and the
+  index is marked crashed.
+
+  The header is written with SDI_CRASHED set when the first page
+  changes after a save and cleared by the next one, so an index that
+  was not saved (the server stopped) is reported crashed when it is
+  opened again.
+
+  With a redo log attached (set_log()) every write to the file is
+  logged first (see Spartan_log.h), so the pages saved by a statement
+  are as durable as its rows: the log is replayed over the index file
+  before the index is loaded.
+
+  Older files (no SDI_PAGED in the flags) are a list of the entries in
+  key order after the first five bytes of the header, each ending with
+  a CRC32C of the rest of it if SDI_CHECKSUMS is set. Files with
+  SDI_PAGED but not SDI_PACKED have pages of SDE_OLD_NODE_KEYS entries
+  and as many child pages, an entry being the whole key (max_key_len
+  bytes), the row position and the key length (int), after a header
+  without the prefix. load_index() reads the keys of either and writes
+  the file again in packed pages.
+
+  A file with SDI_HASHED in the flags is a hash index (a key created
+  USING HASH, see Spartan_hash.h): open_index() hands it to the
+  Spartan_hash class and every call after that is passed on to it.
+  Such an index finds whole keys only and has no order, so
+  prev_entry() and seek_end(true) return NULL.
 */
+#pragma once
 #include "my_global.h"
 #include "my_sys.h"
+#include "spartan_crc.h"
+#include "spartan_log.h"
 
 const long METADATA_SIZE = sizeof(int) + sizeof(bool);
+
+/* size of the header of a paged file */
+const long SDI_HEADER_SIZE = METADATA_SIZE + 4 * sizeof(int);
+
+/* flags in the header */
+const byte SDI_CRASHED = 0x01;
+const byte SDI_CHECKSUMS = 0x02;
+const byte SDI_PAGED = 0x04;
+const byte SDI_PACKED = 0x08;
+const byte SDI_HASHED = 0x10;
+
+/* size of a page */
+const int SDI_PAGE_SIZE = 4096;
+
+/* bytes of a node filled when a tree is built from sorted keys */
+const int SDI_PAGE_FILL = SDI_PAGE_SIZE * 3 / 4;
+
+/* offset of the checksum in a page */
+const int SDI_PAGE_CRC = sizeof(bool) + 3 * sizeof(int);
+
+/* offset of the length of the prefix in a page */
+const int SDI_PAGE_PREFIX = SDI_PAGE_CRC + sizeof(uint32);
+
+/* size of the header of a page (the prefix follows it) */
+const int SDI_PAGE_HEADER = SDI_PAGE_PREFIX + sizeof(uint16);
+
+/* older paged files: size of the header of a page, entries in a page */
+const int SDI_OLD_PAGE_HEADER = SDI_PAGE_PREFIX;
+const int SDE_OLD_NODE_KEYS = 32;
+
+/* pages of the index kept in memory */
+const int SDI_CACHE_PAGES = 1024;
+
+/* levels of the B+tree a search can go down */
+const int SDI_MAX_DEPTH = 32;
 /*
   This is the node that stores the key and the file 
   position for the data row.
@@ -29,14 +145,50 @@ struct SDE_INDEX
   int length;
 };
 
-/* defines (doubly) linked list for internal list */
-struct SDE_NDX_NODE
+/*
+  A cursor walking an index: where the next entry is and the entry
+  last returned. A hash index (see Spartan_hash.h) uses the hash
+  fields; a rebuild of its table ends the walk. The index keeps the
+  cursors set on it in a list through next.
+*/
+struct SDE_CURSOR
+{
+  int page;                  /* leaf of the next key (0 = none) */
+  int slot;                  /* slot of the next key */
+  int bucket;                /* hash: bucket of the next slot (-1 = none) */
+  bool all;                  /* hash: walk every entry, not one key */
+  uint32 hash;               /* hash: hash of the key walked */
+  ulong rebuilds;            /* hash: rebuilds of the table when set */
+  SDE_INDEX key;             /* hash: the key walked */
+  SDE_INDEX found;           /* the entry the cursor returned */
+  SDE_CURSOR *next;          /* next cursor on the same index */
+};
+
+/*
+  A node of the B+tree: a page of the index file in memory (data, laid
+  out as in the file; the fields below are copied into its header when
+  it is written). A leaf holds count keys in key order. An inner node
+  holds count children; the key of entry i (i > 0) is the first key of
+  child i when it was added, so the keys of child i are not less than
+  it and those of child i - 1 are not greater. Emptied nodes are taken
+  out of the tree; nodes are not merged.
+*/
+struct SDE_BTREE_NODE
 {
-  SDE_INDEX key_ndx;  
-  SDE_NDX_NODE *next;
-  SDE_NDX_NODE *prev;
+  byte *data;                /* the page (SDI_PAGE_SIZE bytes) */
+  int prefix;                /* bytes every key of the node starts with */
+  int next;                  /* leaf: page of the next leaf (0 = none) */
+  int prev;                  /* leaf: page of the previous leaf */
+  int count;
+  bool leaf;
+  int page;                  /* page of the file the node is kept in */
+  bool dirty;                /* changed since it was read or written */
+  SDE_BTREE_NODE *newer;     /* cache: next more recently used node */
+  SDE_BTREE_NODE *older;     /* cache: next less recently used node */
 };
 
+class Spartan_hash;
+
 class Spartan_index
 {
 public:
@@ -45,32 +197,128 @@ public:
   ~Spartan_index(void);
   int open_index(char *path);
   int create_index(char *path, int keylen);
+  int create_hash(char *path, int keylen);
   int insert_key(SDE_INDEX *ndx, bool allow_dupes);
+  int bulk_insert(SDE_INDEX *ndx, int count, bool allow_dupes);
   int delete_key(byte *buf, long long pos, int key_len);
-  int update_key(byte *buf, long long pos, int key_len);
+  int update_key(byte *old_key, long long old_pos, byte *buf, long long pos,
+                 int key_len);
   long long get_index_pos(byte *buf, int key_len);
   long long get_first_pos();
   byte *get_first_key();
   byte *get_last_key();
   byte *get_next_key();
   byte *get_prev_key();
+  SDE_INDEX *next_entry(SDE_CURSOR *cur = NULL);
+  SDE_INDEX *prev_entry(SDE_CURSOR *cur = NULL);
+  SDE_INDEX *seek_end(bool last, SDE_CURSOR *cur = NULL);
   int close_index();
   int load_index();
   int destroy_index();
-  SDE_INDEX *seek_index(byte *key, int key_len);
-  SDE_NDX_NODE *seek_index_pos(byte *key, int key_len);
+  SDE_INDEX *seek_index(byte *key, int key_len, SDE_CURSOR *cur = NULL);
+  SDE_INDEX *seek_bound(byte *key, int key_len, bool after, bool last,
+                        SDE_CURSOR *cur = NULL);
+  void add_cursor(SDE_CURSOR *cur);
+  void remove_cursor(SDE_CURSOR *cur);
   int save_index();
   int trunc_index();
+  int remap_positions(long long *old_pos, long long *new_pos, int count);
+  int key_count();
+  long long index_length();
+  int count_range(byte *min_key, int min_len, bool min_incl,
+                  byte *max_key, int max_len, bool max_incl);
+  int count_prefixes(int *lengths, int parts, ulong *counts);
+  bool is_crashed();
+  int check_index(bool allow_dupes, int *from, int pages, int *listed,
+                  ulonglong *sum);
+  int rebuild_index(SDE_INDEX *ndx, int count, bool allow_dupes);
+  void set_log(Spartan_log *new_log, int inx);
 private:
   File index_file;
+  Spartan_log *log;          /* redo log for writes to the file (or NULL) */
+  int log_inx;               /* number of the file in the log */
+  Spartan_hash *hash;        /* the hash index the file holds (or NULL) */
   int max_key_len;
-  SDE_NDX_NODE *root;
-  SDE_NDX_NODE *range_ptr;
-  int block_size;
+  int root;                  /* page of the root (0 = empty) */
+  int pages;                 /* pages in the file (with the header) */
+  int free_head;             /* first free page (0 = none) */
+  int page_size;
+  int leaf_keys;             /* most entries a leaf may hold */
+  int inner_keys;            /* most entries an inner node may hold */
+  int block_size;            /* older files: size of an entry */
+  int keys;                  /* number of keys in the index */
   bool crashed;
+  bool checksums;            /* older files: entries carry checksums */
+  bool paged;                /* the file is in pages */
+  bool old_pages;            /* older files: in pages of whole keys */
+  bool clean;                /* the file matches the pages in memory */
+  SDE_BTREE_NODE **cache;    /* node of each page in memory (or NULL) */
+  int cache_size;            /* entries allocated in cache */
+  int cached;                /* nodes in memory */
+  SDE_BTREE_NODE *newest;    /* most recently used node */
+  SDE_BTREE_NODE *oldest;    /* least recently used node */
+  byte *page_buf;            /* a page as it is in the file */
+  SDE_INDEX *split_keys;     /* the entries of a node being split */
+  int *split_child;          /* and their children */
+  SDE_CURSOR own;            /* the cursor used when none is given */
+  SDE_CURSOR *cursors;       /* the cursors set on the index (own first) */
+  SDE_INDEX key_copy;        /* the key get_*_key() returned */
+  SDE_BTREE_NODE *lost;      /* stands in for pages not in the file */
+  int path_page[SDI_MAX_DEPTH];  /* inner nodes down to the last leaf found */
+  int path_slot[SDI_MAX_DEPTH];  /* child taken in each of them */
+  int depth;                 /* inner nodes in the path */
+  void set_block_size();
   int read_header();
   int write_header();
-  long long write_row(SDE_INDEX *ndx);
+  int write_file(byte *buf, int length, long long position);
+  int cut_file(long long length);
   SDE_INDEX *read_row(long long Position);
   long long curfpos();
+  int read_page(SDE_BTREE_NODE *n);
+  int write_page(SDE_BTREE_NODE *n);
+  SDE_BTREE_NODE *cache_node(int page);
+  SDE_BTREE_NODE *get_page(int page);
+  SDE_BTREE_NODE *new_page(bool leaf);
+  void free_page(SDE_BTREE_NODE *n);
+  void mark_dirty(SDE_BTREE_NODE *n);
+  int flush_pages();
+  void trim_cache(int limit);
+  void drop_cache();
+  void reset_tree();
+  int convert_index();
+  int read_old_entries(SDE_INDEX **ndx, int *count);
+  int read_old_pages(SDE_INDEX **ndx, int *count);
+  int entry_size(bool leaf, int prefix);
+  int max_entries(bool leaf);
+  byte *entry(SDE_BTREE_NODE *n, int i);
+  int cmp_entry(SDE_BTREE_NODE *n, int i, byte *key, int key_len);
+  void get_entry(SDE_BTREE_NODE *n, int i, SDE_INDEX *ndx);
+  byte *entry_key(SDE_BTREE_NODE *n, int i);
+  byte *copy_key(SDE_INDEX *ndx);
+  long long entry_pos(SDE_BTREE_NODE *n, int i);
+  void set_entry_pos(SDE_BTREE_NODE *n, int i, long long pos);
+  int entry_child(SDE_BTREE_NODE *n, int i);
+  void put_entry(SDE_BTREE_NODE *n, int i, SDE_INDEX *ndx, int child);
+  void start_node(SDE_BTREE_NODE *n, SDE_INDEX *first, SDE_INDEX *last);
+  bool add_entry(SDE_BTREE_NODE *n, int slot, SDE_INDEX *ndx, int child);
+  void remove_entry(SDE_BTREE_NODE *n, int slot);
+  SDE_BTREE_NODE *split_node(SDE_BTREE_NODE *n, int slot, SDE_INDEX *ndx,
+                             int child, SDE_INDEX *sep);
+  int node_slot(SDE_BTREE_NODE *leaf, byte *key, int key_len);
+  int fill_run(SDE_INDEX **sorted, int from, int count, bool leaf);
+  SDE_BTREE_NODE *find_leaf(byte *key, int key_len);
+  double key_rank(byte *key, int key_len, bool upper, int *page, int *slot);
+  bool find_path(int page, int level, byte *key, int key_len, int target);
+  bool lower_bound(byte *key, int key_len, SDE_BTREE_NODE **leaf, int *slot);
+  bool find_entry(byte *key, int key_len, long long pos,
+                  SDE_BTREE_NODE **leaf, int *slot);
+  SDE_BTREE_NODE *next_leaf(SDE_BTREE_NODE *n);
+  void insert_child(int level, SDE_BTREE_NODE *right, SDE_INDEX *sep);
+  void insert_at(SDE_BTREE_NODE *leaf, int slot, SDE_INDEX *ndx);
+  void remove_at(SDE_BTREE_NODE *leaf, int slot);
+  SDE_BTREE_NODE *first_leaf();
+  SDE_BTREE_NODE *last_leaf();
+  int build_tree(SDE_INDEX **sorted, int count);
+  void reset_cursors();
+  void fix_cursor(SDE_CURSOR *cur);
 };
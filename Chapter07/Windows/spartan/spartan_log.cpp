@@ -0,0 +1,382 @@
+/*
+  Spartan_log.cpp
+
+  This class implements the redo log of the Spartan data class (and of
+  the index class, see Spartan_log.h). An lsn
+  (log sequence number) is a byte count of all records ever added to
+  the log, so the end of a record is also its lsn. The log file holds
+  the records from start_lsn on; reset() empties it and moves start_lsn
+  up to the end of the log.
+*/
+#include "Spartan_log.h"
+#include <my_dir.h>
+#include <zlib.h>
+
+/* size of the record header: type, position, length and crc32 */
+static const int SDL_RECORD_HEADER = sizeof(byte) + sizeof(long long) +
+                                     2 * sizeof(int);
+
+Spartan_log::Spartan_log(void)
+{
+  int i;
+
+  log_file = -1;
+  for (i = 0; i < SDL_MAX_FILES; i++)
+    index_file[i] = -1;
+  log_buf = NULL;
+  log_buf_len = 0;
+  log_buf_size = 0;
+  start_lsn = 0;
+  written_lsn = 0;
+  synced_lsn = 0;
+  syncing = false;
+  needs_replay = false;
+  pthread_mutex_init(&log_mutex, MY_MUTEX_INIT_FAST);
+  pthread_cond_init(&log_cond, NULL);
+}
+
+Spartan_log::~Spartan_log(void)
+{
+  close_log();
+  pthread_cond_destroy(&log_cond);
+  pthread_mutex_destroy(&log_mutex);
+}
+
+/*
+  Open (or create) the log at location "path". Nothing is done if the
+  log is already open. A log that has records in it is replayed by the
+  next replay() call.
+*/
+int Spartan_log::open_log(char *path)
+{
+  long long length;
+
+  DBUG_ENTER("Spartan_log::open_log");
+  if (log_file != -1)
+    DBUG_RETURN(0);
+  log_file = my_open(path, O_RDWR | O_CREAT | O_BINARY | O_SHARE, MYF(0));
+  if (log_file == -1)
+    DBUG_RETURN(errno);
+  log_buf = (byte *)my_malloc(SDL_BUFFER_SIZE, MYF(MY_WME));
+  if (log_buf == NULL)
+  {
+    close_log();
+    DBUG_RETURN(ENOMEM);
+  }
+  log_buf_size = SDL_BUFFER_SIZE;
+  log_buf_len = 0;
+  length = my_seek(log_file, 0L, MY_SEEK_END, MYF(0));
+  needs_replay = (length > 0);
+  start_lsn = 0;
+  written_lsn = length;
+  synced_lsn = length;
+  DBUG_RETURN(0);
+}
+
+/* close the log (records still buffered are written first) */
+int Spartan_log::close_log()
+{
+  DBUG_ENTER("Spartan_log::close_log");
+  if (log_file != -1)
+  {
+    pthread_mutex_lock(&log_mutex);
+    flush_buffer();
+    pthread_mutex_unlock(&log_mutex);
+    my_close(log_file, MYF(0));
+    log_file = -1;
+  }
+  if (log_buf != NULL)
+    my_free((gptr)log_buf, MYF(0));
+  log_buf = NULL;
+  log_buf_len = 0;
+  log_buf_size = 0;
+  DBUG_RETURN(0);
+}
+
+/*
+  Add a record for length bytes of buf written at position of the data
+  file. Returns the lsn of the end of the record (0 if the log is not
+  open) or -1 on error.
+*/
+long long Spartan_log::write_record(byte type, long long position,
+                                    byte *buf, int length)
+{
+  byte *ptr;
+  uint32 crc;
+  long long lsn;
+  int size = SDL_RECORD_HEADER + length;
+
+  DBUG_ENTER("Spartan_log::write_record");
+  if (log_file == -1)
+    DBUG_RETURN(0);
+  pthread_mutex_lock(&log_mutex);
+  /*
+    Make room in the log buffer. A record larger than the buffer gets
+    a buffer of its own size.
+  */
+  if ((log_buf_len + size > log_buf_size) && flush_buffer())
+  {
+    pthread_mutex_unlock(&log_mutex);
+    DBUG_RETURN(-1);
+  }
+  if (size > log_buf_size)
+  {
+    ptr = (byte *)my_realloc((gptr)log_buf, size, MYF(MY_WME));
+    if (ptr == NULL)
+    {
+      pthread_mutex_unlock(&log_mutex);
+      DBUG_RETURN(-1);
+    }
+    log_buf = ptr;
+    log_buf_size = size;
+  }
+  ptr = log_buf + log_buf_len;
+  ptr[0] = type;
+  memcpy(ptr + sizeof(byte), &position, sizeof(long long));
+  memcpy(ptr + sizeof(byte) + sizeof(long long), &length, sizeof(int));
+  if (length > 0)
+    memcpy(ptr + SDL_RECORD_HEADER, buf, length);
+  crc = crc32(0L, ptr, sizeof(byte) + sizeof(long long) + sizeof(int));
+  if (length > 0)
+    crc = crc32(crc, ptr + SDL_RECORD_HEADER, length);
+  memcpy(ptr + sizeof(byte) + sizeof(long long) + sizeof(int), &crc,
+         sizeof(int));
+  log_buf_len += size;
+  lsn = written_lsn + log_buf_len;
+  pthread_mutex_unlock(&log_mutex);
+  DBUG_RETURN(lsn);
+}
+
+/*
+  Write the records up to lsn to the log file (without syncing it). The
+  data class calls this before it changes the data file.
+*/
+int Spartan_log::write_log(long long lsn)
+{
+  int i = 0;
+
+  DBUG_ENTER("Spartan_log::write_log");
+  if (log_file == -1)
+    DBUG_RETURN(0);
+  pthread_mutex_lock(&log_mutex);
+  if (written_lsn < lsn)
+    i = flush_buffer();
+  pthread_mutex_unlock(&log_mutex);
+  DBUG_RETURN(i);
+}
+
+/*
+  Make the records up to lsn durable. The first thread to get here
+  writes and syncs every record added so far and the threads that come
+  while it syncs wait for it. Their records are synced by the next
+  thread to lead, so one sync commits a whole group of statements.
+  Returns 0 or -1 on error.
+*/
+int Spartan_log::commit(long long lsn)
+{
+  int i = 0;
+  long long target;
+
+  DBUG_ENTER("Spartan_log::commit");
+  if (log_file == -1)
+    DBUG_RETURN(0);
+  pthread_mutex_lock(&log_mutex);
+  while ((synced_lsn < lsn) && (i == 0))
+  {
+    if (syncing)
+    {
+      pthread_cond_wait(&log_cond, &log_mutex);
+      continue;
+    }
+    /*
+      Lead the group: write what is buffered and sync it with the log
+      mutex released so other threads can add records meanwhile.
+    */
+    syncing = true;
+    i = flush_buffer();
+    target = written_lsn;
+    pthread_mutex_unlock(&log_mutex);
+    if ((i == 0) && my_sync(log_file, MYF(MY_WME)))
+      i = -1;
+    pthread_mutex_lock(&log_mutex);
+    if ((i == 0) && (synced_lsn < target))
+      synced_lsn = target;
+    syncing = false;
+    pthread_cond_broadcast(&log_cond);
+  }
+  pthread_mutex_unlock(&log_mutex);
+  DBUG_RETURN(i);
+}
+
+/* get the lsn of the end of the log */
+long long Spartan_log::end_lsn()
+{
+  long long lsn;
+
+  DBUG_ENTER("Spartan_log::end_lsn");
+  pthread_mutex_lock(&log_mutex);
+  lsn = written_lsn + log_buf_len;
+  pthread_mutex_unlock(&log_mutex);
+  DBUG_RETURN(lsn);
+}
+
+/* get the number of bytes in the log since the last checkpoint */
+long long Spartan_log::log_size()
+{
+  DBUG_ENTER("Spartan_log::log_size");
+  DBUG_RETURN(end_lsn() - start_lsn);
+}
+
+/*
+  Apply the records in the log to data_file and sync it. This is only
+  done if the log had records when it was opened; the log is emptied
+  afterwards. Returns 0 or -1 on error.
+*/
+int Spartan_log::replay(File data_file)
+{
+  byte rec_header[SDL_RECORD_HEADER];
+  byte *buf = NULL;
+  int buf_size = 0;
+  long long pos = 0;
+  long long position;
+  int length;
+  uint32 crc;
+  uint32 rec_crc;
+  int inx;
+
+  DBUG_ENTER("Spartan_log::replay");
+  if ((log_file == -1) || !needs_replay)
+    DBUG_RETURN(0);
+  for (;;)
+  {
+    /*
+      Read the record and check it is whole.
+    */
+    if (my_pread(log_file, rec_header, SDL_RECORD_HEADER, pos, MYF(0)) !=
+        (uint)SDL_RECORD_HEADER)
+      break;
+    memcpy(&position, rec_header + sizeof(byte), sizeof(long long));
+    memcpy(&length, rec_header + sizeof(byte) + sizeof(long long),
+           sizeof(int));
+    memcpy(&rec_crc, rec_header + sizeof(byte) + sizeof(long long) +
+           sizeof(int), sizeof(int));
+    if ((length < 0) || (position < 0))
+      break;
+    if (length > buf_size)
+    {
+      if (buf != NULL)
+        my_free((gptr)buf, MYF(0));
+      buf = (byte *)my_malloc(length, MYF(MY_WME));
+      buf_size = (buf == NULL) ? 0 : length;
+      if (buf == NULL)
+        DBUG_RETURN(-1);
+    }
+    if ((length > 0) &&
+        (my_pread(log_file, buf, length, pos + SDL_RECORD_HEADER, MYF(0)) !=
+         (uint)length))
+      break;
+    crc = crc32(0L, rec_header, sizeof(byte) + sizeof(long long) +
+                sizeof(int));
+    if (length > 0)
+      crc = crc32(crc, buf, length);
+    if (crc != rec_crc)
+      break;
+    /*
+      Apply it to the data file (or the index file).
+    */
+    if (rec_header[0] == SDL_TRUNCATE)
+      my_chsize(data_file, position, 0, MYF(MY_WME));
+    else if ((rec_header[0] % SDL_INDEX_STEP == SDL_INDEX_TRUNCATE) ||
+             (rec_header[0] % SDL_INDEX_STEP == SDL_INDEX))
+    {
+      inx = rec_header[0] / SDL_INDEX_STEP;
+      if ((inx < SDL_MAX_FILES) && (index_file[inx] != -1))
+      {
+        if (rec_header[0] % SDL_INDEX_STEP == SDL_INDEX_TRUNCATE)
+          my_chsize(index_file[inx], position, 0, MYF(MY_WME));
+        else if (length > 0)
+          my_pwrite(index_file[inx], buf, length, position, MYF(0));
+      }
+    }
+    else if (length > 0)
+      my_pwrite(data_file, buf, length, position, MYF(0));
+    pos += SDL_RECORD_HEADER + length;
+  }
+  if (buf != NULL)
+    my_free((gptr)buf, MYF(0));
+  if (my_sync(data_file, MYF(MY_WME)) || sync_indexes())
+    DBUG_RETURN(-1);
+  needs_replay = false;
+  DBUG_RETURN(reset());
+}
+
+/*
+  Empty the log. The caller has synced the data file so the records in
+  the log are no longer needed; the index file is synced here.
+*/
+int Spartan_log::reset()
+{
+  int i = 0;
+
+  DBUG_ENTER("Spartan_log::reset");
+  if (log_file == -1)
+    DBUG_RETURN(0);
+  if (sync_indexes())
+    DBUG_RETURN(-1);
+  pthread_mutex_lock(&log_mutex);
+  while (syncing)
+    pthread_cond_wait(&log_cond, &log_mutex);
+  if (my_chsize(log_file, 0, 0, MYF(MY_WME)))
+    i = -1;
+  written_lsn += log_buf_len;
+  log_buf_len = 0;
+  synced_lsn = written_lsn;
+  start_lsn = written_lsn;
+  pthread_mutex_unlock(&log_mutex);
+  DBUG_RETURN(i);
+}
+
+/*
+  Write the log buffer to the end of the log file. The caller holds
+  log_mutex. Returns 0 or -1 on error.
+*/
+int Spartan_log::flush_buffer()
+{
+  DBUG_ENTER("Spartan_log::flush_buffer");
+  if (log_buf_len == 0)
+    DBUG_RETURN(0);
+  if (my_pwrite(log_file, log_buf, log_buf_len, written_lsn - start_lsn,
+                MYF(0)) != (uint)log_buf_len)
+    DBUG_RETURN(-1);
+  written_lsn += log_buf_len;
+  log_buf_len = 0;
+  DBUG_RETURN(0);
+}
+
+/*
+  Sync the index files (and the overflow file) attached. Returns 0 or
+  -1 on error.
+*/
+int Spartan_log::sync_indexes()
+{
+  int i;
+
+  DBUG_ENTER("Spartan_log::sync_indexes");
+  for (i = 0; i < SDL_MAX_FILES; i++)
+    if ((index_file[i] != -1) && my_sync(index_file[i], MYF(MY_WME)))
+      DBUG_RETURN(-1);
+  DBUG_RETURN(0);
+}
+
+/*
+  Attach index file inx, the one the SDL_INDEX records of that number
+  are for (-1 = none), or the overflow file (SDL_OVERFLOW_FILE). It
+  must be attached before the log is replayed.
+*/
+void Spartan_log::set_index(int inx, File file)
+{
+  DBUG_ENTER("Spartan_log::set_index");
+  if ((inx >= 0) && (inx < SDL_MAX_FILES))
+    index_file[inx] = file;
+  DBUG_VOID_RETURN;
+}
@@ -0,0 +1,98 @@
+/*
+  Spartan_log.h
+
+  This header defines a simple redo log class for the Spartan data class.
+  Every change the data class makes to its file (appended rows, deleted
+  markers, rows updated in place, the header and so on) is first added
+  to the log as the bytes written and the file position they go to.
+  When a table is opened the log is replayed over the data file, which
+  repairs torn writes and brings the header up to date.
+
+  Records are collected in a log buffer and written to the log file
+  before the data file changes they describe. A statement is committed
+  by syncing the log up to its last record. Statements that commit at
+  the same time share one sync: the first one syncs the log for all of
+  them while the others wait (group commit).
+
+  The log is emptied at a checkpoint, once the data file has been
+  synced (when the table is closed or the log grows past
+  SDL_CHECKPOINT_SIZE).
+
+  The pages the index class writes are logged the same way (SDL_INDEX
+  records) once the index file is attached with set_index(). A table
+  has an index file for each key, so the records of index file n have
+  the type SDL_INDEX (or SDL_INDEX_TRUNCATE) plus n times
+  SDL_INDEX_STEP. Replay applies them to the index files and a
+  checkpoint syncs them before the log is emptied. The overflow file of
+  the blob values is logged the same way as file SDL_OVERFLOW_FILE.
+
+  File Layout:
+    SOF                              record type (byte)
+    SOF + 1                          file position (long long)
+    SOF + 9                          length (int)
+    SOF + 13                         crc32 of the record (int)
+    SOF + 17                         DATA (length bytes)
+  followed by the next record. Replay stops at the first record that
+  is not whole or does not match its crc32 (a torn write at the end).
+*/
+#pragma once
+#pragma unmanaged
+#include "my_global.h"
+#include "my_sys.h"
+#include "my_pthread.h"
+
+/* log record types */
+const byte SDL_APPEND = 1;       /* rows added at the end of the file */
+const byte SDL_DELETE = 2;       /* a row marked deleted */
+const byte SDL_UPDATE = 3;       /* bytes changed in place */
+const byte SDL_HEADER = 4;       /* the file header or block index */
+const byte SDL_TRUNCATE = 5;     /* the file cut to position bytes */
+const byte SDL_INDEX = 6;        /* bytes written to an index file */
+const byte SDL_INDEX_TRUNCATE = 7;  /* an index file cut to position bytes */
+
+/* index files the log can be attached to, step of their record types */
+const int SDL_MAX_INDEXES = 8;
+const byte SDL_INDEX_STEP = 16;
+
+/* number of the overflow file, logged after the index files */
+const int SDL_OVERFLOW_FILE = SDL_MAX_INDEXES;
+const int SDL_MAX_FILES = SDL_MAX_INDEXES + 1;
+
+/* size of the log buffer (bytes) */
+const int SDL_BUFFER_SIZE = 64 * 1024;
+
+/* log size that triggers a checkpoint (bytes) */
+const long long SDL_CHECKPOINT_SIZE = 16 * 1024 * 1024;
+
+class Spartan_log
+{
+public:
+  Spartan_log(void);
+  ~Spartan_log(void);
+  int open_log(char *path);
+  int close_log();
+  long long write_record(byte type, long long position, byte *buf,
+                         int length);
+  int write_log(long long lsn);
+  int commit(long long lsn);
+  long long end_lsn();
+  long long log_size();
+  int replay(File data_file);
+  int reset();
+  void set_index(int inx, File file);
+private:
+  File log_file;
+  File index_file[SDL_MAX_FILES];  /* files the SDL_INDEX records go to */
+  pthread_mutex_t log_mutex;
+  pthread_cond_t log_cond;   /* signalled when a group sync is done */
+  byte *log_buf;             /* records not yet written to the file */
+  int log_buf_len;
+  int log_buf_size;
+  long long start_lsn;       /* lsn of the start of the log file */
+  long long written_lsn;     /* records up to here are in the file */
+  long long synced_lsn;      /* records up to here are synced */
+  bool syncing;              /* a thread is syncing for a group */
+  bool needs_replay;         /* the log had records when opened */
+  int flush_buffer();
+  int sync_indexes();
+};
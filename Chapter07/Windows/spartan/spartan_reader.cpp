@@ -0,0 +1,307 @@
+/*
+  Spartan_reader.cpp
+
+  This class implements the direct I/O read-ahead ring of the Spartan
+  data class. The file is read in chunks of SDE_READ_CHUNK bytes; chunk
+  n goes into slot n % SDE_READ_AHEAD of the ring. When the scan asks
+  for chunk n the reader threads read chunks n to n + SDE_READ_AHEAD - 1
+  into their slots, each thread one chunk at a time.
+*/
+#include "Spartan_reader.h"
+#include <my_dir.h>
+
+/* states of a slot of the ring */
+static const int SLOT_EMPTY = 0;
+static const int SLOT_READING = 1;
+static const int SLOT_READY = 2;
+
+/* entry point of the reader threads */
+pthread_handler_t spartan_reader_thread(void *arg)
+{
+  ((Spartan_reader *)arg)->run();
+  return 0;
+}
+
+Spartan_reader::Spartan_reader(void)
+{
+  int i;
+
+  direct_file = -1;
+  thread_count = 0;
+  stopping = false;
+  ring_mem = NULL;
+  for (i = 0; i < SDE_READ_AHEAD; i++)
+  {
+    ring_buf[i] = NULL;
+    ring_chunk[i] = -1;
+    ring_len[i] = 0;
+    ring_state[i] = SLOT_EMPTY;
+    ring_stale[i] = false;
+  }
+  scan_chunk = -1;
+  last_chunk = -1;
+  pthread_mutex_init(&ring_mutex, MY_MUTEX_INIT_FAST);
+  pthread_cond_init(&ring_cond, NULL);
+}
+
+Spartan_reader::~Spartan_reader(void)
+{
+  close_reader();
+  pthread_cond_destroy(&ring_cond);
+  pthread_mutex_destroy(&ring_mutex);
+}
+
+/*
+  Open the file at location "path" for direct I/O and allocate the ring.
+  Returns 0 or -1 if direct I/O is not available for the file.
+*/
+int Spartan_reader::open_reader(char *path)
+{
+  int i;
+  byte *ptr;
+
+  DBUG_ENTER("Spartan_reader::open_reader");
+  if (direct_file != -1)
+    DBUG_RETURN(0);
+#ifdef O_DIRECT
+  direct_file = my_open(path, O_RDONLY | O_BINARY | O_DIRECT, MYF(0));
+#endif
+  if (direct_file == -1)
+    DBUG_RETURN(-1);
+  ring_mem = (byte *)my_malloc(SDE_READ_AHEAD * SDE_READ_CHUNK +
+                               SDE_IO_ALIGN, MYF(MY_WME));
+  if (ring_mem == NULL)
+  {
+    close_reader();
+    DBUG_RETURN(-1);
+  }
+  ptr = (byte *)(((size_t)ring_mem + SDE_IO_ALIGN - 1) &
+                 ~(size_t)(SDE_IO_ALIGN - 1));
+  for (i = 0; i < SDE_READ_AHEAD; i++)
+  {
+    ring_buf[i] = ptr + i * SDE_READ_CHUNK;
+    ring_chunk[i] = -1;
+    ring_state[i] = SLOT_EMPTY;
+  }
+  scan_chunk = -1;
+  stopping = false;
+  DBUG_RETURN(0);
+}
+
+/* stop the reader threads, close the file and free the ring */
+int Spartan_reader::close_reader()
+{
+  int i;
+
+  DBUG_ENTER("Spartan_reader::close_reader");
+  pthread_mutex_lock(&ring_mutex);
+  stopping = true;
+  pthread_cond_broadcast(&ring_cond);
+  while (thread_count > 0)
+    pthread_cond_wait(&ring_cond, &ring_mutex);
+  pthread_mutex_unlock(&ring_mutex);
+  if (direct_file != -1)
+    my_close(direct_file, MYF(0));
+  direct_file = -1;
+  if (ring_mem != NULL)
+    my_free((gptr)ring_mem, MYF(0));
+  ring_mem = NULL;
+  for (i = 0; i < SDE_READ_AHEAD; i++)
+  {
+    ring_buf[i] = NULL;
+    ring_chunk[i] = -1;
+    ring_state[i] = SLOT_EMPTY;
+  }
+  DBUG_RETURN(0);
+}
+
+/*
+  Copy length bytes at position into buf out of the ring, waiting for
+  the reader threads to read them. file_length is the length of the
+  file on disk. Returns the number of bytes copied or -1 on error.
+*/
+int Spartan_reader::read(byte *buf, int length, long long position,
+                         long long file_length)
+{
+  long long chunk;
+  int slot;
+  int offset;
+  int n;
+  int done = 0;
+
+  DBUG_ENTER("Spartan_reader::read");
+  if (direct_file == -1)
+    DBUG_RETURN(-1);
+  pthread_mutex_lock(&ring_mutex);
+  if ((thread_count == 0) && start_threads())
+  {
+    pthread_mutex_unlock(&ring_mutex);
+    DBUG_RETURN(-1);
+  }
+  last_chunk = (file_length - 1) / SDE_READ_CHUNK;
+  while ((done < length) && (position < file_length))
+  {
+    chunk = position / SDE_READ_CHUNK;
+    slot = (int)(chunk % SDE_READ_AHEAD);
+    offset = (int)(position - chunk * SDE_READ_CHUNK);
+    if (chunk != scan_chunk)
+    {
+      scan_chunk = chunk;
+      pthread_cond_broadcast(&ring_cond);
+    }
+    if ((ring_chunk[slot] != chunk) || (ring_state[slot] != SLOT_READY))
+    {
+      pthread_cond_wait(&ring_cond, &ring_mutex);
+      continue;
+    }
+    if (ring_len[slot] == -1)
+    {
+      ring_chunk[slot] = -1;
+      ring_state[slot] = SLOT_EMPTY;
+      pthread_mutex_unlock(&ring_mutex);
+      DBUG_RETURN(-1);
+    }
+    /*
+      A chunk read short before the file grew is read again.
+    */
+    if ((ring_len[slot] < SDE_READ_CHUNK) &&
+        (chunk * SDE_READ_CHUNK + ring_len[slot] < file_length))
+    {
+      ring_chunk[slot] = -1;
+      ring_state[slot] = SLOT_EMPTY;
+      pthread_cond_broadcast(&ring_cond);
+      continue;
+    }
+    n = ring_len[slot] - offset;
+    if (n > length - done)
+      n = length - done;
+    if (n > file_length - position)
+      n = (int)(file_length - position);
+    memcpy(buf + done, ring_buf[slot] + offset, n);
+    done += n;
+    position += n;
+  }
+  pthread_mutex_unlock(&ring_mutex);
+  DBUG_RETURN(done);
+}
+
+/*
+  Drop the chunks that hold any of the length bytes at position (all of
+  them if length is negative). A chunk being read is dropped when the
+  read finishes.
+*/
+void Spartan_reader::invalidate(long long position, int length)
+{
+  int i;
+  long long start;
+
+  DBUG_ENTER("Spartan_reader::invalidate");
+  pthread_mutex_lock(&ring_mutex);
+  for (i = 0; i < SDE_READ_AHEAD; i++)
+  {
+    if (ring_chunk[i] == -1)
+      continue;
+    start = ring_chunk[i] * SDE_READ_CHUNK;
+    if ((length >= 0) &&
+        ((position >= start + SDE_READ_CHUNK) || (position + length <= start)))
+      continue;
+    if (ring_state[i] == SLOT_READING)
+      ring_stale[i] = true;
+    else
+    {
+      ring_chunk[i] = -1;
+      ring_state[i] = SLOT_EMPTY;
+    }
+  }
+  pthread_mutex_unlock(&ring_mutex);
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Body of a reader thread: read the next chunk the scan will need until
+  the reader is closed.
+*/
+void Spartan_reader::run()
+{
+  int slot;
+  long long chunk;
+  uint len;
+
+  pthread_mutex_lock(&ring_mutex);
+  while (!stopping)
+  {
+    if ((slot = next_slot()) == -1)
+    {
+      pthread_cond_wait(&ring_cond, &ring_mutex);
+      continue;
+    }
+    chunk = ring_chunk[slot];
+    pthread_mutex_unlock(&ring_mutex);
+    len = my_pread(direct_file, ring_buf[slot], SDE_READ_CHUNK,
+                   chunk * SDE_READ_CHUNK, MYF(0));
+    pthread_mutex_lock(&ring_mutex);
+    if (ring_stale[slot])
+    {
+      ring_chunk[slot] = -1;
+      ring_state[slot] = SLOT_EMPTY;
+    }
+    else
+    {
+      ring_len[slot] = (len == (uint)-1) ? -1 : (int)len;
+      ring_state[slot] = SLOT_READY;
+    }
+    pthread_cond_broadcast(&ring_cond);
+  }
+  thread_count--;
+  pthread_cond_broadcast(&ring_cond);
+  pthread_mutex_unlock(&ring_mutex);
+}
+
+/*
+  Start the reader threads. The caller holds ring_mutex.
+  Returns 0 or -1 if no thread could be started.
+*/
+int Spartan_reader::start_threads()
+{
+  pthread_t thread;
+  pthread_attr_t attr;
+  int i;
+
+  DBUG_ENTER("Spartan_reader::start_threads");
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  stopping = false;
+  for (i = 0; i < SDE_READ_THREADS; i++)
+    if (pthread_create(&thread, &attr, spartan_reader_thread, (void *)this) == 0)
+      thread_count++;
+  pthread_attr_destroy(&attr);
+  DBUG_RETURN((thread_count > 0) ? 0 : -1);
+}
+
+/*
+  Find the first chunk from the one the scan is reading on that is not
+  in the ring yet and claim its slot for reading. The caller holds
+  ring_mutex. Returns the slot or -1 if there is nothing to read.
+*/
+int Spartan_reader::next_slot()
+{
+  long long chunk;
+  int slot;
+
+  if (scan_chunk < 0)
+    return -1;
+  for (chunk = scan_chunk; (chunk < scan_chunk + SDE_READ_AHEAD) &&
+       (chunk <= last_chunk); chunk++)
+  {
+    slot = (int)(chunk % SDE_READ_AHEAD);
+    if (ring_state[slot] == SLOT_READING)
+      continue;
+    if ((ring_chunk[slot] == chunk) && (ring_state[slot] == SLOT_READY))
+      continue;
+    ring_chunk[slot] = chunk;
+    ring_state[slot] = SLOT_READING;
+    ring_stale[slot] = false;
+    return slot;
+  }
+  return -1;
+}
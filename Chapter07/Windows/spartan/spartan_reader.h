@@ -0,0 +1,60 @@
+/*
+  Spartan_reader.h
+
+  This header defines the read-ahead class the Spartan data class uses
+  for direct I/O scans of large tables. The data file is opened a second
+  time with O_DIRECT so the rows are not cached by the operating system
+  as well as by the data class. Reads go through a ring of aligned
+  chunks that a few reader threads fill ahead of the scan, so several
+  large reads are in flight at once instead of one at a time.
+
+  The ring only serves reads. The data class still writes through its
+  own (buffered) descriptor and calls invalidate() for every write so
+  the ring never returns old bytes. Where O_DIRECT is not available
+  open_reader() fails and the data class keeps reading as before.
+*/
+#pragma once
+#pragma unmanaged
+#include "my_global.h"
+#include "my_sys.h"
+#include "my_pthread.h"
+
+/* alignment of direct I/O buffers, positions and lengths (bytes) */
+const int SDE_IO_ALIGN = 4096;
+
+/* size of each read (bytes) */
+const int SDE_READ_CHUNK = 256 * 1024;
+
+/* number of chunks read ahead of the scan */
+const int SDE_READ_AHEAD = 8;
+
+/* number of reader threads (reads in flight) */
+const int SDE_READ_THREADS = 4;
+
+class Spartan_reader
+{
+public:
+  Spartan_reader(void);
+  ~Spartan_reader(void);
+  int open_reader(char *path);
+  int close_reader();
+  int read(byte *buf, int length, long long position, long long file_length);
+  void invalidate(long long position, int length);
+  void run();
+private:
+  File direct_file;
+  pthread_mutex_t ring_mutex;
+  pthread_cond_t ring_cond;  /* signalled when a chunk or request changes */
+  int thread_count;          /* reader threads running */
+  bool stopping;             /* close_reader() is stopping the threads */
+  byte *ring_mem;            /* allocation that holds the aligned ring */
+  byte *ring_buf[SDE_READ_AHEAD];
+  long long ring_chunk[SDE_READ_AHEAD];  /* chunk in each slot (or -1) */
+  int ring_len[SDE_READ_AHEAD];    /* bytes in the chunk (or -1 = error) */
+  int ring_state[SDE_READ_AHEAD];  /* SLOT_EMPTY, SLOT_READING, SLOT_READY */
+  bool ring_stale[SDE_READ_AHEAD]; /* written to while it was being read */
+  long long scan_chunk;      /* chunk the scan is reading */
+  long long last_chunk;      /* last chunk in the file */
+  int start_threads();
+  int next_slot();
+};
@@ -0,0 +1,493 @@
+/*
+  Spartan_zones.cpp
+
+  This class implements the zone map of the Spartan data class. The
+  zones are held in arrays in start position order so the zone of a
+  row is found with a binary search. The minimum and maximum of zone z
+  and column c are at z * cols + c.
+*/
+#include "Spartan_zones.h"
+#include <my_dir.h>
+
+/* size of the file header: clean flag, columns and zone count */
+static const int SDZ_HEADER_SIZE = sizeof(bool) + 2 * sizeof(int);
+
+Spartan_zones::Spartan_zones(void)
+{
+  zone_file = -1;
+  clean = false;
+  rebuild = false;
+  cols = 0;
+  zone_count = 0;
+  zone_alloc = 0;
+  zone_start = NULL;
+  zone_rows = NULL;
+  zone_min = NULL;
+  zone_max = NULL;
+}
+
+Spartan_zones::~Spartan_zones(void)
+{
+  close_zones();
+}
+
+/* create an empty zone map at location "path" for cols columns */
+int Spartan_zones::create_zones(char *path, int cols_arg)
+{
+  DBUG_ENTER("Spartan_zones::create_zones");
+  close_zones();
+  zone_file = my_open(path, O_RDWR | O_CREAT | O_TRUNC | O_BINARY | O_SHARE,
+                      MYF(0));
+  if (zone_file == -1)
+    DBUG_RETURN(errno);
+  cols = cols_arg;
+  rebuild = false;
+  clean = false;
+  DBUG_RETURN(write_zones());
+}
+
+/*
+  Open the zone map at location "path" for cols columns. Nothing is
+  done if it is already open. If the file cannot be trusted the zones
+  are left empty and needs_rebuild() returns true.
+*/
+int Spartan_zones::open_zones(char *path, int cols_arg)
+{
+  DBUG_ENTER("Spartan_zones::open_zones");
+  if (zone_file != -1)
+    DBUG_RETURN(0);
+  zone_file = my_open(path, O_RDWR | O_CREAT | O_BINARY | O_SHARE, MYF(0));
+  if (zone_file == -1)
+    DBUG_RETURN(errno);
+  free_zones();
+  rebuild = (read_zones() || (cols != cols_arg));
+  if (rebuild)
+  {
+    free_zones();
+    cols = cols_arg;
+    clean = false;
+  }
+  DBUG_RETURN(0);
+}
+
+/* write the zones to the file and close it */
+int Spartan_zones::close_zones()
+{
+  int i = 0;
+
+  DBUG_ENTER("Spartan_zones::close_zones");
+  if (zone_file != -1)
+  {
+    if (!clean && !rebuild)
+      i = write_zones();
+    my_close(zone_file, MYF(0));
+    zone_file = -1;
+  }
+  free_zones();
+  rebuild = false;
+  DBUG_RETURN(i);
+}
+
+/*
+  Remove every zone. This is done when the data file is emptied and
+  before the zones are built again from the data file.
+*/
+int Spartan_zones::trunc_zones()
+{
+  DBUG_ENTER("Spartan_zones::trunc_zones");
+  zone_count = 0;
+  rebuild = false;
+  DBUG_RETURN(mark_dirty());
+}
+
+/* must the zones be built again from the data file */
+bool Spartan_zones::needs_rebuild()
+{
+  DBUG_ENTER("Spartan_zones::needs_rebuild");
+  DBUG_RETURN(rebuild);
+}
+
+/* get the number of columns */
+int Spartan_zones::columns()
+{
+  DBUG_ENTER("Spartan_zones::columns");
+  DBUG_RETURN(cols);
+}
+
+/*
+  Add the row written at position with the values of the columns
+  (values[i] is not used if nulls[i] is set). Returns 0 or -1 on error.
+*/
+int Spartan_zones::add_row(long long position, long long *values,
+                           bool *nulls)
+{
+  int zone;
+
+  DBUG_ENTER("Spartan_zones::add_row");
+  if (mark_dirty())
+    DBUG_RETURN(-1);
+  zone = find_zone(position);
+  /*
+    A row after the start of a full last zone starts a new zone.
+  */
+  if ((zone == -1) ||
+      ((zone == zone_count - 1) && (position > zone_start[zone]) &&
+       (zone_rows[zone] >= SDZ_ZONE_ROWS)))
+  {
+    if ((zone != -1) || (zone_count == 0))
+      zone = new_zone(position);
+    else
+    {
+      zone_start[0] = position;
+      zone = 0;
+    }
+    if (zone == -1)
+      DBUG_RETURN(-1);
+  }
+  zone_rows[zone]++;
+  widen_zone(zone, values, nulls);
+  DBUG_RETURN(0);
+}
+
+/* the row at position was overwritten with the values given */
+int Spartan_zones::update_row(long long position, long long *values,
+                              bool *nulls)
+{
+  int zone;
+
+  DBUG_ENTER("Spartan_zones::update_row");
+  if (mark_dirty())
+    DBUG_RETURN(-1);
+  zone = find_zone(position);
+  if (zone == -1)
+    zone = 0;
+  if (zone < zone_count)
+    widen_zone(zone, values, nulls);
+  DBUG_RETURN(0);
+}
+
+/* the row at position was deleted */
+int Spartan_zones::delete_row(long long position)
+{
+  int zone;
+
+  DBUG_ENTER("Spartan_zones::delete_row");
+  if (mark_dirty())
+    DBUG_RETURN(-1);
+  zone = find_zone(position);
+  if (zone == -1)
+    zone = 0;
+  if ((zone < zone_count) && (zone_rows[zone] > 0))
+    zone_rows[zone]--;
+  DBUG_RETURN(0);
+}
+
+/*
+  Get the position a scan at position should go on from, skipping the
+  zones none of whose rows can match all count predicates. Returns
+  position itself if its zone may match, the start of the next zone
+  that may match, or -1 if no zone from here on can.
+*/
+long long Spartan_zones::skip_zones(long long position, SDZ_PREDICATE *preds,
+                                    int count)
+{
+  int zone;
+  int first;
+
+  DBUG_ENTER("Spartan_zones::skip_zones");
+  if (rebuild || (zone_count == 0))
+    DBUG_RETURN(position);
+  zone = find_zone(position);
+  if (zone == -1)
+    zone = 0;
+  first = zone;
+  while ((zone < zone_count) && zone_excluded(zone, preds, count))
+    zone++;
+  if (zone == zone_count)
+    DBUG_RETURN(-1);
+  DBUG_RETURN((zone == first) ? position : zone_start[zone]);
+}
+
+/*
+  Read the zones from the file. Returns 0 or -1 if the file is empty,
+  dirty or short.
+*/
+int Spartan_zones::read_zones()
+{
+  byte header[SDZ_HEADER_SIZE];
+  int count;
+  int i;
+  long long pos = SDZ_HEADER_SIZE;
+
+  DBUG_ENTER("Spartan_zones::read_zones");
+  if (my_pread(zone_file, header, SDZ_HEADER_SIZE, 0, MYF(0)) !=
+      (uint)SDZ_HEADER_SIZE)
+    DBUG_RETURN(-1);
+  memcpy(&clean, header, sizeof(bool));
+  memcpy(&cols, header + sizeof(bool), sizeof(int));
+  memcpy(&count, header + sizeof(bool) + sizeof(int), sizeof(int));
+  if (!clean || (cols < 0) || (count < 0))
+    DBUG_RETURN(-1);
+  for (i = 0; i < count; i++)
+  {
+    if (new_zone(0) == -1)
+      DBUG_RETURN(-1);
+    if ((my_pread(zone_file, (byte *)&zone_start[i], sizeof(long long), pos,
+                  MYF(0)) != sizeof(long long)) ||
+        (my_pread(zone_file, (byte *)&zone_rows[i], sizeof(int),
+                  pos + sizeof(long long), MYF(0)) != sizeof(int)) ||
+        (my_pread(zone_file, (byte *)(zone_min + i * cols),
+                  cols * sizeof(long long),
+                  pos + sizeof(long long) + sizeof(int), MYF(0)) !=
+         cols * sizeof(long long)) ||
+        (my_pread(zone_file, (byte *)(zone_max + i * cols),
+                  cols * sizeof(long long),
+                  pos + sizeof(long long) + sizeof(int) +
+                  cols * sizeof(long long), MYF(0)) !=
+         cols * sizeof(long long)))
+      DBUG_RETURN(-1);
+    pos += sizeof(long long) + sizeof(int) + 2 * cols * sizeof(long long);
+  }
+  DBUG_RETURN(0);
+}
+
+/*
+  Write every zone to the file, sync it and only then mark it clean, so
+  a crash while writing leaves a dirty file. Returns 0 or -1 on error.
+*/
+int Spartan_zones::write_zones()
+{
+  byte header[SDZ_HEADER_SIZE];
+  int zone_size = sizeof(long long) + sizeof(int) +
+                  2 * cols * sizeof(long long);
+  byte *buf;
+  byte *ptr;
+  int i;
+  bool done = false;
+
+  DBUG_ENTER("Spartan_zones::write_zones");
+  buf = (byte *)my_malloc(zone_count * zone_size + 1, MYF(MY_WME));
+  if (buf == NULL)
+    DBUG_RETURN(-1);
+  ptr = buf;
+  for (i = 0; i < zone_count; i++)
+  {
+    memcpy(ptr, &zone_start[i], sizeof(long long));
+    memcpy(ptr + sizeof(long long), &zone_rows[i], sizeof(int));
+    memcpy(ptr + sizeof(long long) + sizeof(int), zone_min + i * cols,
+           cols * sizeof(long long));
+    memcpy(ptr + sizeof(long long) + sizeof(int) + cols * sizeof(long long),
+           zone_max + i * cols, cols * sizeof(long long));
+    ptr += zone_size;
+  }
+  memcpy(header, &done, sizeof(bool));
+  memcpy(header + sizeof(bool), &cols, sizeof(int));
+  memcpy(header + sizeof(bool) + sizeof(int), &zone_count, sizeof(int));
+  i = 0;
+  if ((my_chsize(zone_file, 0, 0, MYF(MY_WME))) ||
+      (my_pwrite(zone_file, header, SDZ_HEADER_SIZE, 0, MYF(0)) !=
+       (uint)SDZ_HEADER_SIZE) ||
+      ((ptr > buf) &&
+       (my_pwrite(zone_file, buf, (uint)(ptr - buf), SDZ_HEADER_SIZE,
+                  MYF(0)) != (uint)(ptr - buf))) ||
+      my_sync(zone_file, MYF(MY_WME)))
+    i = -1;
+  my_free((gptr)buf, MYF(0));
+  if (i == 0)
+  {
+    done = true;
+    if ((my_pwrite(zone_file, (byte *)&done, sizeof(bool), 0, MYF(0)) !=
+         sizeof(bool)))
+      i = -1;
+  }
+  clean = (i == 0);
+  DBUG_RETURN(i);
+}
+
+/*
+  Mark the file dirty before the first change to the zones since it
+  was written. Returns 0 or -1 on error.
+*/
+int Spartan_zones::mark_dirty()
+{
+  bool dirty = false;
+
+  DBUG_ENTER("Spartan_zones::mark_dirty");
+  if (!clean || (zone_file == -1))
+    DBUG_RETURN(0);
+  if (my_pwrite(zone_file, (byte *)&dirty, sizeof(bool), 0, MYF(0)) !=
+      sizeof(bool))
+    DBUG_RETURN(-1);
+  clean = false;
+  DBUG_RETURN(0);
+}
+
+/*
+  Get the zone the row at position is in: the last zone that starts at
+  or before it. Returns -1 if there is none.
+*/
+int Spartan_zones::find_zone(long long position)
+{
+  int lo = 0;
+  int hi = zone_count - 1;
+  int mid;
+
+  DBUG_ENTER("Spartan_zones::find_zone");
+  while (lo <= hi)
+  {
+    mid = (lo + hi) / 2;
+    if (zone_start[mid] <= position)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  DBUG_RETURN(hi);
+}
+
+/*
+  Add an empty zone starting at position to the end of the list.
+  Returns the zone or -1 if there is no memory (the zones are then
+  dropped and must be built again).
+*/
+int Spartan_zones::new_zone(long long position)
+{
+  long long *more_start;
+  int *more_rows;
+  long long *more_min;
+  long long *more_max;
+  int alloc;
+  int i;
+
+  DBUG_ENTER("Spartan_zones::new_zone");
+  if (zone_count == zone_alloc)
+  {
+    /*
+      A failed my_realloc() leaves the old block allocated, so each
+      array is only replaced once it has grown; free_zones() frees
+      whichever are left.
+    */
+    alloc = (zone_alloc == 0) ? 64 : 2 * zone_alloc;
+    more_start = (long long *)my_realloc((gptr)zone_start,
+                                         alloc * sizeof(long long),
+                                         MYF(MY_WME | MY_ALLOW_ZERO_PTR));
+    if (more_start != NULL)
+      zone_start = more_start;
+    more_rows = (int *)my_realloc((gptr)zone_rows, alloc * sizeof(int),
+                                  MYF(MY_WME | MY_ALLOW_ZERO_PTR));
+    if (more_rows != NULL)
+      zone_rows = more_rows;
+    more_min = (long long *)my_realloc((gptr)zone_min,
+                                       alloc * cols * sizeof(long long) + 1,
+                                       MYF(MY_WME | MY_ALLOW_ZERO_PTR));
+    if (more_min != NULL)
+      zone_min = more_min;
+    more_max = (long long *)my_realloc((gptr)zone_max,
+                                       alloc * cols * sizeof(long long) + 1,
+                                       MYF(MY_WME | MY_ALLOW_ZERO_PTR));
+    if (more_max != NULL)
+      zone_max = more_max;
+    if (!more_start || !more_rows || !more_min || !more_max)
+    {
+      free_zones();
+      rebuild = true;
+      DBUG_RETURN(-1);
+    }
+    zone_alloc = alloc;
+  }
+  zone_start[zone_count] = position;
+  zone_rows[zone_count] = 0;
+  for (i = 0; i < cols; i++)
+  {
+    zone_min[zone_count * cols + i] = LONGLONG_MAX;
+    zone_max[zone_count * cols + i] = LONGLONG_MIN;
+  }
+  DBUG_RETURN(zone_count++);
+}
+
+/* widen the minimums and maximums of zone to cover values */
+void Spartan_zones::widen_zone(int zone, long long *values, bool *nulls)
+{
+  long long *min = zone_min + zone * cols;
+  long long *max = zone_max + zone * cols;
+  int i;
+
+  DBUG_ENTER("Spartan_zones::widen_zone");
+  for (i = 0; i < cols; i++)
+  {
+    if (nulls[i])
+      continue;
+    if (values[i] < min[i])
+      min[i] = values[i];
+    if (values[i] > max[i])
+      max[i] = values[i];
+  }
+  DBUG_VOID_RETURN;
+}
+
+/*
+  Can no row of zone match all the predicates? A null value matches no
+  predicate, so a column with only nulls (min > max) excludes the zone.
+*/
+bool Spartan_zones::zone_excluded(int zone, SDZ_PREDICATE *preds, int count)
+{
+  long long min;
+  long long max;
+  int i;
+
+  DBUG_ENTER("Spartan_zones::zone_excluded");
+  if (zone_rows[zone] == 0)
+    DBUG_RETURN(true);
+  for (i = 0; i < count; i++)
+  {
+    if ((preds[i].column < 0) || (preds[i].column >= cols))
+      continue;
+    min = zone_min[zone * cols + preds[i].column];
+    max = zone_max[zone * cols + preds[i].column];
+    if (min > max)
+      DBUG_RETURN(true);
+    switch (preds[i].op) {
+    case SDZ_EQ:
+      if ((preds[i].value < min) || (preds[i].value > max))
+        DBUG_RETURN(true);
+      break;
+    case SDZ_LT:
+      if (min >= preds[i].value)
+        DBUG_RETURN(true);
+      break;
+    case SDZ_LE:
+      if (min > preds[i].value)
+        DBUG_RETURN(true);
+      break;
+    case SDZ_GT:
+      if (max <= preds[i].value)
+        DBUG_RETURN(true);
+      break;
+    case SDZ_GE:
+      if (max < preds[i].value)
+        DBUG_RETURN(true);
+      break;
+    }
+  }
+  DBUG_RETURN(false);
+}
+
+/* free the zones in memory */
+void Spartan_zones::free_zones()
+{
+  DBUG_ENTER("Spartan_zones::free_zones");
+  if (zone_start != NULL)
+    my_free((gptr)zone_start, MYF(0));
+  if (zone_rows != NULL)
+    my_free((gptr)zone_rows, MYF(0));
+  if (zone_min != NULL)
+    my_free((gptr)zone_min, MYF(0));
+  if (zone_max != NULL)
+    my_free((gptr)zone_max, MYF(0));
+  zone_start = NULL;
+  zone_rows = NULL;
+  zone_min = NULL;
+  zone_max = NULL;
+  zone_count = 0;
+  zone_alloc = 0;
+  DBUG_VOID_RETURN;
+}
@@ -0,0 +1,93 @@
+/*
+  Spartan_zones.h
+
+  This header defines a zone map class for the Spartan data class. The
+  rows of the data file are grouped into zones of about SDZ_ZONE_ROWS
+  rows in file order, and for each zone the smallest and largest value
+  of every integer column is kept. A scan with a predicate such as
+  col > 100000 can then skip every zone whose largest value of col is
+  100000 or less without reading its rows.
+
+  A zone is the rows from its start position up to the start of the
+  next zone (the last zone runs to the end of the file). Appended rows
+  go to the last zone; rows written over deleted ones widen the zone
+  they land in. Deleting a row lowers the row count of its zone but
+  leaves the minimum and maximum alone, so they only ever cover too
+  much, never too little. An empty zone is skipped by every scan.
+
+  The zones are kept in memory and written to the file when it is
+  closed. The file is marked dirty on the first change after it is
+  opened; a dirty file (or none, or one with other columns) is not
+  trusted and needs_rebuild() tells the caller to build the zones
+  again from the data file: trunc_zones() and add_row() for each row.
+  Until then no zone is skipped and the file is left dirty.
+
+  File Layout:
+    SOF                              clean (bool)
+    SOF + 1                          number of columns (int)
+    SOF + 5                          number of zones (int)
+    SOF + 9                          ZONES BEGIN HERE
+  Each zone is its start position (long long), its row count (int)
+  and the minimum then the maximum of each column (long long each).
+*/
+#pragma once
+#pragma unmanaged
+#include "my_global.h"
+#include "my_sys.h"
+
+/* rows in a zone */
+const int SDZ_ZONE_ROWS = 1024;
+
+/* predicates a scan can test against the zones */
+const int SDZ_MAX_PREDICATES = 16;
+
+/* comparisons of a predicate */
+const int SDZ_EQ = 0;
+const int SDZ_LT = 1;
+const int SDZ_LE = 2;
+const int SDZ_GT = 3;
+const int SDZ_GE = 4;
+
+/* a predicate: column op value */
+struct SDZ_PREDICATE
+{
+  int column;
+  int op;
+  long long value;
+};
+
+class Spartan_zones
+{
+public:
+  Spartan_zones(void);
+  ~Spartan_zones(void);
+  int create_zones(char *path, int cols);
+  int open_zones(char *path, int cols);
+  int close_zones();
+  int trunc_zones();
+  bool needs_rebuild();
+  int columns();
+  int add_row(long long position, long long *values, bool *nulls);
+  int update_row(long long position, long long *values, bool *nulls);
+  int delete_row(long long position);
+  long long skip_zones(long long position, SDZ_PREDICATE *preds, int count);
+private:
+  File zone_file;
+  bool clean;                /* the file matches the zones in memory */
+  bool rebuild;              /* the file could not be trusted */
+  int cols;                  /* number of columns */
+  int zone_count;            /* number of zones */
+  int zone_alloc;            /* zones allocated */
+  long long *zone_start;     /* first position of each zone */
+  int *zone_rows;            /* live rows in each zone */
+  long long *zone_min;       /* cols minimums per zone */
+  long long *zone_max;       /* cols maximums per zone */
+  int read_zones();
+  int write_zones();
+  int mark_dirty();
+  int find_zone(long long position);
+  int new_zone(long long position);
+  void widen_zone(int zone, long long *values, bool *nulls);
+  bool zone_excluded(int zone, SDZ_PREDICATE *preds, int count);
+  void free_zones();
+};
@@ -48,6 +48,7 @@ Query_tree::query_node::query_node()
     relations[i] = NULL;
     eof[i] = 0;
     ndx[i] = -1;
+    pushed[i] = 0;
   }
   parent_nodeid = -1;
 }
@@ -935,6 +936,14 @@ int Query_tree::push_joins(query_node *QN, query_node *pNode)
 
   DESCRIPTION
     This method will balance the joins once cost-based factors are applied.
+    The inputs of each inner join are ordered by the rows the storage
+    engines say they hold (see estimate_rows()): the input with fewer
+    rows is put on the left. The join reads its left input first and
+    does not read the right one at all if the left one is empty (see
+    do_join()), so the smaller input is the one always read.
+
+  NOTES
+    This is a RECURSIVE method!
 
   RETURN VALUE
     Success = 0
@@ -943,6 +952,101 @@ int Query_tree::push_joins(query_node *QN, query_node *pNode)
 int Query_tree::balance_joins(query_node *QN)
 {
   DBUG_ENTER("balance_joins");
+  if (QN != NULL)
+  {
+    balance_joins(QN->left);
+    balance_joins(QN->right);
+    if ((QN->node_type == qntJoin) && (QN->join_type == jnINNER) &&
+        (QN->join_expr != NULL) &&
+        (estimate_rows(QN, RIGHTCHILD) < estimate_rows(QN, LEFTCHILD)))
+      swap_join(QN);
+  }
+  DBUG_RETURN(0);
+}
+
+/*
+  Estimate the rows an input of a node returns.
+
+  SYNOPSIS
+    estimate_rows()
+    query_node *QN IN the node
+    int child IN the input (LEFTCHILD or RIGHTCHILD)
+
+  DESCRIPTION
+    This method asks the storage engine of a table for the rows it holds
+    (handler::info()). The rows of a node are the rows of its input, or
+    of the larger input of a join.
+
+  NOTES
+    This is a RECURSIVE method!
+
+  RETURN VALUE
+    Success = the estimated number of rows
+    Failed = HA_POS_ERROR (nothing is known)
+*/
+ha_rows Query_tree::estimate_rows(query_node *QN, int child)
+{
+  query_node *input = (child == LEFTCHILD) ? QN->left : QN->right;
+  TABLE *tbl;
+  ha_rows left_rows;
+  ha_rows right_rows;
+
+  DBUG_ENTER("estimate_rows");
+  if (input == NULL)
+  {
+    if ((QN->relations[child] == NULL) ||
+        ((tbl = QN->relations[child]->table) == NULL))
+      DBUG_RETURN(HA_POS_ERROR);
+    tbl->file->info(HA_STATUS_VARIABLE | HA_STATUS_NO_LOCK);
+    DBUG_RETURN(tbl->file->records);
+  }
+  left_rows = estimate_rows(input, LEFTCHILD);
+  if (input->node_type != qntJoin)
+    DBUG_RETURN(left_rows);
+  right_rows = estimate_rows(input, RIGHTCHILD);
+  if ((left_rows == HA_POS_ERROR) || (right_rows == HA_POS_ERROR))
+    DBUG_RETURN(HA_POS_ERROR);
+  DBUG_RETURN((left_rows > right_rows) ? left_rows : right_rows);
+}
+
+/*
+  Swap the inputs of a join.
+
+  SYNOPSIS
+    swap_join()
+    query_node *QN IN the join node
+
+  DESCRIPTION
+    This method swaps the children and the relations of a join node and
+    the operands of its join expressions, which name the field of the
+    left input first.
+
+  RETURN VALUE
+    Success = 0
+    Failed = 1
+*/
+int Query_tree::swap_join(query_node *QN)
+{
+  query_node *node;
+  TABLE_LIST *relation;
+  expr_node *expr;
+  COND *op;
+  int i;
+
+  DBUG_ENTER("swap_join");
+  node = QN->left;
+  QN->left = QN->right;
+  QN->right = node;
+  relation = QN->relations[0];
+  QN->relations[0] = QN->relations[1];
+  QN->relations[1] = relation;
+  for (i = 0; i < QN->join_expr->num_expressions(); i++)
+  {
+    expr = QN->join_expr->get_expression(i);
+    op = expr->left_op;
+    expr->left_op = expr->right_op;
+    expr->right_op = op;
+  }
   DBUG_RETURN(0);
 }
 
@@ -1511,19 +1615,187 @@ int Query_tree::prepare(query_node *qn)
           if (ndx > -1)
             qn->relations[i]->table->file->ha_index_init(ndx, true);
           else
+          {
+            set_read_columns(qn->relations[i]->table);
+            push_conditions(qn->relations[i]->table, qn->where_expr,
+                            &qn->pushed[i]);
             qn->relations[i]->table->file->ha_rnd_init(true);
+          }
         }
     }
     else
       for (i = 0; i < MAXNODETABLES; i++)
         if (qn->relations[i] != NULL)
-            qn->relations[i]->table->file->ha_rnd_init(true);
+        {
+          set_read_columns(qn->relations[i]->table);
+          qn->relations[i]->table->file->ha_rnd_init(true);
+        }
     prepare(qn->left);
     prepare(qn->right);
   }
   DBUG_RETURN(0);
 }
 
+/*
+  Set the columns to read from a table.
+
+  SYNOPSIS
+    set_read_columns()
+    TABLE *tbl IN the table to be scanned.
+
+  DESCRIPTION
+    This method sets the read set of the table to the fields the query
+    uses: the fields in the result set and the fields named in the where
+    and join expressions of any node in the tree. Storage engines that
+    store columns apart (like the Spartan PAX layout) then read only
+    those columns during the scan.
+
+  NOTES
+    If the result set has anything other than plain fields (like an
+    expression) all of the columns are read.
+
+  RETURN VALUE
+    Success = 0
+    Failed = 1
+*/
+int Query_tree::set_read_columns(TABLE *tbl)
+{
+  List_iterator<Item> it(result_fields);
+  Item *item;
+  Field **field;
+
+  DBUG_ENTER("set_read_columns");
+  while ((item = it++))
+    if (item->type() != Item::FIELD_ITEM)
+    {
+      tbl->file->ha_set_all_bits_in_read_set();
+      DBUG_RETURN(0);
+    }
+  tbl->file->ha_clear_all_set();
+  for (field = tbl->field; *field; field++)
+  {
+    bool used = false;
+
+    it.rewind();
+    while ((item = it++) && !used)
+      used = (((Item_field *)item)->field == *field);
+    if (used || find_field_in_tree(root, *field))
+      tbl->file->ha_set_bit_in_read_set((*field)->field_index + 1);
+  }
+  DBUG_RETURN(0);
+}
+
+/*
+  Push the where expression of a restrict node down to a table.
+
+  SYNOPSIS
+    push_conditions()
+    TABLE *tbl IN the table to be scanned.
+    Expression *expr IN the where expression of the node.
+    int *pushed OUT the number of conditions pushed.
+
+  DESCRIPTION
+    This method hands each condition of the expression to the storage
+    engine with cond_push() so the scan can skip the rows that cannot
+    match (the Spartan engine skips whole zones of its data file). The
+    conditions are only pushed if every junction of the expression is
+    an AND; a single condition of an OR could leave out rows that match.
+
+  NOTES
+    do_restrict() still evaluates the whole expression on every row, so
+    what the engine keeps of the conditions does not change the result.
+    cleanup() removes the pushed conditions with cond_pop().
+
+  RETURN VALUE
+    Success = 0
+    Failed = 1
+*/
+int Query_tree::push_conditions(TABLE *tbl, Expression *expr, int *pushed)
+{
+  expr_node *node;
+  int i;
+
+  DBUG_ENTER("push_conditions");
+  *pushed = 0;
+  if ((expr == NULL) || (expr->num_expressions() == 0))
+    DBUG_RETURN(0);
+  node = expr->get_expression(0);
+  if ((expr->num_expressions() > 1) && (node->junction == NULL))
+    DBUG_RETURN(0);
+  for (i = 0; i < expr->num_expressions(); i++)
+  {
+    node = expr->get_expression(i);
+    if ((node != NULL) && (node->junction != NULL) &&
+        (((Item_func *)node->junction)->functype() !=
+         Item_func::COND_AND_FUNC))
+      DBUG_RETURN(0);
+  }
+  for (i = 0; i < expr->num_expressions(); i++)
+  {
+    node = expr->get_expression(i);
+    if ((node != NULL) && (node->operation != NULL) &&
+        (node->operation->type() == Item::FUNC_ITEM))
+    {
+      tbl->file->cond_push(node->operation);
+      (*pushed)++;
+    }
+  }
+  DBUG_RETURN(0);
+}
+
+/*
+  Find a field in the expressions of the query tree.
+
+  SYNOPSIS
+    find_field_in_tree()
+    query_node *qn IN the node to start the search at.
+    Field *field IN the field to locate.
+
+  DESCRIPTION
+    This method looks for the field in the where and join expressions
+    of the node and its children. A field with no table name given in
+    the expression matches any table.
+
+  RETURN VALUE
+    Success = true
+    Failed = false
+*/
+bool Query_tree::find_field_in_tree(query_node *qn, Field *field)
+{
+  Expression *exprs[2];
+  expr_node *node;
+  Item_field *op;
+  int i;
+  int j;
+
+  DBUG_ENTER("find_field_in_tree");
+  if (qn == NULL)
+    DBUG_RETURN(false);
+  exprs[0] = qn->where_expr;
+  exprs[1] = qn->join_expr;
+  for (i = 0; i < 2; i++)
+    for (j = 0; (exprs[i] != NULL) && (j < exprs[i]->num_expressions()); j++)
+    {
+      node = exprs[i]->get_expression(j);
+      if (node == NULL)
+        continue;
+      op = (Item_field *)node->left_op;
+      if (op && (op->type() == Item::FIELD_ITEM) &&
+          (strcasecmp(op->field_name, field->field_name) == 0) &&
+          ((op->table_name == NULL) ||
+          (strcasecmp(op->table_name, field->table->s->table_name.str) == 0)))
+        DBUG_RETURN(true);
+      op = (Item_field *)node->right_op;
+      if (op && (op->type() == Item::FIELD_ITEM) &&
+          (strcasecmp(op->field_name, field->field_name) == 0) &&
+          ((op->table_name == NULL) ||
+          (strcasecmp(op->table_name, field->table->s->table_name.str) == 0)))
+        DBUG_RETURN(true);
+    }
+  DBUG_RETURN(find_field_in_tree(qn->left, field) ||
+              find_field_in_tree(qn->right, field));
+}
+
 /*
   Shutdown the reads after execution.
 
@@ -1552,7 +1824,12 @@ int Query_tree::cleanup(query_node *qn)
   {
       for (i = 0; i < MAXNODETABLES; i++)
         if (qn->relations[i] != NULL)
+        {
             qn->relations[i]->table->file->ha_index_or_rnd_end();
+            qn->relations[i]->table->file->ha_set_all_bits_in_read_set();
+            for (; qn->pushed[i] > 0; qn->pushed[i]--)
+              qn->relations[i]->table->file->cond_pop();
+        }
     cleanup(qn->left);
     cleanup(qn->right);
   }
@@ -1891,6 +2168,9 @@ bool Query_tree::do_restrict(query_node *qn, READ_RECORD *t)
  
        Lastly, evaluate the where clause. If the where clause 
        evaluates to true, we keep the record else we discard it.
+
+       Note: only the columns set by set_read_columns() were read from
+       the table, which are all the where clause and the result need.
     */
     if (qn->relations[0] != NULL)
       memcpy((byte *)qn->relations[0]->table->record[0], (byte *)t->rec_buf, 
@@ -2062,64 +2342,76 @@ READ_RECORD *Query_tree::do_join(query_node *qn)
               insertion_sort(true, fleft, lbuff);
           }
         } while (lbuff != NULL);
-        /* Build buffer for tuples from right child. */
-        do
+        /*
+          An inner join with an empty left input is empty, so the right
+          input is not read at all (see balance_joins()).
+        */
+        if ((qn->join_type == jnINNER) && (left_record_buff == NULL))
         {
-          /* if right child exists, get row from it */
-          if (qn->right != NULL)
-            rbuff = get_next(qn->right);
-
-          /* else, read the row from the table (the storage handler */
-          else
+          qn->eof[2] = true;
+          qn->eof[3] = true;
+        }
+        else
+        {
+          /* Build buffer for tuples from right child. */
+          do
           {
-            /* 
-               Create space for the record buffer and 
-               store pointer in rbuff
-            */
-            rbuff = (READ_RECORD *) my_malloc(sizeof(READ_RECORD),
-                                      MYF(MY_ZEROFILL | MY_WME));
-            rbuff->rec_buf = 
-              (byte *) my_malloc(qn->relations[0]->table->s->rec_buff_length,
-                                      MYF(MY_ZEROFILL | MY_WME));
+            /* if right child exists, get row from it */
+            if (qn->right != NULL)
+              rbuff = get_next(qn->right);
 
-            /* check for end of file. Store result in eof array */
-            qn->eof[1] = 
-              qn->relations[1]->table->file->rnd_next(rbuff->rec_buf);
-            if (qn->eof[1] != HA_ERR_END_OF_FILE)
-              qn->eof[1] = false;
+            /* else, read the row from the table (the storage handler */
             else
             {
-              rbuff = NULL;
-              qn->eof[1] = true;
+              /*
+                 Create space for the record buffer and
+                 store pointer in rbuff
+              */
+              rbuff = (READ_RECORD *) my_malloc(sizeof(READ_RECORD),
+                                        MYF(MY_ZEROFILL | MY_WME));
+              rbuff->rec_buf =
+                (byte *) my_malloc(qn->relations[0]->table->s->rec_buff_length,
+                                        MYF(MY_ZEROFILL | MY_WME));
+
+              /* check for end of file. Store result in eof array */
+              qn->eof[1] =
+                qn->relations[1]->table->file->rnd_next(rbuff->rec_buf);
+              if (qn->eof[1] != HA_ERR_END_OF_FILE)
+                qn->eof[1] = false;
+              else
+              {
+                rbuff = NULL;
+                qn->eof[1] = true;
+              }
             }
-          }
-          /* if the right buffer is not null, get a new row from table */
-          if (rbuff != NULL)
-          {
-            /* we need the table information for processing fields */
-            if (qn->right == NULL)
-              rtable = qn->relations[1]->table;
-            else
-              rtable = get_table(qn->right);
-            if (rtable != NULL)
-              memcpy((byte *)rtable->record[0], (byte *)rbuff->rec_buf, 
-                rtable->s->rec_buff_length);
-
-            /* get the join expression */
-            expr = qn->join_expr->get_expression(0);
-            Field *cur_field = (Field *)expr->right_op;
-            for (Field **field = rtable->field; *field; field++)
-              if (strcasecmp((*field)->field_name, expr->right_op->name)==0)
-                fright = (*field);
+            /* if the right buffer is not null, get a new row from table */
+            if (rbuff != NULL)
+            {
+              /* we need the table information for processing fields */
+              if (qn->right == NULL)
+                rtable = qn->relations[1]->table;
+              else
+                rtable = get_table(qn->right);
+              if (rtable != NULL)
+                memcpy((byte *)rtable->record[0], (byte *)rbuff->rec_buf,
+                  rtable->s->rec_buff_length);
+
+              /* get the join expression */
+              expr = qn->join_expr->get_expression(0);
+              Field *cur_field = (Field *)expr->right_op;
+              for (Field **field = rtable->field; *field; field++)
+                if (strcasecmp((*field)->field_name, expr->right_op->name)==0)
+                  fright = (*field);
       
-            /* 
-               If field was found, add the row to the in-memory buffer
-               ordered by the join column.
-            */
-            if ((fright != NULL) && (!fright->is_null()))
-              insertion_sort(false, fright, rbuff);
-          }
-        } while (rbuff != NULL);
+              /*
+                 If field was found, add the row to the in-memory buffer
+                 ordered by the join column.
+              */
+              if ((fright != NULL) && (!fright->is_null()))
+                insertion_sort(false, fright, rbuff);
+            }
+          } while (rbuff != NULL);
+        }
         left_record_buffer_ptr = left_record_buff;
         right_record_buffer_ptr = right_record_buff;
         qn->preempt_pipeline = false;
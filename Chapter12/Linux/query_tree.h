@@ -100,6 +100,7 @@ public:
     TABLE_LIST          *relations[MAXNODETABLES];
     int                 eof[MAXNODETABLES];
     int                 ndx[MAXNODETABLES];
+    int                 pushed[MAXNODETABLES];
     bool                preempt_pipeline;
     Attribute           *attributes;
     query_node          *left;
@@ -152,6 +153,8 @@ private:
   int push_joins(query_node *qn, query_node *pNode);
   int prune_tree(query_node *prev, query_node *cur_node);
   int balance_joins(query_node *qn);
+  ha_rows estimate_rows(query_node *qn, int child);
+  int swap_join(query_node *qn);
   int split_restrict_with_project(query_node *qn);
   int split_restrict_with_join(query_node *qn);
   int split_project_with_join(query_node *qn);
@@ -163,6 +166,9 @@ private:
   READ_RECORD *do_project(query_node *qn, READ_RECORD *t);
   READ_RECORD *do_join(query_node *qn);
   int find_index_in_expr(Expression *e, char *tbl);
+  int set_read_columns(TABLE *tbl);
+  int push_conditions(TABLE *tbl, Expression *expr, int *pushed);
+  bool find_field_in_tree(query_node *qn, Field *field);
   TABLE *get_table(query_node *qn);
   int insertion_sort(bool left, Field *field, READ_RECORD *rcd);
   int check_rewind(record_buff *cur_left, record_buff *curr_left_prev,